@@ -23,8 +23,12 @@ UTIL_SOURCES = \
     src/celutil/directory.cpp \
     src/celutil/filetype.cpp \
     src/celutil/formatnum.cpp \
+    src/celutil/memorypool.cpp \
+    src/celutil/prefixindex.cpp \
     src/celutil/utf8.cpp \
-    src/celutil/util.cpp
+    src/celutil/util.cpp \
+    src/celutil/workerpool.cpp \
+    src/celutil/yuvconvert.cpp
 
 UTIL_HEADERS = \
     src/celutil/basictypes.h \
@@ -35,16 +39,25 @@ UTIL_HEADERS = \
     src/celutil/directory.h \
     src/celutil/filetype.h \
     src/celutil/formatnum.h \
+    src/celutil/hash.h \
+    src/celutil/mappedfile.h \
+    src/celutil/memorypool.h \
+    src/celutil/prefixindex.h \
     src/celutil/reshandle.h \
     src/celutil/resmanager.h \
+    src/celutil/thread.h \
     src/celutil/timer.h \
     src/celutil/utf8.h \
     src/celutil/util.h \
-    src/celutil/watcher.h
+    src/celutil/watcher.h \
+    src/celutil/workerpool.h \
+    src/celutil/yuvconvert.h
 
 win32 {
     UTIL_SOURCES += \
         src/celutil/windirectory.cpp \
+        src/celutil/winmappedfile.cpp \
+        src/celutil/winthread.cpp \
         src/celutil/wintimer.cpp
 
     UTIL_HEADERS += src/celutil/winutil.h
@@ -53,6 +66,8 @@ win32 {
 unix {
     UTIL_SOURCES += \
         src/celutil/unixdirectory.cpp \
+        src/celutil/unixmappedfile.cpp \
+        src/celutil/unixthread.cpp \
         src/celutil/unixtimer.cpp
 }
 
@@ -119,11 +134,13 @@ TXF_HEADERS = \
 #### Ephemeris module ####
 
 EPHEM_SOURCES = \
+    src/celephem/chebyshevorbit.cpp \
     src/celephem/customorbit.cpp \
     src/celephem/customrotation.cpp \
     src/celephem/jpleph.cpp \
     src/celephem/nutation.cpp \
     src/celephem/orbit.cpp \
+    src/celephem/orbitbatch.cpp \
     src/celephem/precession.cpp \
     src/celephem/rotation.cpp \
     src/celephem/samporbit.cpp \
@@ -134,11 +151,13 @@ EPHEM_SOURCES = \
     src/celephem/vsop87.cpp
 
 EPHEM_HEADERS = \
+    src/celephem/chebyshevorbit.h \
     src/celephem/customorbit.h \
     src/celephem/customrotation.h \
     src/celephem/jpleph.h \
     src/celephem/nutation.h \
     src/celephem/orbit.h \
+    src/celephem/orbitbatch.h \
     src/celephem/precession.h \
     src/celephem/rotation.h \
     src/celephem/samporbit.h \
@@ -157,6 +176,8 @@ ENGINE_SOURCES = \
     src/celengine/axisarrow.cpp \
     src/celengine/body.cpp \
     src/celengine/boundaries.cpp \
+    src/celengine/catalogcache.cpp \
+    src/celengine/catalogreader.cpp \
     src/celengine/catalogxref.cpp \
     src/celengine/cmdparser.cpp \
     src/celengine/command.cpp \
@@ -168,9 +189,11 @@ ENGINE_SOURCES = \
     src/celengine/dsodb.cpp \
     src/celengine/dsoname.cpp \
     src/celengine/dsooctree.cpp \
+    src/celengine/eclipsesearch.cpp \
     src/celengine/execution.cpp \
     src/celengine/fragmentprog.cpp \
     src/celengine/frame.cpp \
+    src/celengine/framestatecache.cpp \
     src/celengine/frametree.cpp \
     src/celengine/galaxy.cpp \
     src/celengine/globular.cpp \
@@ -184,8 +207,11 @@ ENGINE_SOURCES = \
     src/celengine/modelgeometry.cpp \
     src/celengine/multitexture.cpp \
     src/celengine/nebula.cpp \
+    src/celengine/objectstate.cpp \
     src/celengine/observer.cpp \
     src/celengine/opencluster.cpp \
+    src/celengine/orbitbvh.cpp \
+    src/celengine/orbitpathcache.cpp \
     src/celengine/overlay.cpp \
     src/celengine/parseobject.cpp \
     src/celengine/parser.cpp \
@@ -226,6 +252,8 @@ ENGINE_HEADERS = \
     src/celengine/axisarrow.h \
     src/celengine/body.h \
     src/celengine/boundaries.h \
+    src/celengine/catalogcache.h \
+    src/celengine/catalogreader.h \
     src/celengine/catalogxref.h \
     src/celengine/celestia.h \
     src/celengine/cmdparser.h \
@@ -237,10 +265,12 @@ ENGINE_HEADERS = \
     src/celengine/dsodb.h \
     src/celengine/dsoname.h \
     src/celengine/dsooctree.h \
+    src/celengine/eclipsesearch.h \
     src/celengine/execenv.h \
     src/celengine/execution.h \
     src/celengine/fragmentprog.h \
     src/celengine/frame.h \
+    src/celengine/framestatecache.h \
     src/celengine/frametree.h \
     src/celengine/galaxy.h \
     src/celengine/geometry.h \
@@ -256,9 +286,13 @@ ENGINE_HEADERS = \
     src/celengine/modelgeometry.h \
     src/celengine/multitexture.h \
     src/celengine/nebula.h \
+    src/celengine/objectstate.h \
     src/celengine/observer.h \
     src/celengine/octree.h \
+    src/celengine/octreebuilder.h \
     src/celengine/opencluster.h \
+    src/celengine/orbitbvh.h \
+    src/celengine/orbitpathcache.h \
     src/celengine/overlay.h \
     src/celengine/parseobject.h \
     src/celengine/parser.h \
@@ -317,6 +351,7 @@ APP_SOURCES = \
     src/celestia/favorites.cpp \
     src/celestia/imagecapture.cpp \
     src/celestia/scriptmenu.cpp \
+    src/celestia/universeloader.cpp \
     src/celestia/url.cpp \
     src/celestia/celx.cpp \
         src/celestia/celx_celestia.cpp \
@@ -337,6 +372,7 @@ APP_HEADERS = \
     src/celestia/favorites.h \
     src/celestia/imagecapture.h \
     src/celestia/scriptmenu.h \
+    src/celestia/universeloader.h \
     src/celestia/url.h \
     src/celestia/celx.h \
         src/celestia/celx_celestia.h \
@@ -593,6 +629,9 @@ unix {
 
     # jpeg library
     LIBS += -ljpeg
+
+    # worker threads
+    LIBS += -lpthread
     
     # specify where cspice from NAIF is installed (to build cspice support)
     INCLUDEPATH += /opt/cspice/include
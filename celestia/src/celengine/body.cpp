@@ -34,6 +34,7 @@ Body::Body(PlanetarySystem* _system, const string& _name) :
     satellites(NULL),
     timeline(NULL),
     frameTree(NULL),
+    frameStateIndex(0),
     radius(1.0f),
     semiAxes(1.0f, 1.0f, 1.0f),
     mass(0.0f),
@@ -892,14 +893,25 @@ void Body::computeLocations()
     if (locationsComputed)
         return;
 
-    locationsComputed = true;
-
     // No work to do if there's no mesh, or if the mesh cannot be loaded
     if (geometry == InvalidResource)
+    {
+        locationsComputed = true;
         return;
+    }
+
+    // When meshes are loaded asynchronously, try again once the mesh
+    // is ready.
     Geometry* g = GetGeometryManager()->find(geometry);
     if (g == NULL)
+    {
+        const GeometryInfo* info = GetGeometryManager()->getResourceInfo(geometry);
+        if (info == NULL || info->state != ResourceLoadPending)
+            locationsComputed = true;
         return;
+    }
+
+    locationsComputed = true;
 
     // TODO: Implement separate radius and bounding radius so that this hack is
     // not necessary.
@@ -1283,21 +1295,26 @@ bool PlanetarySystem::traverse(TraversalFunc func, void* info) const
     return true;
 }
 
-std::vector<std::string> PlanetarySystem::getCompletion(const std::string& _name, bool deepSearch) const
+std::vector<std::string> PlanetarySystem::getCompletion(const std::string& _name,
+                                                        bool deepSearch,
+                                                        unsigned int maxCompletions) const
 {
     std::vector<std::string> completion;
     int _name_length = UTF8Length(_name);
 
-    // Search through all names in this planetary system.
-    for (ObjectIndex::const_iterator iter = objectIndex.begin();
+    // The object index is ordered by UTF8StringCompare, so all names that
+    // begin with _name follow the first one not less than it.
+    for (ObjectIndex::const_iterator iter = objectIndex.lower_bound(_name);
          iter != objectIndex.end(); iter++)
     {
+        if (maxCompletions != 0 && completion.size() == maxCompletions)
+            return completion;
+
         const string& alias = iter->first;
-        
-        if (UTF8StringCompare(alias, _name, _name_length) == 0)
-        {
-            completion.push_back(alias);
-        }
+        if (UTF8StringCompare(alias, _name, _name_length) != 0)
+            break;
+
+        completion.push_back(alias);
     }
     
     // Scan child objects
@@ -1306,9 +1323,13 @@ std::vector<std::string> PlanetarySystem::getCompletion(const std::string& _name
         for (vector<Body*>::const_iterator iter = satellites.begin();
              iter != satellites.end(); iter++)
         {
+            if (maxCompletions != 0 && completion.size() >= maxCompletions)
+                break;
+
             if ((*iter)->getSatellites() != NULL)
             {
-                vector<string> bodies = (*iter)->getSatellites()->getCompletion(_name);
+                unsigned int remaining = maxCompletions == 0 ? 0 : maxCompletions - completion.size();
+                vector<string> bodies = (*iter)->getSatellites()->getCompletion(_name, true, remaining);
                 completion.insert(completion.end(), bodies.begin(), bodies.end());
             }
         }
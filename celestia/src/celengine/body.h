@@ -60,7 +60,8 @@ class PlanetarySystem
 
     bool traverse(TraversalFunc, void*) const;
     Body* find(const std::string&, bool deepSearch = false, bool i18n = false) const;
-    std::vector<std::string> getCompletion(const std::string& _name, bool rec = true) const;
+    std::vector<std::string> getCompletion(const std::string& _name, bool rec = true,
+                                           unsigned int maxCompletions = 0) const;
 
  private:
     void addBodyToNameIndex(Body* body);
@@ -197,6 +198,10 @@ class Body
     FrameTree* getFrameTree() const;
     FrameTree* getOrCreateFrameTree();
 
+    // Index of the body's entry in a FrameStateCache
+    unsigned int getFrameStateIndex() const { return frameStateIndex; }
+    void setFrameStateIndex(unsigned int index) { frameStateIndex = index; }
+
     const ReferenceFrame* getOrbitFrame(double tdb) const;
     const Orbit* getOrbit(double tdb) const;
     const ReferenceFrame* getBodyFrame(double tdb) const;
@@ -352,6 +357,7 @@ class Body
     Timeline* timeline;
     // Children in the frame hierarchy
     FrameTree* frameTree;
+    unsigned int frameStateIndex;
 
     float radius;
     Eigen::Vector3f semiAxes;
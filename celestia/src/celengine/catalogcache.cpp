@@ -0,0 +1,331 @@
+// catalogcache.cpp
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+#include "catalogcache.h"
+#include "parser.h"
+#include <celutil/basictypes.h>
+#include <celutil/hash.h>
+#include <celutil/mappedfile.h>
+
+using namespace std;
+
+
+// A cache file has the layout (in the byte order of the machine):
+//
+//   header           char[8]   "CELCACHE"
+//   version          uint32
+//   byte order mark  uint32    0x01020304
+//   key              string
+//   input count      uint32
+//   inputs           for each, the filename (a string), then the size,
+//                    modification time, and hash of the file's contents
+//                    as uint64, int64, and uint64
+//   data size        uint64
+//   data
+//
+// Strings are a uint32 length followed by the characters. The version must
+// be changed whenever the format of the cache file or of any data stored
+// in it changes.
+static const char CacheFileHeader[] = "CELCACHE";
+static const uint32 CacheFileVersion = 1;
+static const uint32 ByteOrderMark = 0x01020304;
+
+// Recorded instead of the modification time of a file modified so recently
+// that it could be changed again without the time changing. Such files are
+// hashed when the entry is next loaded.
+static const int64 RecentModificationTime = -1;
+
+
+struct InputStamp
+{
+    uint64 size;
+    int64 modificationTime;
+    uint64 contentHash;
+};
+
+
+static bool statFile(const string& filename, InputStamp& stamp)
+{
+    struct stat buf;
+    if (stat(filename.c_str(), &buf) != 0)
+        return false;
+
+    stamp.size = (uint64) buf.st_size;
+    stamp.modificationTime = (int64) buf.st_mtime;
+    return true;
+}
+
+
+static bool hashFile(const string& filename, uint64& hash)
+{
+    // An empty file can't be mapped
+    MappedFile* file = OpenMappedFile(filename);
+    if (file == NULL)
+    {
+        InputStamp stamp;
+        if (!statFile(filename, stamp) || stamp.size != 0)
+            return false;
+        hash = InitialHashValue;
+        return true;
+    }
+
+    hash = HashBytes(file->data(), file->size());
+    delete file;
+
+    return true;
+}
+
+
+template <class T> static void writeValue(ostream& out, T t)
+{
+    out.write(reinterpret_cast<const char*>(&t), sizeof t);
+}
+
+template <class T> static bool readValue(istream& in, T& t)
+{
+    in.read(reinterpret_cast<char*>(&t), sizeof t);
+    return in.good();
+}
+
+static void writeString(ostream& out, const string& s)
+{
+    writeValue(out, (uint32) s.length());
+    out.write(s.data(), s.length());
+}
+
+static bool readString(istream& in, string& s)
+{
+    uint32 length;
+    if (!readValue(in, length) || length > 0xffff)
+        return false;
+    s.resize(length);
+    if (length > 0)
+        in.read(&s[0], length);
+    return in.good();
+}
+
+
+/*! Use directory for the cache, creating it if necessary. */
+CatalogCache::CatalogCache(const string& _directory) :
+    directory(_directory)
+{
+    if (!directory.empty())
+    {
+#ifdef _WIN32
+        _mkdir(directory.c_str());
+#else
+        mkdir(directory.c_str(), 0777);
+#endif
+    }
+}
+
+
+/*! Read the data of a cache entry into data. Returns false if there is no
+ *  entry for the key, or if it wasn't made from the listed input files or
+ *  any of them have changed since.
+ */
+bool CatalogCache::load(const string& key,
+                        const vector<string>& inputs,
+                        string& data) const
+{
+    string filename = cacheFilename(key);
+    ifstream in(filename.c_str(), ios::in | ios::binary);
+    if (!in.good())
+        return false;
+
+    char header[sizeof CacheFileHeader - 1];
+    uint32 version = 0;
+    uint32 byteOrderMark = 0;
+    in.read(header, sizeof header);
+    if (!in.good() || memcmp(header, CacheFileHeader, sizeof header) != 0 ||
+        !readValue(in, version) || version != CacheFileVersion ||
+        !readValue(in, byteOrderMark) || byteOrderMark != ByteOrderMark)
+    {
+        return false;
+    }
+
+    string entryKey;
+    uint32 inputCount;
+    if (!readString(in, entryKey) || entryKey != key ||
+        !readValue(in, inputCount) || inputCount != inputs.size())
+    {
+        return false;
+    }
+
+    // Files that were touched but not changed are recorded again with
+    // their new modification times, so that they needn't be hashed again.
+    bool stampsChanged = false;
+    for (uint32 i = 0; i < inputCount; i++)
+    {
+        string inputFilename;
+        InputStamp recorded;
+        if (!readString(in, inputFilename) || inputFilename != inputs[i] ||
+            !readValue(in, recorded.size) ||
+            !readValue(in, recorded.modificationTime) ||
+            !readValue(in, recorded.contentHash))
+        {
+            return false;
+        }
+
+        InputStamp current;
+        if (!statFile(inputFilename, current) || current.size != recorded.size)
+            return false;
+
+        if (current.modificationTime != recorded.modificationTime)
+        {
+            uint64 hash;
+            if (!hashFile(inputFilename, hash) || hash != recorded.contentHash)
+                return false;
+            stampsChanged = true;
+        }
+    }
+
+    uint64 dataSize;
+    if (!readValue(in, dataSize) || dataSize > 0x7fffffff)
+        return false;
+
+    data.resize((size_t) dataSize);
+    if (dataSize > 0)
+        in.read(&data[0], (streamsize) dataSize);
+    if (!in.good() || in.peek() != char_traits<char>::eof())
+    {
+        data.clear();
+        return false;
+    }
+
+    if (stampsChanged)
+    {
+        in.close();
+        save(key, inputs, data);
+    }
+
+    return true;
+}
+
+
+/*! Create or replace the cache entry for key, recording the current state
+ *  of the input files that the data was made from.
+ */
+bool CatalogCache::save(const string& key,
+                        const vector<string>& inputs,
+                        const string& data) const
+{
+    if (directory.empty())
+        return false;
+
+    int64 now = (int64) time(NULL);
+    vector<InputStamp> stamps(inputs.size());
+    for (unsigned int i = 0; i < inputs.size(); i++)
+    {
+        if (!statFile(inputs[i], stamps[i]) || !hashFile(inputs[i], stamps[i].contentHash))
+            return false;
+        if (stamps[i].modificationTime >= now - 1)
+            stamps[i].modificationTime = RecentModificationTime;
+    }
+
+    string filename = cacheFilename(key);
+    string tempFilename = filename + ".tmp";
+    {
+        ofstream out(tempFilename.c_str(), ios::out | ios::binary | ios::trunc);
+        if (!out.good())
+            return false;
+
+        out.write(CacheFileHeader, sizeof CacheFileHeader - 1);
+        writeValue(out, CacheFileVersion);
+        writeValue(out, ByteOrderMark);
+        writeString(out, key);
+        writeValue(out, (uint32) inputs.size());
+        for (unsigned int i = 0; i < inputs.size(); i++)
+        {
+            writeString(out, inputs[i]);
+            writeValue(out, stamps[i].size);
+            writeValue(out, stamps[i].modificationTime);
+            writeValue(out, stamps[i].contentHash);
+        }
+        writeValue(out, (uint64) data.size());
+        out.write(data.data(), data.size());
+
+        out.close();
+        if (out.fail())
+        {
+            remove(tempFilename.c_str());
+            return false;
+        }
+    }
+
+#ifdef _WIN32
+    // Renaming doesn't replace an existing file on Windows
+    remove(filename.c_str());
+#endif
+    if (rename(tempFilename.c_str(), filename.c_str()) != 0)
+    {
+        remove(tempFilename.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+
+/*! Return the cached, already parsed contents of a catalog file, or NULL
+ *  if the file isn't in the cache or has changed. The caller must delete
+ *  the returned catalog.
+ */
+ParsedCatalog* CatalogCache::loadCatalog(const string& filename) const
+{
+    vector<string> inputs(1, filename);
+    string data;
+    if (!load("catalog " + filename, inputs, data))
+        return NULL;
+
+    ParsedCatalog* catalog = new ParsedCatalog();
+    if (!catalog->readBinary(data.data(), data.size()))
+    {
+        delete catalog;
+        return NULL;
+    }
+
+    return catalog;
+}
+
+
+/*! Save a catalog just parsed from the named file; this must be done before
+ *  any values are taken from the catalog.
+ */
+bool CatalogCache::saveCatalog(const string& filename, const ParsedCatalog& catalog) const
+{
+    ostringstream out(ios::out | ios::binary);
+    if (!catalog.writeBinary(out))
+        return false;
+
+    vector<string> inputs(1, filename);
+    return save("catalog " + filename, inputs, out.str());
+}
+
+
+// Entries are stored in files named for the hash of their keys
+string CatalogCache::cacheFilename(const string& key) const
+{
+    uint64 hash = HashBytes(key.data(), key.length());
+
+    char name[32];
+    sprintf(name, "%08x%08x.cache", (unsigned int) (hash >> 32), (unsigned int) (hash & 0xffffffff));
+
+    return directory + '/' + name;
+}
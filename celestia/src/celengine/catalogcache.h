@@ -0,0 +1,54 @@
+// catalogcache.h
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#ifndef _CELENGINE_CATALOGCACHE_H_
+#define _CELENGINE_CATALOGCACHE_H_
+
+#include <string>
+#include <vector>
+
+class ParsedCatalog;
+
+
+/*! A CatalogCache keeps the results of loading catalogs in a directory, so
+ *  that later sessions can start without redoing the work: catalog files
+ *  already parsed into binary form, and snapshots of indexes built from
+ *  them such as the star octree. Each cache entry is identified by a key
+ *  and records the files that it was made from; an entry is used only
+ *  while all of those files are unchanged. A file is taken to be unchanged
+ *  if its size and modification time are the same as when the entry was
+ *  written, or, when only the time differs, if its contents hash the same.
+ *
+ *  Cache files are in the byte order of the machine that wrote them. New
+ *  entries are written to a temporary file and then renamed, so a session
+ *  that is interrupted while writing doesn't leave a partial entry; an
+ *  entry that can't be read for any reason is simply recreated.
+ */
+class CatalogCache
+{
+ public:
+    CatalogCache(const std::string& directory);
+
+    bool load(const std::string& key,
+              const std::vector<std::string>& inputs,
+              std::string& data) const;
+    bool save(const std::string& key,
+              const std::vector<std::string>& inputs,
+              const std::string& data) const;
+
+    ParsedCatalog* loadCatalog(const std::string& filename) const;
+    bool saveCatalog(const std::string& filename, const ParsedCatalog& catalog) const;
+
+ private:
+    std::string cacheFilename(const std::string& key) const;
+
+    std::string directory;
+};
+
+#endif // _CELENGINE_CATALOGCACHE_H_
@@ -0,0 +1,230 @@
+// catalogreader.cpp
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include <fstream>
+#include "catalogreader.h"
+#include "catalogcache.h"
+#include "parser.h"
+#include <celutil/mappedfile.h>
+#include <celutil/workerpool.h>
+
+using namespace std;
+
+
+// Number of files parsed ahead of the one being read, per worker thread
+static const unsigned int FilesAheadPerThread = 4;
+
+
+class CatalogReader::ParseTask : public WorkerTask
+{
+ public:
+    ParseTask(CatalogReader* _reader, const string& _filename) :
+        reader(_reader),
+        filename(_filename),
+        catalog(NULL),
+        finished(false)
+    {
+    }
+
+    ~ParseTask()
+    {
+        delete catalog;
+    }
+
+    void run()
+    {
+        ParsedCatalog* parsedCatalog = reader->parseFile(filename);
+
+        MutexLock lock(reader->mutex);
+        catalog = parsedCatalog;
+        finished = true;
+        reader->taskFinished.broadcast();
+    }
+
+    CatalogReader* reader;
+    string filename;
+    ParsedCatalog* catalog;
+    bool finished;
+};
+
+
+CatalogFile::CatalogFile() :
+    catalog(NULL),
+    mappedFile(NULL),
+    in(NULL),
+    tokenizer(NULL)
+{
+}
+
+
+CatalogFile::~CatalogFile()
+{
+    delete tokenizer;
+    delete catalog;
+    delete mappedFile;
+    delete in;
+}
+
+
+CatalogReader::CatalogReader(unsigned int threadCount, const CatalogCache* _cache) :
+    cache(_cache),
+    pool(NULL),
+    nextTask(0),
+    nextSubmitted(0),
+    maxTasksAhead(FilesAheadPerThread * threadCount)
+{
+    if (threadCount > 0)
+        pool = new WorkerPool(threadCount);
+}
+
+
+CatalogReader::~CatalogReader()
+{
+    // Deleting the pool waits for the tasks still running and discards
+    // the rest.
+    delete pool;
+
+    for (vector<ParseTask*>::iterator iter = tasks.begin(); iter != tasks.end(); iter++)
+        delete *iter;
+}
+
+
+/*! Queue a file to be parsed in the background. Files should be queued in
+ *  the order in which they'll be opened.
+ */
+void CatalogReader::prefetch(const string& filename)
+{
+    if (pool == NULL)
+        return;
+
+    tasks.push_back(new ParseTask(this, filename));
+    submitTasks();
+}
+
+
+/*! Open a catalog file for loading; the caller must delete the returned
+ *  file. Returns NULL if the file can't be opened. Queued files preceding
+ *  this one are skipped.
+ */
+CatalogFile* CatalogReader::open(const string& filename)
+{
+    unsigned int index = nextTask;
+    while (index < tasks.size() && tasks[index]->filename != filename)
+        index++;
+
+    CatalogFile* file = NULL;
+
+    if (index < tasks.size())
+    {
+        nextTask = index + 1;
+        submitTasks();
+
+        ParseTask* task = tasks[index];
+        ParsedCatalog* catalog = NULL;
+        {
+            MutexLock lock(mutex);
+            while (!task->finished)
+                taskFinished.wait(mutex);
+            catalog = task->catalog;
+            task->catalog = NULL;
+        }
+
+        if (catalog != NULL)
+            file = openCatalog(catalog);
+    }
+    else if (cache != NULL)
+    {
+        ParsedCatalog* catalog = parseFile(filename);
+        if (catalog != NULL)
+            file = openCatalog(catalog);
+    }
+    else
+    {
+        file = openFile(filename);
+    }
+
+    return file;
+}
+
+
+// Open a catalog file to be read directly
+CatalogFile* CatalogReader::openFile(const string& filename)
+{
+    CatalogFile* file = NULL;
+
+    // Mapping the file avoids copying it; an empty file can't be mapped.
+    MappedFile* mappedFile = OpenMappedFile(filename);
+    if (mappedFile != NULL)
+    {
+        file = new CatalogFile();
+        file->mappedFile = mappedFile;
+        file->tokenizer = new Tokenizer(mappedFile->data(), mappedFile->data() + mappedFile->size());
+    }
+    else
+    {
+        ifstream* in = new ifstream(filename.c_str(), ios::in);
+        if (in->good())
+        {
+            file = new CatalogFile();
+            file->in = in;
+            file->tokenizer = new Tokenizer(in);
+        }
+        else
+        {
+            delete in;
+        }
+    }
+
+    return file;
+}
+
+
+// Create a catalog file that reads from a parsed catalog and owns it
+CatalogFile* CatalogReader::openCatalog(ParsedCatalog* catalog)
+{
+    CatalogFile* file = new CatalogFile();
+    file->catalog = catalog;
+    file->tokenizer = new Tokenizer(catalog);
+
+    return file;
+}
+
+
+// Get a file already parsed from the cache, or parse it and add it to the
+// cache; this may be done on a worker thread. Returns NULL if the file can't
+// be opened.
+ParsedCatalog* CatalogReader::parseFile(const string& filename) const
+{
+    ParsedCatalog* catalog = NULL;
+    if (cache != NULL)
+        catalog = cache->loadCatalog(filename);
+
+    if (catalog == NULL)
+    {
+        CatalogFile* file = openFile(filename);
+        if (file != NULL)
+        {
+            catalog = new ParsedCatalog();
+            catalog->read(file->getTokenizer());
+            delete file;
+
+            if (cache != NULL)
+                cache->saveCatalog(filename, *catalog);
+        }
+    }
+
+    return catalog;
+}
+
+
+void CatalogReader::submitTasks()
+{
+    while (nextSubmitted < tasks.size() && nextSubmitted < nextTask + maxTasksAhead)
+        pool->submit(tasks[nextSubmitted++]);
+}
@@ -0,0 +1,97 @@
+// catalogreader.h
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#ifndef _CELENGINE_CATALOGREADER_H_
+#define _CELENGINE_CATALOGREADER_H_
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <celutil/thread.h>
+
+class Tokenizer;
+class ParsedCatalog;
+class CatalogCache;
+class MappedFile;
+class WorkerPool;
+
+
+/*! A catalog file opened by a CatalogReader, along with whatever its
+ *  tokenizer reads from: the catalog already parsed on a worker thread,
+ *  or the file itself.
+ */
+class CatalogFile
+{
+ public:
+    ~CatalogFile();
+
+    Tokenizer& getTokenizer()
+    {
+        return *tokenizer;
+    }
+
+ private:
+    CatalogFile();
+    CatalogFile(const CatalogFile&);
+    CatalogFile& operator=(const CatalogFile&);
+
+    ParsedCatalog* catalog;
+    MappedFile* mappedFile;
+    std::istream* in;
+    Tokenizer* tokenizer;
+
+    friend class CatalogReader;
+};
+
+
+/*! A CatalogReader parses catalog files (ssc, stc, and dsc files) on worker
+ *  threads ahead of the thread that loads them. The files expected to be
+ *  loaded are first queued with prefetch(), in the order they will be
+ *  loaded; open() then returns each file already parsed, waiting for it
+ *  if necessary. Files that weren't queued, or all files if the reader has
+ *  no threads, are read directly. Loading the catalogs one at a time in
+ *  the usual order gives exactly the same result as reading the files
+ *  directly, so later catalogs can still replace or modify objects from
+ *  earlier ones.
+ *
+ *  Only a limited number of files are parsed ahead of the one being read,
+ *  which bounds the memory used by parsed catalogs.
+ *
+ *  With a CatalogCache, files are taken already parsed from the cache when
+ *  possible, and files that had to be parsed are added to it.
+ */
+class CatalogReader
+{
+ public:
+    CatalogReader(unsigned int threadCount, const CatalogCache* cache = NULL);
+    ~CatalogReader();
+
+    void prefetch(const std::string& filename);
+    CatalogFile* open(const std::string& filename);
+
+ private:
+    class ParseTask;
+
+    static CatalogFile* openFile(const std::string& filename);
+    static CatalogFile* openCatalog(ParsedCatalog* catalog);
+    ParsedCatalog* parseFile(const std::string& filename) const;
+    void submitTasks();
+
+    const CatalogCache* cache;
+    WorkerPool* pool;
+    std::vector<ParseTask*> tasks;
+    unsigned int nextTask;
+    unsigned int nextSubmitted;
+    unsigned int maxTasksAhead;
+
+    Mutex mutex;
+    Condition taskFinished;
+};
+
+#endif // _CELENGINE_CATALOGREADER_H_
@@ -700,27 +700,27 @@ CommandCapture::CommandCapture(const std::string& _type,
 {
 }
 
-void CommandCapture::process(ExecutionEnvironment&)
+void CommandCapture::process(ExecutionEnvironment& env)
 {
 #ifndef TARGET_OS_MAC
-    bool success = false;
-
-
     // Get the dimensions of the current viewport
     int viewport[4];
     glGetIntegerv(GL_VIEWPORT, viewport);
 
+    // The image is compressed and written in the background. As before,
+    // cel scripts aren't told about failures; they're only logged.
+    ScreenshotService* screenshots = env.getCelestiaCore()->getScreenshotService();
     if (compareIgnoringCase(type, "jpeg") == 0)
     {
-        success = CaptureGLBufferToJPEG(filename,
-                                        viewport[0], viewport[1],
-                                        viewport[2], viewport[3]);
+        screenshots->capture(filename, ScreenshotService::JPEG,
+                             viewport[0], viewport[1],
+                             viewport[2], viewport[3]);
     }
     if (compareIgnoringCase(type, "png") == 0)
     {
-        success = CaptureGLBufferToPNG(filename,
-                                       viewport[0], viewport[1],
-                                       viewport[2], viewport[3]);
+        screenshots->capture(filename, ScreenshotService::PNG,
+                             viewport[0], viewport[1],
+                             viewport[2], viewport[3]);
     }
 #endif
 }
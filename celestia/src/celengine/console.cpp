@@ -265,6 +265,7 @@ void ConsoleStreamBuf::setConsole(Console* c)
 
 int ConsoleStreamBuf::overflow(int c)
 {
+    MutexLock lock(mutex);
     if (console != NULL)
     {
         switch (decodeState)
@@ -13,12 +13,14 @@
 #include <string>
 #include <iostream>
 #include <celtxf/texturefont.h>
+#include <celutil/thread.h>
 
 
 class Console;
 
 // Custom streambuf class to support C++ operator style output.  The
-// output is completely unbuffered.
+// output is completely unbuffered. Output from different threads (such
+// as resource loading threads) is serialized one character at a time.
 class ConsoleStreamBuf : public std::streambuf
 {
  public:
@@ -38,6 +40,7 @@ class ConsoleStreamBuf : public std::streambuf
     UTF8DecodeState decodeState;
     wchar_t decodedChar;
     unsigned int decodeShift;
+    Mutex mutex;
 };
 
 
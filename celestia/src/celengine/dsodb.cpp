@@ -20,7 +20,9 @@
 #include <celutil/util.h>
 #include <celutil/bytes.h>
 #include <celutil/utf8.h>
+#include <celutil/workerpool.h>
 #include <celengine/dsodb.h>
+#include <celengine/octreebuilder.h>
 #include "celestia.h"
 #include "astro.h"
 #include "parser.h"
@@ -72,6 +74,7 @@ DSODatabase::DSODatabase():
     catalogNumberIndex   (NULL),
     octreeRoot           (NULL),
     nextAutoCatalogNumber(0xfffffffe),
+    buildThreadCount     (DefaultWorkerThreadCount()),
     avgAbsMag            (0)
 {
 }
@@ -120,13 +123,14 @@ DeepSkyObject* DSODatabase::find(const string& name) const
 }
 
 
-vector<string> DSODatabase::getCompletion(const string& name) const
+vector<string> DSODatabase::getCompletion(const string& name,
+                                          unsigned int maxCompletions) const
 {
     vector<string> completion;
 
     // only named DSOs are supported by completion.
     if (!name.empty() && namesDB != NULL)
-        return namesDB->getCompletion(name);
+        return namesDB->getCompletion(name, maxCompletions);
     else
         return completion;
 }
@@ -222,6 +226,23 @@ void DSODatabase::findCloseDSOs(DSOHandler&     dsoHandler,
 }
 
 
+void DSODatabase::findDSOsInCone(DSOHandler&     dsoHandler,
+                                 const Vector3d& obsPos,
+                                 const Vector3d& axis,
+                                 double          halfAngle,
+                                 double          maxDistance,
+                                 float           limitingMag) const
+{
+    octreeRoot->processObjectsInCone(dsoHandler,
+                                     obsPos,
+                                     axis,
+                                     halfAngle,
+                                     maxDistance,
+                                     limitingMag,
+                                     DSO_OCTREE_ROOT_SIZE);
+}
+
+
 DSONameDatabase* DSODatabase::getNameDatabase() const
 {
     return namesDB;
@@ -237,6 +258,12 @@ void DSODatabase::setNameDatabase(DSONameDatabase* _namesDB)
 bool DSODatabase::load(istream& in, const string& resourcePath)
 {
     Tokenizer tokenizer(&in);
+    return load(tokenizer, resourcePath);
+}
+
+
+bool DSODatabase::load(Tokenizer& tokenizer, const string& resourcePath)
+{
     Parser    parser(&tokenizer);
 
     while (tokenizer.nextToken() != Tokenizer::TokenEnd)
@@ -374,11 +401,20 @@ bool DSODatabase::loadBinary(istream&)
 }
 
 
+void DSODatabase::setBuildThreadCount(unsigned int threadCount)
+{
+    buildThreadCount = threadCount;
+}
+
+
 void DSODatabase::finish()
 {
     buildOctree();
     buildIndexes();
     calcAvgAbsMag();
+
+    if (namesDB != NULL)
+        namesDB->buildCompletionIndex();
     /*
     // Put AbsMag = avgAbsMag for Add-ons without AbsMag entry
     for (int i = 0; i < nDSOs; ++i)
@@ -400,10 +436,18 @@ void DSODatabase::buildOctree()
     // objects end up straddling the base level nodes when the center of the
     // octree is at the origin.
     DynamicDSOOctree* root   = new DynamicDSOOctree(Vector3d::Zero(), absMag);
+
+    vector<DeepSkyObject* const*> dsoList;
+    dsoList.reserve(nDSOs);
     for (int i = 0; i < nDSOs; ++i)
-    {
-        root->insertObject(DSOs[i], DSO_OCTREE_ROOT_SIZE);
-    }
+        dsoList.push_back(&DSOs[i]);
+
+    WorkerPool* pool = NULL;
+    if (buildThreadCount > 0)
+        pool = new WorkerPool(buildThreadCount);
+    OctreeBuilder<DeepSkyObject*, double> builder(pool);
+
+    builder.insertObjects(*root, dsoList, DSO_OCTREE_ROOT_SIZE);
 
     DPRINTF(1, "Spatially sorting DSOs for improved locality of reference . . .\n");
     DeepSkyObject** sortedDSOs    = new DeepSkyObject*[nDSOs];
@@ -411,7 +455,8 @@ void DSODatabase::buildOctree()
 
     // The spatial sorting part is useless for DSOs since we
     // are storing pointers to objects and not the objects themselves:
-    root->rebuildAndSort(octreeRoot, firstDSO);
+    builder.rebuildAndSort(*root, octreeRoot, firstDSO);
+    delete pool;
 
     DPRINTF(1, "%d DSOs total\n", (int) (firstDSO - sortedDSOs));
     DPRINTF(1, "Octree has %d nodes and %d DSOs.\n",
@@ -39,7 +39,8 @@ class DSODatabase
     DeepSkyObject* find(const uint32 catalogNumber) const;
     DeepSkyObject* find(const std::string&) const;
 
-    std::vector<std::string> getCompletion(const std::string&) const;
+    std::vector<std::string> getCompletion(const std::string&,
+                                           unsigned int maxCompletions = 0) const;
 
     void findVisibleDSOs(DSOHandler&    dsoHandler,
                          const Eigen::Vector3d& obsPosition,
@@ -52,6 +53,16 @@ class DSODatabase
                        const Eigen::Vector3d& obsPosition,
                        float radius) const;
 
+    // Pass to dsoHandler the DSOs whose centers are within maxDistance of
+    // obsPosition and within halfAngle radians of the unit vector axis,
+    // and which are brighter than limitingMag as seen from obsPosition.
+    void findDSOsInCone(DSOHandler&    dsoHandler,
+                        const Eigen::Vector3d& obsPosition,
+                        const Eigen::Vector3d& axis,
+                        double halfAngle,
+                        double maxDistance,
+                        float limitingMag) const;
+
     std::string getDSOName    (const DeepSkyObject* const &, bool i18n = false) const;
     std::string getDSONameList(const DeepSkyObject* const &, const unsigned int maxNames = MAX_DSO_NAMES) const;
 
@@ -59,7 +70,13 @@ class DSODatabase
     void setNameDatabase(DSONameDatabase*);
 
     bool load(std::istream&, const std::string& resourcePath);
+    bool load(Tokenizer&, const std::string& resourcePath);
     bool loadBinary(std::istream&);
+
+    // Set the number of worker threads used to build the octree in
+    // finish(); zero builds it on the calling thread.
+    void setBuildThreadCount(unsigned int);
+
     void finish();
 
     static DSODatabase* read(std::istream&);
@@ -80,6 +97,7 @@ private:
     DeepSkyObject**  catalogNumberIndex;
     DSOOctree*       octreeRoot;
     uint32           nextAutoCatalogNumber;
+    unsigned int     buildThreadCount;
     
     double           avgAbsMag;
 };
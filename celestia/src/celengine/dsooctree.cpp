@@ -142,6 +142,68 @@ void DSOOctree::processVisibleObjects(DSOHandler&    processor,
 }
 
 
+template<>
+void DSOOctree::processObjectsInCone(DSOHandler&      processor,
+                                     const PointType& obsPosition,
+                                     const PointType& axis,
+                                     double           halfAngle,
+                                     double           maxDistance,
+                                     float            limitingFactor,
+                                     double           scale) const
+{
+    double nodeRadius  = scale * DSOOctree::SQRT3;
+    double minDistance = (obsPosition - cellCenterPos).norm() - nodeRadius;
+    if (minDistance > maxDistance)
+        return;
+
+    if (!SphereIntersectsCone(cellCenterPos, nodeRadius, obsPosition, axis, halfAngle))
+        return;
+
+    double dimmest      = minDistance > 0.0 ? astro::appToAbsMag((double) limitingFactor, minDistance) : 1000.0;
+    double cosHalfAngle = halfAngle >= PI ? -1.0 : cos(halfAngle);
+
+    // As in processVisibleObjects, the distance passed to the processor
+    // is to the edge of the object's bounding sphere, and the magnitude is
+    // the absolute magnitude.
+    for (unsigned int i = 0; i < nObjects; ++i)
+    {
+        DeepSkyObject* _obj = _firstObject[i];
+        float absMag        = _obj->getAbsoluteMagnitude();
+        if (absMag < dimmest)
+        {
+            Vector3d offset       = _obj->getPosition() - obsPosition;
+            double centerDistance = offset.norm();
+            double distance       = centerDistance - _obj->getBoundingSphereRadius();
+            float appMag = (float) ((distance >= 32.6167) ? astro::absToAppMag((double) absMag, distance) : absMag);
+
+            if (appMag < limitingFactor &&
+                centerDistance <= maxDistance &&
+                offset.dot(axis) >= cosHalfAngle * centerDistance)
+            {
+                processor.process(_obj, distance, absMag);
+            }
+        }
+    }
+
+    if (minDistance <= 0.0 || astro::absToAppMag((double) exclusionFactor, minDistance) <= limitingFactor)
+    {
+        if (_children != NULL)
+        {
+            for (int i = 0; i < 8; ++i)
+            {
+                _children[i]->processObjectsInCone(processor,
+                                                   obsPosition,
+                                                   axis,
+                                                   halfAngle,
+                                                   maxDistance,
+                                                   limitingFactor,
+                                                   scale * 0.5f);
+            }
+        }
+    }
+}
+
+
 template<>
 void DSOOctree::processCloseObjects(DSOHandler&    processor,
                                     const PointType& obsPosition,
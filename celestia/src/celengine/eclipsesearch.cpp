@@ -0,0 +1,594 @@
+// eclipsesearch.cpp
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// Search for eclipses between a body and its satellites.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include <algorithm>
+#include <cmath>
+#include <cassert>
+#include "eclipsesearch.h"
+#include "body.h"
+#include "star.h"
+#include "frame.h"
+#include "timeline.h"
+#include "timelinephase.h"
+#include "lightenv.h"
+#include <celephem/orbit.h>
+#include <celmath/distance.h>
+#include <celutil/workerpool.h>
+
+using namespace Eigen;
+using namespace std;
+
+
+// Default precision of contact times: one second
+static const double DefaultPrecision = 1.0 / 86400.0;
+
+// The time range is divided into chunks no longer than this many days,
+// and into at least MinChunkCount chunks. The chunks don't depend on the
+// number of threads, so neither do the results.
+static const double MaxChunkLength = 30.0;
+static const unsigned int MinChunkCount = 16;
+
+// The relative speed of a pair is sampled this many times over an orbit of
+// the satellite, and as many times again over the whole search.
+static const unsigned int SpeedSampleCount = 32;
+
+// Interval used to differentiate positions when sampling speeds: one minute
+static const double SpeedSampleInterval = 1.0 / 1440.0;
+
+// Sampled speeds are increased by this factor, since the samples may miss
+// the fastest point of an orbit.
+static const double SpeedMargin = 1.5;
+
+// Steps are never shorter than an orbit of the satellite divided by
+// StepsPerOrbit, or MaxMinimumStep days if that's shorter. A step that long
+// could pass over a brief, grazing eclipse, so the minimum of the clearance
+// is searched for whenever such steps straddle one.
+static const double StepsPerOrbit = 256.0;
+static const double MaxMinimumStep = 1.0 / 144.0;
+
+static const unsigned int MaxRootIterations = 100;
+
+
+struct EclipsePair
+{
+    Body* receiver;
+    Body* occulter;
+    double sunRadius;
+
+    // Bound on the rate at which the clearance between the receiver and
+    // the occulter's shadow can change, in kilometers per day
+    double maxRate;
+
+    double minStep;
+
+    // Contacts are searched for no further than this many days from a time
+    // in eclipse.
+    double maxDuration;
+};
+
+
+// Return the distance between the limb of the receiver and the edge of
+// the occulter's shadow: negative when the receiver is at least partly in
+// shadow. The receiver and occulter are treated as spheres, and the sun as
+// distant compared to the distance between them, so the shadow is a
+// cylinder, widened by the penumbra, extending away from the sun. This is
+// the same approximation made by the renderer.
+//
+// Overlapping is set when the bounding spheres of the receiver and
+// occulter intersect, which isn't considered an eclipse.
+static double ShadowClearance(const EclipsePair& pair, double t, bool& overlapping)
+{
+    const Body& receiver = *pair.receiver;
+    const Body& occulter = *pair.occulter;
+
+    Vector3d posReceiver = receiver.getAstrocentricPosition(t);
+    Vector3d posOcculter = occulter.getAstrocentricPosition(t);
+
+    double appSunRadius = pair.sunRadius / posReceiver.norm();
+    double distToOcculter = (posOcculter - posReceiver).norm() - receiver.getRadius();
+    double appOcculterRadius = occulter.getRadius() / distToOcculter;
+    double shadowRadius = (1.0 + appSunRadius / appOcculterRadius) * occulter.getRadius();
+
+    overlapping = distToOcculter <= occulter.getRadius();
+
+    return distance(posReceiver, Ray3d(posOcculter, posOcculter)) -
+        (receiver.getRadius() + shadowRadius);
+}
+
+
+// Estimate the maximum rate of change of the clearance between a pair. The
+// distance from the receiver to the shadow axis changes no faster than the
+// speed of the receiver relative to the occulter, plus the distance between
+// them times the angular speed of the axis about the sun.
+static double MaxClearanceRate(const EclipsePair& pair,
+                               const Body* satellite,
+                               double startTime,
+                               double endTime)
+{
+    const Orbit* orbit = satellite->getOrbit(startTime);
+    double period = orbit->isPeriodic() ? orbit->getPeriod() : 0.0;
+
+    vector<double> times;
+    for (unsigned int i = 0; i < SpeedSampleCount; i++)
+    {
+        if (period > 0.0)
+            times.push_back(startTime + period * i / SpeedSampleCount);
+        times.push_back(startTime + (endTime - startTime) * i / SpeedSampleCount);
+    }
+
+    double maxRelativeSpeed = 0.0;
+    double maxAxisRate = 0.0;
+    for (vector<double>::const_iterator iter = times.begin(); iter != times.end(); iter++)
+    {
+        double t = *iter;
+        Vector3d r0 = pair.receiver->getAstrocentricPosition(t);
+        Vector3d o0 = pair.occulter->getAstrocentricPosition(t);
+        Vector3d r1 = pair.receiver->getAstrocentricPosition(t + SpeedSampleInterval);
+        Vector3d o1 = pair.occulter->getAstrocentricPosition(t + SpeedSampleInterval);
+
+        double relativeSpeed = ((r1 - o1) - (r0 - o0)).norm() / SpeedSampleInterval;
+        double axisRate = (r0 - o0).norm() * (o1 - o0).norm() / (o0.norm() * SpeedSampleInterval);
+        maxRelativeSpeed = max(maxRelativeSpeed, relativeSpeed);
+        maxAxisRate = max(maxAxisRate, axisRate);
+    }
+
+    maxRelativeSpeed *= SpeedMargin;
+
+    // Use the exact bound for satellites that have one, such as those in
+    // elliptical orbits about the body.
+    const Body* center = satellite->getOrbitFrame(startTime)->getCenter().body();
+    if (satellite->getTimeline()->phaseCount() == 1 &&
+        (center == pair.receiver || center == pair.occulter))
+    {
+        maxRelativeSpeed = max(maxRelativeSpeed, orbit->getMaximumSpeed());
+    }
+
+    // Avoid dividing by zero for bodies that don't move at all
+    return max(maxRelativeSpeed + maxAxisRate * SpeedMargin, 1.0e-6);
+}
+
+
+// Return true if the astrocentric position of a body may be computed on
+// several threads at once. Frames that depend on the orientation of other
+// bodies would require their rotation models to be evaluated concurrently
+// as well, so they aren't allowed.
+static bool CanEvaluateConcurrently(const Body* body)
+{
+    const Timeline* timeline = body->getTimeline();
+    for (unsigned int i = 0; i < timeline->phaseCount(); i++)
+    {
+        const TimelinePhase* phase = timeline->getPhase(i);
+        if (!phase->orbit()->canSampleConcurrently())
+            return false;
+
+        vector<Selection> dependencies;
+        if (!phase->orbitFrame()->getOrientationDependencies(dependencies) ||
+            !dependencies.empty())
+        {
+            return false;
+        }
+
+        const Body* center = phase->orbitFrame()->getCenter().body();
+        if (center != NULL && !CanEvaluateConcurrently(center))
+            return false;
+    }
+
+    return true;
+}
+
+
+// Narrow the interval between a time inside an eclipse and one outside of
+// it to the precision, with the Illinois variant of regula falsi. Returns
+// the end of the interval outside of the eclipse, and sets clearance to
+// the clearance at that time.
+static double RefineContact(const EclipsePair& pair,
+                            double inside, double cInside,
+                            double outside, double cOutside,
+                            double precision,
+                            double& clearance)
+{
+    // The clearances used for interpolation are reduced by the Illinois
+    // method; keep the true clearance at the outside end.
+    clearance = cOutside;
+
+    // Interpolated times are kept slightly away from the ends so that the
+    // interval always shrinks.
+    double margin = precision * 0.25;
+
+    int lastMoved = 0;
+    for (unsigned int i = 0; i < MaxRootIterations && fabs(outside - inside) > precision; i++)
+    {
+        double lo = min(inside, outside) + margin;
+        double hi = max(inside, outside) - margin;
+        double t = (inside * cOutside - outside * cInside) / (cOutside - cInside);
+        t = max(lo, min(hi, t));
+
+        bool overlapping = false;
+        double c = ShadowClearance(pair, t, overlapping);
+        if (c < 0.0)
+        {
+            inside = t;
+            cInside = c;
+            if (lastMoved < 0)
+                cOutside *= 0.5;
+            lastMoved = -1;
+        }
+        else
+        {
+            outside = t;
+            cOutside = c;
+            clearance = c;
+            if (lastMoved > 0)
+                cInside *= 0.5;
+            lastMoved = 1;
+        }
+    }
+
+    return outside;
+}
+
+
+// Step forward (direction 1) or backward (direction -1) from a time t
+// inside an eclipse to the contact that ends or begins it. Returns a time
+// just outside the eclipse and sets clearance to the clearance there. The
+// search gives up after pair.maxDuration, returning a time still inside
+// the eclipse, with a negative clearance.
+static double FindContact(const EclipsePair& pair,
+                          double t, double c,
+                          double direction,
+                          double precision,
+                          double& clearance)
+{
+    double limit = t + direction * pair.maxDuration;
+    while ((limit - t) * direction > 0.0)
+    {
+        // Stepping past the contact is harmless; the contact is then
+        // bracketed.
+        double next = t + direction * max(-c / pair.maxRate, pair.minStep);
+        if ((next - limit) * direction > 0.0)
+            next = limit;
+
+        bool overlapping = false;
+        double cNext = ShadowClearance(pair, next, overlapping);
+        if (cNext >= 0.0)
+            return RefineContact(pair, t, c, next, cNext, precision, clearance);
+
+        t = next;
+        c = cNext;
+    }
+
+    clearance = c;
+    return t;
+}
+
+
+// Search for the minimum of the clearance between times a and b, which
+// bracket it, by golden section search. The search stops early if the
+// receiver is found to be in eclipse. Returns the time with the smallest
+// clearance found, and sets clearance and overlapping for that time.
+static double FindMinimumClearance(const EclipsePair& pair,
+                                   double a, double b,
+                                   double precision,
+                                   double& clearance,
+                                   bool& overlapping)
+{
+    const double r = 0.61803398874989485;
+
+    bool overlapping1 = false;
+    bool overlapping2 = false;
+    double t1 = b - r * (b - a);
+    double t2 = a + r * (b - a);
+    double c1 = ShadowClearance(pair, t1, overlapping1);
+    double c2 = ShadowClearance(pair, t2, overlapping2);
+
+    while (b - a > precision && c1 >= 0.0 && c2 >= 0.0)
+    {
+        if (c1 < c2)
+        {
+            b = t2;
+            t2 = t1;
+            c2 = c1;
+            overlapping2 = overlapping1;
+            t1 = b - r * (b - a);
+            c1 = ShadowClearance(pair, t1, overlapping1);
+        }
+        else
+        {
+            a = t1;
+            t1 = t2;
+            c1 = c2;
+            overlapping1 = overlapping2;
+            t2 = a + r * (b - a);
+            c2 = ShadowClearance(pair, t2, overlapping2);
+        }
+    }
+
+    if (c1 < c2)
+    {
+        clearance = c1;
+        overlapping = overlapping1;
+        return t1;
+    }
+    else
+    {
+        clearance = c2;
+        overlapping = overlapping2;
+        return t2;
+    }
+}
+
+
+// Searches one chunk of the time range for eclipses of every pair. An
+// eclipse belongs to the chunk in which it begins; one already in progress
+// at the start of a chunk is skipped, except in the first chunk.
+class EclipseChunkTask : public WorkerTask
+{
+ public:
+    EclipseChunkTask(const vector<EclipsePair>& _pairs,
+                     double _startTime,
+                     double _endTime,
+                     bool _first,
+                     double _precision) :
+        pairs(_pairs),
+        startTime(_startTime),
+        endTime(_endTime),
+        first(_first),
+        precision(_precision)
+    {
+    }
+
+    void run()
+    {
+        for (vector<EclipsePair>::const_iterator iter = pairs.begin(); iter != pairs.end(); iter++)
+            searchPair(*iter);
+    }
+
+    vector<EclipseEvent> eclipses;
+
+ private:
+    void searchPair(const EclipsePair& pair);
+    void addEclipse(const EclipsePair& pair, double start, double end);
+
+    const vector<EclipsePair>& pairs;
+    double startTime;
+    double endTime;
+    bool first;
+    double precision;
+};
+
+
+void EclipseChunkTask::searchPair(const EclipsePair& pair)
+{
+    bool overlapping = false;
+    double t = startTime;
+    double c = ShadowClearance(pair, t, overlapping);
+
+    if (c < 0.0)
+    {
+        double cEnd = 0.0;
+        double end = FindContact(pair, t, c, 1.0, precision, cEnd);
+        if (first && !overlapping)
+        {
+            double cStart = 0.0;
+            addEclipse(pair, FindContact(pair, t, c, -1.0, precision, cStart), end);
+        }
+
+        t = end;
+        c = cEnd;
+    }
+
+    // Time and clearance before the last step
+    double tPrev = t;
+    double cPrev = c;
+
+    // No eclipse can begin before the clearance could have fallen to zero
+    while (t < endTime && c >= 0.0)
+    {
+        double step = c / pair.maxRate;
+        double next = min(t + max(step, pair.minStep), endTime);
+        double cNext = ShadowClearance(pair, next, overlapping);
+
+        double inside = next;
+        double cInside = cNext;
+        double outside = t;
+        double cOutside = c;
+
+        // A minimum length step may have passed over a brief eclipse; if
+        // the clearance has passed through a minimum, look for one there.
+        if (cNext >= 0.0 && step < pair.minStep && cPrev > c && cNext > c)
+        {
+            inside = FindMinimumClearance(pair, tPrev, next, precision, cInside, overlapping);
+            outside = tPrev;
+            cOutside = cPrev;
+        }
+
+        if (cInside < 0.0)
+        {
+            double cStart = 0.0;
+            double start = RefineContact(pair, inside, cInside, outside, cOutside, precision, cStart);
+            double end = FindContact(pair, inside, cInside, 1.0, precision, c);
+            if (!overlapping)
+                addEclipse(pair, start, end);
+
+            t = end;
+            tPrev = t;
+            cPrev = c;
+        }
+        else
+        {
+            tPrev = t;
+            cPrev = c;
+            t = next;
+            c = cNext;
+        }
+    }
+}
+
+
+void EclipseChunkTask::addEclipse(const EclipsePair& pair, double start, double end)
+{
+    EclipseEvent eclipse;
+    eclipse.occulter = pair.occulter;
+    eclipse.receiver = pair.receiver;
+    eclipse.startTime = start;
+    eclipse.endTime = end;
+    eclipses.push_back(eclipse);
+}
+
+
+static bool EclipseStartsBefore(const EclipseEvent& e0, const EclipseEvent& e1)
+{
+    return e0.startTime < e1.startTime;
+}
+
+
+EclipseSearch::EclipseSearch(Body* _body) :
+    body(_body),
+    threadCount(DefaultWorkerThreadCount()),
+    precision(DefaultPrecision)
+{
+}
+
+
+/*! Set the number of worker threads to use, in addition to the thread
+ *  calling findEclipses(). The default is one less than the number of
+ *  processors.
+ */
+void EclipseSearch::setThreadCount(unsigned int n)
+{
+    threadCount = n;
+}
+
+
+/*! Set the precision of the start and end times of eclipses, in days. The
+ *  default is one second.
+ */
+void EclipseSearch::setPrecision(double _precision)
+{
+    precision = _precision;
+}
+
+
+/*! Find eclipses of the types in eclipseTypeMask that begin between
+ *  startTime and endTime, or that are in progress at startTime, and append
+ *  them to eclipses in order of their start times. Returns false if the
+ *  watcher aborted the search, in which case only the eclipses found
+ *  before then are appended.
+ */
+bool EclipseSearch::findEclipses(double startTime,
+                                 double endTime,
+                                 int eclipseTypeMask,
+                                 vector<EclipseEvent>& eclipses,
+                                 EclipseSearchWatcher* watcher) const
+{
+    PlanetarySystem* satellites = body->getSatellites();
+    if (satellites == NULL || body->getSystem() == NULL || endTime <= startTime)
+        return true;
+
+    const Star* sun = body->getSystem()->getStar();
+    assert(sun != NULL);
+
+    bool concurrent = CanEvaluateConcurrently(body);
+
+    // The time range is divided into chunks that are searched concurrently
+    unsigned int chunkCount = max(MinChunkCount,
+                                  (unsigned int) ceil((endTime - startTime) / MaxChunkLength));
+    double chunkLength = (endTime - startTime) / chunkCount;
+
+    vector<EclipsePair> pairs;
+    for (int i = 0; i < satellites->getSystemSize(); i++)
+    {
+        Body* satellite = satellites->getBody(i);
+        if (satellite->getClassification() == Body::Spacecraft)
+            continue;
+
+        for (int type = SolarEclipse; type <= LunarEclipse; type <<= 1)
+        {
+            if ((eclipseTypeMask & type) == 0)
+                continue;
+
+            EclipsePair pair;
+            pair.receiver = type == SolarEclipse ? body : satellite;
+            pair.occulter = type == SolarEclipse ? satellite : body;
+            pair.sunRadius = sun->getRadius();
+
+            // Non-ellipsoidal bodies can't cast correct shadows, and much
+            // smaller occulters don't cast relevant ones.
+            if (!pair.occulter->isEllipsoid() ||
+                pair.occulter->getRadius() < pair.receiver->getRadius() * MinRelativeOccluderRadius)
+            {
+                continue;
+            }
+
+            pair.maxRate = MaxClearanceRate(pair, satellite, startTime, endTime);
+
+            // No eclipse can last longer than an orbit of the satellite
+            const Orbit* orbit = satellite->getOrbit(startTime);
+            if (orbit->isPeriodic() && orbit->getPeriod() > 0.0)
+            {
+                pair.maxDuration = orbit->getPeriod();
+                pair.minStep = min(orbit->getPeriod() / StepsPerOrbit, MaxMinimumStep);
+            }
+            else
+            {
+                pair.maxDuration = endTime - startTime + chunkLength;
+                pair.minStep = MaxMinimumStep;
+            }
+            pair.minStep = max(pair.minStep, precision);
+
+            pairs.push_back(pair);
+        }
+
+        concurrent = concurrent && CanEvaluateConcurrently(satellite);
+    }
+
+    if (pairs.empty())
+        return true;
+
+    // Chunks are searched in rounds of one for every thread, which keeps the
+    // eclipses in order and lets the watcher follow the progress and abort
+    // the search.
+    WorkerPool pool(concurrent ? threadCount : 0);
+    unsigned int chunksPerRound = pool.getThreadCount() + 1;
+
+    vector<EclipseEvent> found;
+    bool aborted = false;
+    for (unsigned int chunk = 0; chunk < chunkCount && !aborted; )
+    {
+        vector<WorkerTask*> tasks;
+        for (unsigned int i = 0; i < chunksPerRound && chunk < chunkCount; i++, chunk++)
+        {
+            double chunkStart = startTime + chunk * chunkLength;
+            double chunkEnd = chunk + 1 == chunkCount ? endTime : startTime + (chunk + 1) * chunkLength;
+            tasks.push_back(new EclipseChunkTask(pairs, chunkStart, chunkEnd, chunk == 0, precision));
+        }
+
+        pool.run(tasks);
+
+        for (vector<WorkerTask*>::iterator iter = tasks.begin(); iter != tasks.end(); iter++)
+        {
+            EclipseChunkTask* task = static_cast<EclipseChunkTask*>(*iter);
+            found.insert(found.end(), task->eclipses.begin(), task->eclipses.end());
+            delete task;
+        }
+
+        if (watcher != NULL && chunk < chunkCount)
+        {
+            if (!watcher->eclipseSearchProgress(startTime + chunk * chunkLength))
+                aborted = true;
+        }
+    }
+
+    stable_sort(found.begin(), found.end(), EclipseStartsBefore);
+    eclipses.insert(eclipses.end(), found.begin(), found.end());
+
+    return !aborted;
+}
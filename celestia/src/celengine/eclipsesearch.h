@@ -0,0 +1,98 @@
+// eclipsesearch.h
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#ifndef _CELENGINE_ECLIPSESEARCH_H_
+#define _CELENGINE_ECLIPSESEARCH_H_
+
+#include <vector>
+
+class Body;
+
+
+/*! An eclipse found by an EclipseSearch: the receiver is at least partly
+ *  in the shadow of the occulter from startTime to endTime. Both times are
+ *  just outside of the eclipse, within the precision of the search.
+ */
+class EclipseEvent
+{
+ public:
+    EclipseEvent() :
+        occulter(NULL),
+        receiver(NULL),
+        startTime(0.0),
+        endTime(0.0)
+    {
+    }
+
+    Body* occulter;
+    Body* receiver;
+    double startTime;
+    double endTime;
+};
+
+
+/*! Receives the progress of an eclipse search, on the thread that called
+ *  EclipseSearch::findEclipses().
+ */
+class EclipseSearchWatcher
+{
+ public:
+    virtual ~EclipseSearchWatcher() {};
+
+    /*! Called each time the search has covered the time range up to t;
+     *  return false to abort the search.
+     */
+    virtual bool eclipseSearchProgress(double t) = 0;
+};
+
+
+/*! An EclipseSearch finds the eclipses between a body and its satellites:
+ *  solar eclipses, where a satellite's shadow falls on the body, and lunar
+ *  eclipses, where a satellite passes through the body's shadow.
+ *
+ *  Rather than testing for eclipses at fixed intervals, the search bounds
+ *  how quickly the distance between the receiver and the edge of the
+ *  occulter's shadow can change, from the orbital speeds of the pair. That
+ *  distance then gives an interval during which no eclipse can begin, so
+ *  the search takes long steps while the satellite is far from conjunction
+ *  and short ones only near it, and doesn't miss brief, grazing eclipses.
+ *  The contact times are found by root finding to within the precision of
+ *  the search.
+ *
+ *  The time range is divided into chunks that are searched on worker
+ *  threads, provided that the orbits of all the bodies involved may be
+ *  evaluated on several threads at once.
+ */
+class EclipseSearch
+{
+ public:
+    EclipseSearch(Body* _body);
+
+    enum
+    {
+        SolarEclipse = 0x1,
+        LunarEclipse = 0x2,
+    };
+
+    void setThreadCount(unsigned int n);
+    void setPrecision(double _precision);
+
+    bool findEclipses(double startTime,
+                      double endTime,
+                      int eclipseTypeMask,
+                      std::vector<EclipseEvent>& eclipses,
+                      EclipseSearchWatcher* watcher = NULL) const;
+
+ private:
+    Body* body;
+    unsigned int threadCount;
+    double precision;
+};
+
+#endif // _CELENGINE_ECLIPSESEARCH_H_
@@ -191,6 +191,18 @@ ReferenceFrame::nestingDepth(unsigned int maxDepth, FrameType frameType) const
 }
 
 
+/*! Append the objects (other than the center) whose orientation or
+ *  position determines the orientation of the frame to a list. The
+ *  default implementation returns false, indicating that the frame
+ *  may depend on objects that it can't enumerate.
+ */
+bool
+ReferenceFrame::getOrientationDependencies(vector<Selection>&) const
+{
+    return false;
+}
+
+
 static unsigned int
 getFrameDepth(const Selection& sel, unsigned int depth, unsigned int maxDepth,
               ReferenceFrame::FrameType frameType)
@@ -251,6 +263,13 @@ J2000EclipticFrame::nestingDepth(unsigned int depth,
 }
 
 
+bool
+J2000EclipticFrame::getOrientationDependencies(vector<Selection>&) const
+{
+    return true;
+}
+
+
 /*** J2000EquatorFrame ***/
 
 J2000EquatorFrame::J2000EquatorFrame(Selection center) :
@@ -282,6 +301,13 @@ J2000EquatorFrame::nestingDepth(unsigned int depth,
 }
 
 
+bool
+J2000EquatorFrame::getOrientationDependencies(vector<Selection>&) const
+{
+    return true;
+}
+
+
 /*** BodyFixedFrame ***/
 
 BodyFixedFrame::BodyFixedFrame(Selection center, Selection obj) :
@@ -360,6 +386,14 @@ BodyFixedFrame::nestingDepth(unsigned int depth,
 }
 
 
+bool
+BodyFixedFrame::getOrientationDependencies(vector<Selection>& objects) const
+{
+    objects.push_back(fixObject);
+    return true;
+}
+
+
 /*** BodyMeanEquatorFrame ***/
 
 BodyMeanEquatorFrame::BodyMeanEquatorFrame(Selection center,
@@ -465,6 +499,14 @@ BodyMeanEquatorFrame::nestingDepth(unsigned int depth,
 }
 
 
+bool
+BodyMeanEquatorFrame::getOrientationDependencies(vector<Selection>& objects) const
+{
+    objects.push_back(equatorObject);
+    return true;
+}
+
+
 /*** CachingFrame ***/
 
 CachingFrame::CachingFrame(Selection _center) :
@@ -13,6 +13,7 @@
 
 #include <celengine/astro.h>
 #include <celengine/selection.h>
+#include <vector>
 #include <Eigen/Core>
 #include <Eigen/Geometry>
 
@@ -59,6 +60,8 @@ class ReferenceFrame
                                       unsigned int maxDepth,
                                       FrameType frameType) const = 0;
 
+    virtual bool getOrientationDependencies(std::vector<Selection>& objects) const;
+
  private:
     Selection centerObject;
     mutable int refCount;
@@ -107,6 +110,7 @@ class J2000EclipticFrame : public ReferenceFrame
     virtual unsigned int nestingDepth(unsigned int depth,
                                       unsigned int maxDepth,
                                       FrameType frameType) const;
+    virtual bool getOrientationDependencies(std::vector<Selection>& objects) const;
 };
 
 
@@ -121,6 +125,7 @@ class J2000EquatorFrame : public ReferenceFrame
     virtual unsigned int nestingDepth(unsigned int depth,
                                       unsigned int maxDepth,
                                       FrameType frameType) const;
+    virtual bool getOrientationDependencies(std::vector<Selection>& objects) const;
 };
 
 
@@ -141,6 +146,7 @@ class BodyFixedFrame : public ReferenceFrame
     virtual unsigned int nestingDepth(unsigned int depth,
                                       unsigned int maxDepth,
                                       FrameType frameType) const;
+    virtual bool getOrientationDependencies(std::vector<Selection>& objects) const;
 
  private:
     Selection fixObject;
@@ -159,6 +165,7 @@ class BodyMeanEquatorFrame : public ReferenceFrame
     virtual unsigned int nestingDepth(unsigned int depth,
                                       unsigned int maxDepth,
                                       FrameType frameType) const;
+    virtual bool getOrientationDependencies(std::vector<Selection>& objects) const;
 
  private:
     Selection equatorObject;
@@ -0,0 +1,606 @@
+// framestatecache.cpp
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include <algorithm>
+#include <utility>
+#include "framestatecache.h"
+#include "frametree.h"
+#include "orbitbvh.h"
+#include "timelinephase.h"
+#include "frame.h"
+#include "body.h"
+#include "star.h"
+#include <celephem/orbit.h>
+#include <celephem/rotation.h>
+#include <celutil/workerpool.h>
+
+using namespace Eigen;
+using namespace std;
+
+
+// Unit number of bodies that appear in more than one unit
+static const unsigned int SharedUnit = ~0u;
+
+// Number of tasks created for each thread that evaluates units; using
+// several per thread evens out the load when subtrees differ in size.
+static const unsigned int TasksPerThread = 4;
+
+
+// Evaluate a range of the units that are independent of each other
+class FrameStateCache::UnitTask : public WorkerTask
+{
+ public:
+    UnitTask(FrameStateCache* _cache, unsigned int _begin, unsigned int _end) :
+        cache(_cache),
+        begin(_begin),
+        end(_end)
+    {
+    }
+
+    void run()
+    {
+        for (unsigned int i = begin; i < end; i++)
+            cache->evaluateUnit(cache->parallelUnits[i]);
+    }
+
+ private:
+    FrameStateCache* cache;
+    unsigned int begin;
+    unsigned int end;
+};
+
+
+FrameStateCache::FrameStateCache() :
+    layoutVersion(0),
+    layoutValid(false),
+    stamp(0),
+    time(0.0),
+    valid(false)
+{
+}
+
+
+FrameStateCache::~FrameStateCache()
+{
+}
+
+
+/*! Discard the cached states and the layout of the frame hierarchy; the
+ *  next update will rebuild both.
+ */
+void
+FrameStateCache::invalidate()
+{
+    layoutValid = false;
+    valid = false;
+}
+
+
+/*! Compute the states of all bodies in the solar systems of the catalog
+ *  at time tdb. Nothing is done if the cache already holds the states for
+ *  that time and the frame hierarchy hasn't changed. The worker pool may
+ *  be NULL, in which case all states are computed by the calling thread.
+ */
+void
+FrameStateCache::update(const SolarSystemCatalog& catalog,
+                        double tdb,
+                        WorkerPool* workerPool)
+{
+    if (!layoutValid || layoutVersion != FrameTree::structureVersion())
+    {
+        buildLayout(catalog);
+        valid = false;
+    }
+
+    if (valid && tdb == time)
+        return;
+
+    time = tdb;
+    stamp++;
+
+    // The positions of the children of the roots are computed first, so
+    // that the populations of asteroids and comets orbiting stars are
+    // handled by the orbit batches of the root trees. Roots with bounding
+    // hierarchies are left to compute their children on demand.
+    for (unsigned int i = 0; i < roots.size(); i++)
+    {
+        if (roots[i]->hasBoundingHierarchy())
+            rootPositions[i] = NULL;
+        else
+            rootPositions[i] = roots[i]->getChildPositions(tdb);
+    }
+
+    unsigned int threadCount = workerPool != NULL ? workerPool->getThreadCount() : 0;
+    if (threadCount > 0 && parallelUnits.size() > 1)
+    {
+        unsigned int totalBodies = 0;
+        for (vector<Unit>::const_iterator iter = parallelUnits.begin();
+             iter != parallelUnits.end(); iter++)
+        {
+            totalBodies += iter->bodyCount;
+        }
+
+        unsigned int taskBodies = max(1u, totalBodies / ((threadCount + 1) * TasksPerThread));
+
+        // Divide the units into contiguous ranges with roughly equal numbers
+        // of bodies.
+        vector<WorkerTask*> tasks;
+        unsigned int begin = 0;
+        unsigned int bodyCount = 0;
+        for (unsigned int i = 0; i < parallelUnits.size(); i++)
+        {
+            bodyCount += parallelUnits[i].bodyCount;
+            if (bodyCount >= taskBodies || i == parallelUnits.size() - 1)
+            {
+                tasks.push_back(new UnitTask(this, begin, i + 1));
+                begin = i + 1;
+                bodyCount = 0;
+            }
+        }
+
+        workerPool->run(tasks);
+
+        for (unsigned int i = 0; i < tasks.size(); i++)
+            delete tasks[i];
+    }
+    else
+    {
+        for (vector<Unit>::const_iterator iter = parallelUnits.begin();
+             iter != parallelUnits.end(); iter++)
+        {
+            evaluateUnit(*iter);
+        }
+    }
+
+    // Units that depend on state shared with other units are evaluated
+    // only after all of the parallel work has finished.
+    for (vector<Unit>::const_iterator iter = serialUnits.begin();
+         iter != serialUnits.end(); iter++)
+    {
+        evaluateUnit(*iter);
+    }
+
+    valid = true;
+}
+
+
+/*! Get the position of a body in astrocentric ecliptic coordinates; this
+ *  is equal to Body::getAstrocentricPosition(tdb).
+ */
+Vector3d
+FrameStateCache::getAstrocentricPosition(const Body* body, double tdb) const
+{
+    const BodyState* state = findState(body, tdb);
+    if (state != NULL)
+        return state->position;
+    else
+        return body->getAstrocentricPosition(tdb);
+}
+
+
+/*! Get the rotation that converts from the ecliptic frame to the body
+ *  fixed frame of a body; this is equal to Body::getEclipticToBodyFixed(tdb).
+ */
+Quaterniond
+FrameStateCache::getEclipticToBodyFixed(const Body* body, double tdb) const
+{
+    const BodyState* state = findState(body, tdb);
+    if (state != NULL)
+        return state->orientation;
+    else
+        return body->getEclipticToBodyFixed(tdb);
+}
+
+
+/*! Get the position of a body in the universal coordinate system.
+ */
+UniversalCoord
+FrameStateCache::getPosition(const Body* body, double tdb) const
+{
+    const BodyState* state = findState(body, tdb);
+    if (state != NULL)
+        return state->star->getPosition(tdb).offsetKm(state->position);
+    else
+        return body->getPosition(tdb);
+}
+
+
+/*! Get the position of any selection in the universal coordinate system;
+ *  only the positions of bodies are cached.
+ */
+UniversalCoord
+FrameStateCache::getPosition(const Selection& sel, double tdb) const
+{
+    if (sel.getType() == Selection::Type_Body)
+        return getPosition(sel.body(), tdb);
+    else
+        return sel.getPosition(tdb);
+}
+
+
+const FrameStateCache::BodyState*
+FrameStateCache::findState(const Body* body, double tdb) const
+{
+    if (!valid || tdb != time)
+        return NULL;
+
+    unsigned int index = body->getFrameStateIndex();
+    if (index >= states.size() || states[index].body != body)
+        return NULL;
+
+    if (states[index].stamp != stamp && states[index].lazyTree != NULL)
+        evaluateLeaf(states[index]);
+
+    if (states[index].stamp == stamp)
+        return &states[index];
+    else
+        return NULL;
+}
+
+
+// Assign a state to every body reachable from the roots of the frame trees
+// and decide which units may be evaluated in parallel.
+void
+FrameStateCache::buildLayout(const SolarSystemCatalog& catalog)
+{
+    states.clear();
+    roots.clear();
+    parallelUnits.clear();
+    serialUnits.clear();
+
+    vector<Unit> units;
+    for (SolarSystemCatalog::const_iterator iter = catalog.begin();
+         iter != catalog.end(); iter++)
+    {
+        const SolarSystem* solarSystem = iter->second;
+        const FrameTree* tree = solarSystem->getFrameTree();
+        if (tree == NULL || tree->getStar() == NULL)
+            continue;
+
+        Unit unit;
+        unit.root = roots.size();
+        roots.push_back(tree);
+
+        for (unsigned int i = 0; i < tree->childCount(); i++)
+        {
+            unsigned int firstState = states.size();
+
+            Body* body = tree->getChild(i)->body();
+            unsigned int index = body->getFrameStateIndex();
+            if (isLazy(tree, body))
+            {
+                BodyState state;
+                state.body = body;
+                state.star = tree->getStar();
+                state.unit = SharedUnit;
+                state.stamp = 0;
+                state.lazyTree = tree;
+                state.lazyChild = i;
+                body->setFrameStateIndex(states.size());
+                states.push_back(state);
+                continue;
+            }
+            else if (index < states.size() && states[index].body == body)
+            {
+                // A body with several phases orbiting the star
+                states[index].unit = SharedUnit;
+            }
+            else
+            {
+                BodyState state;
+                state.body = body;
+                state.star = tree->getStar();
+                state.unit = units.size();
+                state.stamp = 0;
+                state.lazyTree = NULL;
+                state.lazyChild = 0;
+                body->setFrameStateIndex(states.size());
+                states.push_back(state);
+
+                if (body->getFrameTree() != NULL)
+                    addBodies(body->getFrameTree(), tree->getStar(), units.size());
+            }
+
+            unit.child = i;
+            unit.bodyCount = max(1u, (unsigned int) states.size() - firstState);
+            units.push_back(unit);
+        }
+    }
+
+    rootPositions.resize(roots.size());
+
+    // A unit can be evaluated in parallel only when it shares no orbits or
+    // rotation models with other units, since many of them cache their last
+    // result. Gather the objects used by each independent unit, then
+    // look for objects that appear in more than one.
+    vector<bool> independent(units.size());
+    vector<pair<const void*, unsigned int> > objects;
+    for (unsigned int i = 0; i < units.size(); i++)
+    {
+        const FrameTree* tree = roots[units[i].root];
+        const TimelinePhase* phase = tree->getChild(units[i].child);
+        independent[i] = isIndependent(phase->body(), i);
+
+        if (independent[i])
+        {
+            objects.push_back(make_pair((const void*) phase->orbit(), i));
+            objects.push_back(make_pair((const void*) phase->rotationModel(), i));
+
+            vector<const FrameTree*> subtrees;
+            if (phase->body()->getFrameTree() != NULL)
+                subtrees.push_back(phase->body()->getFrameTree());
+            while (!subtrees.empty())
+            {
+                const FrameTree* subtree = subtrees.back();
+                subtrees.pop_back();
+                for (unsigned int j = 0; j < subtree->childCount(); j++)
+                {
+                    const TimelinePhase* child = subtree->getChild(j);
+                    objects.push_back(make_pair((const void*) child->orbit(), i));
+                    objects.push_back(make_pair((const void*) child->rotationModel(), i));
+                    if (child->body()->getFrameTree() != NULL)
+                        subtrees.push_back(child->body()->getFrameTree());
+                }
+            }
+        }
+    }
+
+    sort(objects.begin(), objects.end());
+    for (unsigned int i = 1; i < objects.size(); i++)
+    {
+        if (objects[i].first == objects[i - 1].first &&
+            objects[i].second != objects[i - 1].second)
+        {
+            independent[objects[i].second] = false;
+            independent[objects[i - 1].second] = false;
+        }
+    }
+
+    for (unsigned int i = 0; i < units.size(); i++)
+    {
+        if (independent[i])
+            parallelUnits.push_back(units[i]);
+        else
+            serialUnits.push_back(units[i]);
+    }
+
+    layoutVersion = FrameTree::structureVersion();
+    layoutValid = true;
+}
+
+
+void
+FrameStateCache::addBodies(const FrameTree* tree, const Star* star, unsigned int unit)
+{
+    for (unsigned int i = 0; i < tree->childCount(); i++)
+    {
+        Body* body = tree->getChild(i)->body();
+        unsigned int index = body->getFrameStateIndex();
+        if (isLazy(tree, body))
+        {
+            BodyState state;
+            state.body = body;
+            state.star = star;
+            state.unit = SharedUnit;
+            state.stamp = 0;
+            state.lazyTree = tree;
+            state.lazyChild = i;
+            body->setFrameStateIndex(states.size());
+            states.push_back(state);
+        }
+        else if (index < states.size() && states[index].body == body)
+        {
+            // The body has phases in more than one tree
+            if (states[index].unit != unit)
+                states[index].unit = SharedUnit;
+        }
+        else
+        {
+            BodyState state;
+            state.body = body;
+            state.star = star;
+            state.unit = unit;
+            state.stamp = 0;
+            state.lazyTree = NULL;
+            state.lazyChild = 0;
+            body->setFrameStateIndex(states.size());
+            states.push_back(state);
+
+            if (body->getFrameTree() != NULL)
+                addBodies(body->getFrameTree(), star, unit);
+        }
+    }
+}
+
+
+// Return true if the state of a body is computed on demand: only bodies in
+// trees with bounding hierarchies that have a single phase and no subtree
+// are.
+bool
+FrameStateCache::isLazy(const FrameTree* tree, const Body* body) const
+{
+    return tree->hasBoundingHierarchy() &&
+           body->getFrameTree() == NULL &&
+           body->getTimeline()->phaseCount() == 1;
+}
+
+
+// Return true if evaluating the states of a body and the bodies in its
+// subtree requires only objects that belong to the unit. Every phase of the
+// body is checked, not just those active at the current time, so that the
+// result holds until the frame hierarchy changes.
+bool
+FrameStateCache::isIndependent(const Body* body, unsigned int unit) const
+{
+    unsigned int index = body->getFrameStateIndex();
+    if (index >= states.size() || states[index].body != body || states[index].unit != unit)
+        return false;
+
+    const Timeline* timeline = body->getTimeline();
+    for (unsigned int i = 0; i < timeline->phaseCount(); i++)
+    {
+        const TimelinePhase* phase = timeline->getPhase(i);
+        if (!phase->orbit()->isThreadSafe() || !phase->rotationModel()->isThreadSafe())
+            return false;
+
+        vector<Selection> dependencies;
+        if (!phase->orbitFrame()->getOrientationDependencies(dependencies) ||
+            !phase->bodyFrame()->getOrientationDependencies(dependencies))
+        {
+            return false;
+        }
+
+        for (vector<Selection>::const_iterator iter = dependencies.begin();
+             iter != dependencies.end(); iter++)
+        {
+            const Body* dependency = iter->body();
+            if (dependency == NULL)
+                return false;
+
+            unsigned int dependencyIndex = dependency->getFrameStateIndex();
+            if (dependencyIndex >= states.size() ||
+                states[dependencyIndex].body != dependency ||
+                states[dependencyIndex].unit != unit)
+            {
+                return false;
+            }
+        }
+    }
+
+    if (body->getFrameTree() != NULL)
+        return isIndependent(body->getFrameTree(), unit);
+    else
+        return true;
+}
+
+
+bool
+FrameStateCache::isIndependent(const FrameTree* tree, unsigned int unit) const
+{
+    for (unsigned int i = 0; i < tree->childCount(); i++)
+    {
+        if (!isIndependent(tree->getChild(i)->body(), unit))
+            return false;
+    }
+
+    return true;
+}
+
+
+void
+FrameStateCache::evaluateUnit(const Unit& unit)
+{
+    const FrameTree* tree = roots[unit.root];
+    const TimelinePhase* phase = tree->getChild(unit.child);
+    if (phase->includes(time))
+    {
+        if (rootPositions[unit.root] != NULL)
+        {
+            evaluateChild(tree, unit.child,
+                          rootPositions[unit.root][unit.child],
+                          Vector3d::Zero());
+        }
+        else
+        {
+            evaluateChild(tree, unit.child,
+                          phase->orbit()->positionAtTime(time),
+                          Vector3d::Zero());
+        }
+    }
+}
+
+
+void
+FrameStateCache::evaluateTree(const FrameTree* tree, const Vector3d& center)
+{
+    if (tree->hasBoundingHierarchy())
+    {
+        // Only children that aren't computed on demand are evaluated here.
+        for (unsigned int i = 0; i < tree->childCount(); i++)
+        {
+            const TimelinePhase* phase = tree->getChild(i);
+            if (phase->includes(time) && !isLazy(tree, phase->body()))
+                evaluateChild(tree, i, phase->orbit()->positionAtTime(time), center);
+        }
+    }
+    else
+    {
+        const Vector3d* positions = tree->getChildPositions(time);
+        for (unsigned int i = 0; i < tree->childCount(); i++)
+        {
+            if (tree->getChild(i)->includes(time))
+                evaluateChild(tree, i, positions[i], center);
+        }
+    }
+}
+
+
+// Compute the state of a child from its position in its orbit frame and
+// the astrocentric position of the frame center, then continue down the
+// hierarchy.
+void
+FrameStateCache::evaluateChild(const FrameTree* tree,
+                               unsigned int child,
+                               const Vector3d& position,
+                               const Vector3d& center)
+{
+    const TimelinePhase* phase = tree->getChild(child);
+    const Body* body = phase->body();
+
+    BodyState& state = states[body->getFrameStateIndex()];
+    computeState(phase, position, center, state);
+
+    if (body->getFrameTree() != NULL)
+        evaluateTree(body->getFrameTree(), state.position);
+}
+
+
+// Compute the states of all bodies that are computed on demand in the same
+// leaf of the bounding hierarchy as the given one.
+void
+FrameStateCache::evaluateLeaf(const BodyState& lazyState) const
+{
+    const FrameTree* tree = lazyState.lazyTree;
+    const OrbitBVH* hierarchy = tree->getBoundingHierarchy(time);
+    unsigned int leaf = hierarchy->getLeaf(lazyState.lazyChild);
+    const OrbitBVH::Node& node = hierarchy->getNode(leaf);
+
+    if (leafPositions.size() < node.count)
+        leafPositions.resize(node.count);
+    hierarchy->computeLeafPositions(leaf, time, &leafPositions[0]);
+
+    Vector3d center = Vector3d::Zero();
+    if (tree->getBody() != NULL)
+        center = getAstrocentricPosition(tree->getBody(), time);
+
+    for (unsigned int i = 0; i < node.count; i++)
+    {
+        const TimelinePhase* phase = tree->getChild(hierarchy->getChild(node.first + i));
+        unsigned int index = phase->body()->getFrameStateIndex();
+        if (index < states.size() &&
+            states[index].body == phase->body() &&
+            states[index].lazyTree == tree &&
+            phase->includes(time))
+        {
+            computeState(phase, leafPositions[i], center, states[index]);
+        }
+    }
+}
+
+
+void
+FrameStateCache::computeState(const TimelinePhase* phase,
+                              const Vector3d& position,
+                              const Vector3d& center,
+                              BodyState& state) const
+{
+    state.position = center + phase->orbitFrame()->getOrientation(time).conjugate() * position;
+    state.orientation = phase->rotationModel()->orientationAtTime(time) * phase->bodyFrame()->getOrientation(time);
+    state.stamp = stamp;
+}
@@ -0,0 +1,123 @@
+// framestatecache.h
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#ifndef _CELENGINE_FRAMESTATECACHE_H_
+#define _CELENGINE_FRAMESTATECACHE_H_
+
+#include <vector>
+#include <celengine/solarsys.h>
+#include <celengine/selection.h>
+#include <celengine/univcoord.h>
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <Eigen/NewStdVector>
+
+class Body;
+class Star;
+class FrameTree;
+class TimelinePhase;
+class WorkerPool;
+
+
+/*! A FrameStateCache holds the astrocentric positions and orientations of
+ *  all solar system bodies at a single time. Computing the position of a
+ *  body requires walking up the frame hierarchy and evaluating the orbit
+ *  and frame of every ancestor; the cache instead evaluates each body once,
+ *  working down from the root of each frame tree, so that the renderer,
+ *  picking, and the overlay can all share the results. Independent subtrees
+ *  of the hierarchy are evaluated in parallel.
+ *
+ *  In frame trees large enough to have a bounding hierarchy (see OrbitBVH),
+ *  the states of children without subtrees of their own are computed only
+ *  when requested, a leaf of the hierarchy at a time, so that bodies the
+ *  renderer culls are never positioned at all.
+ *
+ *  The accessor methods fall back to computing the state of a body directly
+ *  when the body doesn't exist at the cached time or when they're called
+ *  for a different time, so callers always get a correct result.
+ */
+class FrameStateCache
+{
+ public:
+    FrameStateCache();
+    ~FrameStateCache();
+
+    void update(const SolarSystemCatalog& catalog,
+                double tdb,
+                WorkerPool* workerPool);
+    void invalidate();
+
+    Eigen::Vector3d getAstrocentricPosition(const Body* body, double tdb) const;
+    Eigen::Quaterniond getEclipticToBodyFixed(const Body* body, double tdb) const;
+    UniversalCoord getPosition(const Body* body, double tdb) const;
+    UniversalCoord getPosition(const Selection& sel, double tdb) const;
+
+ private:
+    struct BodyState
+    {
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+        const Body* body;
+        const Star* star;
+        Eigen::Quaterniond orientation;
+        Eigen::Vector3d position;
+        unsigned int unit;
+        unsigned int stamp;
+
+        // Tree and child index of a body whose state is computed on
+        // demand; the tree is NULL for all other bodies.
+        const FrameTree* lazyTree;
+        unsigned int lazyChild;
+    };
+
+    // A child of the root of a frame tree, along with all of the bodies
+    // below it in the hierarchy. Units that share no state with other units
+    // are evaluated in parallel.
+    struct Unit
+    {
+        unsigned int root;
+        unsigned int child;
+        unsigned int bodyCount;
+    };
+
+    class UnitTask;
+
+    const BodyState* findState(const Body* body, double tdb) const;
+    void buildLayout(const SolarSystemCatalog& catalog);
+    void addBodies(const FrameTree* tree, const Star* star, unsigned int unit);
+    bool isLazy(const FrameTree* tree, const Body* body) const;
+    bool isIndependent(const FrameTree* tree, unsigned int unit) const;
+    bool isIndependent(const Body* body, unsigned int unit) const;
+    void evaluateUnit(const Unit& unit);
+    void evaluateTree(const FrameTree* tree, const Eigen::Vector3d& center);
+    void evaluateChild(const FrameTree* tree,
+                       unsigned int child,
+                       const Eigen::Vector3d& position,
+                       const Eigen::Vector3d& center);
+    void evaluateLeaf(const BodyState& state) const;
+    void computeState(const TimelinePhase* phase,
+                      const Eigen::Vector3d& position,
+                      const Eigen::Vector3d& center,
+                      BodyState& state) const;
+
+    mutable std::vector<BodyState, Eigen::aligned_allocator<BodyState> > states;
+    mutable std::vector<Eigen::Vector3d> leafPositions;
+    std::vector<const FrameTree*> roots;
+    std::vector<const Eigen::Vector3d*> rootPositions;
+    std::vector<Unit> parallelUnits;
+    std::vector<Unit> serialUnits;
+
+    unsigned int layoutVersion;
+    bool layoutValid;
+    unsigned int stamp;
+    double time;
+    bool valid;
+};
+
+#endif // _CELENGINE_FRAMESTATECACHE_H_
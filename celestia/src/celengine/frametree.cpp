@@ -16,6 +16,14 @@
 #include "celengine/timeline.h"
 #include "celengine/timelinephase.h"
 #include "celengine/frame.h"
+#include "celengine/orbitbvh.h"
+#include <celephem/orbit.h>
+#include <celephem/orbitbatch.h>
+
+using namespace Eigen;
+
+
+unsigned int FrameTree::s_structureVersion = 0;
 
 
 /* A FrameTree is hierarchy of solar system bodies organized according to
@@ -43,8 +51,16 @@
 FrameTree::FrameTree(Star* star) :
     starParent(star),
     bodyParent(NULL),
+    m_boundingSphereRadius(0.0),
+    m_maxChildRadius(0.0),
+    m_containsSecondaryIlluminators(false),
     m_changed(true),
-    defaultFrame(NULL)
+    m_childClassMask(0),
+    defaultFrame(NULL),
+    orbitBatch(NULL),
+    childPositionTime(0.0),
+    childPositionsValid(false),
+    boundingHierarchy(NULL)
 {
     // Default frame for a star is J2000 ecliptical, centered
     // on the star.
@@ -58,8 +74,16 @@ FrameTree::FrameTree(Star* star) :
 FrameTree::FrameTree(Body* body) :
     starParent(NULL),
     bodyParent(body),
+    m_boundingSphereRadius(0.0),
+    m_maxChildRadius(0.0),
+    m_containsSecondaryIlluminators(false),
     m_changed(true),
-    defaultFrame(NULL)
+    m_childClassMask(0),
+    defaultFrame(NULL),
+    orbitBatch(NULL),
+    childPositionTime(0.0),
+    childPositionsValid(false),
+    boundingHierarchy(NULL)
 {
     // Default frame for a solar system body is the mean equatorial frame of the body.
     defaultFrame = new BodyMeanEquatorFrame(Selection(body), Selection(body));
@@ -69,7 +93,10 @@ FrameTree::FrameTree(Body* body) :
 
 FrameTree::~FrameTree()
 {
+    s_structureVersion++;
     defaultFrame->release();
+    delete orbitBatch;
+    delete boundingHierarchy;
 }
 
 
@@ -133,6 +160,11 @@ FrameTree::recomputeBoundingSphere()
         m_containsSecondaryIlluminators = false;
         m_childClassMask = 0;
 
+        // The culling hierarchy depends on the sizes of the children and
+        // their subtrees.
+        delete boundingHierarchy;
+        boundingHierarchy = NULL;
+
         for (vector<TimelinePhase*>::iterator iter = children.begin();
              iter != children.end(); iter++)
         {
@@ -167,6 +199,14 @@ FrameTree::addChild(TimelinePhase* phase)
     phase->addRef();
     children.push_back(phase);
     markChanged();
+    s_structureVersion++;
+
+    delete orbitBatch;
+    orbitBatch = NULL;
+    childPositionsValid = false;
+
+    delete boundingHierarchy;
+    boundingHierarchy = NULL;
 }
 
 
@@ -182,6 +222,14 @@ FrameTree::removeChild(TimelinePhase* phase)
         (*iter)->release();
         children.erase(iter);
         markChanged();
+        s_structureVersion++;
+
+        delete orbitBatch;
+        orbitBatch = NULL;
+        childPositionsValid = false;
+
+        delete boundingHierarchy;
+        boundingHierarchy = NULL;
     }
 }
 
@@ -200,3 +248,81 @@ FrameTree::childCount() const
 {
     return children.size();
 }
+
+
+/*! Get the positions of the children at time tdb, each in the frame of its
+ *  own orbit, in a table indexed by child number. Only the positions of the
+ *  children whose phases include tdb are valid. The children with Keplerian
+ *  orbits are computed together in a single batch, which is much faster
+ *  than computing them one at a time when the tree contains many asteroids
+ *  and comets. The table remains valid until the tree is changed or this
+ *  method is called with a different time.
+ */
+const Vector3d*
+FrameTree::getChildPositions(double tdb) const
+{
+    if (children.empty())
+        return NULL;
+
+    if (childPositionsValid && childPositionTime == tdb)
+        return &childPositions[0];
+
+    if (orbitBatch == NULL)
+    {
+        orbitBatch = new OrbitBatch();
+        unbatchedChildren.clear();
+        for (unsigned int i = 0; i < children.size(); i++)
+        {
+            if (!children[i]->orbit()->addToBatch(*orbitBatch, i))
+                unbatchedChildren.push_back(i);
+        }
+        childPositions.resize(children.size());
+    }
+
+    orbitBatch->computePositions(tdb, &childPositions[0]);
+    for (vector<unsigned int>::const_iterator iter = unbatchedChildren.begin();
+         iter != unbatchedChildren.end(); iter++)
+    {
+        const TimelinePhase* phase = children[*iter];
+        if (phase->includes(tdb))
+            childPositions[*iter] = phase->orbit()->positionAtTime(tdb);
+    }
+
+    childPositionTime = tdb;
+    childPositionsValid = true;
+
+    return &childPositions[0];
+}
+
+
+/*! Return true if the children of this tree are grouped in a bounding
+ *  volume hierarchy for culling; only trees with many children are.
+ */
+bool
+FrameTree::hasBoundingHierarchy() const
+{
+    return children.size() >= OrbitBVH::MinChildren;
+}
+
+
+/*! Get the bounding volume hierarchy over the children of this tree for
+ *  use at time tdb, or NULL if the tree has too few children to need one.
+ *  The hierarchy is built the first time it's requested and rebuilt when
+ *  the tree changes or tdb is far enough from the time it was built that
+ *  its bounds are no longer tight. The bounding spheres of the tree must
+ *  be up to date (see recomputeBoundingSphere.)
+ */
+const OrbitBVH*
+FrameTree::getBoundingHierarchy(double tdb) const
+{
+    if (!hasBoundingHierarchy())
+        return NULL;
+
+    if (boundingHierarchy == NULL || !boundingHierarchy->isCurrent(tdb))
+    {
+        delete boundingHierarchy;
+        boundingHierarchy = new OrbitBVH(this, tdb);
+    }
+
+    return boundingHierarchy;
+}
@@ -15,11 +15,14 @@
 
 #include <vector>
 #include <cstddef>
+#include <Eigen/Core>
 
 class Star;
 class Body;
 class ReferenceFrame;
 class TimelinePhase;
+class OrbitBatch;
+class OrbitBVH;
 
 
 class FrameTree
@@ -37,6 +40,14 @@ public:
         return starParent;
     }
 
+    /*! Return the solar system body that this tree is associated with; it
+     *  will be NULL for frame trees associated with stars.
+     */
+    Body* getBody() const
+    {
+        return bodyParent;
+    }
+
     ReferenceFrame* getDefaultReferenceFrame() const;
 
     void addChild(TimelinePhase* phase);
@@ -89,6 +100,19 @@ public:
         return m_childClassMask;
     }
 
+    const Eigen::Vector3d* getChildPositions(double tdb) const;
+
+    bool hasBoundingHierarchy() const;
+    const OrbitBVH* getBoundingHierarchy(double tdb) const;
+
+    /*! Return a counter that is incremented whenever a child is added to
+     *  or removed from any frame tree.
+     */
+    static unsigned int structureVersion()
+    {
+        return s_structureVersion;
+    }
+
 private:
     Star* starParent;
     Body* bodyParent;
@@ -101,6 +125,19 @@ private:
     int m_childClassMask;
 
     ReferenceFrame* defaultFrame;
+
+    // Table of child orbit positions, the batch used to compute those that
+    // have Keplerian orbits, and the indices of the remaining children
+    mutable OrbitBatch* orbitBatch;
+    mutable std::vector<unsigned int> unbatchedChildren;
+    mutable std::vector<Eigen::Vector3d> childPositions;
+    mutable double childPositionTime;
+    mutable bool childPositionsValid;
+
+    // Culling hierarchy over the children of large trees
+    mutable OrbitBVH* boundingHierarchy;
+
+    static unsigned int s_structureVersion;
 };
 
 #endif // _CELENGINE_FRAMETREE_H_
@@ -12,6 +12,7 @@
 #define _CELENGINE_GEOMETRY_H_
 
 #include <celmodel/material.h>
+#include <cstddef>
 #include <celmath/ray.h>
 
 class RenderContext;
@@ -53,6 +54,14 @@ public:
     virtual void loadTextures()
     {
     }
+
+    /*! Return the approximate number of bytes of memory used by the
+     *  geometry, or zero if unknown.
+     */
+    virtual std::size_t getMemoryUsage() const
+    {
+        return 0;
+    }
 };
 
 #endif // _CELENGINE_GEOMETRY_H_
@@ -20,6 +20,10 @@
 
 static const unsigned int MaxLights = 8;
 
+// Occluders with a radius less than this fraction of the receiver's radius
+// don't cast shadows worth rendering or eclipses worth reporting.
+static const float MinRelativeOccluderRadius = 0.005f;
+
 class Body;
 class RingSystem;
 
@@ -103,6 +103,97 @@ string GeometryInfo::resolve(const string& baseDir)
 
 
 Geometry* GeometryInfo::load(const string& resolvedFilename)
+{
+#if PARTICLE_SYSTEM
+    // Strip off the uniquifying suffix
+    string::size_type uniquifyingSuffixStart = resolvedFilename.rfind(UniqueSuffixChar);
+    string filename(resolvedFilename, 0, uniquifyingSuffixStart);
+
+    if (DetermineFileType(filename) == Content_CelestiaParticleSystem)
+    {
+        ifstream in(filename.c_str());
+        if (in.good())
+        {
+            return LoadParticleSystem(in, path);
+        }
+    }
+#endif
+
+    Model* model = loadModel(resolvedFilename);
+    if (model == NULL)
+        return NULL;
+    else
+        return new ModelGeometry(model);
+}
+
+
+// Model read from a file on a worker thread. The model is wrapped in its
+// geometry right away, since that doesn't touch OpenGL until the vertex
+// buffers are initialized.
+class PreparedModel : public PreparedResource
+{
+ public:
+    PreparedModel(ModelGeometry* _geometry) : geometry(_geometry) {};
+    virtual ~PreparedModel() { delete geometry; };
+
+    ModelGeometry* geometry;
+};
+
+
+// Models are read and conditioned on the worker thread; the textures that
+// they refer to are loaded separately when the model is rendered. Celestia
+// meshes use the noise functions, which aren't thread safe, so they are
+// loaded on the main thread along with particle systems.
+PreparedResource* GeometryInfo::prepare(const string& resolvedFilename) const
+{
+    string::size_type uniquifyingSuffixStart = resolvedFilename.rfind(UniqueSuffixChar);
+    string filename(resolvedFilename, 0, uniquifyingSuffixStart);
+    ContentType fileType = DetermineFileType(filename);
+    if (fileType == Content_CelestiaMesh || fileType == Content_CelestiaParticleSystem)
+        return new PreparedModel(NULL);
+
+    Model* model = loadModel(resolvedFilename);
+    if (model == NULL)
+        return NULL;
+    else
+        return new PreparedModel(new ModelGeometry(model));
+}
+
+
+Geometry* GeometryInfo::create(const string& resolvedFilename, PreparedResource* prepared)
+{
+    PreparedModel* preparedModel = static_cast<PreparedModel*>(prepared);
+    if (preparedModel == NULL)
+        return NULL;
+
+    if (preparedModel->geometry == NULL)
+    {
+        delete preparedModel;
+        return load(resolvedFilename);
+    }
+
+    ModelGeometry* geometry = preparedModel->geometry;
+    preparedModel->geometry = NULL;
+    delete preparedModel;
+
+    // Upload the vertex data now rather than stalling the first frame in
+    // which the model is rendered.
+    geometry->initVertexBuffers();
+
+    return geometry;
+}
+
+
+size_t GeometryInfo::getMemoryUsage(const Geometry* geometry) const
+{
+    return geometry->getMemoryUsage();
+}
+
+
+/*! Read a model file and condition it for rendering. This doesn't use
+ *  OpenGL, so it may be called from any thread.
+ */
+Model* GeometryInfo::loadModel(const string& resolvedFilename) const
 {
     // Strip off the uniquifying suffix
     string::size_type uniquifyingSuffixStart = resolvedFilename.rfind(UniqueSuffixChar);
@@ -158,17 +249,7 @@ Geometry* GeometryInfo::load(const string& resolvedFilename)
                 model->transform(center, scale);
         }
     }
-#if PARTICLE_SYSTEM
-    else if (fileType == Content_CelestiaParticleSystem)
-    {
-        ifstream in(filename.c_str());
-        if (in.good())
-        {
-            return LoadParticleSystem(in, path);
-        }
-    }
-#endif
-        
+
     // Condition the model for optimal rendering
     if (model != NULL)
     {
@@ -194,7 +275,7 @@ Geometry* GeometryInfo::load(const string& resolvedFilename)
              << originalMaterialCount << _(" materials ")
              << "(" << model->getMaterialCount() << _(" unique)\n");
 
-        return new ModelGeometry(model);
+        return model;
     }
     else
     {
@@ -14,6 +14,7 @@
 #include <map>
 #include <celutil/resmanager.h>
 #include <celengine/geometry.h>
+#include <celmodel/model.h>
 
 
 class GeometryInfo : public ResourceInfo<Geometry>
@@ -51,6 +52,12 @@ class GeometryInfo : public ResourceInfo<Geometry>
 
     virtual std::string resolve(const std::string&);
     virtual Geometry* load(const std::string&);
+    virtual PreparedResource* prepare(const std::string&) const;
+    virtual Geometry* create(const std::string&, PreparedResource*);
+    virtual std::size_t getMemoryUsage(const Geometry*) const;
+
+ private:
+    cmod::Model* loadModel(const std::string& filename) const;
 };
 
 inline bool operator<(const GeometryInfo& g0, const GeometryInfo& g1)
@@ -90,11 +90,13 @@ ModelGeometry::pick(const Ray3d& r, double& distance) const
 }
 
 
-/*! Render the model; the time parameter is ignored right now
- *  since this class doesn't currently support animation.
+/*! Copy the vertex data of large meshes into vertex buffer objects. This is
+ *  done automatically the first time that the model is rendered, but it may
+ *  be done earlier to avoid a delay when the model first appears. An OpenGL
+ *  context must be current.
  */
 void
-ModelGeometry::render(RenderContext& rc, double /* t */)
+ModelGeometry::initVertexBuffers()
 {
     // The first time the mesh is rendered, we will try and place the
     // vertex data in a vertex buffer object and potentially get a huge
@@ -103,10 +105,9 @@ ModelGeometry::render(RenderContext& rc, double /* t */)
     // the possibility of deleting the original data.  We can always map
     // read-only later on for things like picking, but this could be a low
     // performance path.
-    if (!m_vbInitialized && isVBOSupported())
+    m_vbInitialized = true;
+    if (isVBOSupported())
     {
-        m_vbInitialized = true;
-
         for (unsigned int i = 0; i < m_model->getMeshCount(); ++i)
         {
             Mesh* mesh = m_model->getMesh(i);
@@ -130,6 +131,17 @@ ModelGeometry::render(RenderContext& rc, double /* t */)
             m_glData->vbos.push_back(vboId);
         }
     }
+}
+
+
+/*! Render the model; the time parameter is ignored right now
+ *  since this class doesn't currently support animation.
+ */
+void
+ModelGeometry::render(RenderContext& rc, double /* t */)
+{
+    if (!m_vbInitialized)
+        initVertexBuffers();
 
     unsigned int lastMaterial = ~0u;
     unsigned int materialCount = m_model->getMaterialCount();
@@ -197,6 +209,25 @@ ModelGeometry::isNormalized() const
 }
 
 
+/*! Return the size of the model's vertex and index data. Vertex data
+ *  copied into vertex buffers isn't counted separately.
+ */
+size_t
+ModelGeometry::getMemoryUsage() const
+{
+    size_t size = 0;
+    for (unsigned int i = 0; i < m_model->getMeshCount(); i++)
+    {
+        const Mesh* mesh = m_model->getMesh(i);
+        size += (size_t) mesh->getVertexCount() * mesh->getVertexStride();
+        for (unsigned int j = 0; j < mesh->getGroupCount(); j++)
+            size += mesh->getGroup(j)->nIndices * sizeof(Mesh::index32);
+    }
+
+    return size;
+}
+
+
 bool
 ModelGeometry::usesTextureType(Material::TextureSemantic t) const
 {
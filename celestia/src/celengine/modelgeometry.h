@@ -56,8 +56,10 @@ class ModelGeometry : public Geometry
     virtual bool usesTextureType(cmod::Material::TextureSemantic) const;
     virtual bool isOpaque() const;
     virtual bool isNormalized() const;
+    virtual std::size_t getMemoryUsage() const;
 
     void loadTextures();
+    void initVertexBuffers();
 
  private:
     cmod::Model* m_model;
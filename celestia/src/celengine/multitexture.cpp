@@ -59,12 +59,21 @@ void MultiResTexture::setTexture(const string& source, const string& path,
 }
 
 
+// A texture that is still being loaded in the background may yet succeed,
+// so it shouldn't be replaced by one of another resolution.
+static bool isLoadPending(ResourceHandle h)
+{
+    const TextureInfo* info = GetTextureManager()->getResourceInfo(h);
+    return info != NULL && info->state == ResourceLoadPending;
+}
+
+
 Texture* MultiResTexture::find(unsigned int resolution)
 {
     TextureManager* texMan = GetTextureManager();
 
     Texture* res = texMan->find(tex[resolution]);
-    if (res != NULL)
+    if (res != NULL || isLoadPending(tex[resolution]))
         return res;
 
     // Preferred resolution isn't available; try the second choice
@@ -90,7 +99,7 @@ Texture* MultiResTexture::find(unsigned int resolution)
 
     tex[resolution] = tex[secondChoice];
     res = texMan->find(tex[resolution]);
-    if (res != NULL)
+    if (res != NULL || isLoadPending(tex[resolution]))
         return res;
 
     tex[resolution] = tex[lastResort];
@@ -14,6 +14,7 @@
 #define _NAME_H_
 
 #include <string>
+#include <cstring>
 #include <iostream>
 #include <map>
 #include <vector>
@@ -21,6 +22,8 @@
 #include <celutil/debug.h>
 #include <celutil/util.h>
 #include <celutil/utf8.h>
+#include <celutil/prefixindex.h>
+#include <celutil/hash.h>
 
 // TODO: this can be "detemplatized" by creating e.g. a global-scope enum InvalidCatalogNumber since there
 // lies the one and only need for type genericity.
@@ -31,7 +34,7 @@ template <class OBJ> class NameDatabase
     typedef std::multimap<uint32, std::string> NumberIndex;
 
  public:
-    NameDatabase() {};
+    NameDatabase() : completionIndexValid(false) {};
 
 
     uint32 getNameCount() const;
@@ -47,11 +50,31 @@ template <class OBJ> class NameDatabase
     NumberIndex::const_iterator getFirstNameIter(const uint32 catalogNumber) const;
     NumberIndex::const_iterator getFinalNameIter() const;
 
-    std::vector<std::string> getCompletion(const std::string& name) const;
+    std::vector<std::string> getCompletion(const std::string& name,
+                                           unsigned int maxCompletions = 0) const;
+
+    /*! Build the index used by getCompletion(). This is done automatically
+     *  the first time that completion is requested after names are added,
+     *  but it may be done in advance when loading is finished. Nothing is
+     *  done if the index is already up to date.
+     */
+    void buildCompletionIndex() const;
+
+    /*! Save the completion index so that a later session with the same
+     *  names can restore it instead of building it. readCompletionIndex()
+     *  accepts only an index built from exactly the current set of names.
+     */
+    bool writeCompletionIndex(std::ostream&) const;
+    bool readCompletionIndex(const char* data, std::size_t size);
 
  protected:
+    uint64 hashNames() const;
+
     NameIndex   nameIndex;
     NumberIndex numberIndex;
+
+    mutable PrefixIndex completionIndex;
+    mutable bool completionIndexValid;
 };
 
 
@@ -78,6 +101,7 @@ void NameDatabase<OBJ>::add(const uint32 catalogNumber, const std::string& name)
 
         nameIndex[name]   = catalogNumber;
         numberIndex.insert(NumberIndex::value_type(catalogNumber, name));
+        completionIndexValid = false;
     }
 }
 
@@ -150,18 +174,80 @@ NameDatabase<OBJ>::NumberIndex::const_iterator NameDatabase<OBJ>::getFinalNameIt
 
 
 template <class OBJ>
-std::vector<std::string> NameDatabase<OBJ>::getCompletion(const std::string& name) const
+void NameDatabase<OBJ>::buildCompletionIndex() const
 {
-    std::vector<std::string> completion;
-    int name_length = UTF8Length(name);
+    if (completionIndexValid)
+        return;
 
+    completionIndex.clear();
+    for (NameIndex::const_iterator iter = nameIndex.begin(); iter != nameIndex.end(); ++iter)
+        completionIndex.add(iter->first);
+    completionIndex.sort();
+    completionIndexValid = true;
+}
+
+
+// Hash of the names in the index, in index order
+template <class OBJ>
+uint64 NameDatabase<OBJ>::hashNames() const
+{
+    uint64 hash = InitialHashValue;
     for (NameIndex::const_iterator iter = nameIndex.begin(); iter != nameIndex.end(); ++iter)
     {
-        if (!UTF8StringCompare(iter->first, name, name_length))
-        {
-            completion.push_back(iter->first);
-        }
+        // Include the terminating null, so that different divisions of
+        // the same characters into names give different hashes
+        hash = HashBytes(iter->first.c_str(), iter->first.length() + 1, hash);
     }
+
+    return hash;
+}
+
+
+template <class OBJ>
+bool NameDatabase<OBJ>::writeCompletionIndex(std::ostream& out) const
+{
+    buildCompletionIndex();
+
+    uint64 namesHash = hashNames();
+    uint32 nameCount = (uint32) nameIndex.size();
+    out.write(reinterpret_cast<const char*>(&namesHash), sizeof namesHash);
+    out.write(reinterpret_cast<const char*>(&nameCount), sizeof nameCount);
+
+    return completionIndex.write(out);
+}
+
+
+template <class OBJ>
+bool NameDatabase<OBJ>::readCompletionIndex(const char* data, std::size_t size)
+{
+    uint64 namesHash;
+    uint32 nameCount;
+    if (size < sizeof namesHash + sizeof nameCount)
+        return false;
+    memcpy(&namesHash, data, sizeof namesHash);
+    memcpy(&nameCount, data + sizeof namesHash, sizeof nameCount);
+
+    if (nameCount != nameIndex.size() || namesHash != hashNames())
+        return false;
+
+    std::size_t headerSize = sizeof namesHash + sizeof nameCount;
+    completionIndexValid = completionIndex.read(data + headerSize, size - headerSize);
+
+    return completionIndexValid;
+}
+
+
+// Return the names beginning with the specified string, ignoring case and
+// diacritics. If maxCompletions is nonzero, at most that many are returned.
+template <class OBJ>
+std::vector<std::string> NameDatabase<OBJ>::getCompletion(const std::string& name,
+                                                          unsigned int maxCompletions) const
+{
+    if (!completionIndexValid)
+        buildCompletionIndex();
+
+    std::vector<std::string> completion;
+    completionIndex.getCompletion(name, completion, maxCompletions);
     return completion;
 }
 
@@ -0,0 +1,220 @@
+// objectstate.cpp
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// Evaluation of object states at many times at once, for clients such as
+// scripts that need whole ephemerides rather than single positions.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include <celengine/objectstate.h>
+#include <celengine/observer.h>
+#include <celengine/frame.h>
+#include <celengine/body.h>
+#include <celengine/star.h>
+#include <celengine/deepskyobj.h>
+#include <celengine/timeline.h>
+#include <celengine/timelinephase.h>
+#include <celengine/astro.h>
+#include <celephem/orbit.h>
+#include <celephem/rotation.h>
+#include <vector>
+
+using namespace Eigen;
+using namespace std;
+
+
+const float ObjectState::UnknownMagnitude = 1.0e30f;
+
+
+static Quaterniond UniversalOrientation(const Selection& sel, double t)
+{
+    switch (sel.getType())
+    {
+    case Selection::Type_Body:
+        return sel.body()->getOrientation(t);
+
+    case Selection::Type_Star:
+        return sel.star()->getRotationModel()->orientationAtTime(t);
+
+    case Selection::Type_DeepSky:
+        return sel.deepsky()->getOrientation().cast<double>();
+
+    case Selection::Type_Location:
+        if (sel.location()->getParentBody() != NULL)
+            return sel.location()->getParentBody()->getOrientation(t);
+        return Quaterniond::Identity();
+
+    default:
+        return Quaterniond::Identity();
+    }
+}
+
+
+// Compute the apparent magnitude of the object at the universal position
+// position, with offset the position relative to the viewer in km.
+static float ApparentMagnitude(const Selection& sel,
+                               const UniversalCoord& position,
+                               const Vector3d& offset,
+                               double t)
+{
+    double distance = offset.norm();
+    if (distance <= 0.0)
+        return ObjectState::UnknownMagnitude;
+
+    switch (sel.getType())
+    {
+    case Selection::Type_Body:
+        {
+            const Body* body = sel.body();
+            const Star* sun = body->getSystem() != NULL ? body->getSystem()->getStar() : NULL;
+            if (sun == NULL)
+                return ObjectState::UnknownMagnitude;
+
+            Vector3d sunOffset = position.offsetFromKm(sun->getPosition(t));
+            if (sunOffset.norm() <= 0.0)
+                return ObjectState::UnknownMagnitude;
+            return body->getApparentMagnitude(sun->getLuminosity(), sunOffset, offset);
+        }
+
+    case Selection::Type_Star:
+        return sel.star()->getApparentMagnitude((float) astro::kilometersToLightYears(distance));
+
+    case Selection::Type_DeepSky:
+        return (float) astro::absToAppMag((double) sel.deepsky()->getAbsoluteMagnitude(),
+                                          astro::kilometersToLightYears(distance));
+
+    default:
+        return ObjectState::UnknownMagnitude;
+    }
+}
+
+
+/*! Compute the states of the object sel relative to frame at count
+ *  times, storing them in states. Evaluating a whole series of times in
+ *  one call is much cheaper for scripts than querying the position,
+ *  velocity and orientation separately at each time.
+ */
+void ComputeObjectStates(const Selection& sel,
+                         const ObserverFrame& frame,
+                         const double* times,
+                         unsigned int count,
+                         ObjectState* states)
+{
+    const ReferenceFrame* refFrame = frame.getFrame();
+    Selection center = refFrame->getCenter();
+    bool inertial = refFrame->isInertial();
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        double t = times[i];
+        ObjectState& state = states[i];
+
+        UniversalCoord position = sel.getPosition(t);
+        UniversalCoord centerPosition = center.getPosition(t);
+        Quaterniond frameOrientation = refFrame->getOrientation(t);
+
+        // Universal coordinates are converted to frame coordinates by
+        // rotating by the frame orientation.
+        Vector3d offset = position.offsetFromKm(centerPosition);
+        Vector3d v = sel.getVelocity(t) - center.getVelocity(t);
+        if (!inertial)
+            v -= refFrame->getAngularVelocity(t).cross(offset);
+
+        state.position = frameOrientation * offset;
+        state.velocity = frameOrientation * v;
+        state.orientation = UniversalOrientation(sel, t) * frameOrientation.conjugate();
+        state.appMag = ApparentMagnitude(sel, position, offset, t);
+    }
+}
+
+
+static bool CanEvaluateConcurrently(const Selection& sel);
+
+// Frames whose orientation dependencies are unknown, such as two-vector
+// frames, cache their orientation without protection and can't be used
+// concurrently.
+static bool CanEvaluateConcurrently(const ReferenceFrame* frame)
+{
+    vector<Selection> dependencies;
+    if (!frame->getOrientationDependencies(dependencies))
+        return false;
+
+    for (unsigned int i = 0; i < dependencies.size(); i++)
+    {
+        if (!CanEvaluateConcurrently(dependencies[i]))
+            return false;
+    }
+
+    return CanEvaluateConcurrently(frame->getCenter());
+}
+
+
+static bool CanEvaluateConcurrently(const Selection& sel)
+{
+    switch (sel.getType())
+    {
+    case Selection::Type_Body:
+        {
+            const Timeline* timeline = sel.body()->getTimeline();
+            for (unsigned int i = 0; i < timeline->phaseCount(); i++)
+            {
+                const TimelinePhase* phase = timeline->getPhase(i);
+                if (!phase->orbit()->canSampleConcurrently() ||
+                    !phase->rotationModel()->canEvaluateConcurrently() ||
+                    !CanEvaluateConcurrently(phase->orbitFrame()) ||
+                    !CanEvaluateConcurrently(phase->bodyFrame()))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+    case Selection::Type_Star:
+        {
+            const Star* star = sel.star();
+            if (star->getOrbit() != NULL && !star->getOrbit()->canSampleConcurrently())
+                return false;
+            if (!star->getRotationModel()->canEvaluateConcurrently())
+                return false;
+            if (star->getOrbitBarycenter() != NULL)
+                return CanEvaluateConcurrently(Selection(star->getOrbitBarycenter()));
+            return true;
+        }
+
+    case Selection::Type_Location:
+        if (sel.location()->getParentBody() != NULL)
+            return CanEvaluateConcurrently(Selection(sel.location()->getParentBody()));
+        return true;
+
+    default:
+        return true;
+    }
+}
+
+
+/*! Return true if the states of sel relative to frame may be computed on
+ *  several threads at once, for instance by dividing a range of times
+ *  among threads. This requires every orbit, rotation model and frame
+ *  involved, including those of the sun used for the apparent magnitude
+ *  of a body, to be safe for concurrent evaluation.
+ */
+bool CanComputeStatesConcurrently(const Selection& sel,
+                                  const ObserverFrame& frame)
+{
+    if (!CanEvaluateConcurrently(sel) || !CanEvaluateConcurrently(frame.getFrame()))
+        return false;
+
+    if (sel.body() != NULL && sel.body()->getSystem() != NULL)
+    {
+        Star* sun = sel.body()->getSystem()->getStar();
+        if (sun != NULL && !CanEvaluateConcurrently(Selection(sun)))
+            return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,50 @@
+// objectstate.h
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#ifndef _CELENGINE_OBJECTSTATE_H_
+#define _CELENGINE_OBJECTSTATE_H_
+
+#include <celengine/selection.h>
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+class ObserverFrame;
+
+
+/*! The state of an object at one time, relative to an observer frame:
+ *  the position in kilometers and the velocity in kilometers per day,
+ *  both in frame coordinates, the orientation with respect to the frame,
+ *  and the apparent magnitude of the object as seen from the center of
+ *  the frame. The magnitude is UnknownMagnitude when it can't be computed,
+ *  e.g. for a body without a sun or an object at the center of the frame.
+ */
+class ObjectState
+{
+ public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    Eigen::Vector3d position;
+    Eigen::Vector3d velocity;
+    Eigen::Quaterniond orientation;
+    float appMag;
+
+    static const float UnknownMagnitude;
+};
+
+
+extern void ComputeObjectStates(const Selection& sel,
+                                const ObserverFrame& frame,
+                                const double* times,
+                                unsigned int count,
+                                ObjectState* states);
+
+extern bool CanComputeStatesConcurrently(const Selection& sel,
+                                         const ObserverFrame& frame);
+
+#endif // _CELENGINE_OBJECTSTATE_H_
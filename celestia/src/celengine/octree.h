@@ -15,9 +15,12 @@
 
 #include <Eigen/Core>
 #include <Eigen/Geometry>
+#include <celmath/mathlib.h>
 #include <celmath/plane.h>
 #include <celengine/observer.h>
 #include <vector>
+#include <algorithm>
+#include <cmath>
 
 // The DynamicOctree and StaticOctree template arguments are:
 // OBJ:  object hanging from the node,
@@ -46,8 +49,11 @@ struct OctreeLevelStatistics
 
 
 template <class OBJ, class PREC> class StaticOctree;
+template <class OBJ, class PREC> class OctreeBuilder;
 template <class OBJ, class PREC> class DynamicOctree
 {
+ friend class OctreeBuilder<OBJ, PREC>;
+
 public:
     typedef Eigen::Matrix<PREC, 3, 1> PointType;
 
@@ -126,12 +132,36 @@ template <class OBJ, class PREC> class StaticOctree
                              PREC                               boundingRadius,
                              PREC                               scale) const;
 
+    // This method searches the octree for the objects whose centers lie
+    // within maxDistance of obsPosition and within halfAngle radians of
+    // the unit vector axis as seen from obsPosition, and which are brighter
+    // than limitingFactor. A halfAngle of pi or more includes every
+    // direction. Unlike processVisibleObjects, every test is exact, so only
+    // objects meeting all three conditions are processed.
+    void processObjectsInCone(OctreeProcessor<OBJ, PREC>&       processor,
+                              const PointType&                  obsPosition,
+                              const PointType&                  axis,
+                              PREC                              halfAngle,
+                              PREC                              maxDistance,
+                              float                             limitingFactor,
+                              PREC                              scale) const;
+
     int countChildren() const;
     int countObjects()  const;
 
     void computeStatistics(std::vector<OctreeLevelStatistics>& stats, unsigned int level = 0);
 
- private:
+    // Node accessors; these are used to write an octree to a file and to
+    // restore a prebuilt octree without going through a DynamicOctree.
+    const PointType&    getCellCenter()      const;
+    float               getExclusionFactor() const;
+    const OBJ*          getFirstObject()     const;
+    unsigned int        getObjectCount()     const;
+    const StaticOctree* getChild(int)        const;
+    void                setChildren(StaticOctree** children);
+
+    // Distance from the center of a node to its corners, relative to the
+    // node's scale
     static const PREC SQRT3;
 
  private:
@@ -316,6 +346,26 @@ template <class OBJ, class PREC>
 const PREC StaticOctree<OBJ, PREC>::SQRT3 = (PREC) 1.732050807568877;
 
 
+// Return true if part of a sphere may lie within the cone of directions
+// within halfAngle of axis, as seen from position. The processObjectsInCone
+// specializations use this to cull whole nodes.
+template <class PREC>
+bool SphereIntersectsCone(const Eigen::Matrix<PREC, 3, 1>& center,
+                          PREC                             radius,
+                          const Eigen::Matrix<PREC, 3, 1>& position,
+                          const Eigen::Matrix<PREC, 3, 1>& axis,
+                          PREC                             halfAngle)
+{
+    Eigen::Matrix<PREC, 3, 1> v = center - position;
+    PREC distance = v.norm();
+    if (halfAngle >= (PREC) PI || distance <= radius)
+        return true;
+
+    PREC cosAngle = std::max((PREC) -1, std::min((PREC) 1, v.dot(axis) / distance));
+    return std::acos(cosAngle) <= halfAngle + std::asin(radius / distance);
+}
+
+
 template <class OBJ, class PREC>
 inline StaticOctree<OBJ, PREC>::StaticOctree(const Eigen::Matrix<PREC, 3, 1>& cellCenterPos,
                                              const float         exclusionFactor,
@@ -368,6 +418,51 @@ inline int StaticOctree<OBJ, PREC>::countObjects() const
 }
 
 
+template <class OBJ, class PREC>
+inline const typename StaticOctree<OBJ, PREC>::PointType& StaticOctree<OBJ, PREC>::getCellCenter() const
+{
+    return cellCenterPos;
+}
+
+
+template <class OBJ, class PREC>
+inline float StaticOctree<OBJ, PREC>::getExclusionFactor() const
+{
+    return exclusionFactor;
+}
+
+
+template <class OBJ, class PREC>
+inline const OBJ* StaticOctree<OBJ, PREC>::getFirstObject() const
+{
+    return _firstObject;
+}
+
+
+template <class OBJ, class PREC>
+inline unsigned int StaticOctree<OBJ, PREC>::getObjectCount() const
+{
+    return nObjects;
+}
+
+
+// Return the nth child of this node, or NULL if the node is a leaf.
+template <class OBJ, class PREC>
+inline const StaticOctree<OBJ, PREC>* StaticOctree<OBJ, PREC>::getChild(int n) const
+{
+    return _children != NULL ? _children[n] : NULL;
+}
+
+
+// Attach an array of eight child nodes allocated with new[]; the node takes
+// ownership of the array and the children.
+template <class OBJ, class PREC>
+inline void StaticOctree<OBJ, PREC>::setChildren(StaticOctree** children)
+{
+    _children = children;
+}
+
+
 template <class OBJ, class PREC>
 void StaticOctree<OBJ, PREC>::computeStatistics(std::vector<OctreeLevelStatistics>& stats, unsigned int level)
 {
@@ -0,0 +1,448 @@
+// octreebuilder.h
+//
+// Multithreaded construction of octrees.
+//
+// Copyright (C) 2009, Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#ifndef _CELENGINE_OCTREEBUILDER_H_
+#define _CELENGINE_OCTREEBUILDER_H_
+
+#include <celengine/octree.h>
+#include <celutil/workerpool.h>
+#include <algorithm>
+#include <vector>
+
+
+// OctreeBuilder inserts objects into a DynamicOctree and compiles it into a
+// StaticOctree using a pool of worker threads. The result is identical to
+// what is produced by calling DynamicOctree::insertObject for each object in
+// turn followed by DynamicOctree::rebuildAndSort--same node structure, same
+// object order--so the choice between the serial and parallel paths never
+// affects rendering.
+//
+// The tree is partitioned into independent subtrees. Objects are routed
+// down from the root a level at a time: a node is processed in sequence
+// until it splits, since the moment of splitting depends on how many objects
+// arrived before; after that, deciding whether an object stays in the node or
+// which child it belongs to is independent for each object, and is done in
+// parallel. Once a subtree has few enough objects, the rest of it is built
+// with the ordinary serial insertion on a worker thread.
+template <class OBJ, class PREC> class OctreeBuilder
+{
+ public:
+    typedef DynamicOctree<OBJ, PREC> DynamicNode;
+    typedef StaticOctree<OBJ, PREC>  StaticNode;
+    typedef std::vector<const OBJ*>  ObjectPtrList;
+
+    // If pool is NULL, the octree is built on the calling thread.
+    OctreeBuilder(WorkerPool* pool);
+    ~OctreeBuilder();
+
+    // Equivalent to calling root.insertObject(*objects[i], scale) for each
+    // object in order. The root node must be empty.
+    void insertObjects(DynamicNode& root, const ObjectPtrList& objects, PREC scale);
+
+    // Equivalent to root.rebuildAndSort(staticRoot, sortedObjects)
+    void rebuildAndSort(DynamicNode& root, StaticNode*& staticRoot, OBJ*& sortedObjects);
+
+ private:
+    // A subtree whose remaining objects haven't been inserted yet
+    struct Subtree
+    {
+        DynamicNode*  node;
+        ObjectPtrList objects;
+        PREC          scale;
+    };
+
+    // Below this many objects, subtrees are always built serially
+    static const unsigned int MIN_SUBTREE_OBJECTS = 4096;
+
+    void expand(Subtree* subtree, std::vector<Subtree*>& children);
+    void layout(DynamicNode* node, StaticNode*& staticNode, OBJ*& sortedObjects);
+    bool isSubtreeRoot(const DynamicNode* node) const;
+
+    static unsigned int countObjects(const DynamicNode* node);
+    static bool keepInNode(const DynamicNode* node, const OBJ& obj);
+    static int childIndex(DynamicNode* node, const OBJ& obj);
+
+    class ClassifyTask;
+    class InsertTask;
+    class CountTask;
+    class RebuildTask;
+
+    WorkerPool* pool;
+
+    // Roots of the subtrees built serially by worker threads, sorted by
+    // address; these are also the units of work for rebuildAndSort.
+    std::vector<DynamicNode*> subtreeRoots;
+    std::vector<unsigned int> subtreeObjectCounts;
+    std::vector<RebuildTask*> rebuildTasks;
+};
+
+
+// Sort a contiguous range of a node's objects into those that stay in the
+// node and those that go to each of its children.
+template <class OBJ, class PREC>
+class OctreeBuilder<OBJ, PREC>::ClassifyTask : public WorkerTask
+{
+ public:
+    ClassifyTask(DynamicNode* _node, const OBJ* const* _begin, const OBJ* const* _end) :
+        node(_node), begin(_begin), end(_end)
+    {
+    }
+
+    void run()
+    {
+        for (const OBJ* const* iter = begin; iter != end; ++iter)
+        {
+            const OBJ& obj = **iter;
+            if (keepInNode(node, obj))
+                kept.push_back(&obj);
+            else
+                childObjects[childIndex(node, obj)].push_back(&obj);
+        }
+    }
+
+    DynamicNode* node;
+    const OBJ* const* begin;
+    const OBJ* const* end;
+    ObjectPtrList kept;
+    ObjectPtrList childObjects[8];
+};
+
+
+template <class OBJ, class PREC>
+class OctreeBuilder<OBJ, PREC>::InsertTask : public WorkerTask
+{
+ public:
+    InsertTask(Subtree* _subtree) : subtree(_subtree) {}
+
+    void run()
+    {
+        for (typename ObjectPtrList::const_iterator iter = subtree->objects.begin();
+             iter != subtree->objects.end(); ++iter)
+        {
+            subtree->node->insertObject(**iter, subtree->scale);
+        }
+    }
+
+    Subtree* subtree;
+};
+
+
+template <class OBJ, class PREC>
+class OctreeBuilder<OBJ, PREC>::CountTask : public WorkerTask
+{
+ public:
+    CountTask(const DynamicNode* _node, unsigned int* _count) : node(_node), count(_count) {}
+
+    void run()
+    {
+        *count = countObjects(node);
+    }
+
+    const DynamicNode* node;
+    unsigned int* count;
+};
+
+
+template <class OBJ, class PREC>
+class OctreeBuilder<OBJ, PREC>::RebuildTask : public WorkerTask
+{
+ public:
+    RebuildTask(DynamicNode* _node, StaticNode** _staticNode, OBJ* _sortedObjects) :
+        node(_node), staticNode(_staticNode), sortedObjects(_sortedObjects)
+    {
+    }
+
+    void run()
+    {
+        node->rebuildAndSort(*staticNode, sortedObjects);
+    }
+
+    DynamicNode* node;
+    StaticNode** staticNode;
+    OBJ* sortedObjects;
+};
+
+
+// Sort subtrees by decreasing size so that the largest are started first
+template <class SUBTREE> struct SubtreeSizePredicate
+{
+    bool operator()(const SUBTREE* s0, const SUBTREE* s1) const
+    {
+        return s0->objects.size() > s1->objects.size();
+    }
+};
+
+
+template <class OBJ, class PREC>
+const unsigned int OctreeBuilder<OBJ, PREC>::MIN_SUBTREE_OBJECTS;
+
+
+template <class OBJ, class PREC>
+OctreeBuilder<OBJ, PREC>::OctreeBuilder(WorkerPool* _pool) :
+    pool(_pool)
+{
+}
+
+
+template <class OBJ, class PREC>
+OctreeBuilder<OBJ, PREC>::~OctreeBuilder()
+{
+}
+
+
+template <class OBJ, class PREC>
+void OctreeBuilder<OBJ, PREC>::insertObjects(DynamicNode& root, const ObjectPtrList& objects, PREC scale)
+{
+    subtreeRoots.clear();
+
+    unsigned int workerCount = pool == NULL ? 1 : pool->getThreadCount() + 1;
+    if (workerCount == 1 || objects.size() < MIN_SUBTREE_OBJECTS)
+    {
+        for (typename ObjectPtrList::const_iterator iter = objects.begin(); iter != objects.end(); ++iter)
+            root.insertObject(**iter, scale);
+        subtreeRoots.push_back(&root);
+        return;
+    }
+
+    // Split subtrees until there are enough pieces to keep all threads busy
+    unsigned int grain = std::max(MIN_SUBTREE_OBJECTS, (unsigned int) objects.size() / (workerCount * 8));
+
+    std::vector<Subtree*> pending;
+    std::vector<Subtree*> ready;
+
+    Subtree* rootSubtree = new Subtree();
+    rootSubtree->node = &root;
+    rootSubtree->objects = objects;
+    rootSubtree->scale = scale;
+    pending.push_back(rootSubtree);
+
+    while (!pending.empty())
+    {
+        Subtree* subtree = pending.back();
+        pending.pop_back();
+
+        if (subtree->objects.size() <= grain)
+        {
+            ready.push_back(subtree);
+        }
+        else
+        {
+            expand(subtree, pending);
+            delete subtree;
+        }
+    }
+
+    std::sort(ready.begin(), ready.end(), SubtreeSizePredicate<Subtree>());
+
+    std::vector<WorkerTask*> tasks;
+    for (typename std::vector<Subtree*>::const_iterator iter = ready.begin(); iter != ready.end(); ++iter)
+    {
+        tasks.push_back(new InsertTask(*iter));
+        subtreeRoots.push_back((*iter)->node);
+    }
+
+    pool->run(tasks);
+
+    for (unsigned int i = 0; i < tasks.size(); i++)
+    {
+        delete tasks[i];
+        delete ready[i];
+    }
+
+    std::sort(subtreeRoots.begin(), subtreeRoots.end());
+}
+
+
+// Insert the objects of a subtree into its root node, and create subtrees
+// for the node's children with the objects that should be inserted into
+// them. The children are appended to the children vector.
+template <class OBJ, class PREC>
+void OctreeBuilder<OBJ, PREC>::expand(Subtree* subtree, std::vector<Subtree*>& children)
+{
+    DynamicNode* node = subtree->node;
+    const ObjectPtrList& objects = subtree->objects;
+
+    // Until the node splits, it must be processed one object at a time;
+    // this is exactly the code path of DynamicOctree::insertObject.
+    unsigned int i = 0;
+    for (i = 0; i < objects.size() && node->_children == NULL; i++)
+    {
+        const OBJ& obj = *objects[i];
+        if (!keepInNode(node, obj))
+        {
+            if (node->_objects != NULL && node->_objects->size() >= DynamicNode::SPLIT_THRESHOLD)
+                node->split(subtree->scale * 0.5f);
+        }
+        node->add(obj);
+    }
+
+    if (i == objects.size())
+        return;
+
+    // The rest of the objects either stay in this node or are inserted into
+    // a child node; that decision is independent for every object.
+    unsigned int remaining = objects.size() - i;
+    unsigned int taskCount = std::min(pool->getThreadCount() + 1, remaining / 1024 + 1);
+    std::vector<WorkerTask*> tasks;
+    for (unsigned int task = 0; task < taskCount; task++)
+    {
+        unsigned int begin = i + (unsigned int) ((double) remaining * task / taskCount);
+        unsigned int end   = i + (unsigned int) ((double) remaining * (task + 1) / taskCount);
+        tasks.push_back(new ClassifyTask(node, &objects[0] + begin, &objects[0] + end));
+    }
+
+    pool->run(tasks);
+
+    Subtree* childSubtrees[8];
+    for (int child = 0; child < 8; child++)
+    {
+        childSubtrees[child] = new Subtree();
+        childSubtrees[child]->node = node->_children[child];
+        childSubtrees[child]->scale = subtree->scale * (PREC) 0.5;
+    }
+
+    for (unsigned int task = 0; task < taskCount; task++)
+    {
+        ClassifyTask* classify = static_cast<ClassifyTask*>(tasks[task]);
+        for (typename ObjectPtrList::const_iterator iter = classify->kept.begin(); iter != classify->kept.end(); ++iter)
+            node->add(**iter);
+        for (int child = 0; child < 8; child++)
+        {
+            childSubtrees[child]->objects.insert(childSubtrees[child]->objects.end(),
+                                                 classify->childObjects[child].begin(),
+                                                 classify->childObjects[child].end());
+        }
+        delete classify;
+    }
+
+    for (int child = 0; child < 8; child++)
+    {
+        if (childSubtrees[child]->objects.empty())
+            delete childSubtrees[child];
+        else
+            children.push_back(childSubtrees[child]);
+    }
+}
+
+
+template <class OBJ, class PREC>
+void OctreeBuilder<OBJ, PREC>::rebuildAndSort(DynamicNode& root, StaticNode*& staticRoot, OBJ*& sortedObjects)
+{
+    if (pool == NULL || subtreeRoots.size() <= 1)
+    {
+        root.rebuildAndSort(staticRoot, sortedObjects);
+        return;
+    }
+
+    // Count the objects in each subtree to find where its objects will be
+    // placed in the sorted array.
+    subtreeObjectCounts.resize(subtreeRoots.size());
+    std::vector<WorkerTask*> tasks;
+    for (unsigned int i = 0; i < subtreeRoots.size(); i++)
+        tasks.push_back(new CountTask(subtreeRoots[i], &subtreeObjectCounts[i]));
+    pool->run(tasks);
+    for (unsigned int i = 0; i < tasks.size(); i++)
+        delete tasks[i];
+
+    // Compile the nodes above the subtrees; this creates a rebuild task for
+    // every subtree.
+    layout(&root, staticRoot, sortedObjects);
+
+    tasks.clear();
+    tasks.insert(tasks.end(), rebuildTasks.begin(), rebuildTasks.end());
+    pool->run(tasks);
+    for (unsigned int i = 0; i < rebuildTasks.size(); i++)
+        delete rebuildTasks[i];
+    rebuildTasks.clear();
+}
+
+
+// Serial counterpart of DynamicOctree::rebuildAndSort for the nodes above
+// the subtree roots.
+template <class OBJ, class PREC>
+void OctreeBuilder<OBJ, PREC>::layout(DynamicNode* node, StaticNode*& staticNode, OBJ*& sortedObjects)
+{
+    if (isSubtreeRoot(node))
+    {
+        unsigned int index = std::lower_bound(subtreeRoots.begin(), subtreeRoots.end(), node) - subtreeRoots.begin();
+        rebuildTasks.push_back(new RebuildTask(node, &staticNode, sortedObjects));
+        sortedObjects += subtreeObjectCounts[index];
+        return;
+    }
+
+    OBJ* firstObject = sortedObjects;
+    if (node->_objects != NULL)
+    {
+        for (typename DynamicNode::ObjectList::const_iterator iter = node->_objects->begin();
+             iter != node->_objects->end(); ++iter)
+        {
+            *sortedObjects++ = **iter;
+        }
+    }
+
+    unsigned int nObjects = (unsigned int) (sortedObjects - firstObject);
+    staticNode = new StaticNode(node->cellCenterPos, node->exclusionFactor, firstObject, nObjects);
+
+    if (node->_children != NULL)
+    {
+        StaticNode** children = new StaticNode*[8];
+        for (int i = 0; i < 8; i++)
+            children[i] = NULL;
+        staticNode->setChildren(children);
+
+        for (int i = 0; i < 8; i++)
+            layout(node->_children[i], children[i], sortedObjects);
+    }
+}
+
+
+template <class OBJ, class PREC>
+bool OctreeBuilder<OBJ, PREC>::isSubtreeRoot(const DynamicNode* node) const
+{
+    return std::binary_search(subtreeRoots.begin(), subtreeRoots.end(), node);
+}
+
+
+template <class OBJ, class PREC>
+unsigned int OctreeBuilder<OBJ, PREC>::countObjects(const DynamicNode* node)
+{
+    unsigned int count = node->_objects != NULL ? node->_objects->size() : 0;
+    if (node->_children != NULL)
+    {
+        for (int i = 0; i < 8; i++)
+            count += countObjects(node->_children[i]);
+    }
+
+    return count;
+}
+
+
+// True if an object inserted into a node must be placed in the node itself
+// rather than in one of its children.
+template <class OBJ, class PREC>
+bool OctreeBuilder<OBJ, PREC>::keepInNode(const DynamicNode* node, const OBJ& obj)
+{
+    return DynamicNode::limitingFactorPredicate(obj, node->exclusionFactor) ||
+           DynamicNode::straddlingPredicate(node->cellCenterPos, obj, node->exclusionFactor);
+}
+
+
+template <class OBJ, class PREC>
+int OctreeBuilder<OBJ, PREC>::childIndex(DynamicNode* node, const OBJ& obj)
+{
+    DynamicNode* child = node->getChild(obj, node->cellCenterPos);
+    int i = 0;
+    while (node->_children[i] != child)
+        i++;
+    return i;
+}
+
+#endif // _CELENGINE_OCTREEBUILDER_H_
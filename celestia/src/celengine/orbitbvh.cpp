@@ -0,0 +1,334 @@
+// orbitbvh.cpp
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include <algorithm>
+#include <limits>
+#include "orbitbvh.h"
+#include "frametree.h"
+#include "timelinephase.h"
+#include "frame.h"
+#include "body.h"
+#include <celephem/orbit.h>
+#include <celephem/orbitbatch.h>
+
+using namespace Eigen;
+using namespace std;
+
+
+// A child of the frame tree along with the quantities used to compute
+// the bounds of the nodes that contain it
+struct OrbitBVH::Item
+{
+    unsigned int child;
+    Vector3d position;
+    double extent;
+    double speed;
+    double staticRadius;
+    float radius;
+    float cullingRadius;
+    int classMask;
+    bool secondaryIlluminator;
+};
+
+
+struct HasBoundedSpeedPredicate
+{
+    bool operator()(const OrbitBVH::Item& item) const;
+};
+
+
+struct AxisOrderPredicate
+{
+    AxisOrderPredicate(int _axis) : axis(_axis) {}
+
+    bool operator()(const OrbitBVH::Item& a, const OrbitBVH::Item& b) const;
+
+    int axis;
+};
+
+
+struct StaticRadiusOrderPredicate
+{
+    bool operator()(const OrbitBVH::Item& a, const OrbitBVH::Item& b) const;
+};
+
+
+bool
+HasBoundedSpeedPredicate::operator()(const OrbitBVH::Item& item) const
+{
+    return item.speed >= 0.0;
+}
+
+
+bool
+AxisOrderPredicate::operator()(const OrbitBVH::Item& a, const OrbitBVH::Item& b) const
+{
+    return a.position[axis] < b.position[axis];
+}
+
+
+bool
+StaticRadiusOrderPredicate::operator()(const OrbitBVH::Item& a, const OrbitBVH::Item& b) const
+{
+    return a.staticRadius < b.staticRadius;
+}
+
+
+// Positions can be extrapolated with a speed bound only in frames that
+// never rotate.
+static bool hasFixedOrientation(const ReferenceFrame* frame)
+{
+    return dynamic_cast<const J2000EclipticFrame*>(frame) != NULL ||
+           dynamic_cast<const J2000EquatorFrame*>(frame) != NULL;
+}
+
+
+/*! Build a hierarchy over the children of a frame tree, grouping them by
+ *  their positions at time tdb. The bounding spheres of the subtrees of
+ *  the children must be up to date.
+ */
+OrbitBVH::OrbitBVH(const FrameTree* _tree, double tdb) :
+    tree(_tree),
+    buildTime(tdb),
+    validInterval(numeric_limits<double>::infinity())
+{
+    unsigned int nChildren = tree->childCount();
+    const Vector3d* positions = tree->getChildPositions(tdb);
+
+    vector<Item> items(nChildren);
+    for (unsigned int i = 0; i < nChildren; i++)
+    {
+        const TimelinePhase* phase = tree->getChild(i);
+        const Body* body = phase->body();
+
+        Item& item = items[i];
+        item.child = i;
+        item.position = Vector3d::Zero();
+        item.extent = body->getCullingRadius();
+        item.radius = body->getRadius();
+        item.cullingRadius = body->getCullingRadius();
+        item.classMask = body->getOrbitClassification();
+        item.secondaryIlluminator = body->isSecondaryIlluminator();
+
+        const FrameTree* subtree = body->getFrameTree();
+        if (subtree != NULL)
+        {
+            item.extent += subtree->boundingSphereRadius();
+            item.radius = max(item.radius, (float) subtree->maxChildRadius());
+            item.cullingRadius = max(item.cullingRadius, (float) subtree->maxChildRadius());
+            item.secondaryIlluminator = item.secondaryIlluminator || subtree->containsSecondaryIlluminators();
+        }
+
+        // The bounding radius of an open orbit is meaningless
+        double orbitRadius = phase->orbit()->getBoundingRadius();
+        if (orbitRadius >= 0.0)
+            item.staticRadius = orbitRadius + item.extent;
+        else
+            item.staticRadius = numeric_limits<double>::infinity();
+
+        item.speed = -1.0;
+        if (phase->includes(tdb) && hasFixedOrientation(phase->orbitFrame()))
+        {
+            item.speed = phase->orbit()->getMaximumSpeed();
+            item.position = phase->orbitFrame()->getOrientation(tdb).conjugate() * positions[i];
+        }
+    }
+
+    slotChildren.resize(nChildren);
+    childLeaves.resize(nChildren);
+    batched.resize(nChildren);
+
+    // Children with a speed bound are grouped spatially; the rest can only
+    // be grouped by the sizes of their orbits.
+    unsigned int nBounded = partition(items.begin(), items.end(), HasBoundedSpeedPredicate()) - items.begin();
+    if (nBounded == 0 || nBounded == nChildren)
+    {
+        buildNode(items, 0, nChildren, nBounded != 0);
+    }
+    else
+    {
+        nodes.push_back(Node());
+        unsigned int left = buildNode(items, 0, nBounded, true);
+        unsigned int right = buildNode(items, nBounded, nChildren - nBounded, false);
+
+        const Node& a = nodes[left];
+        const Node& b = nodes[right];
+        Node root;
+        root.staticRadius = max(a.staticRadius, b.staticRadius);
+        root.center = Vector3d::Zero();
+        root.radius = root.staticRadius;
+        root.maxSpeed = -1.0;
+        root.maxRadius = max(a.maxRadius, b.maxRadius);
+        root.maxCullingRadius = max(a.maxCullingRadius, b.maxCullingRadius);
+        root.classMask = a.classMask | b.classMask;
+        root.containsSecondaryIlluminators = a.containsSecondaryIlluminators || b.containsSecondaryIlluminators;
+        root.first = 0;
+        root.count = nChildren;
+        root.left = left;
+        root.right = right;
+        root.batch = NULL;
+        nodes[0] = root;
+    }
+
+    // The hierarchy is rebuilt once the time-dependent bounds of the leaves
+    // have grown to about twice their original size on average.
+    double radiusSum = 0.0;
+    double speedSum = 0.0;
+    for (vector<Node>::const_iterator iter = nodes.begin(); iter != nodes.end(); iter++)
+    {
+        if (iter->isLeaf() && iter->maxSpeed >= 0.0)
+        {
+            radiusSum += iter->radius;
+            speedSum += iter->maxSpeed;
+        }
+    }
+
+    if (speedSum > 0.0)
+        validInterval = radiusSum / speedSum;
+}
+
+
+OrbitBVH::~OrbitBVH()
+{
+    for (vector<Node>::iterator iter = nodes.begin(); iter != nodes.end(); iter++)
+        delete iter->batch;
+}
+
+
+/*! Get a sphere containing every child in a node, along with the bodies
+ *  in their subtrees, at time tdb.
+ */
+Sphered
+OrbitBVH::getBounds(unsigned int n, double tdb) const
+{
+    const Node& node = nodes[n];
+    if (node.maxSpeed >= 0.0)
+    {
+        double radius = node.radius + node.maxSpeed * abs(tdb - buildTime);
+        if (radius < node.staticRadius)
+            return Sphered(node.center, radius);
+    }
+
+    return Sphered(Vector3d::Zero(), node.staticRadius);
+}
+
+
+/*! Compute the positions of the children in a leaf node at time tdb, each
+ *  in the frame of its own orbit. The position of the child in slot
+ *  node.first + i is stored at index i of the table. Only the positions of
+ *  children whose phases include tdb are valid.
+ */
+void
+OrbitBVH::computeLeafPositions(unsigned int n, double tdb, Vector3d* positions) const
+{
+    const Node& node = nodes[n];
+
+    node.batch->computePositions(tdb, positions);
+    for (unsigned int i = 0; i < node.count; i++)
+    {
+        if (!batched[node.first + i])
+        {
+            const TimelinePhase* phase = tree->getChild(slotChildren[node.first + i]);
+            if (phase->includes(tdb))
+                positions[i] = phase->orbit()->positionAtTime(tdb);
+        }
+    }
+}
+
+
+unsigned int
+OrbitBVH::buildNode(vector<Item>& items,
+                    unsigned int first,
+                    unsigned int count,
+                    bool spatial)
+{
+    unsigned int index = nodes.size();
+    nodes.push_back(Node());
+
+    Node node;
+    node.staticRadius = 0.0;
+    node.maxSpeed = spatial ? 0.0 : -1.0;
+    node.maxRadius = 0.0f;
+    node.maxCullingRadius = 0.0f;
+    node.classMask = 0;
+    node.containsSecondaryIlluminators = false;
+    node.first = first;
+    node.count = count;
+    node.left = 0;
+    node.right = 0;
+    node.batch = NULL;
+
+    Vector3d lower = items[first].position;
+    Vector3d upper = items[first].position;
+    for (unsigned int i = first; i < first + count; i++)
+    {
+        const Item& item = items[i];
+        node.staticRadius = max(node.staticRadius, item.staticRadius);
+        node.maxRadius = max(node.maxRadius, item.radius);
+        node.maxCullingRadius = max(node.maxCullingRadius, item.cullingRadius);
+        node.classMask |= item.classMask;
+        node.containsSecondaryIlluminators = node.containsSecondaryIlluminators || item.secondaryIlluminator;
+        if (spatial)
+        {
+            node.maxSpeed = max(node.maxSpeed, item.speed);
+            lower = lower.cwise().min(item.position);
+            upper = upper.cwise().max(item.position);
+        }
+    }
+
+    if (spatial)
+    {
+        node.center = (lower + upper) * 0.5;
+        node.radius = 0.0;
+        for (unsigned int i = first; i < first + count; i++)
+            node.radius = max(node.radius, (items[i].position - node.center).norm() + items[i].extent);
+    }
+    else
+    {
+        node.center = Vector3d::Zero();
+        node.radius = node.staticRadius;
+    }
+
+    if (count > MaxLeafSize)
+    {
+        // Split at the median along the longest axis of the box, or
+        // at the median orbit size.
+        vector<Item>::iterator begin = items.begin() + first;
+        vector<Item>::iterator middle = begin + count / 2;
+        vector<Item>::iterator end = begin + count;
+        if (spatial)
+        {
+            int axis = 0;
+            (upper - lower).maxCoeff(&axis);
+            nth_element(begin, middle, end, AxisOrderPredicate(axis));
+        }
+        else
+        {
+            nth_element(begin, middle, end, StaticRadiusOrderPredicate());
+        }
+
+        node.left = buildNode(items, first, count / 2, spatial);
+        node.right = buildNode(items, first + count / 2, count - count / 2, spatial);
+    }
+    else
+    {
+        node.batch = new OrbitBatch();
+        for (unsigned int i = 0; i < count; i++)
+        {
+            unsigned int child = items[first + i].child;
+            slotChildren[first + i] = child;
+            childLeaves[child] = index;
+            batched[first + i] = tree->getChild(child)->orbit()->addToBatch(*node.batch, i);
+        }
+    }
+
+    nodes[index] = node;
+
+    return index;
+}
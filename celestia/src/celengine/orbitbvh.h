@@ -0,0 +1,143 @@
+// orbitbvh.h
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#ifndef _CELENGINE_ORBITBVH_H_
+#define _CELENGINE_ORBITBVH_H_
+
+#include <vector>
+#include <cmath>
+#include <celmath/sphere.h>
+#include <Eigen/Core>
+
+class FrameTree;
+class OrbitBatch;
+
+
+/*! An OrbitBVH is a bounding volume hierarchy over the children of a frame
+ *  tree with many children, such as a star orbited by a large population of
+ *  asteroids. It lets the renderer reject whole groups of children that are
+ *  outside the view or too small and faint to see without computing any of
+ *  their positions.
+ *
+ *  The children are grouped by their positions at the time the hierarchy
+ *  is built. Since the children move, the bounding sphere of a group grows
+ *  with the time elapsed since then, at the greatest speed of any child in
+ *  the group. Every group also has a fixed bound, a sphere centered on the
+ *  tree center containing the orbits of all children in the group; the
+ *  smaller of the two spheres is used. Children whose speed can't be
+ *  bounded are kept in separate groups, sorted by the sizes of their orbits.
+ *
+ *  All bounds are relative to the center of the frame tree, with the axes
+ *  of the astrocentric ecliptic frame.
+ */
+class OrbitBVH
+{
+ public:
+    OrbitBVH(const FrameTree* tree, double tdb);
+    ~OrbitBVH();
+
+    struct Node
+    {
+        // Bounding sphere at the build time, and the greatest speed of any
+        // child in the node (negative if the node contains children whose
+        // speed has no known bound.)
+        Eigen::Vector3d center;
+        double radius;
+        double maxSpeed;
+
+        // Radius of a sphere centered on the tree center that contains
+        // the node at all times.
+        double staticRadius;
+
+        // Largest body radius and culling radius in the node, including
+        // bodies in the subtrees of the children
+        float maxRadius;
+        float maxCullingRadius;
+
+        // Orbit classifications of the children in the node
+        int classMask;
+        bool containsSecondaryIlluminators;
+
+        // Range of slots occupied by the children of the node
+        unsigned int first;
+        unsigned int count;
+
+        // Indices of the two child nodes; both are zero for a leaf.
+        unsigned int left;
+        unsigned int right;
+
+        OrbitBatch* batch;
+
+        bool isLeaf() const
+        {
+            return left == 0;
+        }
+    };
+
+    /*! Return true if the hierarchy is still worth using at time tdb; if
+     *  not, the groups have grown loose enough that it should be rebuilt.
+     *  The bounds are correct at any time.
+     */
+    bool isCurrent(double tdb) const
+    {
+        return std::abs(tdb - buildTime) <= validInterval;
+    }
+
+    unsigned int nodeCount() const
+    {
+        return nodes.size();
+    }
+
+    /*! Get a node; node zero is the root of the hierarchy. */
+    const Node& getNode(unsigned int n) const
+    {
+        return nodes[n];
+    }
+
+    /*! Get the frame tree child index of the child in the given slot. */
+    unsigned int getChild(unsigned int slot) const
+    {
+        return slotChildren[slot];
+    }
+
+    /*! Get the leaf node that contains the given frame tree child. */
+    unsigned int getLeaf(unsigned int child) const
+    {
+        return childLeaves[child];
+    }
+
+    Sphered getBounds(unsigned int node, double tdb) const;
+    void computeLeafPositions(unsigned int node, double tdb, Eigen::Vector3d* positions) const;
+
+    // Frame trees with fewer children than this are not worth grouping.
+    static const unsigned int MinChildren = 128;
+
+    // Largest number of children in a leaf node
+    static const unsigned int MaxLeafSize = 32;
+
+    // A child being placed in the hierarchy
+    struct Item;
+
+ private:
+
+    unsigned int buildNode(std::vector<Item>& items,
+                           unsigned int first,
+                           unsigned int count,
+                           bool spatial);
+
+    const FrameTree* tree;
+    std::vector<Node> nodes;
+    std::vector<unsigned int> slotChildren;
+    std::vector<unsigned int> childLeaves;
+    std::vector<bool> batched;
+    double buildTime;
+    double validInterval;
+};
+
+#endif // _CELENGINE_ORBITBVH_H_
@@ -0,0 +1,250 @@
+// orbitpathcache.cpp
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include <algorithm>
+#include "orbitpathcache.h"
+#include <celutil/workerpool.h>
+
+using namespace std;
+
+
+// Tolerance of the first sampling of a path, relative to the bounding
+// radius of the orbit
+static const double InitialRelativeTolerance = 1.0e-3;
+
+// Each refinement reduces the tolerance by a power of this factor, so that
+// small changes of the requested tolerance don't cause a path to be sampled
+// again.
+static const double RefinementFactor = 4.0;
+
+// Limit on the number of refinements of the initial tolerance; the finest
+// tolerance is about a millionth of the bounding radius.
+static const unsigned int MaxRefinements = 5;
+
+// Paths are never sampled more finely than this, in kilometers.
+static const double MinTolerance = 0.001;
+
+// Unused paths are only discarded when there are more than this many...
+static const unsigned int CacheCullThreshold = 200;
+
+// ...and then only if they haven't been used in this many frames.
+static const uint32 CacheRetireAge = 16;
+
+
+class OrbitPathCache::SampleTask : public WorkerTask
+{
+ public:
+    SampleTask(const Orbit* _orbit,
+               double _startTime,
+               double _endTime,
+               double _tolerance,
+               Mutex& _mutex) :
+        orbit(_orbit),
+        startTime(_startTime),
+        endTime(_endTime),
+        tolerance(_tolerance),
+        mutex(_mutex),
+        finished(false)
+    {
+    }
+
+    void run()
+    {
+        OrbitPathSampler sampledPath;
+        orbit->sample(startTime, endTime, tolerance, sampledPath);
+
+        MutexLock lock(mutex);
+        sampler.samples.swap(sampledPath.samples);
+        finished = true;
+    }
+
+    bool isFinished() const
+    {
+        MutexLock lock(mutex);
+        return finished;
+    }
+
+    const Orbit* orbit;
+    double startTime;
+    double endTime;
+    double tolerance;
+    OrbitPathSampler sampler;
+
+ private:
+    Mutex& mutex;
+    bool finished;
+};
+
+
+// A single thread is enough to keep up with refinement. A pool without
+// threads isn't used even on a single processor system, since it would run
+// the tasks on the renderer's thread.
+OrbitPathCache::OrbitPathCache() :
+    pool(new WorkerPool(1)),
+    lastRetireFrame(0),
+    lastRefineFrame(0)
+{
+}
+
+
+OrbitPathCache::~OrbitPathCache()
+{
+    // Wait for the running refinement before deleting the tasks
+    delete pool;
+
+    for (EntryMap::iterator iter = entries.begin(); iter != entries.end(); ++iter)
+    {
+        delete iter->second.task;
+        delete iter->second.path;
+    }
+}
+
+
+/*! Return the path of an orbit, sampling it over the time range
+ *  [ startTime, endTime ] if it isn't already in the cache; an existing
+ *  path may cover a different range. The path is refined toward the
+ *  requested tolerance, and pathTolerance is set to the tolerance of the
+ *  path returned, which should be used to extend it.
+ */
+CurvePlot* OrbitPathCache::getPath(const Orbit* orbit,
+                                   double startTime,
+                                   double endTime,
+                                   double tolerance,
+                                   uint32 frame,
+                                   double& pathTolerance)
+{
+    // Quantize the requested tolerance to one of the refinement levels
+    double initialTolerance = max(orbit->getBoundingRadius() * InitialRelativeTolerance, MinTolerance);
+    double wantedTolerance = initialTolerance;
+    for (unsigned int i = 0; i < MaxRefinements && wantedTolerance > tolerance; i++)
+        wantedTolerance /= RefinementFactor;
+    wantedTolerance = max(wantedTolerance, MinTolerance);
+
+    EntryMap::iterator iter = entries.find(orbit);
+    if (iter == entries.end())
+    {
+        if (entries.size() > CacheCullThreshold)
+            retireUnused(frame);
+
+        OrbitPathSampler sampler;
+        orbit->sample(startTime, endTime, initialTolerance, sampler);
+
+        Entry entry;
+        entry.path = new CurvePlot();
+        entry.tolerance = initialTolerance;
+        entry.task = NULL;
+        sampler.insertForward(entry.path);
+
+        iter = entries.insert(EntryMap::value_type(orbit, entry)).first;
+
+        // Paths that must be refined on this thread aren't refined in the
+        // frame in which they first appear.
+        if (!orbit->canSampleConcurrently())
+            lastRefineFrame = frame;
+    }
+
+    Entry& entry = iter->second;
+    entry.path->setLastUsed(frame);
+
+    // Replace the path with a refined one once it's ready
+    if (entry.task != NULL && entry.task->isFinished())
+    {
+        CurvePlot* path = new CurvePlot();
+        path->setLastUsed(frame);
+        entry.task->sampler.insertForward(path);
+
+        delete entry.path;
+        entry.path = path;
+        entry.tolerance = entry.task->tolerance;
+        delete entry.task;
+        entry.task = NULL;
+    }
+
+    if (wantedTolerance < entry.tolerance && entry.task == NULL && !entry.path->empty())
+        refine(orbit, entry, wantedTolerance, frame);
+
+    pathTolerance = entry.tolerance;
+
+    return entry.path;
+}
+
+
+// Sample a path again over the range that it currently covers
+void OrbitPathCache::refine(const Orbit* orbit, Entry& entry, double tolerance, uint32 frame)
+{
+    double startTime = entry.path->startTime();
+    double endTime = entry.path->endTime();
+
+    if (orbit->canSampleConcurrently())
+    {
+        entry.task = new SampleTask(orbit, startTime, endTime, tolerance, mutex);
+        pool->submit(entry.task);
+    }
+    else if (lastRefineFrame != frame)
+    {
+        lastRefineFrame = frame;
+
+        OrbitPathSampler sampler;
+        orbit->sample(startTime, endTime, tolerance, sampler);
+
+        CurvePlot* path = new CurvePlot();
+        path->setLastUsed(frame);
+        sampler.insertForward(path);
+
+        delete entry.path;
+        entry.path = path;
+        entry.tolerance = tolerance;
+    }
+}
+
+
+// Discard paths that haven't been used recently, checking at most once per
+// frame. Paths that are still being refined are kept until the refinement
+// finishes.
+void OrbitPathCache::retireUnused(uint32 frame)
+{
+    if (lastRetireFrame == frame)
+        return;
+    lastRetireFrame = frame;
+
+    for (EntryMap::iterator iter = entries.begin(); iter != entries.end();)
+    {
+        Entry& entry = iter->second;
+        if (frame - entry.path->lastUsed() > CacheRetireAge &&
+            (entry.task == NULL || entry.task->isFinished()))
+        {
+            delete entry.task;
+            delete entry.path;
+            entries.erase(iter++);
+        }
+        else
+        {
+            ++iter;
+        }
+    }
+}
+
+
+/*! Discard all paths. Refinements in progress are abandoned, waiting for
+ *  any that is currently running to finish, so the orbits may be deleted
+ *  afterward.
+ */
+void OrbitPathCache::clear()
+{
+    // Deleting the pool discards queued tasks and waits for the running one
+    delete pool;
+    pool = new WorkerPool(1);
+
+    for (EntryMap::iterator iter = entries.begin(); iter != entries.end(); ++iter)
+    {
+        delete iter->second.task;
+        delete iter->second.path;
+    }
+    entries.clear();
+}
@@ -0,0 +1,106 @@
+// orbitpathcache.h
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#ifndef _CELENGINE_ORBITPATHCACHE_H_
+#define _CELENGINE_ORBITPATHCACHE_H_
+
+#include <map>
+#include <vector>
+#include <celutil/basictypes.h>
+#include <celutil/thread.h>
+#include <celephem/orbit.h>
+#include <curveplot.h>
+
+class WorkerPool;
+
+
+/*! Collects the samples of an orbit, to be added to a path at either end.
+ */
+class OrbitPathSampler : public OrbitSampleProc
+{
+ public:
+    std::vector<CurvePlotSample> samples;
+
+    void sample(double t, const Eigen::Vector3d& position, const Eigen::Vector3d& velocity)
+    {
+        CurvePlotSample samp;
+        samp.t = t;
+        samp.position = position;
+        samp.velocity = velocity;
+        samples.push_back(samp);
+    }
+
+    void insertForward(CurvePlot* plot) const
+    {
+        for (std::vector<CurvePlotSample>::const_iterator iter = samples.begin(); iter != samples.end(); ++iter)
+            plot->addSample(*iter);
+    }
+
+    void insertBackward(CurvePlot* plot) const
+    {
+        for (std::vector<CurvePlotSample>::const_reverse_iterator iter = samples.rbegin(); iter != samples.rend(); ++iter)
+            plot->addSample(*iter);
+    }
+};
+
+
+/*! An OrbitPathCache keeps the sampled paths that the renderer draws for
+ *  orbits. Paths are sampled to a tolerance, the largest distance between
+ *  the drawn curve and the orbit, which the renderer chooses so that the
+ *  error is small on screen.
+ *
+ *  A path is first sampled coarsely, so that it can be drawn at once, and
+ *  is then refined whenever a finer tolerance is requested. Orbits that can
+ *  be sampled concurrently are refined on a background thread, and the
+ *  refined path replaces the old one once it's complete; the old one is
+ *  drawn in the meantime. Other orbits are refined on the calling thread,
+ *  but no more than one per frame, so that the paths of many orbits coming
+ *  into view at once are refined over several frames.
+ *
+ *  Paths unused for several frames are discarded when the cache grows
+ *  large. All orbits in the cache must remain valid until the cache is
+ *  cleared or destroyed.
+ */
+class OrbitPathCache
+{
+ public:
+    OrbitPathCache();
+    ~OrbitPathCache();
+
+    CurvePlot* getPath(const Orbit* orbit,
+                       double startTime,
+                       double endTime,
+                       double tolerance,
+                       uint32 frame,
+                       double& pathTolerance);
+    void clear();
+
+ private:
+    class SampleTask;
+
+    struct Entry
+    {
+        CurvePlot* path;
+        double tolerance;
+        SampleTask* task;
+    };
+
+    typedef std::map<const Orbit*, Entry> EntryMap;
+
+    void refine(const Orbit* orbit, Entry& entry, double tolerance, uint32 frame);
+    void retireUnused(uint32 frame);
+
+    EntryMap entries;
+    WorkerPool* pool;
+    Mutex mutex;
+    uint32 lastRetireFrame;
+    uint32 lastRefineFrame;
+};
+
+#endif // _CELENGINE_ORBITPATHCACHE_H_
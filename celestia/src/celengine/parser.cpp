@@ -8,12 +8,69 @@
 // as published by the Free Software Foundation; either version 2
 // of the License, or (at your option) any later version.
 
+#include <algorithm>
+#include <cstring>
 #include "parser.h"
 #include "astro.h"
+#include <celutil/memorypool.h>
 
 using namespace Eigen;
 
 
+// Values and hashes read by the parser are allocated from a pool owned by
+// the root value of each tree. Every node is preceded by a header recording
+// where its memory came from, so that the delete operator can tell pooled
+// nodes from ones allocated on the heap.
+struct NodeHeader
+{
+    MemoryPool* pool;
+    bool inPool;
+    bool ownsPool;
+};
+
+// Header size, padded to keep the node itself aligned
+static const size_t NodeHeaderSize = 16;
+
+static const unsigned int PoolAlignment = 8;
+static const unsigned int PoolBlockSize = 1024;
+
+
+static void* allocateNode(size_t size, MemoryPool* pool, bool ownsPool)
+{
+    char* memory = NULL;
+    if (pool != NULL)
+        memory = static_cast<char*>(pool->allocate(size + NodeHeaderSize));
+
+    bool inPool = memory != NULL;
+    if (!inPool)
+        memory = static_cast<char*>(::operator new(size + NodeHeaderSize));
+
+    NodeHeader* header = reinterpret_cast<NodeHeader*>(memory);
+    header->pool = pool;
+    header->inPool = inPool;
+    header->ownsPool = ownsPool;
+
+    return memory + NodeHeaderSize;
+}
+
+
+static void freeNode(void* p)
+{
+    if (p == NULL)
+        return;
+
+    char* memory = static_cast<char*>(p) - NodeHeaderSize;
+    NodeHeader* header = reinterpret_cast<NodeHeader*>(memory);
+
+    // Pooled nodes are released along with the rest of the pool when the
+    // owner of the pool is deleted.
+    MemoryPool* pool = header->ownsPool ? header->pool : NULL;
+    if (!header->inPool)
+        ::operator delete(memory);
+    delete pool;
+}
+
+
 /****** Value method implementations *******/
 
 Value::Value(double d)
@@ -22,7 +79,7 @@ Value::Value(double d)
     data.d = d;
 }
 
-Value::Value(string s)
+Value::Value(const string& s)
 {
     type = StringType;
     data.s = new string(s);
@@ -89,7 +146,7 @@ double Value::getNumber() const
     return data.d;
 }
 
-string Value::getString() const
+const string& Value::getString() const
 {
     // ASSERT(type == StringType);
     return *data.s;
@@ -113,11 +170,32 @@ bool Value::getBoolean() const
     return (data.d != 0.0);
 }
 
+void* Value::operator new(size_t size)
+{
+    return allocateNode(size, NULL, false);
+}
+
+void* Value::operator new(size_t size, MemoryPool* pool, bool ownsPool)
+{
+    return allocateNode(size, pool, ownsPool);
+}
+
+void Value::operator delete(void* p)
+{
+    freeNode(p);
+}
+
+void Value::operator delete(void* p, MemoryPool*, bool)
+{
+    freeNode(p);
+}
+
 
 /****** Parser method implementation ******/
 
 Parser::Parser(Tokenizer* _tokenizer) :
-    tokenizer(_tokenizer)
+    tokenizer(_tokenizer),
+    pool(NULL)
 {
 }
 
@@ -161,7 +239,7 @@ Hash* Parser::readHash()
         return NULL;
     }
 
-    Hash* hash = new Hash();
+    Hash* hash = new (pool, false) Hash();
 
     tok = tokenizer->nextToken();
     while (tok != Tokenizer::TokenEndGroup)
@@ -222,8 +300,8 @@ bool Parser::readUnits(const string& propertyName, Hash* hash)
             return false;
         }
        
-        string unit = tokenizer->getNameValue();
-        Value* value = new Value(unit);
+        const string& unit = tokenizer->getNameValue();
+        Value* value = new (pool, false) Value(unit);
         
         if (astro::isLengthUnit(unit))
         {
@@ -256,54 +334,480 @@ bool Parser::readUnits(const string& propertyName, Hash* hash)
 Value* Parser::readValue()
 {
     Tokenizer::TokenType tok = tokenizer->nextToken();
+
+    // A tokenizer replaying a parsed catalog has the value already
+    Value* value = tokenizer->takeParsedValue();
+    if (value != NULL)
+        return value;
+
+    // The first value read becomes the root of a new tree, and the owner of
+    // the pool that the rest of the tree is allocated from.
+    bool isRoot = (pool == NULL);
+    if (isRoot)
+        pool = new MemoryPool(PoolAlignment, PoolBlockSize);
+
     switch (tok)
     {
     case Tokenizer::TokenNumber:
-        return new Value(tokenizer->getNumberValue());
+        value = new (pool, isRoot) Value(tokenizer->getNumberValue());
+        break;
 
     case Tokenizer::TokenString:
-        return new Value(tokenizer->getStringValue());
+        value = new (pool, isRoot) Value(tokenizer->getStringValue());
+        break;
 
     case Tokenizer::TokenName:
         if (tokenizer->getNameValue() == "false")
-            return new Value(false);
+            value = new (pool, isRoot) Value(false);
         else if (tokenizer->getNameValue() == "true")
-            return new Value(true);
+            value = new (pool, isRoot) Value(true);
         else
-        {
             tokenizer->pushBack();
-            return NULL;
-        }
+        break;
 
     case Tokenizer::TokenBeginArray:
         tokenizer->pushBack();
         {
             Array* array = readArray();
-            if (array == NULL)
-                return NULL;
-            else
-                return new Value(array);
+            if (array != NULL)
+                value = new (pool, isRoot) Value(array);
         }
+        break;
 
     case Tokenizer::TokenBeginGroup:
         tokenizer->pushBack();
         {
             Hash* hash = readHash();
-            if (hash == NULL)
-                return NULL;
-            else
-                return new Value(hash);
+            if (hash != NULL)
+                value = new (pool, isRoot) Value(hash);
         }
+        break;
 
     default:
         tokenizer->pushBack();
+        break;
+    }
+
+    if (isRoot)
+    {
+        // Without a root, nothing else refers to the pool
+        if (value == NULL)
+            delete pool;
+        pool = NULL;
+    }
+
+    return value;
+}
+
+
+/****** ParsedCatalog method implementations ******/
+
+ParsedCatalog::ParsedCatalog()
+{
+}
+
+
+ParsedCatalog::~ParsedCatalog()
+{
+    for (vector<Item>::iterator iter = items.begin(); iter != items.end(); iter++)
+        delete iter->value;
+}
+
+
+/*! Read every token from the tokenizer, parsing each top level array or
+ *  property list. Reading stops after the first error, which the catalog
+ *  loaders then encounter when the catalog is replayed.
+ */
+void ParsedCatalog::read(Tokenizer& tokenizer)
+{
+    Parser parser(&tokenizer);
+
+    for (;;)
+    {
+        Tokenizer::TokenType tok = tokenizer.nextToken();
+        if (tok == Tokenizer::TokenEnd)
+            break;
+
+        Item item;
+        item.type = tok;
+        item.lineNumber = tokenizer.getLineNumber();
+        item.number = 0.0;
+        item.textStart = text.size();
+        item.textLength = 0;
+        item.value = NULL;
+
+        if (tok == Tokenizer::TokenNumber)
+        {
+            item.number = tokenizer.getNumberValue();
+        }
+        else if (tok == Tokenizer::TokenName || tok == Tokenizer::TokenString)
+        {
+            const string& tokenText = tok == Tokenizer::TokenName ? tokenizer.getNameValue() : tokenizer.getStringValue();
+            text += tokenText;
+            item.textLength = tokenText.size();
+        }
+        else if (tok == Tokenizer::TokenBeginGroup || tok == Tokenizer::TokenBeginArray)
+        {
+            tokenizer.pushBack();
+            item.value = parser.readValue();
+            if (item.value == NULL)
+                tok = Tokenizer::TokenError;
+        }
+
+        items.push_back(item);
+
+        if (tok == Tokenizer::TokenError)
+            break;
+    }
+}
+
+
+// The binary form of a catalog is a count of items followed by the items.
+// Each item is its token type and line number, and then the number, the
+// text of a name or string, or a flag and the value of an array or property
+// list. Values are their type followed by their data: a count and elements
+// for arrays, and a count and key/value pairs for property lists. Strings
+// are a length followed by the characters.
+
+// Bound on the nesting of values read from binary catalogs, so that bad
+// data can't exhaust the stack
+static const unsigned int MaxBinaryValueDepth = 64;
+
+template <class T> static void writeBinary(ostream& out, T t)
+{
+    out.write(reinterpret_cast<const char*>(&t), sizeof t);
+}
+
+static void writeBinaryString(ostream& out, const char* s, unsigned int length)
+{
+    writeBinary(out, (uint32) length);
+    out.write(s, length);
+}
+
+static void writeBinaryValue(ostream& out, const Value* value)
+{
+    writeBinary(out, (uint8) value->getType());
+
+    switch (value->getType())
+    {
+    case Value::NumberType:
+        writeBinary(out, value->getNumber());
+        break;
+
+    case Value::StringType:
+        writeBinaryString(out, value->getString().data(), value->getString().length());
+        break;
+
+    case Value::BooleanType:
+        writeBinary(out, (uint8) (value->getBoolean() ? 1 : 0));
+        break;
+
+    case Value::ArrayType:
+        {
+            const Array* array = value->getArray();
+            writeBinary(out, (uint32) array->size());
+            for (Array::const_iterator iter = array->begin(); iter != array->end(); iter++)
+                writeBinaryValue(out, *iter);
+        }
+        break;
+
+    case Value::HashType:
+        {
+            Hash* hash = value->getHash();
+            writeBinary(out, (uint32) (hash->end() - hash->begin()));
+            for (HashIterator iter = hash->begin(); iter != hash->end(); iter++)
+            {
+                writeBinaryString(out, iter->first.data(), iter->first.length());
+                writeBinaryValue(out, iter->second);
+            }
+        }
+        break;
+    }
+}
+
+
+// Reads the data of a binary catalog, checking that it isn't truncated
+class BinaryCatalogReader
+{
+ public:
+    BinaryCatalogReader(const char* _data, const char* _end) :
+        data(_data),
+        end(_end)
+    {
+    }
+
+    template <class T> bool read(T& t)
+    {
+        if ((size_t) (end - data) < sizeof t)
+            return false;
+        memcpy(&t, data, sizeof t);
+        data += sizeof t;
+        return true;
+    }
+
+    bool readString(const char*& s, uint32& length)
+    {
+        if (!read(length) || (size_t) (end - data) < length)
+            return false;
+        s = data;
+        data += length;
+        return true;
+    }
+
+    bool atEnd() const
+    {
+        return data == end;
+    }
+
+    Value* readValue(MemoryPool* pool, bool isRoot, unsigned int depth);
+
+ private:
+    const char* data;
+    const char* end;
+};
+
+
+// Read a value, allocating it and its descendants from the pool. Returns
+// NULL if the data is bad.
+Value* BinaryCatalogReader::readValue(MemoryPool* pool, bool isRoot, unsigned int depth)
+{
+    uint8 type;
+    if (depth > MaxBinaryValueDepth || !read(type))
         return NULL;
+
+    Value* value = NULL;
+    switch (type)
+    {
+    case Value::NumberType:
+        {
+            double d;
+            if (read(d))
+                value = new (pool, isRoot) Value(d);
+        }
+        break;
+
+    case Value::StringType:
+        {
+            const char* s;
+            uint32 length;
+            if (readString(s, length))
+                value = new (pool, isRoot) Value(string(s, length));
+        }
+        break;
+
+    case Value::BooleanType:
+        {
+            uint8 b;
+            if (read(b))
+                value = new (pool, isRoot) Value(b != 0);
+        }
+        break;
+
+    case Value::ArrayType:
+        {
+            uint32 count;
+            if (!read(count))
+                break;
+
+            Array* array = new Array();
+            for (uint32 i = 0; i < count; i++)
+            {
+                Value* element = readValue(pool, false, depth + 1);
+                if (element == NULL)
+                {
+                    for (Array::iterator iter = array->begin(); iter != array->end(); iter++)
+                        delete *iter;
+                    delete array;
+                    return NULL;
+                }
+                array->push_back(element);
+            }
+            value = new (pool, isRoot) Value(array);
+        }
+        break;
+
+    case Value::HashType:
+        {
+            uint32 count;
+            if (!read(count))
+                break;
+
+            Hash* hash = new (pool, false) Hash();
+            string key;
+            for (uint32 i = 0; i < count; i++)
+            {
+                // Keys were written in order; requiring that they still are
+                // means that every entry is added to the end of the hash.
+                const char* keyData;
+                uint32 keyLength;
+                Value* element = NULL;
+                if (readString(keyData, keyLength) &&
+                    (i == 0 || key.compare(0, string::npos, keyData, keyLength) < 0))
+                {
+                    element = readValue(pool, false, depth + 1);
+                }
+
+                if (element == NULL)
+                {
+                    delete hash;
+                    return NULL;
+                }
+
+                key.assign(keyData, keyLength);
+                hash->addValue(key, *element);
+            }
+            value = new (pool, isRoot) Value(hash);
+        }
+        break;
+    }
+
+    return value;
+}
+
+
+/*! Write the catalog in binary form. This must be done before any values
+ *  are taken from the catalog.
+ */
+bool ParsedCatalog::writeBinary(ostream& out) const
+{
+    ::writeBinary(out, (uint32) items.size());
+    for (vector<Item>::const_iterator iter = items.begin(); iter != items.end(); iter++)
+    {
+        ::writeBinary(out, (uint8) iter->type);
+        ::writeBinary(out, (int32) iter->lineNumber);
+
+        switch (iter->type)
+        {
+        case Tokenizer::TokenNumber:
+            ::writeBinary(out, iter->number);
+            break;
+        case Tokenizer::TokenName:
+        case Tokenizer::TokenString:
+            writeBinaryString(out, getText(*iter), iter->textLength);
+            break;
+        case Tokenizer::TokenBeginGroup:
+        case Tokenizer::TokenBeginArray:
+            ::writeBinary(out, (uint8) (iter->value != NULL ? 1 : 0));
+            if (iter->value != NULL)
+                writeBinaryValue(out, iter->value);
+            break;
+        default:
+            break;
+        }
     }
+
+    return out.good();
 }
 
 
+/*! Read a catalog written by writeBinary() into an empty catalog. Returns
+ *  false if the data is bad, in which case the catalog is left empty.
+ */
+bool ParsedCatalog::readBinary(const char* data, size_t size)
+{
+    BinaryCatalogReader in(data, data + size);
+
+    uint32 itemCount;
+    if (!in.read(itemCount))
+        return false;
+
+    bool good = true;
+    for (uint32 i = 0; i < itemCount && good; i++)
+    {
+        uint8 type;
+        int32 lineNumber;
+        if (!in.read(type) || !in.read(lineNumber) || type > Tokenizer::TokenEndUnits)
+        {
+            good = false;
+            break;
+        }
+
+        Item item;
+        item.type = (Tokenizer::TokenType) type;
+        item.lineNumber = lineNumber;
+        item.number = 0.0;
+        item.textStart = text.size();
+        item.textLength = 0;
+        item.value = NULL;
+
+        switch (item.type)
+        {
+        case Tokenizer::TokenNumber:
+            good = in.read(item.number);
+            break;
+
+        case Tokenizer::TokenName:
+        case Tokenizer::TokenString:
+            {
+                const char* s;
+                uint32 length;
+                good = in.readString(s, length);
+                if (good)
+                {
+                    text.append(s, length);
+                    item.textLength = length;
+                }
+            }
+            break;
+
+        case Tokenizer::TokenBeginGroup:
+        case Tokenizer::TokenBeginArray:
+            {
+                uint8 hasValue;
+                good = in.read(hasValue);
+                if (good && hasValue != 0)
+                {
+                    MemoryPool* pool = new MemoryPool(PoolAlignment, PoolBlockSize);
+                    item.value = in.readValue(pool, true, 0);
+                    if (item.value == NULL)
+                    {
+                        delete pool;
+                        good = false;
+                    }
+                }
+            }
+            break;
+
+        default:
+            break;
+        }
+
+        if (good)
+            items.push_back(item);
+    }
+
+    if (!good || !in.atEnd())
+    {
+        for (vector<Item>::iterator iter = items.begin(); iter != items.end(); iter++)
+            delete iter->value;
+        items.clear();
+        text.clear();
+        return false;
+    }
+
+    return true;
+}
+
+
+/*! Remove the value stored with an item and return it; the caller takes
+ *  ownership.
+ */
+Value* ParsedCatalog::takeValue(unsigned int index)
+{
+    Value* value = items[index].value;
+    items[index].value = NULL;
+
+    return value;
+}
+
+
+/****** AssociativeArray method implementations ******/
+
 AssociativeArray::AssociativeArray()
 {
+    // Room for the properties of a typical catalog object, so that the
+    // entries are rarely copied as the hash grows
+    assoc.reserve(8);
 }
 
 AssociativeArray::~AssociativeArray()
@@ -316,22 +820,37 @@ AssociativeArray::~AssociativeArray()
         iter++;
     }
 #endif
-    for (map<string, Value*>::iterator iter = assoc.begin(); iter != assoc.end(); iter++)
+    for (vector<pair<string, Value*> >::iterator iter = assoc.begin(); iter != assoc.end(); iter++)
         delete iter->second;
 }
 
-Value* AssociativeArray::getValue(string key) const
+struct KeyOrderPredicate
 {
-    map<string, Value*>::const_iterator iter = assoc.find(key);
-    if (iter == assoc.end())
+    bool operator()(const pair<string, Value*>& entry, const string& key) const
+    {
+        return entry.first < key;
+    }
+};
+
+Value* AssociativeArray::getValue(const string& key) const
+{
+    vector<pair<string, Value*> >::const_iterator iter =
+        lower_bound(assoc.begin(), assoc.end(), key, KeyOrderPredicate());
+    if (iter == assoc.end() || iter->first != key)
         return NULL;
     else
         return iter->second;
 }
 
-void AssociativeArray::addValue(string key, Value& val)
+/*! Add a value to the hash; if there's already a value with the same key,
+ *  the hash is left unchanged.
+ */
+void AssociativeArray::addValue(const string& key, Value& val)
 {
-    assoc.insert(map<string, Value*>::value_type(key, &val));
+    vector<pair<string, Value*> >::iterator iter =
+        lower_bound(assoc.begin(), assoc.end(), key, KeyOrderPredicate());
+    if (iter == assoc.end() || iter->first != key)
+        assoc.insert(iter, make_pair(key, &val));
 }
 
 bool AssociativeArray::getNumber(const string& key, double& val) const
@@ -900,3 +1419,31 @@ AssociativeArray::end()
 {
     return assoc.end();
 }
+
+
+void*
+AssociativeArray::operator new(size_t size)
+{
+    return allocateNode(size, NULL, false);
+}
+
+
+void*
+AssociativeArray::operator new(size_t size, MemoryPool* pool, bool ownsPool)
+{
+    return allocateNode(size, pool, ownsPool);
+}
+
+
+void
+AssociativeArray::operator delete(void* p)
+{
+    freeNode(p);
+}
+
+
+void
+AssociativeArray::operator delete(void* p, MemoryPool*, bool)
+{
+    freeNode(p);
+}
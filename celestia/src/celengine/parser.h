@@ -12,7 +12,10 @@
 #define _PARSER_H_
 
 #include <vector>
-#include <map>
+#include <string>
+#include <utility>
+#include <iostream>
+#include <cstddef>
 #include <celmath/vecmath.h>
 #include <celmath/quaternion.h>
 #include <celutil/color.h>
@@ -22,8 +25,9 @@
 #include <Eigen/Geometry>
 
 class Value;
+class MemoryPool;
 
-typedef map<string, Value*>::const_iterator HashIterator;
+typedef vector<pair<string, Value*> >::const_iterator HashIterator;
 
 class AssociativeArray
 {
@@ -31,8 +35,8 @@ class AssociativeArray
     AssociativeArray();
     ~AssociativeArray();
 
-    Value* getValue(string) const;
-    void addValue(string, Value&);
+    Value* getValue(const std::string&) const;
+    void addValue(const std::string&, Value&);
 
     bool getNumber(const std::string&, double&) const;
     bool getNumber(const std::string&, float&) const;
@@ -66,9 +70,15 @@ class AssociativeArray
 
     HashIterator begin();
     HashIterator end();
+
+    static void* operator new(std::size_t size);
+    static void* operator new(std::size_t size, MemoryPool* pool, bool ownsPool);
+    static void operator delete(void* p);
+    static void operator delete(void* p, MemoryPool* pool, bool ownsPool);
     
  private:
-    map<string, Value*> assoc;
+    // Entries sorted by key
+    vector<pair<string, Value*> > assoc;
 };
 
 typedef vector<Value*> Array;
@@ -86,7 +96,7 @@ public:
     };
 
     Value(double);
-    Value(string);
+    Value(const string&);
     Value(Array*);
     Value(Hash*);
     Value(bool);
@@ -95,11 +105,16 @@ public:
     ValueType getType() const;
 
     double getNumber() const;
-    string getString() const;
+    const string& getString() const;
     Array* getArray() const;
     Hash* getHash() const;
     bool getBoolean() const;
 
+    static void* operator new(std::size_t size);
+    static void* operator new(std::size_t size, MemoryPool* pool, bool ownsPool);
+    static void operator delete(void* p);
+    static void operator delete(void* p, MemoryPool* pool, bool ownsPool);
+
 private:
     ValueType type;
 
@@ -112,6 +127,13 @@ private:
 };
 
 
+/*! The values and hashes of each tree read by a Parser are allocated from
+ *  a memory pool belonging to the root value of the tree, and the whole
+ *  pool is released when the root is deleted. Trees are still deleted
+ *  with the delete operator, and values created elsewhere may be freely
+ *  added to them; values must not be moved out of a tree that will be
+ *  deleted before them.
+ */
 class Parser
 {
 public:
@@ -121,10 +143,71 @@ public:
 
 private:
     Tokenizer* tokenizer;
+    MemoryPool* pool;
     
     bool readUnits(const std::string&, Hash*);
     Array* readArray();
     Hash* readHash();
 };
 
+
+/*! A ParsedCatalog holds the contents of a catalog file read ahead of
+ *  time: the tokens of the file, with every top level array and property
+ *  list already parsed into a value. Catalogs can be parsed on worker
+ *  threads and handed to the catalog loaders later through a Tokenizer
+ *  created for the catalog; the loaders see the same tokens, and their
+ *  parsers return the stored values instead of parsing them again.
+ *
+ *  A catalog can also be saved in a binary form, which is much faster to
+ *  read than the original file. The binary form is in the byte order of
+ *  the machine that wrote it, and is meant for caching parsed catalogs
+ *  rather than for distribution.
+ */
+class ParsedCatalog
+{
+ public:
+    ParsedCatalog();
+    ~ParsedCatalog();
+
+    void read(Tokenizer& tokenizer);
+    bool writeBinary(std::ostream& out) const;
+    bool readBinary(const char* data, std::size_t size);
+
+    // Name and string tokens keep their text in the catalog's text buffer
+    struct Item
+    {
+        Tokenizer::TokenType type;
+        int lineNumber;
+        double number;
+        unsigned int textStart;
+        unsigned int textLength;
+        Value* value;
+    };
+
+    unsigned int itemCount() const
+    {
+        return items.size();
+    }
+
+    const Item& getItem(unsigned int index) const
+    {
+        return items[index];
+    }
+
+    const char* getText(const Item& item) const
+    {
+        return text.data() + item.textStart;
+    }
+
+    Value* takeValue(unsigned int index);
+
+ private:
+    vector<Item> items;
+    string text;
+
+    // Prohibit copying of catalogs, which own their values
+    ParsedCatalog(const ParsedCatalog&);
+    ParsedCatalog& operator=(const ParsedCatalog&);
+};
+
 #endif // _PARSER_H_
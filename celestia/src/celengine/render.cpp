@@ -60,6 +60,9 @@ std::ofstream hdrlog;
 #include "renderglsl.h"
 #include "axisarrow.h"
 #include "frametree.h"
+#include "framestatecache.h"
+#include "orbitbvh.h"
+#include "orbitpathcache.h"
 #include "timelinephase.h"
 #include "skygrid.h"
 #include "modelgeometry.h"
@@ -71,6 +74,7 @@ std::ofstream hdrlog;
 #include <celutil/utf8.h>
 #include <celutil/util.h>
 #include <celutil/timer.h>
+#include <celutil/workerpool.h>
 #include <curveplot.h>
 #include <GL/glew.h>
 #include <algorithm>
@@ -79,6 +83,7 @@ std::ofstream hdrlog;
 #include <cassert>
 #include <sstream>
 #include <iomanip>
+#include <deque>
 #include "eigenport.h"
 
 using namespace cmod;
@@ -128,7 +133,10 @@ static const float BaseStarDiscSize      = 5.0f;
 static const float MaxScaledDiscStarSize = 8.0f;
 static const float GlareOpacity = 0.65f;
 
-static const float MinRelativeOccluderRadius = 0.005f;
+// Stars outside the view frustum are culled before rendering, but the frustum
+// is first enlarged by this margin (the sine of an angle) so that glare
+// around bright stars just outside the field of view is still drawn.
+static const float StarCullMargin = 0.15f;
 
 static const float CubeCornerToCenterDistance = (float) sqrt(3.0);
 
@@ -195,11 +203,6 @@ static const int MaxSkyRings = 32;
 static const int MaxSkySlices = 180;
 static const int MinSkySlices = 30;
 
-// Size at which the orbit cache will be flushed of old orbit paths
-static const unsigned int OrbitCacheCullThreshold = 200;
-// Age in frames at which unused orbit paths may be eliminated from the cache
-static const uint32 OrbitCacheRetireAge = 16;
-
 Color Renderer::StarLabelColor          (0.471f, 0.356f, 0.682f);
 Color Renderer::PlanetLabelColor        (0.407f, 0.333f, 0.964f);
 Color Renderer::DwarfPlanetLabelColor   (0.407f, 0.333f, 0.964f);
@@ -337,6 +340,91 @@ private:
 };
 
 
+// A StarBatch records the output of a star renderer that searches one part
+// of the star octree on a worker thread. Nothing that touches OpenGL or
+// renderer state may be called from a worker, so the vertices, labels and
+// render list entries are stored here and later replayed on the rendering
+// thread, in the same order as a single threaded search would produce them.
+struct StarBatch
+{
+    enum Operation
+    {
+        StarOp,
+        GlareStarOp,
+        ParticleOp,
+        LabelOp,
+        RenderListOp,
+        DeferredStarOp,
+    };
+
+    struct StarVertex
+    {
+        Eigen::Vector3f position;
+        Color color;
+        float size;
+    };
+
+    struct Label
+    {
+        std::string text;
+        Color color;
+        Eigen::Vector3f position;
+    };
+
+    // Stars that require the position of the observer relative to the star
+    // to be computed exactly; this involves evaluating the star's orbit,
+    // which isn't safe to do on a worker thread.
+    struct DeferredStar
+    {
+        const Star* star;
+        float distance;
+        float appMag;
+    };
+
+    void clear()
+    {
+        operations.clear();
+        starVertices.clear();
+        particles.clear();
+        labels.clear();
+        renderListEntries.clear();
+        deferredStars.clear();
+    }
+
+    std::vector<unsigned char> operations;
+    std::vector<StarVertex> starVertices;
+    std::vector<Renderer::Particle> particles;
+    std::vector<Label> labels;
+    std::vector<RenderListEntry> renderListEntries;
+    std::vector<DeferredStar> deferredStars;
+};
+
+
+// When a frame is drawn in several views, as for a planetarium dome, the
+// views usually share a position and time and differ only in direction.
+// What depends only on the position and time is found by the first view
+// and reused by the others.
+struct Renderer::ViewpointState
+{
+    ViewpointState(const UniversalCoord& _position, double _time) :
+        position(_position),
+        time(_time),
+        lightingFound(false)
+    {
+    }
+
+    UniversalCoord position;
+    double time;
+
+    // Stars near enough to illuminate solar system bodies, their light,
+    // and the position of the observer relative to each of them
+    bool lightingFound;
+    vector<const Star*> nearStars;
+    vector<LightSource> lightSources;
+    vector<Vector3d> astrocentricPositions;
+};
+
+
 StarVertexBuffer::StarVertexBuffer(unsigned int _capacity) :
     capacity(_capacity),
     vertices(NULL),
@@ -605,13 +693,16 @@ Renderer::Renderer() :
     starVertexBuffer(NULL),
     pointStarVertexBuffer(NULL),
     glareVertexBuffer(NULL),
+    workerPool(NULL),
+    frameStateCache(NULL),
+    frameViewCount(0),
     useVertexPrograms(false),
     useRescaleNormal(false),
     usePointSprite(false),
     textureResolution(medres),
     useNewStarRendering(false),
     frameCount(0),
-    lastOrbitCacheFlush(0),
+    orbitPathCache(NULL),
     minOrbitSize(MinOrbitSizeForLabel),
     distanceLimit(1.0e6f),
     minFeatureSize(MinFeatureSizeForLabel),
@@ -635,6 +726,8 @@ Renderer::Renderer() :
     starVertexBuffer = new StarVertexBuffer(2048);
     pointStarVertexBuffer = new PointStarVertexBuffer(2048);
     glareVertexBuffer = new PointStarVertexBuffer(2048);
+    workerPool = new WorkerPool(DefaultWorkerThreadCount());
+    orbitPathCache = new OrbitPathCache();
     skyVertices = new SkyVertex[MaxSkySlices * (MaxSkyRings + 1)];
     skyIndices = new uint32[(MaxSkySlices + 1) * 2 * MaxSkyRings];
     skyContour = new SkyContourPoint[MaxSkySlices + 1];
@@ -670,6 +763,14 @@ Renderer::~Renderer()
         delete starVertexBuffer;
     if (pointStarVertexBuffer != NULL)
         delete pointStarVertexBuffer;
+    delete workerPool;
+    delete orbitPathCache;
+    clearViewpointStates();
+    for (vector<StarBatch*>::iterator iter = starBatches.begin();
+         iter != starBatches.end(); iter++)
+    {
+        delete *iter;
+    }
     delete[] skyVertices;
     delete[] skyIndices;
     delete[] skyContour;
@@ -698,7 +799,7 @@ Renderer::~Renderer()
 
 Renderer::DetailOptions::DetailOptions() :
     ringSystemSections(100),
-    orbitPathSamplePoints(100),
+    orbitPathTolerance(0.5f),
     shadowTextureSize(256),
     eclipseTextureSize(128)
 {
@@ -1744,42 +1845,6 @@ static void disableSmoothLines()
 }
 
 
-class OrbitSampler : public OrbitSampleProc
-{
-public:
-    vector<CurvePlotSample> samples;
-
-    OrbitSampler()
-    {
-    }
-
-    void sample(double t, const Vector3d& position, const Vector3d& velocity)
-    {
-        CurvePlotSample samp;
-        samp.t = t;
-        samp.position = position;
-        samp.velocity = velocity;
-        samples.push_back(samp);
-    }
-
-    void insertForward(CurvePlot* plot)
-    {
-        for (vector<CurvePlotSample>::const_iterator iter = samples.begin(); iter != samples.end(); ++iter)
-        {
-            plot->addSample(*iter);
-        }
-    }
-
-    void insertBackward(CurvePlot* plot)
-    {
-        for (vector<CurvePlotSample>::const_reverse_iterator iter = samples.rbegin(); iter != samples.rend(); ++iter)
-        {
-            plot->addSample(*iter);
-        }
-    }
-};
-
-
 Vector4f renderOrbitColor(const Body *body, bool selected, float opacity)
 {
     Color orbitColor;
@@ -1860,80 +1925,40 @@ void Renderer::renderOrbit(const OrbitPathListEntry& orbitPath,
     else
         orbit = orbitPath.star->getOrbit();
 
-    CurvePlot* cachedOrbit = NULL;
-    OrbitCache::iterator cached = orbitCache.find(orbit);
-    if (cached != orbitCache.end())
-    {
-        cachedOrbit = cached->second;
-        cachedOrbit->setLastUsed(frameCount);
-    }
+    // Sample the orbit closely enough that the error is within the
+    // tolerance in pixels at the nearest point of the orbit's bounding
+    // sphere; the cached path is refined as the camera approaches.
+    double nearestDistance = max(orbitPath.origin.norm() - (double) orbitPath.radius, 0.0);
+    double tolerance = nearestDistance * pixelSize * detailOptions.orbitPathTolerance;
 
-    // If it's not in the cache already
-    if (cachedOrbit == NULL)
+    // Aperiodic orbits aren't true orbits, but are sampled trajectories,
+    // generally of spacecraft; they're sampled from the beginning of their
+    // valid range.
+    double sampleStart = t;
+    if (!orbit->isPeriodic())
     {
-        double startTime = t;
-        int nSamples = detailOptions.orbitPathSamplePoints;
+        double begin = 0.0, end = 0.0;
+        orbit->getValidRange(begin, end);
 
-        // Adjust the number of samples used for aperiodic orbits--these aren't
-        // true orbits, but are sampled trajectories, generally of spacecraft.
-        // Better control is really needed--some sort of adaptive sampling would
-        // be ideal.
-        if (!orbit->isPeriodic())
-        {
-            double begin = 0.0, end = 0.0;
-            orbit->getValidRange(begin, end);
+        // If the orbit is aperiodic and doesn't have a
+        // finite duration, we don't render it. A compromise
+        // would be to pick some time window centered at the
+        // current time, but we'd have to pick some arbitrary
+        // duration.
+        if (begin == end)
+            return;
 
-            if (begin != end)
-            {
-                startTime = begin;
-                nSamples = (int) (orbit->getPeriod() * 100.0);
-                nSamples = max(min(nSamples, 1000), 100);
-            }
-            else
-            {
-                // If the orbit is aperiodic and doesn't have a
-                // finite duration, we don't render it. A compromise
-                // would be to pick some time window centered at the
-                // current time, but we'd have to pick some arbitrary
-                // duration.
-                nSamples = 0;
-            }
-        }
-        else
-        {
-            startTime = t - orbit->getPeriod();
-        }
-
-        cachedOrbit = new CurvePlot();
-        cachedOrbit->setLastUsed(frameCount);
-
-        OrbitSampler sampler;
-        orbit->sample(startTime,
-                      startTime + orbit->getPeriod(),
-                      sampler);
-        sampler.insertForward(cachedOrbit);
-
-        // If the orbit cache is full, first try and eliminate some old orbits
-        if (orbitCache.size() > OrbitCacheCullThreshold)
-        {
-            // Check for old orbits at most once per frame
-            if (lastOrbitCacheFlush != frameCount)
-            {
-                for (OrbitCache::iterator iter = orbitCache.begin(); iter != orbitCache.end();)
-                {
-                    // Tricky code to eliminate a node in the orbit cache without screwing
-                    // up the iterator. Should work in all STL implementations.
-                    if (frameCount - iter->second->lastUsed() > OrbitCacheRetireAge)
-                        orbitCache.erase(iter++);
-                    else
-                        ++iter;
-                }
-                lastOrbitCacheFlush = frameCount;
-            }
-        }
-
-        orbitCache[orbit] = cachedOrbit;
+        sampleStart = begin;
     }
+    else
+    {
+        sampleStart = t - orbit->getPeriod();
+    }
+
+    double pathTolerance = 0.0;
+    CurvePlot* cachedOrbit = orbitPathCache->getPath(orbit,
+                                                     sampleStart, sampleStart + orbit->getPeriod(),
+                                                     tolerance, frameCount, pathTolerance);
 
     if (cachedOrbit->empty())
         return;
@@ -1983,8 +2008,8 @@ void Renderer::renderOrbit(const OrbitPathListEntry& orbitPath,
             cachedOrbit->removeSamplesBefore(cachedOrbit->startTime() * (1.0 + 1.0e-15));
 
             // Add the new samples
-            OrbitSampler sampler;
-            orbit->sample(newWindowStart, min(currentWindowStart, newWindowEnd), sampler);
+            OrbitPathSampler sampler;
+            orbit->sample(newWindowStart, min(currentWindowStart, newWindowEnd), pathTolerance, sampler);
             sampler.insertBackward(cachedOrbit);
 #if DEBUG_ORBIT_CACHE
             clog << "new sample count: " << cachedOrbit->sampleCount() << endl;
@@ -1999,8 +2024,8 @@ void Renderer::renderOrbit(const OrbitPathListEntry& orbitPath,
             cachedOrbit->removeSamplesAfter(cachedOrbit->endTime() * (1.0 - 1.0e-15));
 
             // Add the new samples
-            OrbitSampler sampler;
-            orbit->sample(max(currentWindowEnd, newWindowStart), newWindowEnd, sampler);
+            OrbitPathSampler sampler;
+            orbit->sample(max(currentWindowEnd, newWindowStart), newWindowEnd, pathTolerance, sampler);
             sampler.insertForward(cachedOrbit);
 #if DEBUG_ORBIT_CACHE
             clog << "new sample count: " << cachedOrbit->sampleCount() << endl;
@@ -2771,6 +2796,60 @@ void Renderer::render(const Observer& observer,
 #endif
 }
 
+/*! Begin a frame that will be drawn in viewCount views; the views are
+ *  drawn by calling draw or render for each, followed by endFrame.
+ */
+void Renderer::beginFrame(unsigned int viewCount)
+{
+    // Caches that age their contents by frame count them once, no matter
+    // how many views the frame has.
+    frameCount++;
+    frameViewCount = viewCount;
+    clearViewpointStates();
+}
+
+
+void Renderer::endFrame()
+{
+    frameViewCount = 0;
+    clearViewpointStates();
+}
+
+
+// Return the state shared by views of the current frame drawn from the
+// given position and time, creating it if this is the first such view.
+Renderer::ViewpointState&
+Renderer::getViewpointState(const UniversalCoord& position, double now)
+{
+    for (vector<ViewpointState*>::iterator iter = viewpointStates.begin();
+         iter != viewpointStates.end(); iter++)
+    {
+        ViewpointState* state = *iter;
+        if (state->time == now &&
+            state->position.x == position.x &&
+            state->position.y == position.y &&
+            state->position.z == position.z)
+        {
+            return *state;
+        }
+    }
+
+    viewpointStates.push_back(new ViewpointState(position, now));
+    return *viewpointStates.back();
+}
+
+
+void Renderer::clearViewpointStates()
+{
+    for (vector<ViewpointState*>::iterator iter = viewpointStates.begin();
+         iter != viewpointStates.end(); iter++)
+    {
+        delete *iter;
+    }
+    viewpointStates.clear();
+}
+
+
 void Renderer::draw(const Observer& observer,
                     const Universe& universe,
                     float faintestMagNight,
@@ -2780,7 +2859,15 @@ void Renderer::draw(const Observer& observer,
     double now = observer.getTime();
     realTime = observer.getRealTime();
 
-    frameCount++;
+    // A view drawn on its own is a frame by itself, and shares nothing
+    // with the previous one.
+    if (frameViewCount == 0)
+    {
+        frameCount++;
+        clearViewpointStates();
+    }
+    ViewpointState& viewpoint = getViewpointState(observer.getPosition(), now);
+
     settingsChanged = false;
 
     // Compute the size of a pixel
@@ -2871,18 +2958,36 @@ void Renderer::draw(const Observer& observer,
 
     if (renderFlags & ShowPlanets)
     {
-        nearStars.clear();
-        universe.getNearStars(observer.getPosition(), 1.0f, nearStars);
+        // Compute the states of all solar system bodies once; the render,
+        // orbit, and label lists and the eclipse tests all read from them.
+        frameStateCache = &universe.getFrameStateCache(now, workerPool);
+
+        if (!viewpoint.lightingFound)
+        {
+            universe.getNearStars(observer.getPosition(), 1.0f, viewpoint.nearStars);
+
+            // Set up direct light sources (i.e. just stars at the moment)
+            setupLightSources(viewpoint.nearStars, observer.getPosition(), now,
+                              viewpoint.lightSources, renderFlags);
+
+            // Compute the position of the observer in astrocentric coordinates
+            for (vector<const Star*>::const_iterator iter = viewpoint.nearStars.begin();
+                 iter != viewpoint.nearStars.end(); iter++)
+            {
+                viewpoint.astrocentricPositions.push_back(astrocentricPosition(observer.getPosition(), **iter, now));
+            }
+
+            viewpoint.lightingFound = true;
+        }
 
-        // Set up direct light sources (i.e. just stars at the moment)
-        setupLightSources(nearStars, observer.getPosition(), now, lightSourceList, renderFlags);
+        nearStars = viewpoint.nearStars;
+        lightSourceList = viewpoint.lightSources;
 
         // Traverse the frame trees of each nearby solar system and
         // build the list of objects to be rendered.
-        for (vector<const Star*>::const_iterator iter = nearStars.begin();
-             iter != nearStars.end(); iter++)
+        for (unsigned int i = 0; i < nearStars.size(); i++)
         {
-            const Star* sun = *iter;
+            const Star* sun = nearStars[i];
             SolarSystem* solarSystem = universe.getSolarSystem(sun);
             if (solarSystem != NULL)
             {
@@ -2896,14 +3001,12 @@ void Renderer::draw(const Observer& observer,
                         solarSysTree->markUpdated();
                     }
 
-                    // Compute the position of the observer in astrocentric coordinates
-                    Vector3d astrocentricObserverPos = astrocentricPosition(observer.getPosition(), *sun, now);
+                    const Vector3d& astrocentricObserverPos = viewpoint.astrocentricPositions[i];
 
                     // Build render lists for bodies and orbits paths
                     buildRenderLists(astrocentricObserverPos,
                                      xfrustum,
                                      observer.getOrientation().conjugate() * -Vector3d::UnitZ(),
-                                     Vector3d::Zero(),
                                      solarSysTree,
                                      observer,
                                      now);
@@ -7449,8 +7552,8 @@ bool Renderer::testEclipse(const Body& receiver,
         // less than the distance between the sun and the receiver.  This
         // approximation works everywhere in the solar system, and is likely
         // valid for any orbitally stable pair of objects orbiting a star.
-        Vector3d posReceiver = receiver.getAstrocentricPosition(now);
-        Vector3d posCaster = caster.getAstrocentricPosition(now);
+        Vector3d posReceiver = frameStateCache->getAstrocentricPosition(&receiver, now);
+        Vector3d posCaster = frameStateCache->getAstrocentricPosition(&caster, now);
 
         //const Star* sun = receiver.getSystem()->getStar();
         //assert(sun != NULL);
@@ -7527,7 +7630,7 @@ bool Renderer::testEclipse(const Body& receiver,
             {
                 // Possible intersection, but it depends on the orientation of the
                 // rings.
-                Quaterniond casterOrientation = caster.getOrientation(now);
+                Quaterniond casterOrientation = frameStateCache->getEclipticToBodyFixed(&caster, now);
                 Vector3d ringPlaneNormal = casterOrientation * Vector3d::UnitY();                
                 Vector3d shadowDirection = lightToCasterDir.normalized();                
                 Vector3d v = ringPlaneNormal.cross(shadowDirection);
@@ -8308,7 +8411,6 @@ void Renderer::addRenderListEntries(RenderListEntry& rle,
 void Renderer::buildRenderLists(const Vector3d& astrocentricObserverPos,
                                 const Frustum& viewFrustum,
                                 const Vector3d& viewPlaneNormal,
-                                const Vector3d& frameCenter,
                                 const FrameTree* tree,
                                 const Observer& observer,
                                 double now)
@@ -8320,10 +8422,27 @@ void Renderer::buildRenderLists(const Vector3d& astrocentricObserverPos,
     double invCosViewAngle = 1.0 / cosViewConeAngle;
     double sinViewAngle = sqrt(1.0 - square(cosViewConeAngle));   
 
+    // Trees with many children are culled a group at a time using their
+    // bounding hierarchies, so that the positions of children in groups that
+    // can't be seen are never computed.
+    vector<unsigned int> visibleChildren;
+    const OrbitBVH* hierarchy = tree != NULL ? tree->getBoundingHierarchy(now) : NULL;
+    if (hierarchy != NULL)
+    {
+        Vector3d treeCenter_v = -astrocentricObserverPos;
+        if (tree->getBody() != NULL)
+            treeCenter_v += frameStateCache->getAstrocentricPosition(tree->getBody(), now);
+        cullBoundingHierarchy(*hierarchy, 0, treeCenter_v, viewPlaneNormal,
+                              labelClassMask, now, visibleChildren);
+    }
+
     unsigned int nChildren = tree != NULL ? tree->childCount() : 0;
+    if (hierarchy != NULL)
+        nChildren = visibleChildren.size();
+
     for (unsigned int i = 0; i < nChildren; i++)
     {
-        const TimelinePhase* phase = tree->getChild(i);
+        const TimelinePhase* phase = tree->getChild(hierarchy != NULL ? visibleChildren[i] : i);
 
         // No need to do anything if the phase isn't active now
         if (!phase->includes(now))
@@ -8335,9 +8454,7 @@ void Renderer::buildRenderLists(const Vector3d& astrocentricObserverPos,
         // pos_v: viewer-relative position of object
 
         // Get the position of the body relative to the sun.
-        Vector3d p = phase->orbit()->positionAtTime(now);
-        ReferenceFrame* frame = phase->orbitFrame();
-        Vector3d pos_s = frameCenter + frame->getOrientation(now).conjugate() * p;
+        Vector3d pos_s = frameStateCache->getAstrocentricPosition(body, now);
 
         // We now have the positions of the observer and the planet relative
         // to the sun.  From these, compute the position of the body
@@ -8522,7 +8639,6 @@ void Renderer::buildRenderLists(const Vector3d& astrocentricObserverPos,
                 buildRenderLists(astrocentricObserverPos,
                                  viewFrustum,
                                  viewPlaneNormal,
-                                 pos_s,
                                  subtree,
                                  observer,
                                  now);
@@ -8533,6 +8649,98 @@ void Renderer::buildRenderLists(const Vector3d& astrocentricObserverPos,
 }
 
 
+/*! Gather the children in a node of a bounding hierarchy that might
+ *  appear in the view or light something that does. Whole groups are
+ *  rejected when they lie outside the view cone, or when nothing in them
+ *  could be bright enough, large enough, or labeled. These are the same
+ *  tests that buildRenderLists applies to single bodies and subtrees, made
+ *  conservative for every position the bodies in the group may occupy.
+ */
+void Renderer::cullBoundingHierarchy(const OrbitBVH& hierarchy,
+                                     unsigned int n,
+                                     const Vector3d& treeCenter_v,
+                                     const Vector3d& viewPlaneNormal,
+                                     int labelClassMask,
+                                     double now,
+                                     vector<unsigned int>& children)
+{
+    const OrbitBVH::Node& node = hierarchy.getNode(n);
+    Sphered bounds = hierarchy.getBounds(n, now);
+
+    double invCosViewAngle = 1.0 / cosViewConeAngle;
+    double sinViewAngle = sqrt(1.0 - square(cosViewConeAngle));
+
+    Vector3d pos_v = treeCenter_v + bounds.center;
+    double dist_vn = viewPlaneNormal.dot(pos_v);
+    double perpDistSq = (pos_v - dist_vn * viewPlaneNormal).squaredNorm();
+
+    float brightestPossible = -100.0f;
+    float largestPossible = 100.0f;
+
+    // As with subtrees, no culling is possible when the viewer is inside the
+    // bounding sphere. The brightness can't be limited either when a light
+    // source is inside it.
+    double minPossibleDistance = pos_v.norm() - bounds.radius;
+    if (minPossibleDistance > 1.0)
+    {
+        float lum = 0.0f;
+        bool nearLight = false;
+        for (unsigned int li = 0; li < lightSourceList.size(); li++)
+        {
+            double sunDistance = (pos_v - lightSourceList[li].position).norm() - bounds.radius;
+            if (sunDistance > 0.0)
+                lum += luminosityAtOpposition(lightSourceList[li].luminosity, (float) sunDistance, node.maxRadius);
+            else
+                nearLight = true;
+        }
+
+        if (!nearLight)
+            brightestPossible = astro::lumToAppMag(lum, astro::kilometersToLightYears(minPossibleDistance));
+        largestPossible = node.maxCullingRadius / (float) minPossibleDistance / pixelSize;
+    }
+
+    bool traverse = false;
+    if (brightestPossible < faintestPlanetMag ||
+        largestPossible > 1.0f                ||
+        (node.classMask & labelClassMask) != 0)
+    {
+        if (dist_vn > -bounds.radius)
+        {
+            double maxPerpDist = (bounds.radius + dist_vn * sinViewAngle) * invCosViewAngle;
+            traverse = perpDistSq < maxPerpDist * maxPerpDist;
+        }
+    }
+
+    if (node.containsSecondaryIlluminators &&
+        !traverse                           &&
+        largestPossible > PLANETSHINE_PIXEL_SIZE_LIMIT)
+    {
+        double influenceRadius = bounds.radius + node.maxRadius * PLANETSHINE_DISTANCE_LIMIT_FACTOR;
+        if (dist_vn > -influenceRadius)
+        {
+            double maxPerpDist = (influenceRadius + dist_vn * sinViewAngle) * invCosViewAngle;
+            traverse = perpDistSq < maxPerpDist * maxPerpDist;
+        }
+    }
+
+    if (!traverse)
+        return;
+
+    if (node.isLeaf())
+    {
+        for (unsigned int i = 0; i < node.count; i++)
+            children.push_back(hierarchy.getChild(node.first + i));
+    }
+    else
+    {
+        cullBoundingHierarchy(hierarchy, node.left, treeCenter_v, viewPlaneNormal,
+                              labelClassMask, now, children);
+        cullBoundingHierarchy(hierarchy, node.right, treeCenter_v, viewPlaneNormal,
+                              labelClassMask, now, children);
+    }
+}
+
+
 void Renderer::buildOrbitLists(const Vector3d& astrocentricObserverPos,
                                const Quaterniond& observerOrientation,
                                const Frustum& viewFrustum,
@@ -8552,31 +8760,39 @@ void Renderer::buildOrbitLists(const Vector3d& astrocentricObserverPos,
             continue;
 
         Body* body = phase->body();
+        const FrameTree* subtree = body->getFrameTree();
+
+        // Only show orbits for major bodies or selected objects. 
+        Body::VisibilityPolicy orbitVis = body->getOrbitVisibility();
+
+        bool orbitVisible = body->isVisible() &&
+            (body == highlightObject.body() ||
+             orbitVis == Body::AlwaysVisible ||
+             (orbitVis == Body::UseClassVisibility && (body->getOrbitClassification() & orbitMask) != 0));
+
+        // The position is only needed to draw the orbit or to cull the
+        // subtree; bodies needing neither are skipped without computing it.
+        if (!orbitVisible && subtree == NULL)
+            continue;
 
         // pos_s: sun-relative position of object
         // pos_v: viewer-relative position of object
 
         // Get the position of the body relative to the sun.
-        Vector3d pos_s = body->getAstrocentricPosition(now);
+        Vector3d pos_s = frameStateCache->getAstrocentricPosition(body, now);
 
         // We now have the positions of the observer and the planet relative
         // to the sun.  From these, compute the position of the body
         // relative to the observer.
         Vector3d pos_v = pos_s - astrocentricObserverPos;
 
-        // Only show orbits for major bodies or selected objects. 
-        Body::VisibilityPolicy orbitVis = body->getOrbitVisibility();
-
-        if (body->isVisible() &&
-            (body == highlightObject.body() ||
-             orbitVis == Body::AlwaysVisible ||
-             (orbitVis == Body::UseClassVisibility && (body->getOrbitClassification() & orbitMask) != 0)))
+        if (orbitVisible)
         {
             Vector3d orbitOrigin = Vector3d::Zero();
             Selection centerObject = phase->orbitFrame()->getCenter();
             if (centerObject.body() != NULL)
             {
-                orbitOrigin = centerObject.body()->getAstrocentricPosition(now);
+                orbitOrigin = frameStateCache->getAstrocentricPosition(centerObject.body(), now);
             }
 
             // Calculate the origin of the orbit relative to the observer
@@ -8601,7 +8817,6 @@ void Renderer::buildOrbitLists(const Vector3d& astrocentricObserverPos,
             }
         }
 
-        const FrameTree* subtree = body->getFrameTree();
         if (subtree != NULL)
         {
             // Only try to render orbits of child objects when:
@@ -8730,12 +8945,11 @@ void Renderer::buildLabelLists(const Frustum& viewFrustum,
                     {
                         // In the typical case, we're rendering labels for many
                         // objects that orbit the same primary. Avoid repeatedly
-                        // calling getPosition() by caching the last primary
-                        // position.
+                        // computing the primary position by caching the last one.
                         if (primary != lastPrimary)
                         {
-                            Vector3d p = phase->orbitFrame()->getOrientation(now).conjugate() *
-                                         phase->orbit()->positionAtTime(now);
+                            Vector3d p = frameStateCache->getAstrocentricPosition(body, now) -
+                                         frameStateCache->getAstrocentricPosition(primary, now);
                             Vector3d v = iter->position.cast<double>() - p;
 
                             primarySphere = Sphered(v, primary->getRadius());
@@ -8886,18 +9100,248 @@ ObjectRenderer<OBJ, PREC>::ObjectRenderer(const PREC _distanceLimit) :
 }
 
 
-class StarRenderer : public ObjectRenderer<Star, float>
+// Base class of the star renderers. If batch is non-null, the output of
+// the renderer is recorded in the batch instead of going directly to the
+// vertex buffers, render list and annotations; this is the case when the
+// renderer processes one part of a multithreaded visible star search.
+class StarBatchRenderer : public ObjectRenderer<Star, float>
+{
+ public:
+    StarBatchRenderer();
+
+    // Send the output recorded in a batch to the vertex buffers, render
+    // list and annotations. Deferred stars are processed now.
+    void replay(const StarBatch& batch);
+
+ protected:
+    virtual void renderStar(const Vector3f& position, const Color& color, float size) = 0;
+    virtual void renderGlareStar(const Vector3f& /* position */, const Color& /* color */, float /* size */) {};
+
+    inline void addStar(const Vector3f& position, const Color& color, float size);
+    inline void addGlareStar(const Vector3f& position, const Color& color, float size);
+    void addParticle(const Renderer::Particle& particle);
+    void addLabel(const char* text, const Color& color, const Vector3f& position);
+    void addRenderListEntry(const RenderListEntry& rle);
+    bool deferStar(const Star& star, float distance, float appMag);
+
+ public:
+    StarBatch* batch;
+    vector<Renderer::Particle>* glareParticles;
+    vector<RenderListEntry>*    renderList;
+};
+
+
+StarBatchRenderer::StarBatchRenderer() :
+    ObjectRenderer<Star, float>(STAR_DISTANCE_LIMIT),
+    batch         (NULL),
+    glareParticles(NULL),
+    renderList    (NULL)
+{
+}
+
+
+void StarBatchRenderer::addStar(const Vector3f& position, const Color& color, float size)
+{
+    if (batch == NULL)
+    {
+        renderStar(position, color, size);
+    }
+    else
+    {
+        StarBatch::StarVertex v = { position, color, size };
+        batch->starVertices.push_back(v);
+        batch->operations.push_back(StarBatch::StarOp);
+    }
+}
+
+
+void StarBatchRenderer::addGlareStar(const Vector3f& position, const Color& color, float size)
+{
+    if (batch == NULL)
+    {
+        renderGlareStar(position, color, size);
+    }
+    else
+    {
+        StarBatch::StarVertex v = { position, color, size };
+        batch->starVertices.push_back(v);
+        batch->operations.push_back(StarBatch::GlareStarOp);
+    }
+}
+
+
+void StarBatchRenderer::addParticle(const Renderer::Particle& particle)
+{
+    if (batch == NULL)
+    {
+        glareParticles->insert(glareParticles->end(), particle);
+    }
+    else
+    {
+        batch->particles.push_back(particle);
+        batch->operations.push_back(StarBatch::ParticleOp);
+    }
+}
+
+
+void StarBatchRenderer::addLabel(const char* text, const Color& color, const Vector3f& position)
+{
+    if (batch == NULL)
+    {
+        renderer->addBackgroundAnnotation(NULL, text, color, position);
+    }
+    else
+    {
+        StarBatch::Label label;
+        label.text = text;
+        label.color = color;
+        label.position = position;
+        batch->labels.push_back(label);
+        batch->operations.push_back(StarBatch::LabelOp);
+    }
+}
+
+
+void StarBatchRenderer::addRenderListEntry(const RenderListEntry& rle)
+{
+    if (batch == NULL)
+    {
+        renderList->insert(renderList->end(), rle);
+    }
+    else
+    {
+        batch->renderListEntries.push_back(rle);
+        batch->operations.push_back(StarBatch::RenderListOp);
+    }
+}
+
+
+// Defer processing of a star until the batch is replayed. Returns false if
+// the renderer isn't recording a batch, in which case the star must be
+// processed immediately.
+bool StarBatchRenderer::deferStar(const Star& star, float distance, float appMag)
+{
+    if (batch == NULL)
+        return false;
+
+    StarBatch::DeferredStar deferred = { &star, distance, appMag };
+    batch->deferredStars.push_back(deferred);
+    batch->operations.push_back(StarBatch::DeferredStarOp);
+
+    // The star is counted when the batch is replayed
+    nProcessed--;
+
+    return true;
+}
+
+
+void StarBatchRenderer::replay(const StarBatch& b)
+{
+    vector<StarBatch::StarVertex>::const_iterator starIter = b.starVertices.begin();
+    vector<Renderer::Particle>::const_iterator particleIter = b.particles.begin();
+    vector<StarBatch::Label>::const_iterator labelIter = b.labels.begin();
+    vector<RenderListEntry>::const_iterator rleIter = b.renderListEntries.begin();
+    vector<StarBatch::DeferredStar>::const_iterator deferredIter = b.deferredStars.begin();
+
+    for (vector<unsigned char>::const_iterator iter = b.operations.begin();
+         iter != b.operations.end(); iter++)
+    {
+        switch (*iter)
+        {
+        case StarBatch::StarOp:
+            renderStar(starIter->position, starIter->color, starIter->size);
+            starIter++;
+            break;
+        case StarBatch::GlareStarOp:
+            renderGlareStar(starIter->position, starIter->color, starIter->size);
+            starIter++;
+            break;
+        case StarBatch::ParticleOp:
+            glareParticles->insert(glareParticles->end(), *particleIter);
+            particleIter++;
+            break;
+        case StarBatch::LabelOp:
+            renderer->addBackgroundAnnotation(NULL, labelIter->text, labelIter->color, labelIter->position);
+            labelIter++;
+            break;
+        case StarBatch::RenderListOp:
+            renderList->insert(renderList->end(), *rleIter);
+            rleIter++;
+            break;
+        case StarBatch::DeferredStarOp:
+            process(*deferredIter->star, deferredIter->distance, deferredIter->appMag);
+            deferredIter++;
+            break;
+        }
+    }
+}
+
+
+// Adapter that creates a copy of a star renderer for each part of a
+// multithreaded visible star search. Each copy records its output in a
+// batch of its own; the batches are kept by the Renderer and reused from
+// frame to frame.
+template <class RENDERER> class PartitionedStarRenderer : public PartitionedStarHandler
+{
+ public:
+    PartitionedStarRenderer(RENDERER& _renderer, vector<StarBatch*>& _batches) :
+        renderer(_renderer),
+        batches(_batches)
+    {
+    }
+
+    StarHandler* getPartHandler(unsigned int part)
+    {
+        while (parts.size() <= part)
+        {
+            if (batches.size() <= parts.size())
+                batches.push_back(new StarBatch());
+            StarBatch* b = batches[parts.size()];
+            b->clear();
+
+            // A deque never moves its elements, so previously returned
+            // handlers stay valid.
+            parts.push_back(renderer);
+            parts.back().batch = b;
+        }
+
+        return &parts[part];
+    }
+
+    // Replay the recorded batches in order with the original renderer
+    void replay()
+    {
+        for (unsigned int i = 0; i < parts.size(); i++)
+        {
+            renderer.replay(*parts[i].batch);
+            renderer.nProcessed += parts[i].nProcessed;
+            renderer.nRendered  += parts[i].nRendered;
+            renderer.nClose     += parts[i].nClose;
+            renderer.nBright    += parts[i].nBright;
+            renderer.nLabelled  += parts[i].nLabelled;
+        }
+    }
+
+ private:
+    RENDERER& renderer;
+    vector<StarBatch*>& batches;
+    deque<RENDERER> parts;
+};
+
+
+class StarRenderer : public StarBatchRenderer
 {
  public:
     StarRenderer();
 
     void process(const Star& star, float distance, float appMag);
 
+ protected:
+    void renderStar(const Vector3f& position, const Color& color, float size);
+
  public:
     Vector3d obsPos;
 
-    vector<Renderer::Particle>*      glareParticles;
-    vector<RenderListEntry>*         renderList;
     StarVertexBuffer*      starVertexBuffer;
     PointStarVertexBuffer* pointStarVertexBuffer;
 
@@ -8924,7 +9368,6 @@ class StarRenderer : public ObjectRenderer<Star, float>
 
 
 StarRenderer::StarRenderer() :
-    ObjectRenderer<Star, float>(STAR_DISTANCE_LIMIT),
     starVertexBuffer     (NULL),
     pointStarVertexBuffer(NULL),
     useScaledDiscs       (false),
@@ -8980,6 +9423,9 @@ void StarRenderer::process(const Star& star, float distance, float appMag)
         // and use the most inexpensive test possible . . .
         if (distance < 1.0f || orbitSizeInPixels > 1.0f)
         {
+            if (deferStar(star, distance, appMag))
+                return;
+
             // Compute the position of the observer relative to the star.
             // This is a much more accurate (and expensive) distance
             // calculation than the previous one which used the observer's
@@ -9014,9 +9460,9 @@ void StarRenderer::process(const Star& star, float distance, float appMag)
                 float distr = 3.5f * (labelThresholdMag - appMag)/labelThresholdMag;
                 if (distr > 1.0f)
                     distr = 1.0f;
-                renderer->addBackgroundAnnotation(NULL, nameBuffer,
-                                                  Color(Renderer::StarLabelColor, distr * Renderer::StarLabelColor.alpha()),
-                                                  relPos);
+                addLabel(nameBuffer,
+                         Color(Renderer::StarLabelColor, distr * Renderer::StarLabelColor.alpha()),
+                         relPos);
                 nLabelled++;
             }
         }
@@ -9068,17 +9514,9 @@ void StarRenderer::process(const Star& star, float distance, float appMag)
             }
 
             if (starPrimitive == GL_POINTS)
-            {
-                pointStarVertexBuffer->addStar(relPos,
-                                               Color(starColor, alpha),
-                                               pointSize);
-            }
+                addStar(relPos, Color(starColor, alpha), pointSize);
             else
-            {
-                starVertexBuffer->addStar(relPos,
-                                          Color(starColor, alpha),
-                                          pointSize * renderDistance);
-            }
+                addStar(relPos, Color(starColor, alpha), pointSize * renderDistance);
 
             ++nRendered;
 
@@ -9108,7 +9546,7 @@ void StarRenderer::process(const Star& star, float distance, float appMag)
                 }
 
                 p.color = Color(starColor, alpha);
-                glareParticles->insert(glareParticles->end(), p);
+                addParticle(p);
                 ++nBright;
             }
         }
@@ -9132,23 +9570,35 @@ void StarRenderer::process(const Star& star, float distance, float appMag)
             rle.radius = star.getRadius();
             rle.discSizeInPixels = discSizeInPixels;
             rle.appMag = appMag;
-            renderList->push_back(rle);
+            addRenderListEntry(rle);
         }
     }
 }
 
 
-class PointStarRenderer : public ObjectRenderer<Star, float>
+void StarRenderer::renderStar(const Vector3f& position, const Color& color, float size)
+{
+    if (starPrimitive == GL_POINTS)
+        pointStarVertexBuffer->addStar(position, color, size);
+    else
+        starVertexBuffer->addStar(position, color, size);
+}
+
+
+class PointStarRenderer : public StarBatchRenderer
 {
  public:
     PointStarRenderer();
 
     void process(const Star& star, float distance, float appMag);
 
+ protected:
+    void renderStar(const Vector3f& position, const Color& color, float size);
+    void renderGlareStar(const Vector3f& position, const Color& color, float size);
+
  public:
     Vector3d obsPos;
 
-    vector<RenderListEntry>*         renderList;
     PointStarVertexBuffer* starVertexBuffer;
     PointStarVertexBuffer* glareVertexBuffer;
 
@@ -9175,7 +9625,6 @@ class PointStarRenderer : public ObjectRenderer<Star, float>
 
 
 PointStarRenderer::PointStarRenderer() :
-    ObjectRenderer<Star, float>(STAR_DISTANCE_LIMIT),
     starVertexBuffer     (NULL),
     useScaledDiscs       (false),
     maxDiscSize          (1.0f),
@@ -9235,6 +9684,9 @@ void PointStarRenderer::process(const Star& star, float distance, float appMag)
         // and use the most inexpensive test possible . . .
         if (distance < 1.0f || orbitSizeInPixels > 1.0f)
         {
+            if (deferStar(star, distance, appMag))
+                return;
+
             // Compute the position of the observer relative to the star.
             // This is a much more accurate (and expensive) distance
             // calculation than the previous one which used the observer's
@@ -9268,9 +9720,9 @@ void PointStarRenderer::process(const Star& star, float distance, float appMag)
                 float distr = 3.5f * (labelThresholdMag - appMag)/labelThresholdMag;
                 if (distr > 1.0f)
                     distr = 1.0f;
-                renderer->addBackgroundAnnotation(NULL, nameBuffer,
-                                                  Color(Renderer::StarLabelColor, distr * Renderer::StarLabelColor.alpha()),
-                                                  relPos);
+                addLabel(nameBuffer,
+                         Color(Renderer::StarLabelColor, distr * Renderer::StarLabelColor.alpha()),
+                         relPos);
                 nLabelled++;
             }
         }
@@ -9312,11 +9764,11 @@ void PointStarRenderer::process(const Star& star, float distance, float appMag)
                     discSize *= discScale;
 
                     float glareAlpha = min(0.5f, discScale / 4.0f);
-                    glareVertexBuffer->addStar(relPos, Color(starColor, glareAlpha), discSize * 3.0f);
+                    addGlareStar(relPos, Color(starColor, glareAlpha), discSize * 3.0f);
 
                     alpha = 1.0f;
                 }
-                starVertexBuffer->addStar(relPos, Color(starColor, alpha), discSize);
+                addStar(relPos, Color(starColor, alpha), discSize);
             }
             else
             {
@@ -9328,12 +9780,12 @@ void PointStarRenderer::process(const Star& star, float distance, float appMag)
                 {
                     float discScale = min(100.0f, satPoint - appMag + 2.0f);
                     float glareAlpha = min(GlareOpacity, (discScale - 2.0f) / 4.0f);
-                    glareVertexBuffer->addStar(relPos, Color(starColor, glareAlpha), 2.0f * discScale * size);
+                    addGlareStar(relPos, Color(starColor, glareAlpha), 2.0f * discScale * size);
 #ifdef DEBUG_HDR_ADAPT
                     maxSize = max(maxSize, 2.0f * discScale * size);
 #endif
                 }
-                starVertexBuffer->addStar(relPos, Color(starColor, alpha), size);
+                addStar(relPos, Color(starColor, alpha), size);
             }
 
             ++nRendered;
@@ -9358,12 +9810,24 @@ void PointStarRenderer::process(const Star& star, float distance, float appMag)
             rle.discSizeInPixels = discSizeInPixels;
             rle.appMag = appMag;
             rle.isOpaque = true;
-            renderList->insert(renderList->end(), rle);
+            addRenderListEntry(rle);
         }
     }
 }
 
 
+void PointStarRenderer::renderStar(const Vector3f& position, const Color& color, float size)
+{
+    starVertexBuffer->addStar(position, color, size);
+}
+
+
+void PointStarRenderer::renderGlareStar(const Vector3f& position, const Color& color, float size)
+{
+    glareVertexBuffer->addStar(position, color, size);
+}
+
+
 // Calculate the maximum field of view (from top left corner to bottom right) of
 // a frustum with the specified aspect ratio (width/height) and vertical field of
 // view. We follow the convention used elsewhere and use units of degrees for
@@ -9375,6 +9839,48 @@ static double calcMaxFOV(double fovY_degrees, double aspectRatio)
 }
 
 
+// Search the star database for visible stars using the renderer's worker
+// threads. The star renderer gets exactly the same input as it would from a
+// single threaded search.
+template <class RENDERER> static void
+findVisibleStars(const StarDatabase& starDB,
+                 RENDERER& starRenderer,
+                 WorkerPool& workerPool,
+                 vector<StarBatch*>& starBatches,
+                 const Observer& observer,
+                 float fovY,
+                 float aspectRatio,
+                 float faintestMagNight)
+{
+    Vector3f obsPos = observer.getPosition().toLy().cast<float>();
+
+#ifndef DEBUG_HDR_ADAPT
+    if (workerPool.getThreadCount() > 0)
+    {
+        PartitionedStarRenderer<RENDERER> partitionedRenderer(starRenderer, starBatches);
+        starDB.findVisibleStars(workerPool,
+                                partitionedRenderer,
+                                obsPos,
+                                observer.getOrientationf(),
+                                fovY,
+                                aspectRatio,
+                                faintestMagNight,
+                                StarCullMargin);
+        partitionedRenderer.replay();
+        return;
+    }
+#endif
+
+    starDB.findVisibleStars(starRenderer,
+                            obsPos,
+                            observer.getOrientationf(),
+                            fovY,
+                            aspectRatio,
+                            faintestMagNight,
+                            StarCullMargin);
+}
+
+
 void Renderer::renderStars(const StarDatabase& starDB,
                            float faintestMagNight,
                            const Observer& observer)
@@ -9466,12 +9972,9 @@ void Renderer::renderStars(const StarDatabase& starDB,
         // Use quad primitives
         starRenderer.starVertexBuffer->start();
     }
-    starDB.findVisibleStars(starRenderer,
-                            obsPos.cast<float>(),
-                            observer.getOrientationf(),
-                            degToRad(fov),
-                            (float) windowWidth / (float) windowHeight,
-                            faintestMagNight);
+    findVisibleStars(starDB, starRenderer, *workerPool, starBatches, observer,
+                     degToRad(fov), (float) windowWidth / (float) windowHeight,
+                     faintestMagNight);
 #ifdef DEBUG_HDR_ADAPT
   HDR_LOG <<
       "* minMag = "    << starRenderer.minMag << ", " <<
@@ -9560,12 +10063,9 @@ void Renderer::renderPointStars(const StarDatabase& starDB,
     else
         starRenderer.starVertexBuffer->startSprites(*context);
 
-    starDB.findVisibleStars(starRenderer,
-                            obsPos.cast<float>(),
-                            observer.getOrientationf(),
-                            degToRad(fov),
-                            (float) windowWidth / (float) windowHeight,
-                            faintestMagNight);
+    findVisibleStars(starDB, starRenderer, *workerPool, starBatches, observer,
+                     degToRad(fov), (float) windowWidth / (float) windowHeight,
+                     faintestMagNight);
 
     starRenderer.starVertexBuffer->render();
     starRenderer.glareVertexBuffer->render();
@@ -10603,9 +11103,12 @@ void Renderer::loadTextures(Body* body)
 }
 
 
+/*! Discard the cached orbit paths; this must be done before deleting any
+ *  orbit that may have been drawn.
+ */
 void Renderer::invalidateOrbitCache()
 {
-    orbitCache.clear();
+    orbitPathCache->clear();
 }
 
 
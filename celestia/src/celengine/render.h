@@ -84,6 +84,11 @@ struct SecondaryIlluminator
 
 class StarVertexBuffer;
 class PointStarVertexBuffer;
+struct StarBatch;
+class WorkerPool;
+class FrameStateCache;
+class OrbitBVH;
+class OrbitPathCache;
 
 class Renderer
 {
@@ -97,7 +102,7 @@ class Renderer
     {
         DetailOptions();
         unsigned int ringSystemSections;
-        unsigned int orbitPathSamplePoints;
+        float orbitPathTolerance;
         unsigned int shadowTextureSize;
         unsigned int eclipseTextureSize;
     };
@@ -121,6 +126,13 @@ class Renderer
               float faintestVisible,
               const Selection& sel);
 
+    // Bracket the drawing of one frame in several views. Views drawn from
+    // the same position and time share the work that doesn't depend on
+    // the view direction, and caches that age their contents by frame see
+    // the views as a single frame.
+    void beginFrame(unsigned int viewCount);
+    void endFrame();
+
     enum {
         NoLabels            = 0x000,
         StarLabels          = 0x001,
@@ -426,7 +438,11 @@ class Renderer
     };
 
  private:
+    struct ViewpointState;
+
     void setFieldOfView(float);
+    ViewpointState& getViewpointState(const UniversalCoord& position, double now);
+    void clearViewpointStates();
     void renderStars(const StarDatabase& starDB,
                      float faintestVisible,
                      const Observer& observer);
@@ -445,10 +461,16 @@ class Renderer
     void buildRenderLists(const Eigen::Vector3d& astrocentricObserverPos,
                           const Frustum& viewFrustum,
                           const Eigen::Vector3d& viewPlaneNormal,
-                          const Eigen::Vector3d& frameCenter,
                           const FrameTree* tree,
                           const Observer& observer,
                           double now);
+    void cullBoundingHierarchy(const OrbitBVH& hierarchy,
+                               unsigned int node,
+                               const Eigen::Vector3d& treeCenter_v,
+                               const Eigen::Vector3d& viewPlaneNormal,
+                               int labelClassMask,
+                               double now,
+                               std::vector<unsigned int>& children);
     void buildOrbitLists(const Eigen::Vector3d& astrocentricObserverPos,
                          const Eigen::Quaterniond& observerOrientation,
                          const Frustum& viewFrustum,
@@ -653,6 +675,13 @@ class Renderer
     StarVertexBuffer* starVertexBuffer;
     PointStarVertexBuffer* pointStarVertexBuffer;
 	PointStarVertexBuffer* glareVertexBuffer;
+    // Worker threads for the visible star search, and the buffers that
+    // collect the results of each part of the search
+    WorkerPool* workerPool;
+    std::vector<StarBatch*> starBatches;
+    // Positions and orientations of solar system bodies at the time of
+    // the frame being rendered
+    const FrameStateCache* frameStateCache;
     std::vector<RenderListEntry> renderList;
     std::vector<SecondaryIlluminator> secondaryIlluminators;
     std::vector<DepthBufferPartition> depthPartitions;
@@ -667,6 +696,10 @@ class Renderer
 
     std::vector<LightSource> lightSourceList;
 
+    // State shared by the views of the frame drawn from each position
+    std::vector<ViewpointState*> viewpointStates;
+    unsigned int frameViewCount;
+
     double modelMatrix[16];
     double projMatrix[16];
 
@@ -711,9 +744,7 @@ class Renderer
 #endif
 
  private:
-    typedef std::map<const Orbit*, CurvePlot*> OrbitCache;
-    OrbitCache orbitCache;
-    uint32 lastOrbitCacheFlush;
+    OrbitPathCache* orbitPathCache;
 
     float minOrbitSize;
     float distanceLimit;
@@ -456,7 +456,9 @@ Selection Simulation::findObjectFromPath(string s, bool i18n)
 }
 
 
-vector<std::string> Simulation::getObjectCompletion(string s, bool withLocations)
+vector<std::string> Simulation::getObjectCompletion(string s,
+                                                   bool withLocations,
+                                                   unsigned int maxCompletions)
 {
     Selection path[2];
     int nPathEntries = 0;
@@ -478,7 +480,7 @@ vector<std::string> Simulation::getObjectCompletion(string s, bool withLocations
         path[nPathEntries++] = Selection(closestSolarSystem->getStar());
     }
 
-    return universe->getCompletionPath(s, path, nPathEntries, withLocations);
+    return universe->getCompletionPath(s, path, nPathEntries, withLocations, maxCompletions);
 }
 
 
@@ -41,6 +41,9 @@ class Universe;
 bool LoadSolarSystemObjects(std::istream& in,
                             Universe& universe,
                             const std::string& dir = "");
+bool LoadSolarSystemObjects(Tokenizer& tokenizer,
+                            Universe& universe,
+                            const std::string& dir = "");
 
 #endif // _SOLARSYS_H_
 
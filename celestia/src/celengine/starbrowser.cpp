@@ -11,7 +11,6 @@
 
 #include <string>
 #include <algorithm>
-#include <set>
 #include "starbrowser.h"
 
 using namespace Eigen;
@@ -21,144 +20,55 @@ using namespace std;
 // TODO: More of the functions in this module should be converted to
 // methods of the StarBrowser class.
 
-struct CloserStarPredicate
-{
-    Vector3f pos;
-    bool operator()(const Star* star0, const Star* star1) const
-    {
-        Vector3f p0 = star0->getPosition();
-        Vector3f p1 = star1->getPosition();
-
-#if 0
-        Vector3f v0(p0.x * 1e6 - pos.x, p0.y * 1e6 - pos.y, p0.z * 1e6 - pos.z);
-        Vector3f v1(p1.x * 1e6 - pos.x, p1.y * 1e6 - pos.y, p1.z * 1e6 - pos.z);
-#endif
-        Vector3f v0 = p0 * 1.0e6f - pos;
-        Vector3f v1 = p1 * 1.0e6f - pos;
-
-        return (v0.squaredNorm() < v1.squaredNorm());                               
-    }
-};
-
-
-struct BrighterStarPredicate
-{
-    Vector3f pos;
-    UniversalCoord ucPos;
-    bool operator()(const Star* star0, const Star* star1) const
-    {
-        Vector3f p0 = star0->getPosition();
-        Vector3f p1 = star1->getPosition();
-        Vector3f v0 = p0 * 1.0e6f - pos;
-        Vector3f v1 = p1 * 1.0e6f - pos;
-        float d0 = v0.norm();
-        float d1 = v1.norm();
-
-        return (star0->getApparentMagnitude(d0) <
-                star1->getApparentMagnitude(d1));
-    }
-};
-
-
-struct BrightestStarPredicate
-{
-    bool operator()(const Star* star0, const Star* star1) const
-    {
-        return (star0->getAbsoluteMagnitude() <
-                star1->getAbsoluteMagnitude());
-    }
-};
+// Star browsers never list more than this many stars
+static const unsigned int MaxListedStars = 500;
 
 
-struct SolarSystemPredicate
+struct CloserStarPredicate
 {
     Vector3f pos;
-    SolarSystemCatalog* solarSystems;
-
     bool operator()(const Star* star0, const Star* star1) const
     {
-        SolarSystemCatalog::iterator iter;
-
-        iter = solarSystems->find(star0->getCatalogNumber());
-        bool hasPlanets0 = (iter != solarSystems->end());
-        iter = solarSystems->find(star1->getCatalogNumber());
-        bool hasPlanets1 = (iter != solarSystems->end());
-        if (hasPlanets1 == hasPlanets0)
-        {
-            Vector3f p0 = star0->getPosition();
-            Vector3f p1 = star1->getPosition();
-            Vector3f v0 = p0 * 1.0e6f - pos;
-            Vector3f v1 = p1 * 1.0e6f - pos;
-            return (v0.squaredNorm() < v1.squaredNorm());
-        }
-        else
-        {
-            return hasPlanets0;
-        }
+        return ((pos - star0->getPosition()).squaredNorm() <
+                (pos - star1->getPosition()).squaredNorm());
     }
 };
 
 
-// Find the nearest/brightest/X-est N stars in a database.  The
-// supplied predicate determines which of two stars is a better match.
-template<class Pred> static std::vector<const Star*>*
-findStars(const StarDatabase& stardb, Pred pred, int nStars)
+// Find the nStars stars with planets nearest to pos. Only the stars in the
+// solar system catalog are examined, which is much smaller than the star
+// database.
+static std::vector<const Star*>*
+findStarsWithPlanets(const SolarSystemCatalog& solarSystems,
+                     const Vector3f& pos,
+                     unsigned int nStars)
 {
-    std::vector<const Star*>* finalStars = new std::vector<const Star*>();
-    if (nStars == 0)
-        return finalStars;
-    if(nStars > 500)
-        nStars = 500;
-
-    typedef std::multiset<const Star*, Pred> StarSet;
-    StarSet firstStars(pred);
-
-    int totalStars = stardb.size();
-    if (totalStars < nStars)
-        nStars = totalStars;
-
-    // We'll need at least nStars in the set, so first fill
-    // up the list indiscriminately.
-    int i = 0;
-    for (i = 0; i < nStars; i++)
-        firstStars.insert(stardb.getStar(i));
-
-    // From here on, only add a star to the set if it's
-    // a better match than the worst matching star already
-    // in the set.
-    const Star* lastStar = *--firstStars.end();
-    for (; i < totalStars; i++)
+    std::vector<const Star*>* stars = new std::vector<const Star*>();
+    stars->reserve(solarSystems.size());
+    for (SolarSystemCatalog::const_iterator iter = solarSystems.begin();
+         iter != solarSystems.end(); iter++)
     {
-        Star* star = stardb.getStar(i);
-        if (pred(star, lastStar))
-        {
-            firstStars.insert(star);
-            firstStars.erase(--firstStars.end());
-            lastStar = *--firstStars.end();
-        }
+        const Star* star = iter->second->getStar();
+        if (star != NULL)
+            stars->push_back(star);
     }
 
-    // Move the best matching stars into the vector
-    finalStars->reserve(nStars);
-    for (typename StarSet::const_iterator iter = firstStars.begin();
-         iter != firstStars.end(); iter++)
-    {
-        finalStars->insert(finalStars->end(), *iter);
-    }
+    CloserStarPredicate closerPred;
+    closerPred.pos = pos;
+    nStars = min(nStars, (unsigned int) stars->size());
+    partial_sort(stars->begin(), stars->begin() + nStars, stars->end(), closerPred);
+    stars->resize(nStars);
 
-    return finalStars;
+    return stars;
 }
 
 
 const Star* StarBrowser::nearestStar()
 {
     Universe* univ = appSim->getUniverse();
-    CloserStarPredicate closerPred;
-    closerPred.pos = pos;
-    std::vector<const Star*>* stars = findStars(*(univ->getStarCatalog()), closerPred, 1);
-    const Star *star = (*stars)[0];
-    delete stars;
-    return star;
+    std::vector<const Star*> stars;
+    univ->getStarCatalog()->findNearestStars(pos, 1, stars);
+    return stars.empty() ? NULL : stars[0];
 }
 
 
@@ -166,21 +76,26 @@ std::vector<const Star*>*
 StarBrowser::listStars(unsigned int nStars)
 {
     Universe* univ = appSim->getUniverse();
+    const StarDatabase* stardb = univ->getStarCatalog();
+    nStars = min(nStars, MaxListedStars);
+    if (nStars == 0)
+        return new std::vector<const Star*>();
+
     switch(predicate)
     {
     case BrighterStars:
         {
-            BrighterStarPredicate brighterPred;
-            brighterPred.pos = pos;
-            brighterPred.ucPos = ucPos;
-            return findStars(*(univ->getStarCatalog()), brighterPred, nStars);
+            std::vector<const Star*>* stars = new std::vector<const Star*>();
+            stardb->findBrightestStars(pos, nStars, *stars);
+            return stars;
         }
         break;
 
     case BrightestStars:
         {
-            BrightestStarPredicate brightestPred;
-            return findStars(*(univ->getStarCatalog()), brightestPred, nStars);
+            std::vector<const Star*>* stars = new std::vector<const Star*>();
+            stardb->findMostLuminousStars(nStars, *stars);
+            return stars;
         }
         break;
 
@@ -189,20 +104,16 @@ StarBrowser::listStars(unsigned int nStars)
             SolarSystemCatalog* solarSystems = univ->getSolarSystemCatalog();
             if (solarSystems == NULL)
                 return NULL;
-            SolarSystemPredicate solarSysPred;
-            solarSysPred.pos = pos;
-            solarSysPred.solarSystems = solarSystems;
-            return findStars(*(univ->getStarCatalog()), solarSysPred,
-                             min((size_t) nStars, solarSystems->size()));
+            return findStarsWithPlanets(*solarSystems, pos, nStars);
         }
         break;
 
     case NearestStars:
     default:
         {
-            CloserStarPredicate closerPred;
-            closerPred.pos = pos;
-            return findStars(*(univ->getStarCatalog()), closerPred, nStars);
+            std::vector<const Star*>* stars = new std::vector<const Star*>();
+            stardb->findNearestStars(pos, nStars, *stars);
+            return stars;
         }
         break;
     }
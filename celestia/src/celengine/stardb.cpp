@@ -18,7 +18,10 @@
 #include <celmath/plane.h>
 #include <celutil/util.h>
 #include <celutil/bytes.h>
+#include <celutil/mappedfile.h>
+#include <celutil/workerpool.h>
 #include <celengine/stardb.h>
+#include <celengine/octreebuilder.h>
 #include "celestia.h"
 #include "astro.h"
 #include "parser.h"
@@ -53,6 +56,63 @@ static const float STAR_EXTRA_ROOM        = 0.01f; // Reserve 1% capacity for ex
 const char* StarDatabase::FILE_HEADER            = "CELSTARS";
 const char* StarDatabase::CROSSINDEX_FILE_HEADER = "CELINDEX";
 
+// A sorted star database has the same header as an ordinary binary star
+// database but a different version number. The stars are stored in octree
+// order, so that the file can be memory mapped and used without rebuilding
+// the octree or sorting the catalog number index at startup. The layout is
+// (all values little endian):
+//
+//   header           char[8]   "CELSTARS"
+//   version          uint16    0x0200
+//   reserved         uint16    0
+//   star count       uint32
+//   node count       uint32
+//   root node size   float     must match STAR_OCTREE_ROOT_SIZE
+//   stars            SortedStarRecord[star count]
+//   octree nodes     SortedNodeRecord[node count], in depth first order
+//   catalog index    uint32[star count], star indices sorted by catalog number
+//
+// The star records are identical to those of version 0x0100 files. Sorted
+// star databases are generated from ordinary ones by the sortstardb tool.
+static const uint16 SORTED_FILE_VERSION        = 0x0200;
+static const unsigned int SORTED_HEADER_SIZE   = 24;
+
+struct SortedStarRecord
+{
+    uint32 catalogNumber;
+    float x, y, z;
+    int16 absMag;
+    uint16 spectralType;
+};
+
+struct SortedNodeRecord
+{
+    float x, y, z;
+    float exclusionFactor;
+    uint32 firstStar;
+    uint32 starCount;
+    uint32 hasChildren;
+};
+
+// An octree snapshot (see writeOctreeSnapshot) has the layout:
+//
+//   star count       uint32
+//   node count       uint32
+//   stars            SnapshotStarRecord[star count], in octree order
+//   octree nodes     SortedNodeRecord[node count], in depth first order
+//   catalog index    uint32[star count], star indices sorted by catalog number
+//
+// Only the properties of stars that determine their place in the octree
+// are recorded, as a check that the snapshot matches the loaded stars. The
+// orbital radii of stars also matter, but they aren't final until finish()
+// resolves barycenters after building the octree, so they can't be checked.
+struct SnapshotStarRecord
+{
+    uint32 catalogNumber;
+    float x, y, z;
+    float absMag;
+};
+
 
 // Used to sort stars by catalog number
 struct CatalogNumberOrderingPredicate
@@ -183,10 +243,19 @@ StarDatabase::StarDatabase():
     nStars               (0),
     stars                (NULL),
     namesDB              (NULL),
+    catalogNumberIndex   (NULL),
     octreeRoot           (NULL),
+    supplementalOctreeRoot(NULL),
+    starArrays           (NULL),
     nextAutoCatalogNumber(0xfffffffe),
     binFileCatalogNumberIndex(NULL),
-    binFileStarCount(0)
+    binFileStarCount(0),
+    sortedFile(NULL),
+    presortedStars(NULL),
+    presortedStarCount(0),
+    presortedNodeCount(0),
+    buildThreadCount(DefaultWorkerThreadCount()),
+    octreeFromSnapshot(false)
 {
     crossIndexes.resize(MaxCatalog);
 }
@@ -200,6 +269,10 @@ StarDatabase::~StarDatabase()
     if (catalogNumberIndex != NULL)
         delete [] catalogNumberIndex;
 
+    delete sortedFile;
+    delete[] presortedStars;
+    delete starArrays;
+
     for (vector<CrossIndex*>::iterator iter = crossIndexes.begin(); iter != crossIndexes.end(); ++iter)
     {
         if (*iter != NULL)
@@ -331,13 +404,14 @@ Star* StarDatabase::searchCrossIndex(const Catalog catalog, const uint32 number)
 }
 
 
-vector<string> StarDatabase::getCompletion(const string& name) const
+vector<string> StarDatabase::getCompletion(const string& name,
+                                           unsigned int maxCompletions) const
 {
     vector<string> completion;
 
     // only named stars are supported by completion.
     if (!name.empty() && namesDB != NULL)
-        return namesDB->getCompletion(name);
+        return namesDB->getCompletion(name, maxCompletions);
     else
         return completion;
 }
@@ -507,15 +581,13 @@ string StarDatabase::getStarNameList(const Star& star, const unsigned int maxNam
 }
 
 
-void StarDatabase::findVisibleStars(StarHandler& starHandler,
-                                    const Vector3f& position,
-                                    const Quaternionf& orientation,
-                                    float fovY,
-                                    float aspectRatio,
-                                    float limitingMag) const
+// Compute the bounding planes of an infinite view frustum
+static void ComputeFrustumPlanes(Hyperplane<float, 3>* frustumPlanes,
+                                 const Vector3f& position,
+                                 const Quaternionf& orientation,
+                                 float fovY,
+                                 float aspectRatio)
 {
-    // Compute the bounding planes of an infinite view frustum
-    Hyperplane<float, 3> frustumPlanes[5];
     Vector3f planeNormals[5];
     Eigen::Matrix3f rot = orientation.toRotationMatrix();
     float h = (float) tan(fovY / 2);
@@ -530,12 +602,137 @@ void StarDatabase::findVisibleStars(StarHandler& starHandler,
         planeNormals[i] = rot.transpose() * planeNormals[i].normalized();
         frustumPlanes[i] = Hyperplane<float, 3>(planeNormals[i], position);
     }
+}
+
+
+void StarDatabase::findVisibleStars(StarHandler& starHandler,
+                                    const Vector3f& position,
+                                    const Quaternionf& orientation,
+                                    float fovY,
+                                    float aspectRatio,
+                                    float limitingMag,
+                                    float cullMargin) const
+{
+    Hyperplane<float, 3> frustumPlanes[5];
+    ComputeFrustumPlanes(frustumPlanes, position, orientation, fovY, aspectRatio);
+
+    if (starArrays != NULL)
+    {
+        ProcessVisibleStars(octreeRoot, *starArrays, starHandler,
+                            position, frustumPlanes, limitingMag, cullMargin,
+                            STAR_OCTREE_ROOT_SIZE);
+        if (supplementalOctreeRoot != NULL)
+        {
+            ProcessVisibleStars(supplementalOctreeRoot, *starArrays, starHandler,
+                                position, frustumPlanes, limitingMag, cullMargin,
+                                STAR_OCTREE_ROOT_SIZE);
+        }
+        return;
+    }
 
     octreeRoot->processVisibleObjects(starHandler,
                                       position,
                                       frustumPlanes,
                                       limitingMag,
                                       STAR_OCTREE_ROOT_SIZE);
+    if (supplementalOctreeRoot != NULL)
+    {
+        supplementalOctreeRoot->processVisibleObjects(starHandler,
+                                                      position,
+                                                      frustumPlanes,
+                                                      limitingMag,
+                                                      STAR_OCTREE_ROOT_SIZE);
+    }
+}
+
+
+// Search one range of the star octree for visible stars
+class VisibleStarsTask : public WorkerTask
+{
+ public:
+    VisibleStarsTask(const StarOctreeRange& _range,
+                     const StarArrays& _arrays,
+                     StarHandler* _handler,
+                     const Vector3f& _position,
+                     const Hyperplane<float, 3>* _frustumPlanes,
+                     float _limitingMag,
+                     float _cullMargin) :
+        range(_range),
+        arrays(_arrays),
+        handler(_handler),
+        position(_position),
+        frustumPlanes(_frustumPlanes),
+        limitingMag(_limitingMag),
+        cullMargin(_cullMargin)
+    {
+    }
+
+    void run()
+    {
+        ProcessVisibleStars(range.node, arrays, *handler,
+                            position, frustumPlanes, limitingMag, cullMargin,
+                            range.scale, range.includeChildren);
+    }
+
+ private:
+    StarOctreeRange range;
+    const StarArrays& arrays;
+    StarHandler* handler;
+    Vector3f position;
+    const Hyperplane<float, 3>* frustumPlanes;
+    float limitingMag;
+    float cullMargin;
+};
+
+
+void StarDatabase::findVisibleStars(WorkerPool& workerPool,
+                                    PartitionedStarHandler& starHandler,
+                                    const Vector3f& position,
+                                    const Quaternionf& orientation,
+                                    float fovY,
+                                    float aspectRatio,
+                                    float limitingMag,
+                                    float cullMargin) const
+{
+    if (starArrays == NULL || workerPool.getThreadCount() == 0)
+    {
+        findVisibleStars(*starHandler.getPartHandler(0),
+                         position, orientation, fovY, aspectRatio,
+                         limitingMag, cullMargin);
+        return;
+    }
+
+    Hyperplane<float, 3> frustumPlanes[5];
+    ComputeFrustumPlanes(frustumPlanes, position, orientation, fovY, aspectRatio);
+
+    // Use several ranges per thread, as the number of stars in each of them
+    // varies a lot.
+    unsigned int minRanges = (workerPool.getThreadCount() + 1) * 8;
+    vector<StarOctreeRange> ranges;
+    SplitVisibleStarOctree(octreeRoot, position, frustumPlanes, limitingMag,
+                           STAR_OCTREE_ROOT_SIZE, minRanges, ranges);
+    if (supplementalOctreeRoot != NULL)
+    {
+        StarOctreeRange range;
+        range.node = supplementalOctreeRoot;
+        range.scale = STAR_OCTREE_ROOT_SIZE;
+        range.includeChildren = true;
+        ranges.push_back(range);
+    }
+
+    vector<WorkerTask*> tasks;
+    for (unsigned int i = 0; i < ranges.size(); i++)
+    {
+        tasks.push_back(new VisibleStarsTask(ranges[i], *starArrays,
+                                             starHandler.getPartHandler(i),
+                                             position, frustumPlanes,
+                                             limitingMag, cullMargin));
+    }
+
+    workerPool.run(tasks);
+
+    for (unsigned int i = 0; i < tasks.size(); i++)
+        delete tasks[i];
 }
 
 
@@ -547,6 +744,74 @@ void StarDatabase::findCloseStars(StarHandler& starHandler,
                                     position,
                                     radius,
                                     STAR_OCTREE_ROOT_SIZE);
+    if (supplementalOctreeRoot != NULL)
+    {
+        supplementalOctreeRoot->processCloseObjects(starHandler,
+                                                    position,
+                                                    radius,
+                                                    STAR_OCTREE_ROOT_SIZE);
+    }
+}
+
+
+void StarDatabase::findStarsInCone(StarHandler& starHandler,
+                                   const Vector3f& position,
+                                   const Vector3f& axis,
+                                   float halfAngle,
+                                   float maxDistance,
+                                   float limitingMag) const
+{
+    octreeRoot->processObjectsInCone(starHandler,
+                                     position,
+                                     axis,
+                                     halfAngle,
+                                     maxDistance,
+                                     limitingMag,
+                                     STAR_OCTREE_ROOT_SIZE);
+    if (supplementalOctreeRoot != NULL)
+    {
+        supplementalOctreeRoot->processObjectsInCone(starHandler,
+                                                     position,
+                                                     axis,
+                                                     halfAngle,
+                                                     maxDistance,
+                                                     limitingMag,
+                                                     STAR_OCTREE_ROOT_SIZE);
+    }
+}
+
+
+void StarDatabase::findNearestStars(const Vector3f& position,
+                                    unsigned int nStars,
+                                    vector<const Star*>& stars,
+                                    float maxDistance) const
+{
+    vector<const StarOctree*> roots;
+    roots.push_back(octreeRoot);
+    roots.push_back(supplementalOctreeRoot);
+    FindNearestStars(roots, position, nStars, maxDistance, STAR_OCTREE_ROOT_SIZE, stars);
+}
+
+
+void StarDatabase::findBrightestStars(const Vector3f& position,
+                                      unsigned int nStars,
+                                      vector<const Star*>& stars,
+                                      float limitingMag) const
+{
+    vector<const StarOctree*> roots;
+    roots.push_back(octreeRoot);
+    roots.push_back(supplementalOctreeRoot);
+    FindBrightestStars(roots, position, nStars, limitingMag, STAR_OCTREE_ROOT_SIZE, stars);
+}
+
+
+void StarDatabase::findMostLuminousStars(unsigned int nStars,
+                                         vector<const Star*>& stars) const
+{
+    vector<const StarOctree*> roots;
+    roots.push_back(octreeRoot);
+    roots.push_back(supplementalOctreeRoot);
+    FindMostLuminousStars(roots, nStars, STAR_OCTREE_ROOT_SIZE, stars);
 }
 
 
@@ -731,16 +996,341 @@ bool StarDatabase::loadBinary(istream& in)
 }
 
 
+/*! Load a sorted star database (version 0x0200.) The file is memory mapped
+ *  and kept open until finish() is called, at which point the octree and
+ *  catalog number index stored in the file are used directly instead of being
+ *  rebuilt. A sorted database may only be loaded into an empty StarDatabase.
+ *  Returns false without printing an error if the file isn't a sorted star
+ *  database, so that the caller can fall back to loadBinary().
+ */
+bool StarDatabase::loadSortedBinary(const string& filename)
+{
+    COMPILE_TIME_ASSERT(sizeof(SortedStarRecord) == 20);
+    COMPILE_TIME_ASSERT(sizeof(SortedNodeRecord) == 28);
+
+    MappedFile* file = OpenMappedFile(filename);
+    if (file == NULL)
+        return false;
+
+    const char* data = file->data();
+    if (file->size() < SORTED_HEADER_SIZE ||
+        strncmp(data, FILE_HEADER, strlen(FILE_HEADER)) != 0)
+    {
+        delete file;
+        return false;
+    }
+
+    uint16 version;
+    memcpy(&version, data + 8, sizeof version);
+    LE_TO_CPU_INT16(version, version);
+    if (version != SORTED_FILE_VERSION)
+    {
+        delete file;
+        return false;
+    }
+
+    if (nStars != 0)
+    {
+        cerr << _("Sorted star database must be loaded before other star catalogs\n");
+        delete file;
+        return false;
+    }
+
+    uint32 nStarsInFile = 0;
+    uint32 nNodes = 0;
+    float rootSize = 0.0f;
+    memcpy(&nStarsInFile, data + 12, sizeof nStarsInFile);
+    LE_TO_CPU_INT32(nStarsInFile, nStarsInFile);
+    memcpy(&nNodes, data + 16, sizeof nNodes);
+    LE_TO_CPU_INT32(nNodes, nNodes);
+    memcpy(&rootSize, data + 20, sizeof rootSize);
+    LE_TO_CPU_FLOAT(rootSize, rootSize);
+
+    size_t expectedSize = SORTED_HEADER_SIZE +
+                          (size_t) nStarsInFile * (sizeof(SortedStarRecord) + sizeof(uint32)) +
+                          (size_t) nNodes * sizeof(SortedNodeRecord);
+    if (file->size() != expectedSize || nNodes == 0 || rootSize != STAR_OCTREE_ROOT_SIZE)
+    {
+        cerr << _("Bad sorted star database ") << filename << '\n';
+        delete file;
+        return false;
+    }
+
+    const SortedStarRecord* records = reinterpret_cast<const SortedStarRecord*>(data + SORTED_HEADER_SIZE);
+    const SortedNodeRecord* nodes = reinterpret_cast<const SortedNodeRecord*>(records + nStarsInFile);
+    const uint32* catalogIndex = reinterpret_cast<const uint32*>(nodes + nNodes);
+
+    // Star records are the only thing that must be converted to objects up
+    // front: stc files loaded after this may look up and modify stars.
+    Star* sorted = new Star[nStarsInFile];
+    for (uint32 i = 0; i < nStarsInFile; i++)
+    {
+        const SortedStarRecord& rec = records[i];
+        uint32 catNo;
+        float x, y, z;
+        int16 absMag;
+        uint16 spectralType;
+        LE_TO_CPU_INT32(catNo, rec.catalogNumber);
+        LE_TO_CPU_FLOAT(x, rec.x);
+        LE_TO_CPU_FLOAT(y, rec.y);
+        LE_TO_CPU_FLOAT(z, rec.z);
+        LE_TO_CPU_INT16(absMag, rec.absMag);
+        LE_TO_CPU_INT16(spectralType, rec.spectralType);
+
+        // An out of range luminosity class can only come from a corrupt
+        // file; it must be rejected here since GetStarDetails doesn't.
+        StarDetails* details = NULL;
+        StellarClass sc;
+        if (sc.unpack(spectralType) &&
+            sc.getLuminosityClass() < StellarClass::Lum_Count)
+        {
+            details = StarDetails::GetStarDetails(sc);
+        }
+
+        if (details == NULL)
+        {
+            cerr << _("Bad spectral type in star database, star #") << i << "\n";
+            delete[] sorted;
+            delete file;
+            return false;
+        }
+
+        Star& star = sorted[i];
+        star.setPosition(x, y, z);
+        star.setAbsoluteMagnitude((float) absMag / 256.0f);
+        star.setDetails(details);
+        star.setCatalogNumber(catNo);
+    }
+
+    // The catalog index in the file is already sorted, so it can serve as
+    // the load time index without any sorting.
+    binFileCatalogNumberIndex = new Star*[nStarsInFile];
+    for (uint32 i = 0; i < nStarsInFile; i++)
+    {
+        uint32 starIndex;
+        LE_TO_CPU_INT32(starIndex, catalogIndex[i]);
+        if (starIndex >= nStarsInFile)
+        {
+            cerr << _("Bad sorted star database ") << filename << '\n';
+            delete[] binFileCatalogNumberIndex;
+            binFileCatalogNumberIndex = NULL;
+            delete[] sorted;
+            delete file;
+            return false;
+        }
+        binFileCatalogNumberIndex[i] = sorted + starIndex;
+    }
+
+    binFileStarCount = nStarsInFile;
+    presortedStars = sorted;
+    presortedStarCount = nStarsInFile;
+    presortedNodeCount = nNodes;
+    sortedFile = file;
+    nStars = nStarsInFile;
+
+    clog << nStars << _(" stars in sorted binary database\n");
+
+    return true;
+}
+
+
+static void writeUint(ostream& out, uint32 n)
+{
+    LE_TO_CPU_INT32(n, n);
+    out.write(reinterpret_cast<char*>(&n), sizeof n);
+}
+
+static void writeFloat(ostream& out, float f)
+{
+    LE_TO_CPU_FLOAT(f, f);
+    out.write(reinterpret_cast<char*>(&f), sizeof f);
+}
+
+static void writeUshort(ostream& out, uint16 n)
+{
+    LE_TO_CPU_INT16(n, n);
+    out.write(reinterpret_cast<char*>(&n), sizeof n);
+}
+
+static void writeShort(ostream& out, int16 n)
+{
+    LE_TO_CPU_INT16(n, n);
+    out.write(reinterpret_cast<char*>(&n), sizeof n);
+}
+
+
+static void writeOctreeNodes(ostream& out, const StarOctree* node, const Star* firstStar)
+{
+    const StarOctree* child = node->getChild(0);
+
+    writeFloat(out, node->getCellCenter().x());
+    writeFloat(out, node->getCellCenter().y());
+    writeFloat(out, node->getCellCenter().z());
+    writeFloat(out, node->getExclusionFactor());
+    writeUint(out, (uint32) (node->getFirstObject() - firstStar));
+    writeUint(out, node->getObjectCount());
+    writeUint(out, child != NULL ? 1 : 0);
+
+    if (child != NULL)
+    {
+        for (int i = 0; i < 8; i++)
+            writeOctreeNodes(out, node->getChild(i), firstStar);
+    }
+}
+
+
+/*! Write the database as a sorted star database. This may only be done for
+ *  a database that has been finished and that contains just stars from
+ *  binary star files: stars defined in stc files may have details that
+ *  can't be represented by a packed spectral type.
+ */
+bool StarDatabase::writeSortedBinary(ostream& out) const
+{
+    if (octreeRoot == NULL || supplementalOctreeRoot != NULL)
+        return false;
+
+    // Recover the packed spectral types of the stars; every valid packed
+    // spectral type maps to a shared details record.
+    map<const StarDetails*, uint16> packedSpectralTypes;
+    for (uint32 packed = 0; packed <= 0xffff; packed++)
+    {
+        // Packed types with an out of range luminosity class are rejected
+        // here, since GetStarDetails doesn't check for them.
+        StellarClass sc;
+        if (sc.unpack((uint16) packed) &&
+            sc.getLuminosityClass() < StellarClass::Lum_Count)
+        {
+            StarDetails* details = StarDetails::GetStarDetails(sc);
+            if (details != NULL && packedSpectralTypes.find(details) == packedSpectralTypes.end())
+                packedSpectralTypes[details] = (uint16) packed;
+        }
+    }
+
+    vector<uint16> spectralTypes(nStars);
+    for (int i = 0; i < nStars; i++)
+    {
+        map<const StarDetails*, uint16>::const_iterator iter = packedSpectralTypes.find(stars[i].getDetails());
+        if (iter == packedSpectralTypes.end())
+        {
+            cerr << _("Star ") << stars[i].getCatalogNumber() << _(" can't be written to a sorted database\n");
+            return false;
+        }
+        spectralTypes[i] = iter->second;
+    }
+
+    out.write(FILE_HEADER, strlen(FILE_HEADER));
+    writeUshort(out, SORTED_FILE_VERSION);
+    writeUshort(out, 0);
+    writeUint(out, (uint32) nStars);
+    writeUint(out, (uint32) (1 + octreeRoot->countChildren()));
+    writeFloat(out, STAR_OCTREE_ROOT_SIZE);
+
+    for (int i = 0; i < nStars; i++)
+    {
+        const Star& star = stars[i];
+        writeUint(out, star.getCatalogNumber());
+        writeFloat(out, star.getPosition().x());
+        writeFloat(out, star.getPosition().y());
+        writeFloat(out, star.getPosition().z());
+        writeShort(out, (int16) floor(star.getAbsoluteMagnitude() * 256.0f + 0.5f));
+        writeUshort(out, spectralTypes[i]);
+    }
+
+    writeOctreeNodes(out, octreeRoot, stars);
+
+    for (int i = 0; i < nStars; i++)
+        writeUint(out, (uint32) (catalogNumberIndex[i] - stars));
+
+    return out.good();
+}
+
+
+/*! Write a snapshot of the octree and catalog number index built by
+ *  finish(). This fails for a database with a supplemental octree, which
+ *  is built quickly anyway, or with stars sharing a catalog number.
+ */
+bool StarDatabase::writeOctreeSnapshot(ostream& out) const
+{
+    if (octreeRoot == NULL || supplementalOctreeRoot != NULL)
+        return false;
+
+    for (int i = 1; i < nStars; i++)
+    {
+        if (catalogNumberIndex[i - 1]->getCatalogNumber() == catalogNumberIndex[i]->getCatalogNumber())
+            return false;
+    }
+
+    writeUint(out, (uint32) nStars);
+    writeUint(out, (uint32) (1 + octreeRoot->countChildren()));
+
+    for (int i = 0; i < nStars; i++)
+    {
+        const Star& star = stars[i];
+        writeUint(out, star.getCatalogNumber());
+        writeFloat(out, star.getPosition().x());
+        writeFloat(out, star.getPosition().y());
+        writeFloat(out, star.getPosition().z());
+        writeFloat(out, star.getAbsoluteMagnitude());
+    }
+
+    writeOctreeNodes(out, octreeRoot, stars);
+
+    for (int i = 0; i < nStars; i++)
+        writeUint(out, (uint32) (catalogNumberIndex[i] - stars));
+
+    return out.good();
+}
+
+
+void StarDatabase::setOctreeSnapshot(const string& snapshot)
+{
+    octreeSnapshot = snapshot;
+}
+
+
+bool StarDatabase::usedOctreeSnapshot() const
+{
+    return octreeFromSnapshot;
+}
+
+
+void StarDatabase::buildStarArrays()
+{
+    if (starArrays == NULL && octreeRoot != NULL)
+        starArrays = new StarArrays(stars, nStars);
+}
+
+
+void StarDatabase::setBuildThreadCount(unsigned int threadCount)
+{
+    buildThreadCount = threadCount;
+}
+
+
 void StarDatabase::finish()
 {
     clog << _("Total star count: ") << nStars << endl;
     
-    buildOctree();
-    buildIndexes();
+    if (!buildOctreeFromSnapshot() && (sortedFile == NULL || !buildOctreeFromSortedFile()))
+    {
+        buildOctree();
+        buildIndexes();
+    }
+    string().swap(octreeSnapshot);
 
     // Delete the temporary indices used only during loading
     delete[] binFileCatalogNumberIndex;
+    binFileCatalogNumberIndex = NULL;
     stcFileCatalogNumberIndex.clear();
+
+    if (namesDB != NULL)
+        namesDB->buildCompletionIndex();
+
+    // The sorted database file isn't needed once the octree is built
+    delete sortedFile;
+    sortedFile = NULL;
+    delete[] presortedStars;
+    presortedStars = NULL;
     
     // Resolve all barycenters; this can't be done before star sorting. There's
     // still a bug here: final orbital radii aren't available until after
@@ -1175,6 +1765,13 @@ bool StarDatabase::createStar(Star* star,
 bool StarDatabase::load(istream& in, const string& resourcePath)
 {
     Tokenizer tokenizer(&in);
+    return load(tokenizer, resourcePath);
+}
+
+
+/*! Load stars from a tokenizer, such as one replaying a ParsedCatalog. */
+bool StarDatabase::load(Tokenizer& tokenizer, const string& resourcePath)
+{
     Parser parser(&tokenizer);
 
     while (tokenizer.nextToken() != Tokenizer::TokenEnd)
@@ -1390,15 +1987,30 @@ void StarDatabase::buildOctree()
                                       STAR_OCTREE_ROOT_SIZE * (float) sqrt(3.0));
     DynamicStarOctree* root = new DynamicStarOctree(Vector3f(1000.0f, 1000.0f, 1000.0f),
                                                     absMag);
+
+    // Stars from a presorted database end up here only if stc files modified
+    // them in a way that invalidated the prebuilt octree.
+    vector<const Star*> starList;
+    starList.reserve(presortedStarCount + unsortedStars.size());
+    for (unsigned int i = 0; i < presortedStarCount; ++i)
+        starList.push_back(&presortedStars[i]);
     for (unsigned int i = 0; i < unsortedStars.size(); ++i)
-    {
-        root->insertObject(unsortedStars[i], STAR_OCTREE_ROOT_SIZE);
-    }
+        starList.push_back(&unsortedStars[i]);
+
+    // The octree builder produces exactly the same octree regardless of the
+    // number of threads.
+    WorkerPool* pool = NULL;
+    if (buildThreadCount > 0)
+        pool = new WorkerPool(buildThreadCount);
+    OctreeBuilder<Star, float> builder(pool);
+
+    builder.insertObjects(*root, starList, STAR_OCTREE_ROOT_SIZE);
     
     DPRINTF(1, "Spatially sorting stars for improved locality of reference . . .\n");
     Star* sortedStars    = new Star[nStars];
     Star* firstStar      = sortedStars;
-    root->rebuildAndSort(octreeRoot, firstStar);
+    builder.rebuildAndSort(*root, octreeRoot, firstStar);
+    delete pool;
 
     // ASSERT((int) (firstStar - sortedStars) == nStars);
     DPRINTF(1, "%d stars total\n", (int) (firstStar - sortedStars));
@@ -1441,6 +2053,299 @@ void StarDatabase::buildIndexes()
 }
 
 
+// Recreate a node of a prebuilt octree and all of its descendants. Returns
+// NULL if the node records are inconsistent.
+static StarOctree* restoreOctreeNode(const SortedNodeRecord*& node,
+                                     const SortedNodeRecord* end,
+                                     Star* firstStar,
+                                     uint32 starCount)
+{
+    if (node == end)
+        return NULL;
+
+    float x, y, z, exclusionFactor;
+    uint32 first, count, hasChildren;
+    LE_TO_CPU_FLOAT(x, node->x);
+    LE_TO_CPU_FLOAT(y, node->y);
+    LE_TO_CPU_FLOAT(z, node->z);
+    LE_TO_CPU_FLOAT(exclusionFactor, node->exclusionFactor);
+    LE_TO_CPU_INT32(first, node->firstStar);
+    LE_TO_CPU_INT32(count, node->starCount);
+    LE_TO_CPU_INT32(hasChildren, node->hasChildren);
+    ++node;
+
+    if (first > starCount || count > starCount - first)
+        return NULL;
+
+    StarOctree* octree = new StarOctree(Vector3f(x, y, z), exclusionFactor, firstStar + first, count);
+    if (hasChildren != 0)
+    {
+        StarOctree** children = new StarOctree*[8];
+        for (int i = 0; i < 8; i++)
+            children[i] = NULL;
+        octree->setChildren(children);
+
+        for (int i = 0; i < 8; i++)
+        {
+            children[i] = restoreOctreeNode(node, end, firstStar, starCount);
+            if (children[i] == NULL)
+            {
+                // Children that weren't created are NULL, and get skipped
+                // by the octree destructor.
+                delete octree;
+                return NULL;
+            }
+        }
+    }
+
+    return octree;
+}
+
+
+/*! Use the octree and catalog number index from a sorted star database.
+ *  Stars added by stc files are placed in a separate, much smaller octree.
+ *  If stc files changed the position, brightness, or orbit of any star
+ *  from the sorted database, the prebuilt octree can't be used and this
+ *  method returns false; the caller must then build the octree from scratch.
+ */
+bool StarDatabase::buildOctreeFromSortedFile()
+{
+    const SortedStarRecord* records = reinterpret_cast<const SortedStarRecord*>(sortedFile->data() + SORTED_HEADER_SIZE);
+    const SortedNodeRecord* nodes = reinterpret_cast<const SortedNodeRecord*>(records + presortedStarCount);
+    const uint32* catalogIndex = reinterpret_cast<const uint32*>(nodes + presortedNodeCount);
+
+    for (unsigned int i = 0; i < presortedStarCount; i++)
+    {
+        const Star& star = presortedStars[i];
+        float x, y, z;
+        int16 absMag;
+        LE_TO_CPU_FLOAT(x, records[i].x);
+        LE_TO_CPU_FLOAT(y, records[i].y);
+        LE_TO_CPU_FLOAT(z, records[i].z);
+        LE_TO_CPU_INT16(absMag, records[i].absMag);
+
+        if (star.getPosition() != Vector3f(x, y, z) ||
+            star.getAbsoluteMagnitude() != (float) absMag / 256.0f ||
+            star.getOrbit() != NULL ||
+            star.getOrbitalRadius() != 0.0f)
+        {
+            clog << _("Star catalogs modified the sorted star database; rebuilding octree\n");
+            return false;
+        }
+    }
+
+    unsigned int nExtraStars = unsortedStars.size();
+    Star* allStars = presortedStars;
+    if (nExtraStars > 0)
+    {
+        allStars = new Star[nStars];
+        copy(presortedStars, presortedStars + presortedStarCount, allStars);
+    }
+
+    const SortedNodeRecord* node = nodes;
+    StarOctree* root = restoreOctreeNode(node, nodes + presortedNodeCount, allStars, presortedStarCount);
+    if (root == NULL || node != nodes + presortedNodeCount)
+    {
+        cerr << _("Bad octree in sorted star database\n");
+        delete root;
+        if (allStars != presortedStars)
+            delete[] allStars;
+        return false;
+    }
+
+    Star** extraStarIndex = NULL;
+    if (nExtraStars > 0)
+    {
+        DPRINTF(1, "Sorting %u stars from star catalogs into octree . . .\n", nExtraStars);
+        float absMag = astro::appToAbsMag(STAR_OCTREE_MAGNITUDE,
+                                          STAR_OCTREE_ROOT_SIZE * (float) sqrt(3.0));
+        DynamicStarOctree* extraRoot = new DynamicStarOctree(Vector3f(1000.0f, 1000.0f, 1000.0f),
+                                                             absMag);
+        for (unsigned int i = 0; i < nExtraStars; ++i)
+            extraRoot->insertObject(unsortedStars[i], STAR_OCTREE_ROOT_SIZE);
+
+        Star* firstStar = allStars + presortedStarCount;
+        extraRoot->rebuildAndSort(supplementalOctreeRoot, firstStar);
+        delete extraRoot;
+        unsortedStars.clear();
+
+        extraStarIndex = new Star*[nExtraStars];
+        for (unsigned int i = 0; i < nExtraStars; ++i)
+            extraStarIndex[i] = allStars + presortedStarCount + i;
+        sort(extraStarIndex, extraStarIndex + nExtraStars, PtrCatalogNumberOrderingPredicate());
+    }
+    else
+    {
+        // The stars array takes ownership of the presorted stars
+        presortedStars = NULL;
+    }
+
+    octreeRoot = root;
+    stars = allStars;
+
+    // Merge the prebuilt catalog number index with the index of stars
+    // added from stc files.
+    Star** presortedIndex = new Star*[presortedStarCount];
+    for (unsigned int i = 0; i < presortedStarCount; i++)
+    {
+        uint32 starIndex;
+        LE_TO_CPU_INT32(starIndex, catalogIndex[i]);
+        presortedIndex[i] = stars + starIndex;
+    }
+
+    catalogNumberIndex = new Star*[nStars];
+    merge(presortedIndex, presortedIndex + presortedStarCount,
+          extraStarIndex, extraStarIndex + nExtraStars,
+          catalogNumberIndex,
+          PtrCatalogNumberOrderingPredicate());
+
+    delete[] presortedIndex;
+    delete[] extraStarIndex;
+
+    DPRINTF(1, "Octree has %d nodes and %d stars.\n",
+            1 + octreeRoot->countChildren(), octreeRoot->countObjects());
+
+    return true;
+}
+
+
+/*! Use the octree snapshot to place the loaded stars, provided that it
+ *  has exactly the same stars, identified by catalog number, with the same
+ *  positions and magnitudes. Returns false otherwise, and the octree must
+ *  then be built from scratch.
+ */
+bool StarDatabase::buildOctreeFromSnapshot()
+{
+    COMPILE_TIME_ASSERT(sizeof(SnapshotStarRecord) == 20);
+
+    if (octreeSnapshot.empty())
+        return false;
+
+    const char* data = octreeSnapshot.data();
+    uint32 nStarsInSnapshot = 0;
+    uint32 nNodes = 0;
+    if (octreeSnapshot.size() >= 8)
+    {
+        memcpy(&nStarsInSnapshot, data, sizeof nStarsInSnapshot);
+        LE_TO_CPU_INT32(nStarsInSnapshot, nStarsInSnapshot);
+        memcpy(&nNodes, data + 4, sizeof nNodes);
+        LE_TO_CPU_INT32(nNodes, nNodes);
+    }
+
+    size_t expectedSize = 8 + (size_t) nStarsInSnapshot * (sizeof(SnapshotStarRecord) + sizeof(uint32)) +
+                          (size_t) nNodes * sizeof(SortedNodeRecord);
+    if (octreeSnapshot.size() != expectedSize || nStarsInSnapshot != (uint32) nStars || nNodes == 0)
+    {
+        clog << _("Star octree snapshot doesn't match the star catalogs; rebuilding octree\n");
+        return false;
+    }
+
+    // List the loaded stars in catalog number order by merging the indexes
+    // used during loading. They cover all stars only when no catalog
+    // number is shared, which is also required for the snapshot to be used.
+    vector<Star*> starsByCatalogNumber;
+    starsByCatalogNumber.reserve(nStars);
+    {
+        Star** binIter = binFileCatalogNumberIndex;
+        Star** binEnd = binFileCatalogNumberIndex + (binIter != NULL ? binFileStarCount : 0);
+        map<uint32, Star*>::const_iterator stcIter = stcFileCatalogNumberIndex.begin();
+        while (binIter != binEnd || stcIter != stcFileCatalogNumberIndex.end())
+        {
+            if (stcIter == stcFileCatalogNumberIndex.end() ||
+                (binIter != binEnd && (*binIter)->getCatalogNumber() < stcIter->first))
+            {
+                starsByCatalogNumber.push_back(*binIter++);
+            }
+            else
+            {
+                starsByCatalogNumber.push_back(stcIter->second);
+                ++stcIter;
+            }
+        }
+    }
+
+    const SnapshotStarRecord* records = reinterpret_cast<const SnapshotStarRecord*>(data + 8);
+    const SortedNodeRecord* nodes = reinterpret_cast<const SortedNodeRecord*>(records + nStarsInSnapshot);
+    const uint32* catalogIndex = reinterpret_cast<const uint32*>(nodes + nNodes);
+
+    bool matches = starsByCatalogNumber.size() == nStarsInSnapshot;
+    Star* sortedStars = NULL;
+    Star** sortedIndex = NULL;
+    if (matches)
+    {
+        sortedStars = new Star[nStars];
+        sortedIndex = new Star*[nStars];
+    }
+
+    for (uint32 i = 0; i < nStarsInSnapshot && matches; i++)
+    {
+        const Star* star = starsByCatalogNumber[i];
+        uint32 starIndex;
+        LE_TO_CPU_INT32(starIndex, catalogIndex[i]);
+
+        // Strictly increasing catalog numbers guarantee that each record
+        // is matched by just one star.
+        if (starIndex >= nStarsInSnapshot ||
+            (i > 0 && star->getCatalogNumber() <= starsByCatalogNumber[i - 1]->getCatalogNumber()))
+        {
+            matches = false;
+            break;
+        }
+
+        const SnapshotStarRecord& rec = records[starIndex];
+        uint32 catNo;
+        float x, y, z, absMag;
+        LE_TO_CPU_INT32(catNo, rec.catalogNumber);
+        LE_TO_CPU_FLOAT(x, rec.x);
+        LE_TO_CPU_FLOAT(y, rec.y);
+        LE_TO_CPU_FLOAT(z, rec.z);
+        LE_TO_CPU_FLOAT(absMag, rec.absMag);
+
+        if (catNo != star->getCatalogNumber() ||
+            star->getPosition() != Vector3f(x, y, z) ||
+            star->getAbsoluteMagnitude() != absMag)
+        {
+            matches = false;
+            break;
+        }
+
+        sortedStars[starIndex] = *star;
+        sortedIndex[i] = sortedStars + starIndex;
+    }
+
+    StarOctree* root = NULL;
+    if (matches)
+    {
+        const SortedNodeRecord* node = nodes;
+        root = restoreOctreeNode(node, nodes + nNodes, sortedStars, nStarsInSnapshot);
+        if (root == NULL || node != nodes + nNodes)
+        {
+            delete root;
+            matches = false;
+        }
+    }
+
+    if (!matches)
+    {
+        clog << _("Star octree snapshot doesn't match the star catalogs; rebuilding octree\n");
+        delete[] sortedStars;
+        delete[] sortedIndex;
+        return false;
+    }
+
+    octreeRoot = root;
+    stars = sortedStars;
+    catalogNumberIndex = sortedIndex;
+    unsortedStars.clear();
+    octreeFromSnapshot = true;
+
+    DPRINTF(1, "Octree has %d nodes and %d stars.\n",
+            1 + octreeRoot->countChildren(), octreeRoot->countObjects());
+
+    return true;
+}
+
+
 /*! While loading the star catalogs, this function must be called instead of
  *  find(). The final catalog number index for stars cannot be built until
  *  after all stars have been loaded. During catalog loading, there are two
@@ -20,9 +20,28 @@
 #include <celengine/staroctree.h>
 #include <celengine/parser.h>
 
+class MappedFile;
+class WorkerPool;
 
 static const unsigned int MAX_STAR_NAMES = 10;
 
+
+/*! A parallel search for visible stars divides the star octree into parts,
+ *  each of which is searched on a worker thread with a handler of its own.
+ *  Processing the stars found in parts 0, 1, 2... in that order is
+ *  equivalent to a single threaded search of the whole octree.
+ */
+class PartitionedStarHandler
+{
+ public:
+    virtual ~PartitionedStarHandler() {};
+
+    // Return the handler for the specified part. All handlers are requested
+    // on the thread that started the search, before the search begins; the
+    // parts are numbered consecutively from zero.
+    virtual StarHandler* getPartHandler(unsigned int part) = 0;
+};
+
 // TODO: Move BlockArray to celutil; consider making it a full STL
 // style container with iterator support.
 
@@ -114,19 +133,60 @@ class StarDatabase
     Star* find(const std::string&) const;
     uint32 findCatalogNumberByName(const std::string&) const;
 
-    std::vector<std::string> getCompletion(const std::string&) const;
+    std::vector<std::string> getCompletion(const std::string&,
+                                           unsigned int maxCompletions = 0) const;
 
+    // If star arrays have been built and cullMargin is non-negative, stars
+    // outside the view frustum enlarged by cullMargin (the sine of an angle)
+    // are culled instead of being passed to the handler.
     void findVisibleStars(StarHandler& starHandler,
                           const Eigen::Vector3f& obsPosition,
                           const Eigen::Quaternionf&   obsOrientation,
                           float fovY,
                           float aspectRatio,
-                          float limitingMag) const;
+                          float limitingMag,
+                          float cullMargin = -1.0f) const;
+
+    // Multithreaded version of findVisibleStars; if the star arrays haven't
+    // been built, the search is not divided and runs on the calling thread.
+    void findVisibleStars(WorkerPool& workerPool,
+                          PartitionedStarHandler& starHandler,
+                          const Eigen::Vector3f& obsPosition,
+                          const Eigen::Quaternionf&   obsOrientation,
+                          float fovY,
+                          float aspectRatio,
+                          float limitingMag,
+                          float cullMargin = -1.0f) const;
 
     void findCloseStars(StarHandler& starHandler,
                         const Eigen::Vector3f& obsPosition,
                         float radius) const;
 
+    // Pass to starHandler the stars within maxDistance of obsPosition,
+    // within halfAngle radians of the unit vector axis and brighter than
+    // limitingMag as seen from obsPosition.
+    void findStarsInCone(StarHandler& starHandler,
+                         const Eigen::Vector3f& obsPosition,
+                         const Eigen::Vector3f& axis,
+                         float halfAngle,
+                         float maxDistance,
+                         float limitingMag) const;
+
+    // Append to stars the nStars stars nearest to obsPosition, or brightest
+    // as seen from obsPosition, best match first. If nStars is zero, all
+    // stars within maxDistance or brighter than limitingMag are found.
+    void findNearestStars(const Eigen::Vector3f& obsPosition,
+                          unsigned int nStars,
+                          std::vector<const Star*>& stars,
+                          float maxDistance = 1.0e30f) const;
+    void findBrightestStars(const Eigen::Vector3f& obsPosition,
+                            unsigned int nStars,
+                            std::vector<const Star*>& stars,
+                            float limitingMag = 1.0e30f) const;
+    // Append to stars the nStars stars with the brightest absolute magnitude
+    void findMostLuminousStars(unsigned int nStars,
+                               std::vector<const Star*>& stars) const;
+
     std::string getStarName    (const Star&, bool i18n = false) const;
     void getStarName(const Star& star, char* nameBuffer, unsigned int bufferSize, bool i18n = false) const;
     std::string getStarNameList(const Star&, const unsigned int maxNames = MAX_STAR_NAMES) const;
@@ -135,7 +195,10 @@ class StarDatabase
     void setNameDatabase(StarNameDatabase*);
     
     bool load(std::istream&, const std::string& resourcePath);
+    bool load(Tokenizer&, const std::string& resourcePath);
     bool loadBinary(std::istream&);
+    bool loadSortedBinary(const std::string& filename);
+    bool writeSortedBinary(std::ostream&) const;
 
     enum Catalog
     {
@@ -171,8 +234,27 @@ class StarDatabase
     Star*  searchCrossIndex(const Catalog, const uint32 number) const;
     uint32 crossIndex      (const Catalog, const uint32 number) const;
 
+    // Set the number of worker threads used to build the octree in
+    // finish(); zero builds it on the calling thread.
+    void setBuildThreadCount(unsigned int);
+
     void finish();
 
+    // An octree snapshot records the octree and catalog number index built
+    // by finish(), so that they can be restored when exactly the same stars
+    // are loaded again instead of being rebuilt. A snapshot set before
+    // finish() is checked against the loaded stars and ignored if they
+    // differ in any way that matters to the octree; usedOctreeSnapshot()
+    // tells whether finish() used it.
+    bool writeOctreeSnapshot(std::ostream&) const;
+    void setOctreeSnapshot(const std::string& snapshot);
+    bool usedOctreeSnapshot() const;
+
+    // Create a structure-of-arrays copy of the star positions and
+    // magnitudes, which makes findVisibleStars much faster for large
+    // catalogs. This may only be called after finish().
+    void buildStarArrays();
+
     static StarDatabase* read(std::istream&);
 
     static const char* FILE_HEADER;
@@ -188,6 +270,8 @@ private:
 
     void buildOctree();
     void buildIndexes();
+    bool buildOctreeFromSortedFile();
+    bool buildOctreeFromSnapshot();
     Star* findWhileLoading(uint32 catalogNumber) const;
 
     int nStars;
@@ -196,6 +280,10 @@ private:
     StarNameDatabase* namesDB;
     Star**            catalogNumberIndex;
     StarOctree*       octreeRoot;
+    // Octree for stars added by stc files on top of a presorted binary
+    // database; NULL when all stars are in the main octree.
+    StarOctree*       supplementalOctreeRoot;
+    StarArrays*       starArrays;
     uint32            nextAutoCatalogNumber;
 
     std::vector<CrossIndex*> crossIndexes;
@@ -208,6 +296,14 @@ private:
     unsigned int binFileStarCount;
     // Catalog number -> star mapping for stars loaded from stc files
     std::map<uint32, Star*> stcFileCatalogNumberIndex;    
+    // Memory mapped presorted star database and the stars read from it
+    MappedFile* sortedFile;
+    Star* presortedStars;
+    unsigned int presortedStarCount;
+    unsigned int presortedNodeCount;
+    unsigned int buildThreadCount;
+    std::string octreeSnapshot;
+    bool octreeFromSnapshot;
 
     struct BarycenterUsage
     {
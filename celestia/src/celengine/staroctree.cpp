@@ -11,8 +11,19 @@
 // of the License, or (at your option) any later version.
 
 #include <celengine/staroctree.h>
+#include <cstddef>
+#include <cmath>
+#include <algorithm>
+#include <queue>
+#include <limits>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define STAR_ARRAYS_SSE
+#include <xmmintrin.h>
+#endif
 
 using namespace Eigen;
+using namespace std;
 
 // Maximum permitted orbital radius for stars, in light years. Orbital
 // radii larger than this value are not guaranteed to give correct
@@ -144,6 +155,64 @@ void StarOctree::processVisibleObjects(StarHandler&    processor,
 }
 
 
+template<>
+void StarOctree::processObjectsInCone(StarHandler&    processor,
+                                      const Vector3f& obsPosition,
+                                      const Vector3f& axis,
+                                      float           halfAngle,
+                                      float           maxDistance,
+                                      float           limitingFactor,
+                                      float           scale) const
+{
+    float nodeRadius  = scale * StarOctree::SQRT3;
+    float minDistance = (obsPosition - cellCenterPos).norm() - nodeRadius;
+    if (minDistance > maxDistance)
+        return;
+
+    if (!SphereIntersectsCone(cellCenterPos, nodeRadius, obsPosition, axis, halfAngle))
+        return;
+
+    float dimmest      = minDistance > 0 ? astro::appToAbsMag(limitingFactor, minDistance) : 1000;
+    float cosHalfAngle = halfAngle >= (float) PI ? -1.0f : (float) cos(halfAngle);
+
+    for (unsigned int i = 0; i < nObjects; ++i)
+    {
+        const Star& obj = _firstObject[i];
+
+        if (obj.getAbsoluteMagnitude() < dimmest)
+        {
+            Vector3f offset = obj.getPosition() - obsPosition;
+            float distance  = offset.norm();
+            float appMag    = astro::absToAppMag(obj.getAbsoluteMagnitude(), distance);
+
+            if (appMag < limitingFactor &&
+                distance <= maxDistance &&
+                offset.dot(axis) >= cosHalfAngle * distance)
+            {
+                processor.process(obj, distance, appMag);
+            }
+        }
+    }
+
+    if (minDistance <= 0 || astro::absToAppMag(exclusionFactor, minDistance) <= limitingFactor)
+    {
+        if (_children != NULL)
+        {
+            for (int i = 0; i < 8; ++i)
+            {
+                _children[i]->processObjectsInCone(processor,
+                                                   obsPosition,
+                                                   axis,
+                                                   halfAngle,
+                                                   maxDistance,
+                                                   limitingFactor,
+                                                   scale * 0.5f);
+            }
+        }
+    }
+}
+
+
 template<>
 void StarOctree::processCloseObjects(StarHandler&    processor,
                                      const Vector3f& obsPosition,
@@ -190,3 +259,525 @@ void StarOctree::processCloseObjects(StarHandler&    processor,
         }
     }
 }
+
+
+StarArrays::StarArrays(const Star* _stars, unsigned int _nStars) :
+    stars(_stars),
+    nStars(_nStars)
+{
+    // Allocate all arrays at once, each one aligned to a 16 byte boundary
+    unsigned int arraySize = (nStars + BlockSize + 3) & ~3u;
+    storage = new float[arraySize * 6 + 3];
+    float* base = reinterpret_cast<float*>((reinterpret_cast<size_t>(storage) + 15) & ~(size_t) 15);
+    x             = base;
+    y             = base + arraySize;
+    z             = base + arraySize * 2;
+    absMag        = base + arraySize * 3;
+    brightness    = base + arraySize * 4;
+    orbitalRadius = base + arraySize * 5;
+
+    for (unsigned int i = 0; i < nStars; i++)
+    {
+        const Star& star = stars[i];
+        Vector3f pos = star.getPosition();
+        x[i] = pos.x();
+        y[i] = pos.y();
+        z[i] = pos.z();
+        absMag[i] = star.getAbsoluteMagnitude();
+        brightness[i] = (float) pow(10.0, -0.4 * star.getAbsoluteMagnitude());
+        orbitalRadius[i] = star.getOrbitalRadius();
+    }
+
+    // Padding elements never pass the magnitude tests
+    for (unsigned int i = nStars; i < arraySize; i++)
+    {
+        x[i] = y[i] = z[i] = 0.0f;
+        absMag[i] = 1.0e30f;
+        brightness[i] = 0.0f;
+        orbitalRadius[i] = 0.0f;
+    }
+}
+
+
+StarArrays::~StarArrays()
+{
+    delete[] storage;
+}
+
+
+// Values shared by all blocks tested during a traversal
+struct StarBlockCullInfo
+{
+    float obsX, obsY, obsZ;
+    // Multiplied by a star's brightness, this gives the squared distance
+    // beyond which the star is fainter than the limiting magnitude.
+    float brightnessScale;
+    bool  cullToFrustum;
+    float frustumMargin;
+    // Frustum planes, with offsets relative to the observer position
+    float planeX[5], planeY[5], planeZ[5], planeOffset[5];
+};
+
+
+// The block tests are conservative: they may let through a few stars right
+// at the magnitude limit that the exact test rejects, but never reject a star
+// that the exact test accepts.
+static const float CULL_TOLERANCE = 1.001f;
+static const float MAX_STAR_ORBIT_RADIUS_SQUARED = MAX_STAR_ORBIT_RADIUS * MAX_STAR_ORBIT_RADIUS * CULL_TOLERANCE;
+
+
+// Test a block of stars starting at index first of the star arrays, and
+// return a bit mask with a bit set for each star that passed.
+#ifdef STAR_ARRAYS_SSE
+static unsigned int CullStarBlock(const StarArrays& arrays,
+                                  unsigned int first,
+                                  const StarBlockCullInfo& info,
+                                  float dimmest)
+{
+    unsigned int mask = 0;
+    for (unsigned int half = 0; half < StarArrays::BlockSize; half += 4)
+    {
+        unsigned int i = first + half;
+        __m128 dx = _mm_sub_ps(_mm_loadu_ps(arrays.x + i), _mm_set1_ps(info.obsX));
+        __m128 dy = _mm_sub_ps(_mm_loadu_ps(arrays.y + i), _mm_set1_ps(info.obsY));
+        __m128 dz = _mm_sub_ps(_mm_loadu_ps(arrays.z + i), _mm_set1_ps(info.obsZ));
+        __m128 distSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+                                        _mm_mul_ps(dz, dz));
+
+        __m128 maxDistSquared = _mm_mul_ps(_mm_loadu_ps(arrays.brightness + i),
+                                           _mm_set1_ps(info.brightnessScale));
+        __m128 close = _mm_cmplt_ps(distSquared, _mm_set1_ps(MAX_STAR_ORBIT_RADIUS_SQUARED));
+        __m128 pass = _mm_and_ps(_mm_cmplt_ps(_mm_loadu_ps(arrays.absMag + i), _mm_set1_ps(dimmest)),
+                                 _mm_or_ps(_mm_cmplt_ps(distSquared, maxDistSquared), close));
+
+        if (info.cullToFrustum && _mm_movemask_ps(pass) != 0)
+        {
+            __m128 margin = _mm_add_ps(_mm_mul_ps(_mm_sqrt_ps(distSquared), _mm_set1_ps(info.frustumMargin)),
+                                       _mm_loadu_ps(arrays.orbitalRadius + i));
+            margin = _mm_sub_ps(_mm_setzero_ps(), margin);
+            __m128 inside = _mm_cmpeq_ps(dx, dx);
+            for (unsigned int j = 0; j < 5; j++)
+            {
+                __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, _mm_set1_ps(info.planeX[j])),
+                                                 _mm_mul_ps(dy, _mm_set1_ps(info.planeY[j]))),
+                                      _mm_add_ps(_mm_mul_ps(dz, _mm_set1_ps(info.planeZ[j])),
+                                                 _mm_set1_ps(info.planeOffset[j])));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(d, margin));
+            }
+
+            // Stars close to the observer are never culled
+            pass = _mm_and_ps(pass, _mm_or_ps(inside, close));
+        }
+
+        mask |= (unsigned int) _mm_movemask_ps(pass) << half;
+    }
+
+    return mask;
+}
+#else
+static unsigned int CullStarBlock(const StarArrays& arrays,
+                                  unsigned int first,
+                                  const StarBlockCullInfo& info,
+                                  float dimmest)
+{
+    unsigned int mask = 0;
+    for (unsigned int lane = 0; lane < StarArrays::BlockSize; lane++)
+    {
+        unsigned int i = first + lane;
+        float dx = arrays.x[i] - info.obsX;
+        float dy = arrays.y[i] - info.obsY;
+        float dz = arrays.z[i] - info.obsZ;
+        float distSquared = dx * dx + dy * dy + dz * dz;
+        bool close = distSquared < MAX_STAR_ORBIT_RADIUS_SQUARED;
+
+        if (arrays.absMag[i] >= dimmest ||
+            !(distSquared < arrays.brightness[i] * info.brightnessScale || close))
+        {
+            continue;
+        }
+
+        if (info.cullToFrustum && !close)
+        {
+            float margin = -(sqrt(distSquared) * info.frustumMargin + arrays.orbitalRadius[i]);
+            unsigned int j;
+            for (j = 0; j < 5; j++)
+            {
+                if (dx * info.planeX[j] + dy * info.planeY[j] + dz * info.planeZ[j] + info.planeOffset[j] < margin)
+                    break;
+            }
+            if (j != 5)
+                continue;
+        }
+
+        mask |= 1u << lane;
+    }
+
+    return mask;
+}
+#endif
+
+
+// Test whether a node of the star octree lies within the view frustum. If it
+// does, dimmest is set to the faintest absolute magnitude that a star in the
+// node may have and still be visible, and recurse to whether the node's
+// children may contain visible stars. These are the node tests of
+// StarOctree::processVisibleObjects.
+static bool IsStarNodeVisible(const StarOctree*           node,
+                              const Vector3f&             obsPosition,
+                              const Hyperplane<float, 3>* frustumPlanes,
+                              float                       limitingMag,
+                              float                       scale,
+                              float&                      dimmest,
+                              bool&                       recurse)
+{
+    const Vector3f& cellCenterPos = node->getCellCenter();
+
+    for (unsigned int i = 0; i < 5; ++i)
+    {
+        const Hyperplane<float, 3>& plane = frustumPlanes[i];
+        float r = scale * plane.normal().cwise().abs().sum();
+        if (plane.signedDistance(cellCenterPos) < -r)
+            return false;
+    }
+
+    float minDistance = (obsPosition - cellCenterPos).norm() - scale * StarOctree::SQRT3;
+    dimmest = minDistance > 0 ? astro::appToAbsMag(limitingMag, minDistance) : 1000;
+    recurse = minDistance <= 0 || astro::absToAppMag(node->getExclusionFactor(), minDistance) <= limitingMag;
+
+    return true;
+}
+
+
+static void ProcessVisibleStarsInNode(const StarOctree*                 node,
+                                      const StarArrays&                 arrays,
+                                      StarHandler&                      processor,
+                                      const Vector3f&                   obsPosition,
+                                      const Hyperplane<float, 3>*       frustumPlanes,
+                                      float                             limitingMag,
+                                      const StarBlockCullInfo&          info,
+                                      float                             scale,
+                                      bool                              includeChildren)
+{
+    float dimmest = 0.0f;
+    bool recurse = false;
+    if (!IsStarNodeVisible(node, obsPosition, frustumPlanes, limitingMag, scale, dimmest, recurse))
+        return;
+
+    unsigned int first = (unsigned int) (node->getFirstObject() - arrays.stars);
+    unsigned int nObjects = node->getObjectCount();
+    for (unsigned int block = 0; block < nObjects; block += StarArrays::BlockSize)
+    {
+        unsigned int mask = CullStarBlock(arrays, first + block, info, dimmest);
+        if (nObjects - block < StarArrays::BlockSize)
+            mask &= (1u << (nObjects - block)) - 1;
+
+        for (unsigned int lane = 0; mask != 0; lane++, mask >>= 1)
+        {
+            if ((mask & 1) == 0)
+                continue;
+
+            // Repeat the exact tests of processVisibleObjects
+            const Star& obj = arrays.stars[first + block + lane];
+            float distance    = (obsPosition - obj.getPosition()).norm();
+            float appMag      = astro::absToAppMag(obj.getAbsoluteMagnitude(), distance);
+
+            if (appMag < limitingMag || (distance < MAX_STAR_ORBIT_RADIUS && obj.getOrbit()))
+                processor.process(obj, distance, appMag);
+        }
+    }
+
+    if (includeChildren && recurse && node->getChild(0) != NULL)
+    {
+        for (int i = 0; i < 8; ++i)
+        {
+            ProcessVisibleStarsInNode(node->getChild(i), arrays, processor,
+                                      obsPosition, frustumPlanes, limitingMag,
+                                      info, scale * 0.5f, true);
+        }
+    }
+}
+
+
+void ProcessVisibleStars(const StarOctree*                 node,
+                         const StarArrays&                 arrays,
+                         StarHandler&                      processor,
+                         const Vector3f&                   obsPosition,
+                         const Hyperplane<float, 3>*       frustumPlanes,
+                         float                             limitingMag,
+                         float                             frustumMargin,
+                         float                             scale,
+                         bool                              includeChildren)
+{
+    StarBlockCullInfo info;
+    info.obsX = obsPosition.x();
+    info.obsY = obsPosition.y();
+    info.obsZ = obsPosition.z();
+    info.brightnessScale = (float) (LY_PER_PARSEC * LY_PER_PARSEC *
+                                    pow(10.0, 0.4 * (limitingMag + 5.0)) * CULL_TOLERANCE);
+    info.cullToFrustum = frustumMargin >= 0.0f;
+    info.frustumMargin = frustumMargin;
+    for (unsigned int i = 0; i < 5; i++)
+    {
+        info.planeX[i] = frustumPlanes[i].normal().x();
+        info.planeY[i] = frustumPlanes[i].normal().y();
+        info.planeZ[i] = frustumPlanes[i].normal().z();
+        info.planeOffset[i] = frustumPlanes[i].signedDistance(obsPosition);
+    }
+
+    ProcessVisibleStarsInNode(node, arrays, processor, obsPosition, frustumPlanes,
+                              limitingMag, info, scale, includeChildren);
+}
+
+
+void SplitVisibleStarOctree(const StarOctree*           root,
+                            const Vector3f&             obsPosition,
+                            const Hyperplane<float, 3>* frustumPlanes,
+                            float                       limitingMag,
+                            float                       scale,
+                            unsigned int                minRanges,
+                            vector<StarOctreeRange>&    ranges)
+{
+    vector<StarOctreeRange> subtrees;
+    StarOctreeRange rootRange;
+    rootRange.node = root;
+    rootRange.scale = scale;
+    rootRange.includeChildren = true;
+    subtrees.push_back(rootRange);
+
+    // Expand the subtrees a level at a time. The stars of a node are
+    // processed before those of its children, so a subtree is replaced by
+    // a range for its root node alone followed by the subtrees of the
+    // children.
+    bool expanded = true;
+    while (expanded && subtrees.size() < minRanges)
+    {
+        expanded = false;
+        vector<StarOctreeRange> next;
+        for (vector<StarOctreeRange>::const_iterator iter = subtrees.begin(); iter != subtrees.end(); iter++)
+        {
+            const StarOctree* node = iter->node;
+            bool hasChildren = node->getChild(0) != NULL;
+            if (!iter->includeChildren || !hasChildren)
+            {
+                if (node->getObjectCount() > 0)
+                    next.push_back(*iter);
+                continue;
+            }
+
+            float dimmest = 0.0f;
+            bool recurse = false;
+            if (!IsStarNodeVisible(node, obsPosition, frustumPlanes, limitingMag, iter->scale, dimmest, recurse))
+                continue;
+
+            if (!recurse)
+            {
+                next.push_back(*iter);
+                continue;
+            }
+
+            if (node->getObjectCount() > 0)
+            {
+                StarOctreeRange nodeRange = *iter;
+                nodeRange.includeChildren = false;
+                next.push_back(nodeRange);
+            }
+
+            for (int i = 0; i < 8; i++)
+            {
+                StarOctreeRange childRange;
+                childRange.node = node->getChild(i);
+                childRange.scale = iter->scale * 0.5f;
+                childRange.includeChildren = true;
+                next.push_back(childRange);
+            }
+            expanded = true;
+        }
+        subtrees.swap(next);
+    }
+
+    ranges.insert(ranges.end(), subtrees.begin(), subtrees.end());
+}
+
+
+// A node waiting to be searched by a best-first star query. The key is a
+// lower bound for the keys of all stars in the node and its descendants.
+struct StarQueryNode
+{
+    const StarOctree* node;
+    float scale;
+    float key;
+
+    // Ordering for a priority queue, which returns the largest element
+    // first: the node with the smallest key is searched first.
+    bool operator<(const StarQueryNode& other) const
+    {
+        return key > other.key;
+    }
+};
+
+
+// Key functions for the star queries; a smaller key is a better match.
+// childKey() gives a lower bound for the keys of the stars in a child node
+// and its descendants.
+struct NearestStarKey
+{
+    Vector3f position;
+
+    float starKey(const Star& star) const
+    {
+        return (position - star.getPosition()).norm();
+    }
+
+    float childKey(const StarOctree* /* parent */, const StarOctree* child, float childScale) const
+    {
+        float minDistance = (position - child->getCellCenter()).norm() - childScale * StarOctree::SQRT3;
+        return max(minDistance, 0.0f);
+    }
+};
+
+
+struct BrightestStarKey
+{
+    Vector3f position;
+
+    float starKey(const Star& star) const
+    {
+        float distance = (position - star.getPosition()).norm();
+        return astro::absToAppMag(star.getAbsoluteMagnitude(), distance);
+    }
+
+    // No star below a node is brighter than the node's exclusion factor
+    float childKey(const StarOctree* parent, const StarOctree* child, float childScale) const
+    {
+        float minDistance = (position - child->getCellCenter()).norm() - childScale * StarOctree::SQRT3;
+        if (minDistance <= 0.0f)
+            return -numeric_limits<float>::infinity();
+        return astro::absToAppMag(parent->getExclusionFactor(), minDistance);
+    }
+};
+
+
+struct LuminousStarKey
+{
+    float starKey(const Star& star) const
+    {
+        return star.getAbsoluteMagnitude();
+    }
+
+    float childKey(const StarOctree* parent, const StarOctree* /* child */, float /* childScale */) const
+    {
+        return parent->getExclusionFactor();
+    }
+};
+
+
+// Search the octrees for the nStars stars with the smallest keys less than
+// maxKey. Nodes are visited in order of their key bounds, and the search
+// ends as soon as the next node can't hold a better star than the worst one
+// already found.
+template<class KEY> static void FindStars(const vector<const StarOctree*>& roots,
+                                          const KEY&                       key,
+                                          unsigned int                     nStars,
+                                          float                            maxKey,
+                                          float                            scale,
+                                          vector<const Star*>&             stars)
+{
+    priority_queue<StarQueryNode> nodes;
+    for (vector<const StarOctree*>::const_iterator iter = roots.begin(); iter != roots.end(); iter++)
+    {
+        if (*iter != NULL)
+        {
+            StarQueryNode root;
+            root.node = *iter;
+            root.scale = scale;
+            root.key = -numeric_limits<float>::infinity();
+            nodes.push(root);
+        }
+    }
+
+    // The best stars found so far, with the worst one on top
+    typedef pair<float, const Star*> StarMatch;
+    priority_queue<StarMatch> matches;
+    float limit = maxKey;
+
+    while (!nodes.empty())
+    {
+        StarQueryNode queryNode = nodes.top();
+        nodes.pop();
+        if (queryNode.key >= limit)
+            break;
+
+        const StarOctree* node = queryNode.node;
+        const Star* objects = node->getFirstObject();
+        for (unsigned int i = 0; i < node->getObjectCount(); i++)
+        {
+            float starKey = key.starKey(objects[i]);
+            if (starKey < limit)
+            {
+                matches.push(StarMatch(starKey, &objects[i]));
+                if (nStars != 0 && matches.size() >= nStars)
+                {
+                    if (matches.size() > nStars)
+                        matches.pop();
+                    limit = matches.top().first;
+                }
+            }
+        }
+
+        if (node->getChild(0) != NULL)
+        {
+            float childScale = queryNode.scale * 0.5f;
+            for (int i = 0; i < 8; i++)
+            {
+                StarQueryNode child;
+                child.node = node->getChild(i);
+                child.scale = childScale;
+                child.key = key.childKey(node, child.node, childScale);
+                if (child.key < limit)
+                    nodes.push(child);
+            }
+        }
+    }
+
+    // Copy the matches to the stars vector, best match first
+    size_t first = stars.size();
+    stars.resize(first + matches.size());
+    for (size_t i = stars.size(); !matches.empty(); matches.pop())
+        stars[--i] = matches.top().second;
+}
+
+
+void FindNearestStars(const vector<const StarOctree*>& roots,
+                      const Vector3f&                  position,
+                      unsigned int                     nStars,
+                      float                            maxDistance,
+                      float                            scale,
+                      vector<const Star*>&             stars)
+{
+    NearestStarKey key;
+    key.position = position;
+    FindStars(roots, key, nStars, maxDistance, scale, stars);
+}
+
+
+void FindBrightestStars(const vector<const StarOctree*>& roots,
+                        const Vector3f&                  position,
+                        unsigned int                     nStars,
+                        float                            limitingMag,
+                        float                            scale,
+                        vector<const Star*>&             stars)
+{
+    BrightestStarKey key;
+    key.position = position;
+    FindStars(roots, key, nStars, limitingMag, scale, stars);
+}
+
+
+void FindMostLuminousStars(const vector<const StarOctree*>& roots,
+                           unsigned int                     nStars,
+                           float                            scale,
+                           vector<const Star*>&             stars)
+{
+    LuminousStarKey key;
+    FindStars(roots, key, nStars, numeric_limits<float>::infinity(), scale, stars);
+}
@@ -15,10 +15,125 @@
 
 #include <celengine/star.h>
 #include <celengine/octree.h>
+#include <vector>
 
 
 typedef DynamicOctree  <Star, float> DynamicStarOctree;
 typedef StaticOctree   <Star, float> StarOctree;
 typedef OctreeProcessor<Star, float> StarHandler;
 
+
+// StarArrays is a structure-of-arrays copy of the data required to cull
+// the stars in a star octree, in the same order as the octree's sorted
+// star array. It lets the octree traversal test blocks of stars at once
+// without touching the Star objects of stars that are culled.
+class StarArrays
+{
+ public:
+    StarArrays(const Star* stars, unsigned int nStars);
+    ~StarArrays();
+
+    // Stars are processed in blocks of this size
+    enum { BlockSize = 8 };
+
+    const Star* stars;
+    unsigned int nStars;
+
+    // All arrays have BlockSize extra elements at the end so that a block
+    // may always be loaded in full.
+    float* x;
+    float* y;
+    float* z;
+    float* absMag;
+    // 10^(-0.4 * absMag), so that magnitude limits can be tested without
+    // computing logarithms.
+    float* brightness;
+    float* orbitalRadius;
+
+ private:
+    StarArrays(const StarArrays&);
+    StarArrays& operator=(const StarArrays&);
+
+    float* storage;
+};
+
+
+// Batched counterpart of StarOctree::processVisibleObjects; the octree's
+// stars must be a subrange of the stars in the star arrays. The processor
+// is invoked for the same stars and with the same distances and apparent
+// magnitudes as by processVisibleObjects, except that if frustumMargin is
+// non-negative, stars outside the view frustum are culled too. The view
+// frustum is enlarged for this test by frustumMargin--the sine of an
+// angle--and the orbits of stars are taken into account.
+// If includeChildren is false, only the stars of the node itself are
+// processed.
+extern void ProcessVisibleStars(const StarOctree*                 node,
+                                const StarArrays&                 arrays,
+                                StarHandler&                      processor,
+                                const Eigen::Vector3f&            obsPosition,
+                                const Eigen::Hyperplane<float, 3>* frustumPlanes,
+                                float                             limitingMag,
+                                float                             frustumMargin,
+                                float                             scale,
+                                bool                              includeChildren = true);
+
+
+// A part of a star octree: either a single node or a whole subtree
+struct StarOctreeRange
+{
+    const StarOctree* node;
+    float scale;
+    bool includeChildren;
+};
+
+
+// Divide the potentially visible part of a star octree into at least
+// minRanges ranges (unless the tree is too small) and append them to the
+// ranges vector. Calling ProcessVisibleStars for each range in order
+// processes exactly the same stars in the same order as a single call for
+// the whole tree, so the ranges can be searched independently on different
+// threads and their results concatenated.
+extern void SplitVisibleStarOctree(const StarOctree*                  root,
+                                   const Eigen::Vector3f&             obsPosition,
+                                   const Eigen::Hyperplane<float, 3>* frustumPlanes,
+                                   float                              limitingMag,
+                                   float                              scale,
+                                   unsigned int                       minRanges,
+                                   std::vector<StarOctreeRange>&      ranges);
+
+
+// Best-first queries of star octrees. Each query searches all of the
+// octrees in roots (the main octree and the supplemental octree for stars
+// added after a sorted database was loaded), whose root nodes have the
+// specified scale, and appends the matching stars to the stars vector,
+// best match first. At most nStars stars are found; if nStars is zero,
+// there's no limit beyond the distance or magnitude limit.
+// Node distance bounds and the exclusion factor magnitude bounds limit the
+// search to the nodes that may contain a better star than the worst one
+// found so far, so the cost depends on nStars rather than on the size of
+// the catalog.
+
+// Find the stars closest to position, no farther than maxDistance
+extern void FindNearestStars(const std::vector<const StarOctree*>& roots,
+                             const Eigen::Vector3f&                position,
+                             unsigned int                          nStars,
+                             float                                 maxDistance,
+                             float                                 scale,
+                             std::vector<const Star*>&             stars);
+
+// Find the stars with the brightest apparent magnitude seen from position,
+// no fainter than limitingMag
+extern void FindBrightestStars(const std::vector<const StarOctree*>& roots,
+                               const Eigen::Vector3f&                position,
+                               unsigned int                          nStars,
+                               float                                 limitingMag,
+                               float                                 scale,
+                               std::vector<const Star*>&             stars);
+
+// Find the stars with the brightest absolute magnitude
+extern void FindMostLuminousStars(const std::vector<const StarOctree*>& roots,
+                                  unsigned int                          nStars,
+                                  float                                 scale,
+                                  std::vector<const Star*>&             stars);
+
 #endif  // _CELENGINE_STAROCTREE_H_
@@ -9,9 +9,11 @@
 
 #include "celestia.h"
 #include <celutil/debug.h>
+#include <celutil/filetype.h>
 #include <iostream>
 #include <fstream>
 #include "multitexture.h"
+#include "virtualtex.h"
 #include "texmanager.h"
 
 using namespace std;
@@ -114,20 +116,32 @@ string TextureInfo::resolve(const string& baseDir)
 }
 
 
-Texture* TextureInfo::load(const string& name)
+Texture::AddressMode TextureInfo::getAddressMode() const
 {
-    Texture::AddressMode addressMode = Texture::EdgeClamp;
-    Texture::MipMapMode mipMode = Texture::DefaultMipMaps;
-
     if (flags & WrapTexture)
-        addressMode = Texture::Wrap;
+        return Texture::Wrap;
     else if (flags & BorderClamp)
-        addressMode = Texture::BorderClamp;
+        return Texture::BorderClamp;
+    else
+        return Texture::EdgeClamp;
+}
+
 
+Texture::MipMapMode TextureInfo::getMipMapMode() const
+{
     if (flags & NoMipMaps)
-        mipMode = Texture::NoMipMaps;
+        return Texture::NoMipMaps;
     else if (flags & AutoMipMaps)
-        mipMode = Texture::AutoMipMaps;
+        return Texture::AutoMipMaps;
+    else
+        return Texture::DefaultMipMaps;
+}
+
+
+Texture* TextureInfo::load(const string& name)
+{
+    Texture::AddressMode addressMode = getAddressMode();
+    Texture::MipMapMode mipMode = getMipMapMode();
 
     if (bumpHeight == 0.0f)
     {
@@ -147,3 +161,79 @@ Texture* TextureInfo::load(const string& name)
     return NULL;
 }
 
+
+// Image decoded on a worker thread, waiting to be turned into a texture,
+// or a texture that could be created entirely on the worker thread.
+class PreparedTexture : public PreparedResource
+{
+ public:
+    PreparedTexture(Image* _image) : image(_image), texture(NULL) {};
+    PreparedTexture(Texture* _texture) : image(NULL), texture(_texture) {};
+    virtual ~PreparedTexture() { delete image; delete texture; };
+
+    Image* image;
+    Texture* texture;
+};
+
+
+PreparedResource* TextureInfo::prepare(const string& name) const
+{
+    // Virtual textures don't use OpenGL until their tiles are loaded, so
+    // the description file and tile directories can be read here.
+    if (DetermineFileType(name) == Content_CelestiaTexture)
+    {
+        Texture* tex = LoadVirtualTexture(name);
+        if (tex == NULL)
+            return NULL;
+        return new PreparedTexture(tex);
+    }
+
+    Image* img = LoadImageFromFile(name);
+    if (img == NULL)
+        return NULL;
+
+    if (bumpHeight != 0.0f)
+    {
+        Image* normalMap = img->computeNormalMap(bumpHeight,
+                                                 getAddressMode() == Texture::Wrap);
+        delete img;
+        if (normalMap == NULL)
+            return NULL;
+        img = normalMap;
+    }
+
+    return new PreparedTexture(img);
+}
+
+
+Texture* TextureInfo::create(const string& name, PreparedResource* prepared)
+{
+    PreparedTexture* preparedTexture = static_cast<PreparedTexture*>(prepared);
+    if (preparedTexture == NULL)
+        return NULL;
+
+    Texture* tex = NULL;
+    if (preparedTexture->texture != NULL)
+    {
+        tex = preparedTexture->texture;
+        preparedTexture->texture = NULL;
+    }
+    else if (bumpHeight == 0.0f)
+    {
+        tex = LoadTextureFromImage(*preparedTexture->image, name, getAddressMode(), getMipMapMode());
+    }
+    else
+    {
+        tex = LoadTextureFromImage(*preparedTexture->image, name, getAddressMode(), Texture::DefaultMipMaps);
+    }
+
+    delete preparedTexture;
+
+    return tex;
+}
+
+
+size_t TextureInfo::getMemoryUsage(const Texture* tex) const
+{
+    return tex->getMemoryUsage();
+}
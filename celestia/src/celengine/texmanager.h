@@ -67,6 +67,13 @@ class TextureInfo : public ResourceInfo<Texture>
 
     virtual std::string resolve(const std::string&);
     virtual Texture* load(const std::string&);
+    virtual PreparedResource* prepare(const std::string&) const;
+    virtual Texture* create(const std::string&, PreparedResource*);
+    virtual std::size_t getMemoryUsage(const Texture*) const;
+
+ private:
+    Texture::AddressMode getAddressMode() const;
+    Texture::MipMapMode getMipMapMode() const;
 };
 
 inline bool operator<(const TextureInfo& ti0, const TextureInfo& ti1)
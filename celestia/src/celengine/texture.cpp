@@ -347,9 +347,25 @@ static int CalcMipLevelCount(int w, int h)
 }
 
 
+// Estimate the memory used by a texture created from an image, including
+// any mipmaps generated for it.
+static size_t CalcTextureMemoryUsage(const Image& img,
+                                     bool mipmap,
+                                     bool precomputedMipMaps)
+{
+    if (precomputedMipMaps)
+        return img.getSize();
+
+    // A complete set of mipmaps adds a third to the size of the base level
+    size_t size = img.getMipLevelSize(0);
+    return mipmap ? size + size / 3 : size;
+}
+
+
 Texture::Texture(int w, int h, int d) :
     alpha(false),
     compressed(false),
+    memoryUsage(0),
     width(w),
     height(h),
     depth(d),
@@ -410,6 +426,12 @@ int Texture::getDepth() const
 }
 
 
+size_t Texture::getMemoryUsage() const
+{
+    return memoryUsage;
+}
+
+
 unsigned int Texture::getFormatOptions() const
 {
     return formatOptions;
@@ -448,6 +470,7 @@ ImageTexture::ImageTexture(Image& img,
     {
         mipmap = false;
     }
+    memoryUsage = CalcTextureMemoryUsage(img, mipmap, precomputedMipMaps);
 
     GLenum texAddress = GetGLTexAddressMode(addressMode);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, texAddress);
@@ -565,6 +588,7 @@ TiledTexture::TiledTexture(Image& img,
     // If a precomputed mipmap set isn't provided, turn of mipmapping entirely.
     if (!precomputedMipMaps && img.isCompressed())
         mipmap = false;
+    memoryUsage = CalcTextureMemoryUsage(img, mipmap, precomputedMipMaps);
 
     GLenum texAddress = GetGLTexAddressMode(EdgeClamp);
     int internalFormat = getInternalFormat(img.getFormat());
@@ -778,6 +802,7 @@ CubeMap::CubeMap(Image* faces[]) :
     // If a precomputed mipmap set isn't provided, turn of mipmapping entirely.
     if (!precomputedMipMaps && faces[0]->isCompressed())
         mipmap = false;
+    memoryUsage = 6 * CalcTextureMemoryUsage(*faces[0], mipmap, precomputedMipMaps);
 
     glGenTextures(1, (GLuint*) &glName);
     glBindTexture(GL_TEXTURE_CUBE_MAP_ARB, glName);
@@ -1062,22 +1087,33 @@ Texture* LoadTextureFromFile(const string& filename,
     if (img == NULL)
         return NULL;
 
-    Texture* tex = CreateTextureFromImage(*img, addressMode, mipMode);
+    Texture* tex = LoadTextureFromImage(*img, filename, addressMode, mipMode);
 
-    if (contentType == Content_DXT5NormalMap)
+    delete img;
+
+    return tex;
+}
+
+
+Texture* LoadTextureFromImage(Image& img,
+                              const string& filename,
+                              Texture::AddressMode addressMode,
+                              Texture::MipMapMode mipMode)
+{
+    Texture* tex = CreateTextureFromImage(img, addressMode, mipMode);
+
+    if (DetermineFileType(filename) == Content_DXT5NormalMap)
     {
         // If the texture came from a .dxt5nm file then mark it as a dxt5
         // compressed normal map. There's no separate OpenGL format for dxt5
         // normal maps, so the file extension is the only thing that
         // distinguishes it from a plain old dxt5 texture.
-        if (img->getFormat() == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+        if (img.getFormat() == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
         {
             tex->setFormatOptions(Texture::DXT5NormalMap);
         }
     }
 
-    delete img;
-
     return tex;
 }
 
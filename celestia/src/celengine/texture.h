@@ -11,6 +11,7 @@
 #define _CELENGINE_TEXTURE_H_
 
 #include <string>
+#include <cstddef>
 #include <celutil/basictypes.h>
 #include <celutil/color.h>
 #include <celengine/image.h>
@@ -70,6 +71,9 @@ class Texture
     int getHeight() const;
     int getDepth() const;
 
+    //! Approximate number of bytes of texture memory used
+    virtual std::size_t getMemoryUsage() const;
+
     bool hasAlpha() const { return alpha; }
     bool isCompressed() const { return compressed; }
 
@@ -105,6 +109,7 @@ class Texture
  protected:
     bool alpha;
     bool compressed;
+    std::size_t memoryUsage;
 
  private:
     int width;
@@ -188,5 +193,13 @@ extern Texture* LoadHeightMapFromFile(const std::string& filename,
                                       float height,
                                       Texture::AddressMode addressMode = Texture::EdgeClamp);
 
+// Create a texture from an image that was loaded from the named file; the
+// filename is used to recognize images that need special handling, such
+// as DXT5 compressed normal maps.
+extern Texture* LoadTextureFromImage(Image& img,
+                                     const std::string& filename,
+                                     Texture::AddressMode addressMode = Texture::EdgeClamp,
+                                     Texture::MipMapMode mipMode = Texture::DefaultMipMaps);
+
 
 #endif // _CELENGINE_TEXTURE_H_
@@ -12,7 +12,29 @@
 #include <cmath>
 #include <iomanip>
 #include <celutil/utf8.h>
+#include <celutil/basictypes.h>
 #include "tokenizer.h"
+#include "parser.h"
+
+
+// Size of the blocks read from the input stream
+static const unsigned int BufferSize = 65536;
+
+// Powers of ten that are exactly representable as doubles
+static const double ExactPowersOfTen[] =
+{
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+    1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+    1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static const int MaxExactPowerOfTen = 22;
+
+// Integers up to 2^53 are exactly representable as doubles
+static const uint64 MaxExactMantissa = (uint64) 1 << 53;
+
+// Digits beyond this are dropped from the mantissa
+static const int MaxMantissaDigits = 19;
 
 
 static bool issep(char c)
@@ -21,8 +43,63 @@ static bool issep(char c)
 }
 
 
+/*! Create a tokenizer that reads from a stream. The stream is read ahead
+ *  in large blocks, so the position of the stream is undefined after
+ *  tokenizing and nothing else should read from it.
+ */
 Tokenizer::Tokenizer(istream* _in) :
     in(_in),
+    buffer(NULL),
+    bufferPos(NULL),
+    bufferEnd(NULL),
+    catalog(NULL),
+    catalogPos(0),
+    tokenType(TokenBegin),
+    haveValidNumber(false),
+    haveValidName(false),
+    haveValidString(false),
+    pushedBack(false),
+    lineNum(1)
+{
+    buffer = new char[BufferSize];
+    bufferPos = buffer;
+    bufferEnd = buffer;
+}
+
+
+/*! Create a tokenizer that reads text directly from a range of memory,
+ *  such as a memory mapped file. The memory must remain valid for the
+ *  lifetime of the tokenizer.
+ */
+Tokenizer::Tokenizer(const char* begin, const char* end) :
+    in(NULL),
+    buffer(NULL),
+    bufferPos(begin),
+    bufferEnd(end),
+    catalog(NULL),
+    catalogPos(0),
+    tokenType(TokenBegin),
+    haveValidNumber(false),
+    haveValidName(false),
+    haveValidString(false),
+    pushedBack(false),
+    lineNum(1)
+{
+}
+
+
+/*! Create a tokenizer that replays the tokens of a catalog parsed earlier.
+ *  Values taken from the tokenizer with takeParsedValue() are removed from
+ *  the catalog; the catalog must remain valid for the lifetime of the
+ *  tokenizer.
+ */
+Tokenizer::Tokenizer(ParsedCatalog* _catalog) :
+    in(NULL),
+    buffer(NULL),
+    bufferPos(NULL),
+    bufferEnd(NULL),
+    catalog(_catalog),
+    catalogPos(0),
     tokenType(TokenBegin),
     haveValidNumber(false),
     haveValidName(false),
@@ -33,6 +110,40 @@ Tokenizer::Tokenizer(istream* _in) :
 }
 
 
+Tokenizer::~Tokenizer()
+{
+    delete[] buffer;
+}
+
+
+int Tokenizer::readChar()
+{
+    if (bufferPos == bufferEnd && !fillBuffer())
+        return -1;
+
+    int c = (unsigned char) *bufferPos++;
+    if (c == '\n')
+        lineNum++;
+
+    return c;
+}
+
+
+// Read the next block of the stream into the buffer; return false at the
+// end of the input.
+bool Tokenizer::fillBuffer()
+{
+    if (in == NULL || !in->good())
+        return false;
+
+    in->read(buffer, BufferSize);
+    bufferPos = buffer;
+    bufferEnd = buffer + in->gcount();
+
+    return bufferPos != bufferEnd;
+}
+
+
 Tokenizer::TokenType Tokenizer::nextToken()
 {
     State state = StartState;
@@ -43,7 +154,10 @@ Tokenizer::TokenType Tokenizer::nextToken()
         return tokenType;
     }
 
-    textToken = "";
+    if (catalog != NULL)
+        return nextParsedToken();
+
+    textToken.clear();
     haveValidNumber = false;
     haveValidName = false;
     haveValidString = false;
@@ -51,7 +165,7 @@ Tokenizer::TokenType Tokenizer::nextToken()
     if (tokenType == TokenBegin)
     {
         nextChar = readChar();
-        if (in->eof())
+        if (nextChar == -1)
             return TokenEnd;
     }
     else if (tokenType == TokenEnd)
@@ -66,6 +180,14 @@ Tokenizer::TokenType Tokenizer::nextToken()
     double exponentValue = 0;
     double exponentSign = 1;
 
+    // The digits of a number are also gathered into an integer mantissa
+    // and a decimal exponent, which give a correctly rounded value without
+    // calling pow() whenever both are small enough.
+    uint64 mantissa = 0;
+    int mantissaDigits = 0;
+    int decimalExponent = 0;
+    bool exactMantissa = true;
+
     TokenType newToken = TokenBegin;
     while (newToken == TokenBegin)
     {
@@ -80,6 +202,8 @@ Tokenizer::TokenType Tokenizer::nextToken()
             {
                 state = NumberState;
                 integerValue = (int) nextChar - (int) '0';
+                mantissa = (uint64) integerValue;
+                mantissaDigits = mantissa != 0 ? 1 : 0;
             }
             else if (nextChar == '-')
             {
@@ -239,6 +363,17 @@ Tokenizer::TokenType Tokenizer::nextToken()
             {
                 state = NumberState;
                 integerValue = integerValue * 10 + (int) nextChar - (int) '0';
+                if (mantissaDigits < MaxMantissaDigits)
+                {
+                    mantissa = mantissa * 10 + (nextChar - '0');
+                    if (mantissa != 0)
+                        mantissaDigits++;
+                }
+                else
+                {
+                    decimalExponent++;
+                    exactMantissa = exactMantissa && nextChar == '0';
+                }
             }
             else if (nextChar == '.')
             {
@@ -266,6 +401,17 @@ Tokenizer::TokenType Tokenizer::nextToken()
                 state = FractionState;
                 fractionValue = fractionValue * 10 + nextChar - (int) '0';
                 fracExp *= 10;
+                if (mantissaDigits < MaxMantissaDigits)
+                {
+                    mantissa = mantissa * 10 + (nextChar - '0');
+                    if (mantissa != 0)
+                        mantissaDigits++;
+                    decimalExponent--;
+                }
+                else
+                {
+                    exactMantissa = exactMantissa && nextChar == '0';
+                }
             }
             else if (nextChar == 'e' || nextChar == 'E')
             {
@@ -327,6 +473,9 @@ Tokenizer::TokenType Tokenizer::nextToken()
                 state = FractionState;
                 fractionValue = fractionValue * 10 + (int) nextChar - (int) '0';
                 fracExp = 10;
+                mantissa = (uint64) (nextChar - '0');
+                mantissaDigits = mantissa != 0 ? 1 : 0;
+                decimalExponent = -1;
             }
             else
             {
@@ -375,9 +524,23 @@ Tokenizer::TokenType Tokenizer::nextToken()
     tokenType = newToken;
     if (haveValidNumber)
     {
-        numberValue = integerValue + fractionValue / fracExp;
-        if (exponentValue != 0)
-            numberValue *= pow(10.0, exponentValue * exponentSign);
+        double exponent = decimalExponent + exponentValue * exponentSign;
+        if (exactMantissa && mantissa <= MaxExactMantissa &&
+            exponent >= -MaxExactPowerOfTen && exponent <= MaxExactPowerOfTen)
+        {
+            // Both the mantissa and the power of ten are exact, so a single
+            // multiplication or division rounds correctly.
+            if (exponent >= 0)
+                numberValue = (double) mantissa * ExactPowersOfTen[(int) exponent];
+            else
+                numberValue = (double) mantissa / ExactPowersOfTen[(int) -exponent];
+        }
+        else
+        {
+            numberValue = integerValue + fractionValue / fracExp;
+            if (exponentValue != 0)
+                numberValue *= pow(10.0, exponentValue * exponentSign);
+        }
         numberValue *= sign;
     }
 
@@ -403,27 +566,18 @@ double Tokenizer::getNumberValue()
 }
 
 
-string Tokenizer::getNameValue()
+const string& Tokenizer::getNameValue() const
 {
     return textToken;
 }
 
 
-string Tokenizer::getStringValue()
+const string& Tokenizer::getStringValue() const
 {
     return textToken;
 }
 
 
-int Tokenizer::readChar()
-{
-    int c = (int) in->get();
-    if (c == '\n')
-        lineNum++;
-
-    return c;
-}
-
 void Tokenizer::syntaxError(const char* message)
 {
     cerr << message << '\n';
@@ -435,6 +589,40 @@ int Tokenizer::getLineNumber() const
     return lineNum;
 }
 
+
+Tokenizer::TokenType Tokenizer::nextParsedToken()
+{
+    if (catalogPos == catalog->itemCount())
+    {
+        tokenType = TokenEnd;
+        return tokenType;
+    }
+
+    const ParsedCatalog::Item& item = catalog->getItem(catalogPos++);
+    tokenType = item.type;
+    textToken.assign(catalog->getText(item), item.textLength);
+    numberValue = item.number;
+    lineNum = item.lineNumber;
+    haveValidNumber = tokenType == TokenNumber;
+    haveValidName = tokenType == TokenName;
+    haveValidString = tokenType == TokenString;
+
+    return tokenType;
+}
+
+
+/*! When replaying a parsed catalog, return the value of the array or
+ *  property list that begins at the current token; the caller takes
+ *  ownership of it. Returns NULL for any other tokenizer.
+ */
+Value* Tokenizer::takeParsedValue()
+{
+    if (catalog == NULL || (tokenType != TokenBeginGroup && tokenType != TokenBeginArray))
+        return NULL;
+
+    return catalog->takeValue(catalogPos - 1);
+}
+
 #if 0
 // Tokenizer test
 int main(int argc, char *argv[])
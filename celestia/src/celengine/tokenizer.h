@@ -16,6 +16,9 @@
 
 using namespace std;
 
+class ParsedCatalog;
+class Value;
+
 
 class Tokenizer
 {
@@ -40,16 +43,21 @@ public:
     };
 
     Tokenizer(istream*);
+    Tokenizer(const char* begin, const char* end);
+    Tokenizer(ParsedCatalog* catalog);
+    ~Tokenizer();
 
     TokenType nextToken();
     TokenType getTokenType();
     void pushBack();
     double getNumberValue();
-    string getNameValue();
-    string getStringValue();
+    const string& getNameValue() const;
+    const string& getStringValue() const;
 
     int getLineNumber() const;
 
+    Value* takeParsedValue();
+
 private:
     enum State
     {
@@ -67,7 +75,17 @@ private:
         UnicodeEscapeState  = 11,
     };
 
+    // Characters are read from the stream a block at a time into the
+    // buffer; a tokenizer created for a range of memory reads the range
+    // directly and has no stream.
     istream* in;
+    char* buffer;
+    const char* bufferPos;
+    const char* bufferEnd;
+
+    // Catalog whose tokens are replayed, and the index of the next one
+    ParsedCatalog* catalog;
+    unsigned int catalogPos;
 
     int nextChar;
     TokenType tokenType;
@@ -80,7 +98,9 @@ private:
 
     bool pushedBack;
 
-    int readChar();
+    inline int readChar();
+    bool fillBuffer();
+    TokenType nextParsedToken();
     void syntaxError(const char*);
 
     double numberValue;
@@ -88,6 +108,10 @@ private:
     string textToken;
 
     int lineNum;
+
+    // Prohibit copying of tokenizers, which own their buffers
+    Tokenizer(const Tokenizer&);
+    Tokenizer& operator=(const Tokenizer&);
 };
 
 #endif // _TOKENIZER_H_
@@ -18,6 +18,7 @@
 #include "universe.h"
 #include "timelinephase.h"
 #include "frametree.h"
+#include "framestatecache.h"
 #include <celmath/mathlib.h>
 #include <celmath/intersect.h>
 #include <celutil/utf8.h>
@@ -35,14 +36,17 @@ Universe::Universe() :
     solarSystemCatalog(NULL),
     asterisms(NULL),
     boundaries(NULL),
-    markers(NULL)
+    markers(NULL),
+    frameStateCache(NULL)
 {
     markers = new MarkerList();
+    frameStateCache = new FrameStateCache();
 }
 
 Universe::~Universe()
 {
     delete markers;
+    delete frameStateCache;
     // TODO: Clean up!
 }
 
@@ -66,6 +70,16 @@ SolarSystemCatalog* Universe::getSolarSystemCatalog() const
 void Universe::setSolarSystemCatalog(SolarSystemCatalog* catalog)
 {
     solarSystemCatalog = catalog;
+    frameStateCache->invalidate();
+}
+
+
+const FrameStateCache& Universe::getFrameStateCache(double tdb,
+                                                    WorkerPool* workerPool) const
+{
+    if (solarSystemCatalog != NULL)
+        frameStateCache->update(*solarSystemCatalog, tdb, workerPool);
+    return *frameStateCache;
 }
 
 
@@ -277,33 +291,6 @@ void ClosestStarFinder::process(const Star& star, float distance, float)
 }
 
 
-class NearStarFinder : public StarHandler
-{
-public:
-    NearStarFinder(float _maxDistance, vector<const Star*>& nearStars);
-    ~NearStarFinder() {};
-    void process(const Star& star, float distance, float appMag);
-
-private:
-    float maxDistance;
-    vector<const Star*>& nearStars;
-};
-
-NearStarFinder::NearStarFinder(float _maxDistance,
-                               vector<const Star*>& _nearStars) :
-    maxDistance(_maxDistance),
-    nearStars(_nearStars)
-{
-}
-
-void NearStarFinder::process(const Star& star, float distance, float)
-{
-    if (distance < maxDistance)
-        nearStars.push_back(&star);
-}
-
-
-
 struct PlanetPickInfo
 {
     double sinAngle2Closest;
@@ -313,6 +300,7 @@ struct PlanetPickInfo
     Ray3d pickRay;
     double jd;
     float atanTolerance;
+    const FrameStateCache* frameState;
 };
 
 
@@ -324,7 +312,7 @@ static bool ApproxPlanetPickTraversal(Body* body, void* info)
     if (!body->isVisible() || !body->extant(pickInfo->jd) || !body->isClickable())
         return true;
 
-    Vector3d bpos = body->getAstrocentricPosition(pickInfo->jd);
+    Vector3d bpos = pickInfo->frameState->getAstrocentricPosition(body, pickInfo->jd);
     Vector3d bodyDir = bpos - pickInfo->pickRay.origin;
     double distance = bodyDir.norm();
 
@@ -357,7 +345,7 @@ static bool ApproxPlanetPickTraversal(Body* body, void* info)
 static bool ExactPlanetPickTraversal(Body* body, void* info)
 {
     PlanetPickInfo* pickInfo = reinterpret_cast<PlanetPickInfo*>(info);
-    Vector3d bpos = body->getAstrocentricPosition(pickInfo->jd);
+    Vector3d bpos = pickInfo->frameState->getAstrocentricPosition(body, pickInfo->jd);
     float radius = body->getRadius();
     double distance = -1.0;
 
@@ -388,7 +376,7 @@ static bool ExactPlanetPickTraversal(Body* body, void* info)
         {
             // Transform rotate the pick ray into object coordinates
             Quaterniond qd = body->getGeometryOrientation().cast<double>();
-            Matrix3d m = (qd * body->getEclipticToBodyFixed(pickInfo->jd)).toRotationMatrix();
+            Matrix3d m = (qd * pickInfo->frameState->getEclipticToBodyFixed(body, pickInfo->jd)).toRotationMatrix();
             Ray3d r(pickInfo->pickRay.origin - bpos, pickInfo->pickRay.direction);
             r = r.transform(m);
 
@@ -486,6 +474,7 @@ Selection Universe::pickPlanet(SolarSystem& solarSystem,
     pickInfo.closestBody = NULL;
     pickInfo.jd = when;
     pickInfo.atanTolerance = (float) atan(tolerance);
+    pickInfo.frameState = &getFrameStateCache(when);
 
     // First see if there's a planet|moon that the pick ray intersects.
     // Select the closest planet|moon intersected.
@@ -1096,10 +1085,14 @@ Selection Universe::findPath(const string& s,
 }
 
 
+// Return the names of objects beginning with s: first locations and bodies
+// in the context solar systems, then deep sky objects, then stars. If
+// maxCompletions is nonzero, at most that many names are returned.
 vector<string> Universe::getCompletion(const string& s,
                                                  Selection* contexts,
                                                  int nContexts,
-                                                 bool withLocations)
+                                                 bool withLocations,
+                                                 unsigned int maxCompletions)
 {
     vector<string> completion;
     int s_length = UTF8Length(s);
@@ -1127,24 +1120,35 @@ vector<string> Universe::getCompletion(const string& s,
             PlanetarySystem* planets = sys->getPlanets();
             if (planets != NULL)
             {
-                vector<string> bodies = planets->getCompletion(s);
+                vector<string> bodies = planets->getCompletion(s, true, maxCompletions);
                 completion.insert(completion.end(),
                                   bodies.begin(), bodies.end());
             }
         }
     }
 
+    if (maxCompletions != 0 && completion.size() >= maxCompletions)
+    {
+        completion.resize(maxCompletions);
+        return completion;
+    }
+
     // Deep sky objects:
     if (dsoCatalog != NULL)
     {
-        vector<string> dsos  = dsoCatalog->getCompletion(s);
+        unsigned int remaining = maxCompletions == 0 ? 0 : maxCompletions - completion.size();
+        vector<string> dsos  = dsoCatalog->getCompletion(s, remaining);
         completion.insert(completion.end(), dsos.begin(), dsos.end());
     }
 
+    if (maxCompletions != 0 && completion.size() >= maxCompletions)
+        return completion;
+
     // and finally stars;
     if (starCatalog != NULL)
     {
-        vector<string> stars  = starCatalog->getCompletion(s);
+        unsigned int remaining = maxCompletions == 0 ? 0 : maxCompletions - completion.size();
+        vector<string> stars  = starCatalog->getCompletion(s, remaining);
         completion.insert(completion.end(), stars.begin(), stars.end());
     }
 
@@ -1155,14 +1159,15 @@ vector<string> Universe::getCompletion(const string& s,
 vector<string> Universe::getCompletionPath(const string& s,
                                            Selection* contexts,
                                            int nContexts,
-                                           bool withLocations)
+                                           bool withLocations,
+                                           unsigned int maxCompletions)
 {
     vector<string> completion;
     vector<string> locationCompletion;
     string::size_type pos = s.rfind('/', s.length());
 
     if (pos == string::npos)
-        return getCompletion(s, contexts, nContexts, withLocations);
+        return getCompletion(s, contexts, nContexts, withLocations, maxCompletions);
 
     string base(s, 0, pos);
     Selection sel = findPath(base, contexts, nContexts, true);
@@ -1205,9 +1210,11 @@ vector<string> Universe::getCompletionPath(const string& s,
     }
 
     if (worlds != NULL)
-        completion = worlds->getCompletion(s.substr(pos + 1), false);
+        completion = worlds->getCompletion(s.substr(pos + 1), false, maxCompletions);
 
     completion.insert(completion.end(), locationCompletion.begin(), locationCompletion.end());
+    if (maxCompletions != 0 && completion.size() > maxCompletions)
+        completion.resize(maxCompletions);
 
     return completion;
 }
@@ -1228,9 +1235,9 @@ SolarSystem* Universe::getNearestSolarSystem(const UniversalCoord& position) con
 void
 Universe::getNearStars(const UniversalCoord& position,
                        float maxDistance,
-                       vector<const Star*>& nearStars) const
+                       vector<const Star*>& nearStars,
+                       unsigned int maxStars) const
 {
     Vector3f pos = position.toLy().cast<float>();
-    NearStarFinder finder(1.0f, nearStars);
-    starCatalog->findCloseStars(finder, pos, maxDistance);
+    starCatalog->findNearestStars(pos, maxStars, nearStars, maxDistance);
 }
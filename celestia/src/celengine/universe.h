@@ -23,6 +23,8 @@
 
 class ConstellationBoundaries;
 class Asterism;
+class FrameStateCache;
+class WorkerPool;
 
 class Universe
 {
@@ -71,11 +73,13 @@ class Universe
     std::vector<std::string> getCompletion(const std::string& s,
                                            Selection* contexts = NULL,
                                            int nContexts = 0,
-                                           bool withLocations = false);
+                                           bool withLocations = false,
+                                           unsigned int maxCompletions = 0);
     std::vector<std::string> getCompletionPath(const std::string& s,
                                                Selection* contexts = NULL,
                                                int nContexts = 0,
-                                               bool withLocations = false);
+                                               bool withLocations = false,
+                                               unsigned int maxCompletions = 0);
 
 
     SolarSystem* getNearestSolarSystem(const UniversalCoord& position) const;
@@ -83,9 +87,17 @@ class Universe
     SolarSystem* getSolarSystem(const Selection&) const;
     SolarSystem* createSolarSystem(Star* star) const;
 
+    // Get the states of all solar system bodies at time tdb, computing them
+    // first if the cache holds the states for a different time.
+    const FrameStateCache& getFrameStateCache(double tdb,
+                                              WorkerPool* workerPool = NULL) const;
+
+    // Get the stars within maxDistance light years of position, nearest
+    // first; if maxStars is nonzero, only the nearest maxStars are returned.
     void getNearStars(const UniversalCoord& position,
                       float maxDistance,
-                      std::vector<const Star*>& stars) const;
+                      std::vector<const Star*>& stars,
+                      unsigned int maxStars = 0) const;
 
     void markObject(const Selection&,
                     const MarkerRepresentation& rep,
@@ -124,6 +136,7 @@ class Universe
     std::vector<Asterism*>* asterisms;
     ConstellationBoundaries* boundaries;
     MarkerList* markers;
+    FrameStateCache* frameStateCache;
 
     std::vector<const Star*> closeStars;
 };
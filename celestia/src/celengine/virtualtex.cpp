@@ -13,10 +13,13 @@
 #include <cmath>
 #include <cassert>
 #include <cstdio>
+#include <algorithm>
 #include "celutil/debug.h"
 #include "celutil/directory.h"
 #include "celutil/filetype.h"
+#include <celmath/mathlib.h>
 #include "virtualtex.h"
+#include "texmanager.h"
 #include <GL/glew.h>
 #include "parser.h"
 
@@ -24,6 +27,19 @@ using namespace std;
 
 static const int MaxResolutionLevels = 13;
 
+// Limits on tile streaming: the number of tiles turned into textures
+// each time the texture is used, and the number of tiles being loaded
+static const unsigned int MaxTileUploadsPerFrame = 4;
+static const unsigned int MaxPendingTileLoads = 16;
+
+// Tiles that haven't been used recently are unloaded when the resident
+// tiles take up more than this much memory. Prefetching stops at half of it.
+static const size_t MaxResidentTileMemory = 256 << 20;
+static const unsigned int TileEvictionDelay = 8;
+
+// Number of frames of camera motion to look ahead when prefetching
+static const double PrefetchLookahead = 30.0;
+
 
 // Virtual textures are composed of tiles that are loaded from the hard drive
 // as they become visible.  Hidden tiles may be evicted from graphics memory
@@ -35,6 +51,12 @@ static const int MaxResolutionLevels = 13;
 // a power of two, with width = 2 * height.  The baseSplit determines the
 // number of tiles at the lowest LOD.  It is the log base 2 of the width in
 // tiles of LOD zero.  Though it's not required
+//
+// When the texture manager has a worker pool, tiles are read and decoded
+// on the pool, and the deepest resident tile on the path to a tile that
+// isn't loaded yet is used in its place.  Tiles that are likely to be
+// needed soon--the next level of detail when approaching the surface, and
+// neighbors in the direction in which the view is moving--are prefetched.
 
 static bool isPow2(int x)
 {
@@ -63,7 +85,23 @@ VirtualTexture::VirtualTexture(const string& _tilePath,
     baseSplit(_baseSplit),
     tileSize(_tileSize),
     ticks(0),
-    nResolutionLevels(0)
+    tilesRequested(0),
+    nResolutionLevels(0),
+    residentTileMemory(0),
+    visibleSumCos(0.0),
+    visibleSumSin(0.0),
+    visibleSumV(0.0),
+    visibleCount(0),
+    visibleMaxLOD(0),
+    haveLastCenter(false),
+    lastCenterU(0.0),
+    lastCenterV(0.0),
+    velocityU(0.0),
+    velocityV(0.0),
+    lastMaxLOD(0),
+    lodTrend(0),
+    pendingLoadCount(0),
+    runningLoadCount(0)
 {
     assert(tileSize != 0 && isPow2(tileSize));
     tileTree[0] = new TileQuadtreeNode();
@@ -78,6 +116,22 @@ VirtualTexture::VirtualTexture(const string& _tilePath,
 
 VirtualTexture::~VirtualTexture()
 {
+    // Wait for tiles still being loaded by the worker pool
+    {
+        MutexLock lock(mutex);
+        while (runningLoadCount > 0)
+            loadFinished.wait(mutex);
+    }
+
+    for (deque<TileLoadTask*>::iterator iter = finishedLoads.begin();
+         iter != finishedLoads.end(); iter++)
+    {
+        delete (*iter)->image;
+        delete *iter;
+    }
+
+    deleteTileTree(tileTree[0]);
+    deleteTileTree(tileTree[1]);
 }
 
 
@@ -98,9 +152,24 @@ const TextureTile VirtualTexture::getTile(int lod, int u, int v)
     }
     else
     {
+        // Track the center of the visible region in order to estimate
+        // how it is moving. U wraps around, so average it as an angle.
+        double angle = (u + 0.5) / (double) (2 << lod) * 2.0 * PI;
+        visibleSumCos += cos(angle);
+        visibleSumSin += sin(angle);
+        visibleSumV += (v + 0.5) / (double) (1 << lod);
+        visibleCount++;
+        visibleMaxLOD = max(visibleMaxLOD, (uint) lod);
+
+        // Find the deepest tile on the path to the requested one, along
+        // with the coarsest tile and the deepest one that is resident.
         TileQuadtreeNode* node = tileTree[u >> lod];
         Tile* tile = node->tile;
         uint tileLOD = 0;
+        Tile* coarsestTile = tile;
+        uint coarsestLOD = 0;
+        Tile* residentTile = (tile != NULL && tile->tex != NULL) ? tile : NULL;
+        uint residentLOD = 0;
 
         for (int n = 0; n < lod; n++)
         {
@@ -118,6 +187,16 @@ const TextureTile VirtualTexture::getTile(int lod, int u, int v)
                 {
                     tile = node->tile;
                     tileLOD = n + 1;
+                    if (coarsestTile == NULL)
+                    {
+                        coarsestTile = tile;
+                        coarsestLOD = tileLOD;
+                    }
+                    if (tile->tex != NULL)
+                    {
+                        residentTile = tile;
+                        residentLOD = tileLOD;
+                    }
                 }
             }
         }
@@ -128,21 +207,55 @@ const TextureTile VirtualTexture::getTile(int lod, int u, int v)
             return TextureTile(0);
         }
 
-        // Make the tile resident.
         uint tileU = u >> (lod - tileLOD);
         uint tileV = v >> (lod - tileLOD);
-        makeResident(tile, tileLOD, tileU, tileV);
+        if (GetTextureManager()->getWorkerPool() == NULL)
+        {
+            // Make the tile resident now.
+            makeResident(tile, tileLOD, tileU, tileV);
+            if (tile->tex != NULL)
+            {
+                residentTile = tile;
+                residentLOD = tileLOD;
+            }
+        }
+        else
+        {
+            // Visible tiles that aren't resident are loaded in the
+            // background by endUsage(). If there's nothing to show in the
+            // meantime, also request the coarsest tile, which will be
+            // quicker to arrive.
+            if (tile->lastVisible != ticks)
+            {
+                tile->lastVisible = ticks;
+                visibleTiles.push_back(TileRequest(tile, tileLOD, tileU, tileV));
+            }
+
+            if (residentTile == NULL && coarsestTile != tile &&
+                coarsestTile->lastVisible != ticks)
+            {
+                coarsestTile->lastVisible = ticks;
+                uint lodDiff = lod - coarsestLOD;
+                fallbackTiles.push_back(TileRequest(coarsestTile, coarsestLOD,
+                                                    u >> lodDiff, v >> lodDiff));
+            }
+        }
 
-        // It's possible that we failed to make the tile resident, either
+        // It's possible that we failed to make any tile resident, either
         // because the texture file was bad, or there was an unresolvable
-        // out of memory situation.  In that case there is nothing else to
-        // do but return a texture tile with a null texture name.
-        if (tile->tex == NULL)
+        // out of memory situation, or it's still being loaded.  In that case
+        // there is nothing else to do but return a texture tile with a null
+        // texture name.
+        if (residentTile == NULL)
         {
             return TextureTile(0);
         }
         else
         {
+            tile = residentTile;
+            tileLOD = residentLOD;
+            tile->lastUsed = ticks;
+
             // Set up the texture subrect to be the entire texture
             float texU = 0.0f;
             float texV = 0.0f;
@@ -196,11 +309,232 @@ void VirtualTexture::beginUsage()
 {
     ticks++;
     tilesRequested = 0;
+
+    finishTileLoads();
 }
 
 
 void VirtualTexture::endUsage()
 {
+    if (visibleCount > 0)
+        updateMotion();
+
+    WorkerPool* pool = GetTextureManager()->getWorkerPool();
+    if (pool != NULL)
+        queueTileLoads(pool);
+
+    visibleTiles.clear();
+    fallbackTiles.clear();
+
+    evictTiles();
+}
+
+
+size_t VirtualTexture::getMemoryUsage() const
+{
+    return residentTileMemory;
+}
+
+
+// Estimate how the visible region of the texture is moving from the
+// change in its center and level of detail since the last frame.
+void VirtualTexture::updateMotion()
+{
+    double centerU = atan2(visibleSumSin, visibleSumCos) / (2.0 * PI);
+    if (centerU < 0.0)
+        centerU += 1.0;
+    double centerV = visibleSumV / visibleCount;
+
+    if (haveLastCenter)
+    {
+        double du = centerU - lastCenterU;
+        if (du > 0.5)
+            du -= 1.0;
+        else if (du < -0.5)
+            du += 1.0;
+        double dv = centerV - lastCenterV;
+
+        // Smooth the velocity, since the texture may be used more than
+        // once per frame.
+        velocityU = 0.5 * (velocityU + du);
+        velocityV = 0.5 * (velocityV + dv);
+
+        if (visibleMaxLOD > lastMaxLOD)
+            lodTrend = 1;
+        else if (visibleMaxLOD < lastMaxLOD)
+            lodTrend = -1;
+    }
+
+    lastCenterU = centerU;
+    lastCenterV = centerV;
+    lastMaxLOD = visibleMaxLOD;
+    haveLastCenter = true;
+
+    visibleSumCos = 0.0;
+    visibleSumSin = 0.0;
+    visibleSumV = 0.0;
+    visibleCount = 0;
+    visibleMaxLOD = 0;
+}
+
+
+// Add requests for the tiles that will probably be needed soon: the
+// children of visible tiles when the level of detail has been increasing,
+// and the neighbors of visible tiles in the direction of motion.
+void VirtualTexture::addPrefetchRequests(vector<TileRequest>& requests) const
+{
+    for (vector<TileRequest>::const_iterator iter = visibleTiles.begin();
+         iter != visibleTiles.end(); iter++)
+    {
+        uint lod = iter->lod;
+
+        if (lodTrend > 0 && lod + 1 < nResolutionLevels)
+        {
+            for (uint i = 0; i < 4; i++)
+            {
+                uint u = iter->u * 2 + (i & 1);
+                uint v = iter->v * 2 + (i >> 1);
+                Tile* tile = findTile(lod + 1, u, v);
+                if (tile != NULL)
+                    requests.push_back(TileRequest(tile, lod + 1, u, v));
+            }
+        }
+
+        // Only look for a neighbor if the view will have moved at least
+        // half a tile in that direction within the lookahead time.
+        uint uTiles = 2 << lod;
+        uint vTiles = 1 << lod;
+        double uShift = velocityU * PrefetchLookahead * uTiles;
+        double vShift = velocityV * PrefetchLookahead * vTiles;
+        int du = uShift > 0.5 ? 1 : (uShift < -0.5 ? -1 : 0);
+        int dv = vShift > 0.5 ? 1 : (vShift < -0.5 ? -1 : 0);
+
+        if (du != 0 || dv != 0)
+        {
+            uint u = (iter->u + uTiles + du) % uTiles;
+            int v = (int) iter->v + dv;
+            if (v >= 0 && v < (int) vTiles)
+            {
+                Tile* tile = findTile(lod, u, (uint) v);
+                if (tile != NULL)
+                    requests.push_back(TileRequest(tile, lod, u, (uint) v));
+            }
+        }
+    }
+}
+
+
+// Submit loads for the tiles needed since beginUsage(), coarsest first,
+// followed by prefetched tiles if there's room for them.
+void VirtualTexture::queueTileLoads(WorkerPool* pool)
+{
+    vector<TileRequest> requests(fallbackTiles);
+    requests.insert(requests.end(), visibleTiles.begin(), visibleTiles.end());
+    stable_sort(requests.begin(), requests.end());
+
+    if (residentTileMemory < MaxResidentTileMemory / 2)
+        addPrefetchRequests(requests);
+
+    for (vector<TileRequest>::const_iterator iter = requests.begin();
+         iter != requests.end() && pendingLoadCount < MaxPendingTileLoads; iter++)
+    {
+        Tile* tile = iter->tile;
+        if (tile->tex != NULL || tile->loadFailed || tile->loadPending)
+            continue;
+
+        tile->loadPending = true;
+        pendingLoadCount++;
+        {
+            MutexLock lock(mutex);
+            runningLoadCount++;
+        }
+
+        pool->submit(new TileLoadTask(this, *iter,
+                                      getTileFilename(iter->lod, iter->u, iter->v)));
+    }
+}
+
+
+void VirtualTexture::TileLoadTask::run()
+{
+    image = LoadImageFromFile(filename);
+
+    MutexLock lock(texture->mutex);
+    texture->finishedLoads.push_back(this);
+    texture->runningLoadCount--;
+    texture->loadFinished.signal();
+}
+
+
+// Create textures for tiles that have been loaded by the worker pool. No
+// more than MaxTileUploadsPerFrame are created at once so that a sudden
+// change in the view doesn't stall rendering.
+void VirtualTexture::finishTileLoads()
+{
+    for (uint i = 0; i < MaxTileUploadsPerFrame; i++)
+    {
+        TileLoadTask* task = NULL;
+        {
+            MutexLock lock(mutex);
+            if (finishedLoads.empty())
+                break;
+            task = finishedLoads.front();
+            finishedLoads.pop_front();
+        }
+
+        Tile* tile = task->request.tile;
+        tile->loadPending = false;
+        pendingLoadCount--;
+
+        if (task->image != NULL)
+        {
+            setTileTexture(tile, createTileTexture(*task->image, task->request.lod));
+            delete task->image;
+        }
+        else
+        {
+            tile->loadFailed = true;
+        }
+
+        delete task;
+    }
+}
+
+
+// Unload the least recently used tiles when the resident tiles use too
+// much memory. Tiles used in the last few passes are always kept.
+void VirtualTexture::evictTiles()
+{
+    if (residentTileMemory <= MaxResidentTileMemory)
+        return;
+
+    vector<pair<unsigned int, int> > candidates;
+    for (uint i = 0; i < residentTiles.size(); i++)
+    {
+        if (residentTiles[i]->lastUsed + TileEvictionDelay < ticks)
+            candidates.push_back(make_pair(residentTiles[i]->lastUsed, (int) i));
+    }
+
+    sort(candidates.begin(), candidates.end());
+
+    vector<bool> evicted(residentTiles.size(), false);
+    for (vector<pair<unsigned int, int> >::const_iterator iter = candidates.begin();
+         iter != candidates.end() && residentTileMemory > MaxResidentTileMemory; iter++)
+    {
+        Tile* tile = residentTiles[iter->second];
+        residentTileMemory -= tile->tex->getMemoryUsage();
+        delete tile->tex;
+        tile->tex = NULL;
+        evicted[iter->second] = true;
+    }
+
+    uint nKept = 0;
+    for (uint i = 0; i < residentTiles.size(); i++)
+    {
+        if (!evicted[i])
+            residentTiles[nKept++] = residentTiles[i];
+    }
+    residentTiles.resize(nKept);
 }
 
 
@@ -214,51 +548,78 @@ uint VirtualTexture::tileIndex(unsigned int lod,
 #endif
 
 
-ImageTexture* VirtualTexture::loadTileTexture(uint lod, uint u, uint v)
+// Get the name of the file containing a tile; lod is the depth of the tile
+// in the quadtree, which is baseSplit greater than the level number.
+string VirtualTexture::getTileFilename(uint lod, uint u, uint v) const
 {
-    lod >>= baseSplit;
+    lod -= baseSplit;
 
     assert(lod < (unsigned)MaxResolutionLevels);
 
     char filename[64];
     sprintf(filename, "level%d/%s%d_%d", lod, tilePrefix.c_str(), u, v);
 
-    string pathname = tilePath + filename + tileExt;
-    Image* img = LoadImageFromFile(pathname);
-    if (img == NULL)
-        return NULL;
+    return tilePath + filename + tileExt;
+}
 
+
+ImageTexture* VirtualTexture::createTileTexture(Image& img, uint lod)
+{
     ImageTexture* tex = NULL;
 
     // Only use mip maps for the LOD 0; for higher LODs, the function of mip
     // mapping is built into the texture.
-    MipMapMode mipMapMode = lod == 0 ? DefaultMipMaps : NoMipMaps;
+    MipMapMode mipMapMode = lod == baseSplit ? DefaultMipMaps : NoMipMaps;
 
-    if (isPow2(img->getWidth()) && isPow2(img->getHeight()))
-        tex = new ImageTexture(*img, EdgeClamp, mipMapMode);
+    if (isPow2(img.getWidth()) && isPow2(img.getHeight()))
+        tex = new ImageTexture(img, EdgeClamp, mipMapMode);
 
     // TODO: Virtual textures can have tiles in different formats, some
     // compressed and some not. The compression flag doesn't make much
     // sense for them.
-    compressed = img->isCompressed();
+    compressed = img.isCompressed();
+
+    return tex;
+}
 
+
+ImageTexture* VirtualTexture::loadTileTexture(uint lod, uint u, uint v)
+{
+    Image* img = LoadImageFromFile(getTileFilename(lod, u, v));
+    if (img == NULL)
+        return NULL;
+
+    ImageTexture* tex = createTileTexture(*img, lod);
     delete img;
 
     return tex;
 }
 
 
+void VirtualTexture::setTileTexture(Tile* tile, ImageTexture* tex)
+{
+    tile->tex = tex;
+    if (tex == NULL)
+    {
+        // cout << "Texture load failed!\n";
+        tile->loadFailed = true;
+    }
+    else
+    {
+        tile->lastUsed = ticks;
+        residentTiles.push_back(tile);
+        residentTileMemory += tex->getMemoryUsage();
+    }
+}
+
+
 void VirtualTexture::makeResident(Tile* tile, uint lod, uint u, uint v)
 {
     if (tile->tex == NULL && !tile->loadFailed)
     {
-        // Potentially evict other tiles in order to make this one fit
-        tile->tex = loadTileTexture(lod, u, v);
-        if (tile->tex == NULL)
-        {
-            // cout << "Texture load failed!\n";
-            tile->loadFailed = true;
-        }
+        // Evicting other tiles to make room for this one is left to
+        // evictTiles()
+        setTileTexture(tile, loadTileTexture(lod, u, v));
     }
 }
 
@@ -328,6 +689,42 @@ void VirtualTexture::addTileToTree(Tile* tile, uint lod, uint u, uint v)
     // Verify that the tile doesn't already exist
     if (node->tile == NULL)
         node->tile = tile;
+    else
+        delete tile;
+}
+
+
+// Return the tile at exactly the specified level of the quadtree, or NULL
+// if there isn't one.
+VirtualTexture::Tile* VirtualTexture::findTile(uint lod, uint u, uint v) const
+{
+    TileQuadtreeNode* node = tileTree[u >> lod];
+
+    for (uint i = 0; i < lod && node != NULL; i++)
+    {
+        uint mask = 1 << (lod - i - 1);
+        uint child = (((v & mask) << 1) | (u & mask)) >> (lod - i - 1);
+        node = node->children[child];
+    }
+
+    return node == NULL ? NULL : node->tile;
+}
+
+
+void VirtualTexture::deleteTileTree(TileQuadtreeNode* node)
+{
+    if (node == NULL)
+        return;
+
+    for (int i = 0; i < 4; i++)
+        deleteTileTree(node->children[i]);
+
+    if (node->tile != NULL)
+    {
+        delete node->tile->tex;
+        delete node->tile;
+    }
+    delete node;
 }
 
 
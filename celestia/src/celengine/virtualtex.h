@@ -11,7 +11,11 @@
 #define _CELENGINE_VIRTUALTEX_H_
 
 #include <string>
+#include <vector>
+#include <deque>
 #include "celutil/basictypes.h"
+#include <celutil/thread.h>
+#include <celutil/workerpool.h>
 #include <celengine/texture.h>
 
 
@@ -34,13 +38,17 @@ class VirtualTexture : public Texture
     virtual void beginUsage();
     virtual void endUsage();
 
+    virtual std::size_t getMemoryUsage() const;
+
  private:
     struct Tile
     {
-        Tile() : lastUsed(0), tex(NULL), loadFailed(false) {};
+        Tile() : lastUsed(0), lastVisible(0), tex(NULL), loadFailed(false), loadPending(false) {};
         unsigned int lastUsed;
+        unsigned int lastVisible;
         ImageTexture* tex;
         bool loadFailed;
+        bool loadPending;
     };
 
     struct TileQuadtreeNode
@@ -56,14 +64,64 @@ class VirtualTexture : public Texture
         TileQuadtreeNode* children[4];
     };
 
+    struct TileRequest
+    {
+        TileRequest(Tile* _tile, uint _lod, uint _u, uint _v) :
+            tile(_tile), lod(_lod), u(_u), v(_v) {};
+
+        bool operator<(const TileRequest& other) const
+        {
+            return lod < other.lod;
+        }
+
+        Tile* tile;
+        uint lod;
+        uint u;
+        uint v;
+    };
+
+    // Reads and decodes a tile image on a worker thread
+    class TileLoadTask : public WorkerTask
+    {
+     public:
+        TileLoadTask(VirtualTexture* _texture,
+                     const TileRequest& _request,
+                     const std::string& _filename) :
+            texture(_texture),
+            request(_request),
+            filename(_filename),
+            image(NULL)
+        {
+        }
+
+        virtual void run();
+
+        VirtualTexture* texture;
+        TileRequest request;
+        std::string filename;
+        Image* image;
+    };
+
+    friend class TileLoadTask;
+
     void populateTileTree();
     void addTileToTree(Tile* tile, uint lod, uint v, uint u);
+    void deleteTileTree(TileQuadtreeNode* node);
     void makeResident(Tile* tile, uint lod, uint v, uint u);
+    void setTileTexture(Tile* tile, ImageTexture* tex);
+    std::string getTileFilename(uint lod, uint u, uint v) const;
+    ImageTexture* createTileTexture(Image& img, uint lod);
     ImageTexture* loadTileTexture(uint lod, uint u, uint v);
 
+    void updateMotion();
+    void addPrefetchRequests(std::vector<TileRequest>& requests) const;
+    void queueTileLoads(WorkerPool* pool);
+    void finishTileLoads();
+    void evictTiles();
+
     Tile* tiles;
     Tile* findTile(unsigned int lod,
-                   unsigned int u, unsigned int v);
+                   unsigned int u, unsigned int v) const;
 
  private:
     std::string tilePath;
@@ -81,6 +139,39 @@ class VirtualTexture : public Texture
     };
 
     TileQuadtreeNode* tileTree[2];
+
+    // Tiles made resident, and the texture memory that they use
+    std::vector<Tile*> residentTiles;
+    std::size_t residentTileMemory;
+
+    // Tiles found by getTile() since beginUsage(); fallbackTiles are coarse
+    // tiles needed because nothing was resident to stand in for a tile.
+    std::vector<TileRequest> visibleTiles;
+    std::vector<TileRequest> fallbackTiles;
+
+    // Motion of the visible region across the texture, used to predict
+    // which tiles will be needed next
+    double visibleSumCos;
+    double visibleSumSin;
+    double visibleSumV;
+    unsigned int visibleCount;
+    unsigned int visibleMaxLOD;
+    bool haveLastCenter;
+    double lastCenterU;
+    double lastCenterV;
+    double velocityU;
+    double velocityV;
+    unsigned int lastMaxLOD;
+    int lodTrend;
+
+    // Tiles queued for loading and not yet made resident
+    unsigned int pendingLoadCount;
+
+    // The mutex guards finishedLoads and runningLoadCount
+    Mutex mutex;
+    Condition loadFinished;
+    std::deque<TileLoadTask*> finishedLoads;
+    unsigned int runningLoadCount;
 };
 
 
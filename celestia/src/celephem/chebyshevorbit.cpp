@@ -0,0 +1,279 @@
+// chebyshevorbit.cpp
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// Piecewise Chebyshev approximation of expensive orbit calculations.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include "chebyshevorbit.h"
+#include <celmath/mathlib.h>
+#include <cmath>
+#include <cassert>
+
+using namespace Eigen;
+using namespace std;
+
+
+// Granule times are measured from J2000
+static const double GranuleEpoch = 2451545.0;
+
+// Initial granule length for periodic orbits is the period divided by this
+// number; non-periodic orbits start with DefaultGranuleLength.
+static const double GranulesPerPeriod    = 32.0;
+static const double DefaultGranuleLength = 16.0;
+
+// The granule length is halved at most this many times in order to meet
+// the tolerance.
+static const unsigned int MaxSubdivisions = 8;
+
+// Number of evaluations of the wrapped orbit required to fit a granule:
+// one at each of the Degree + 1 Chebyshev nodes, and Degree + 2 more to
+// check the error.
+static const unsigned int FitCost = 2 * ChebyshevCachedOrbit::Degree + 3;
+
+
+// Evaluate a Chebyshev series with the Clenshaw recurrence
+static double ChebyshevSum(const double* c, unsigned int n, double x)
+{
+    double b1 = 0.0;
+    double b2 = 0.0;
+    for (unsigned int k = n - 1; k >= 1; k--)
+    {
+        double t = 2.0 * x * b1 - b2 + c[k];
+        b2 = b1;
+        b1 = t;
+    }
+
+    return x * b1 - b2 + c[0];
+}
+
+
+// Evaluate the derivative of a Chebyshev series
+static double ChebyshevDerivativeSum(const double* c, unsigned int n, double x)
+{
+    double d[ChebyshevCachedOrbit::Degree + 1];
+    assert(n <= ChebyshevCachedOrbit::Degree + 1);
+
+    d[n - 1] = 0.0;
+    d[n - 2] = 2.0 * (n - 1) * c[n - 1];
+    for (unsigned int k = n - 2; k >= 1; k--)
+        d[k - 1] = d[k + 1] + 2.0 * k * c[k];
+    d[0] *= 0.5;
+
+    return ChebyshevSum(d, n - 1, x);
+}
+
+
+ChebyshevCachedOrbit::ChebyshevCachedOrbit(CachingOrbit* _orbit,
+                                           double _tolerance,
+                                           unsigned int _maxGranules) :
+    orbit(_orbit),
+    tolerance(_tolerance),
+    maxGranules(_maxGranules),
+    granuleLength(DefaultGranuleLength),
+    minGranuleLength(0.0),
+    candidateIndex(0),
+    candidateRequests(0),
+    fitFailed(false)
+{
+    assert(orbit != NULL);
+    if (orbit->isPeriodic() && orbit->getPeriod() > 0.0)
+        granuleLength = orbit->getPeriod() / GranulesPerPeriod;
+    minGranuleLength = granuleLength / (double) (1 << MaxSubdivisions);
+}
+
+
+ChebyshevCachedOrbit::~ChebyshevCachedOrbit()
+{
+    delete orbit;
+}
+
+
+/*! Copy the granule containing the specified time, along with the granule
+ *  length, since other threads may evict the granule or change the length
+ *  once the mutex is released. False is returned if the granule isn't
+ *  cached and shouldn't be fitted yet, in which case the wrapped orbit must
+ *  be evaluated instead.
+ */
+bool
+ChebyshevCachedOrbit::getGranule(double jd, Granule& granule, double& length) const
+{
+    MutexLock lock(mutex);
+
+    if (fitFailed)
+        return false;
+
+    double g = floor((jd - GranuleEpoch) / granuleLength);
+    if (g < -2.0e9 || g > 2.0e9)
+        return false;
+    int index = (int) g;
+    length = granuleLength;
+
+    if (!granules.empty() && granules.front().index == index)
+    {
+        granule = granules.front();
+        return true;
+    }
+
+    GranuleIndex::iterator iter = granuleIndex.find(index);
+    if (iter != granuleIndex.end())
+    {
+        // Move the granule to the front of the LRU list
+        granules.splice(granules.begin(), granules, iter->second);
+        granule = granules.front();
+        return true;
+    }
+
+    if (index != candidateIndex)
+    {
+        candidateIndex = index;
+        candidateRequests = 0;
+    }
+
+    candidateRequests++;
+    if (candidateRequests < FitCost)
+        return false;
+
+    // The mutex is held while fitting; other threads needing the granule
+    // would only fit it again.
+    if (!fitGranule(index, granule))
+        return false;
+
+    granules.push_front(granule);
+    granuleIndex[index] = granules.begin();
+    if (granules.size() > maxGranules)
+    {
+        granuleIndex.erase(granules.back().index);
+        granules.pop_back();
+    }
+
+    return true;
+}
+
+
+/*! Fit Chebyshev polynomials to the wrapped orbit over a granule. If the
+ *  fit isn't accurate enough, the granule length is halved, the cache is
+ *  flushed, and false is returned.
+ */
+bool ChebyshevCachedOrbit::fitGranule(int index, Granule& granule) const
+{
+    const unsigned int n = Degree + 1;
+    double halfLength = granuleLength * 0.5;
+    double center = GranuleEpoch + (index + 0.5) * granuleLength;
+
+    // Sample the orbit at the Chebyshev nodes
+    Vector3d samples[n];
+    for (unsigned int k = 0; k < n; k++)
+    {
+        double x = cos(PI * (k + 0.5) / n);
+        samples[k] = orbit->computePosition(center + x * halfLength);
+    }
+
+    granule.index = index;
+    for (unsigned int j = 0; j < n; j++)
+    {
+        Vector3d sum = Vector3d::Zero();
+        for (unsigned int k = 0; k < n; k++)
+            sum += samples[k] * cos(PI * j * (k + 0.5) / n);
+        sum *= 2.0 / n;
+        if (j == 0)
+            sum *= 0.5;
+
+        granule.coeffs[0][j] = sum.x();
+        granule.coeffs[1][j] = sum.y();
+        granule.coeffs[2][j] = sum.z();
+    }
+
+    // Check the error at the extrema of the first neglected polynomial,
+    // which include both ends of the granule.
+    bool accurate = true;
+    for (unsigned int k = 0; k <= n && accurate; k++)
+    {
+        double x = cos(PI * k / n);
+        Vector3d p = orbit->computePosition(center + x * halfLength);
+        Vector3d approx(ChebyshevSum(granule.coeffs[0], n, x),
+                        ChebyshevSum(granule.coeffs[1], n, x),
+                        ChebyshevSum(granule.coeffs[2], n, x));
+        if ((p - approx).norm() > tolerance)
+            accurate = false;
+    }
+
+    if (!accurate)
+    {
+        flush();
+        granuleLength *= 0.5;
+        if (granuleLength < minGranuleLength)
+            fitFailed = true;
+    }
+
+    return accurate;
+}
+
+
+void ChebyshevCachedOrbit::flush() const
+{
+    granules.clear();
+    granuleIndex.clear();
+    candidateRequests = 0;
+}
+
+
+Vector3d ChebyshevCachedOrbit::computePosition(double jd) const
+{
+    Granule granule;
+    double length = 0.0;
+    if (!getGranule(jd, granule, length))
+        return orbit->computePosition(jd);
+
+    double halfLength = length * 0.5;
+    double x = (jd - GranuleEpoch - (granule.index + 0.5) * length) / halfLength;
+
+    return Vector3d(ChebyshevSum(granule.coeffs[0], Degree + 1, x),
+                    ChebyshevSum(granule.coeffs[1], Degree + 1, x),
+                    ChebyshevSum(granule.coeffs[2], Degree + 1, x));
+}
+
+
+Vector3d ChebyshevCachedOrbit::computeVelocity(double jd) const
+{
+    Granule granule;
+    double length = 0.0;
+    if (!getGranule(jd, granule, length))
+        return orbit->computeVelocity(jd);
+
+    double halfLength = length * 0.5;
+    double x = (jd - GranuleEpoch - (granule.index + 0.5) * length) / halfLength;
+
+    // Convert the derivative with respect to x to kilometers per day
+    return Vector3d(ChebyshevDerivativeSum(granule.coeffs[0], Degree + 1, x),
+                    ChebyshevDerivativeSum(granule.coeffs[1], Degree + 1, x),
+                    ChebyshevDerivativeSum(granule.coeffs[2], Degree + 1, x)) / halfLength;
+}
+
+
+double ChebyshevCachedOrbit::getPeriod() const
+{
+    return orbit->getPeriod();
+}
+
+
+double ChebyshevCachedOrbit::getBoundingRadius() const
+{
+    return orbit->getBoundingRadius();
+}
+
+
+bool ChebyshevCachedOrbit::isPeriodic() const
+{
+    return orbit->isPeriodic();
+}
+
+
+void ChebyshevCachedOrbit::getValidRange(double& begin, double& end) const
+{
+    orbit->getValidRange(begin, end);
+}
@@ -0,0 +1,92 @@
+// chebyshevorbit.h
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#ifndef _CELENGINE_CHEBYSHEVORBIT_H_
+#define _CELENGINE_CHEBYSHEVORBIT_H_
+
+#include "orbit.h"
+#include <celutil/thread.h>
+#include <vector>
+#include <list>
+#include <map>
+
+
+/*! A ChebyshevCachedOrbit speeds up an expensive orbit calculation such as
+ *  a VSOP87 series by approximating it with Chebyshev polynomials. Time is
+ *  divided into granules of equal length, and the polynomials for a granule
+ *  are fitted the first time that the granule is used often enough to make
+ *  the fit worthwhile. The fit is checked against the wrapped orbit, and the
+ *  granule length is reduced until the error is within the tolerance; if no
+ *  acceptable fit can be found, the wrapped orbit is always used directly.
+ *  The most recently used granules are kept in a cache of limited size,
+ *  which is protected by a mutex so that the orbit may be evaluated on
+ *  several threads at once.
+ */
+class ChebyshevCachedOrbit : public CachingOrbit
+{
+ public:
+    ChebyshevCachedOrbit(CachingOrbit* _orbit,
+                         double _tolerance,
+                         unsigned int _maxGranules = DefaultMaxGranules);
+    virtual ~ChebyshevCachedOrbit();
+
+    virtual Eigen::Vector3d computePosition(double jd) const;
+    virtual Eigen::Vector3d computeVelocity(double jd) const;
+    virtual double getPeriod() const;
+    virtual double getBoundingRadius() const;
+    virtual bool isPeriodic() const;
+    virtual void getValidRange(double& begin, double& end) const;
+
+    double getTolerance() const { return tolerance; }
+    double getGranuleLength() const { return granuleLength; }
+
+    enum
+    {
+        Degree             = 12,
+        DefaultMaxGranules = 64,
+    };
+
+ private:
+    struct Granule
+    {
+        int index;
+        // Degree + 1 coefficients for each of x, y, and z
+        double coeffs[3][Degree + 1];
+    };
+
+    bool getGranule(double jd, Granule& granule, double& length) const;
+    bool fitGranule(int index, Granule& granule) const;
+    void flush() const;
+
+ private:
+    CachingOrbit* orbit;
+    double tolerance;
+    unsigned int maxGranules;
+    mutable double granuleLength;
+    double minGranuleLength;
+
+    typedef std::list<Granule> GranuleList;
+    typedef std::map<int, GranuleList::iterator> GranuleIndex;
+
+    // Granules in order from most to least recently used
+    mutable GranuleList granules;
+    mutable GranuleIndex granuleIndex;
+
+    // A granule is fitted only after it has been requested often enough
+    // to pay for the evaluations of the wrapped orbit that the fit
+    // requires.
+    mutable int candidateIndex;
+    mutable unsigned int candidateRequests;
+
+    mutable bool fitFailed;
+
+    mutable Mutex mutex;
+};
+
+#endif // _CELENGINE_CHEBYSHEVORBIT_H_
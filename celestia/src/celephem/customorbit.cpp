@@ -10,6 +10,7 @@
 #include "customorbit.h"
 #include "vsop87.h"
 #include "jpleph.h"
+#include "chebyshevorbit.h"
 #include <celengine/astro.h>
 #include <celmath/mathlib.h>
 #include <celmath/geomutil.h>
@@ -37,6 +38,10 @@ static const double SaturnRadius = 60330.0;
 // the apocenter distance computed from the mean elements.
 static const double BoundingRadiusSlack = 1.2;
 
+// Maximum error of the Chebyshev approximations to the analytic theories,
+// in kilometers.
+static const double CustomOrbitTolerance = 1.0e-3;
+
 static bool jplephInitialized = false;
 static JPLEphemeris* jpleph = NULL;
 
@@ -3150,15 +3155,30 @@ static double yearToJD(int year)
 }
 
 
+// Most of the analytic theories are expensive to evaluate, so they are
+// approximated by Chebyshev polynomials.
+static Orbit* CreateCachedOrbit(CachingOrbit* orbit)
+{
+    return new ChebyshevCachedOrbit(orbit, CustomOrbitTolerance);
+}
+
+
 Orbit* GetCustomOrbit(const string& name)
 {
     // Attempt to load JPL ephemeris data if we haven't tried already
     if (!jplephInitialized)
     {
         jplephInitialized = true;
-        ifstream in("data/jpleph.dat", ios::in | ios::binary);
-        if (in.good())
-            jpleph = JPLEphemeris::load(in);
+
+        // Map the ephemeris file if possible so that only the records that
+        // are actually used are read.
+        jpleph = JPLEphemeris::loadMapped("data/jpleph.dat");
+        if (jpleph == NULL)
+        {
+            ifstream in("data/jpleph.dat", ios::in | ios::binary);
+            if (in.good())
+                jpleph = JPLEphemeris::load(in);
+        }
         if (jpleph != NULL)
         {   
             if (jpleph->getDENumber()!=100) {
@@ -3178,25 +3198,25 @@ Orbit* GetCustomOrbit(const string& name)
     }
 
     if (name == "mercury")
-        return new MixedOrbit(new MercuryOrbit(), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
+        return new MixedOrbit(CreateCachedOrbit(new MercuryOrbit()), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
     if (name == "venus")
-        return new MixedOrbit(new VenusOrbit(), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
+        return new MixedOrbit(CreateCachedOrbit(new VenusOrbit()), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
     if (name == "earth")
-        return new MixedOrbit(new EarthOrbit(), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
+        return new MixedOrbit(CreateCachedOrbit(new EarthOrbit()), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
     if (name == "moon")
-        return new MixedOrbit(new LunarOrbit(), yearToJD(-2000), yearToJD(4000), astro::EarthMass + astro::LunarMass);
+        return new MixedOrbit(CreateCachedOrbit(new LunarOrbit()), yearToJD(-2000), yearToJD(4000), astro::EarthMass + astro::LunarMass);
     if (name == "mars")
-        return new MixedOrbit(new MarsOrbit(), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
+        return new MixedOrbit(CreateCachedOrbit(new MarsOrbit()), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
     if (name == "jupiter")
-        return new MixedOrbit(new JupiterOrbit(), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
+        return new MixedOrbit(CreateCachedOrbit(new JupiterOrbit()), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
     if (name == "saturn")
-        return new MixedOrbit(new SaturnOrbit(), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
+        return new MixedOrbit(CreateCachedOrbit(new SaturnOrbit()), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
     if (name == "uranus")
-        return new MixedOrbit(new UranusOrbit(), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
+        return new MixedOrbit(CreateCachedOrbit(new UranusOrbit()), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
     if (name == "neptune")
-        return new MixedOrbit(new NeptuneOrbit(), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
+        return new MixedOrbit(CreateCachedOrbit(new NeptuneOrbit()), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
     if (name == "pluto")
-        return new MixedOrbit(new PlutoOrbit(), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
+        return new MixedOrbit(CreateCachedOrbit(new PlutoOrbit()), yearToJD(-4000), yearToJD(4000), astro::SolarMass);
 
     // Two styles of custom orbit name are permitted for JPL ephemeris orbits.
     // The preferred is <ephemeris>-<object>, e.g. jpl-mercury. But the reverse
@@ -3257,54 +3277,54 @@ Orbit* GetCustomOrbit(const string& name)
 
     // HTC2.0 ephemeris for Saturnian satellites in Lagrange points of Tethys and Dione
     if (name == "htc20-helene")
-        return HTC20Orbit::CreateHeleneOrbit();
+        return CreateCachedOrbit(HTC20Orbit::CreateHeleneOrbit());
     if (name == "htc20-telesto")
-        return HTC20Orbit::CreateTelestoOrbit();
+        return CreateCachedOrbit(HTC20Orbit::CreateTelestoOrbit());
     if (name == "htc20-calypso")
-        return HTC20Orbit::CreateCalypsoOrbit();
+        return CreateCachedOrbit(HTC20Orbit::CreateCalypsoOrbit());
 
     if (name == "phobos")
-        return new PhobosOrbit();
+        return CreateCachedOrbit(new PhobosOrbit());
     if (name == "deimos")
-        return new DeimosOrbit();
+        return CreateCachedOrbit(new DeimosOrbit());
     if (name == "io")
-        return new IoOrbit();
+        return CreateCachedOrbit(new IoOrbit());
     if (name == "europa")
-        return new EuropaOrbit();
+        return CreateCachedOrbit(new EuropaOrbit());
     if (name == "ganymede")
-        return new GanymedeOrbit();
+        return CreateCachedOrbit(new GanymedeOrbit());
     if (name == "callisto")
-        return new CallistoOrbit();
+        return CreateCachedOrbit(new CallistoOrbit());
     if (name == "mimas")
-        return new MimasOrbit();
+        return CreateCachedOrbit(new MimasOrbit());
     if (name == "enceladus")
-        return new EnceladusOrbit();
+        return CreateCachedOrbit(new EnceladusOrbit());
     if (name == "tethys")
-        return new TethysOrbit();
+        return CreateCachedOrbit(new TethysOrbit());
     if (name == "dione")
-        return new DioneOrbit();
+        return CreateCachedOrbit(new DioneOrbit());
     if (name == "rhea")
-        return new RheaOrbit();
+        return CreateCachedOrbit(new RheaOrbit());
     if (name == "titan")
-        return new TitanOrbit();
+        return CreateCachedOrbit(new TitanOrbit());
     if (name == "hyperion")
-        return new HyperionOrbit();
+        return CreateCachedOrbit(new HyperionOrbit());
     if (name == "iapetus")
-        return new IapetusOrbit();
+        return CreateCachedOrbit(new IapetusOrbit());
     if (name == "phoebe")
-        return new PhoebeOrbit();
+        return CreateCachedOrbit(new PhoebeOrbit());
     if (name == "miranda")
-        return CreateUranianSatelliteOrbit(1);
+        return CreateCachedOrbit(CreateUranianSatelliteOrbit(1));
     if (name == "ariel")
-        return CreateUranianSatelliteOrbit(2);
+        return CreateCachedOrbit(CreateUranianSatelliteOrbit(2));
     if (name == "umbriel")
-        return CreateUranianSatelliteOrbit(3);
+        return CreateCachedOrbit(CreateUranianSatelliteOrbit(3));
     if (name == "titania")
-        return CreateUranianSatelliteOrbit(4);
+        return CreateCachedOrbit(CreateUranianSatelliteOrbit(4));
     if (name == "oberon")
-        return CreateUranianSatelliteOrbit(5);
+        return CreateCachedOrbit(CreateUranianSatelliteOrbit(5));
     if (name == "triton")
-        return new TritonOrbit();
+        return CreateCachedOrbit(new TritonOrbit());
     else
         return CreateVSOP87Orbit(name);
 }
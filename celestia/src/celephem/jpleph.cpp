@@ -13,9 +13,11 @@
 #include <fstream>
 #include <iomanip>
 #include <cstdio>
+#include <cstring>
 #include <cassert>
 #include <celutil/bytes.h>
 #include <celutil/basictypes.h>
+#include <celutil/mappedfile.h>
 #include "jpleph.h"
 
 using namespace Eigen;
@@ -56,18 +58,30 @@ static double readDouble(istream& in, bool swap)
 JPLEphRecord::~JPLEphRecord()
 {
     if (coeffs != NULL)
-	delete coeffs;
+	delete[] coeffs;
 }
 
 
 
-JPLEphemeris::JPLEphemeris()
+JPLEphemeris::JPLEphemeris() :
+    nRecords(0),
+    mappedFile(NULL),
+    recordCacheClock(0)
 {
+    for (unsigned int i = 0; i < RecordCacheSize; i++)
+    {
+        recordCache[i].recNo = ~0u;
+        recordCache[i].lastUsed = 0;
+        recordCache[i].coeffs = NULL;
+    }
 }
 
 
 JPLEphemeris::~JPLEphemeris()
 {
+    for (unsigned int i = 0; i < RecordCacheSize; i++)
+        delete[] recordCache[i].coeffs;
+    delete mappedFile;
 }
 
 
@@ -129,10 +143,75 @@ Vector3d JPLEphemeris::getPlanetPosition(JPLEphemItem planet, double tjd) const
     // recNo is always >= 0:
     unsigned int recNo = (unsigned int) ((tjd - startDate) / daysPerInterval);
     // Make sure we don't go past the end of the array if t == endDate
-    if (recNo >= records.size())
-        recNo = records.size() - 1;
-    const JPLEphRecord* rec = &records[recNo];
+    if (recNo >= nRecords)
+        recNo = nRecords - 1;
+
+    if (mappedFile == NULL)
+    {
+        const JPLEphRecord* rec = &records[recNo];
+        return evaluate(planet, tjd, rec->t0, rec->coeffs);
+    }
+    else if (!swapBytes)
+    {
+        // Records in native byte order are used in place; the first two
+        // values of each record are its start and end time.
+        const double* rec = reinterpret_cast<const double*>(mappedFile->data()) +
+            (recNo + 2) * recordSize;
+        return evaluate(planet, tjd, rec[0], rec + 2);
+    }
+    else
+    {
+        MutexLock lock(recordCacheMutex);
+        const double* rec = getMappedRecord(recNo);
+        return evaluate(planet, tjd, rec[0], rec + 2);
+    }
+}
 
+
+// Return a byte swapped copy of a record from a mapped ephemeris file,
+// decoding it if it isn't in the cache already. The record cache mutex must
+// be locked by the caller, and the returned record is only valid while the
+// mutex remains locked.
+const double* JPLEphemeris::getMappedRecord(unsigned int recNo) const
+{
+    recordCacheClock++;
+
+    CachedRecord* entry = &recordCache[0];
+    for (unsigned int i = 0; i < RecordCacheSize; i++)
+    {
+        if (recordCache[i].recNo == recNo)
+        {
+            recordCache[i].lastUsed = recordCacheClock;
+            return recordCache[i].coeffs;
+        }
+
+        // Replace the least recently used record
+        if (recordCache[i].lastUsed < entry->lastUsed)
+            entry = &recordCache[i];
+    }
+
+    if (entry->coeffs == NULL)
+        entry->coeffs = new double[recordSize];
+
+    const char* rec = mappedFile->data() + (size_t) (recNo + 2) * recordSize * sizeof(double);
+    for (unsigned int i = 0; i < recordSize; i++)
+    {
+        double d;
+        memcpy(&d, rec + i * sizeof(double), sizeof(double));
+        entry->coeffs[i] = bswap_double(d);
+    }
+
+    entry->recNo = recNo;
+    entry->lastUsed = recordCacheClock;
+
+    return entry->coeffs;
+}
+
+
+// Evaluate the Chebyshev polynomials for an item in a record with start
+// time t0.
+Vector3d JPLEphemeris::evaluate(JPLEphemItem planet, double tjd, double t0, const double* recCoeffs) const
+{
     assert(coeffInfo[planet].nGranules >= 1);
     assert(coeffInfo[planet].nGranules <= 32);
     assert(coeffInfo[planet].nCoeffs <= MaxChebyshevCoeffs);
@@ -140,20 +219,20 @@ Vector3d JPLEphemeris::getPlanetPosition(JPLEphemItem planet, double tjd) const
     // u is the normalized time (in [-1, 1]) for interpolating
     // coeffs is a pointer to the Chebyshev coefficients
     double u = 0.0;
-    double* coeffs = NULL;
+    const double* coeffs = NULL;
 
     // nGranules is unsigned int so it will be compared against FFFFFFFF:
     if (coeffInfo[planet].nGranules == (unsigned int) -1)
     {
-    	coeffs = rec->coeffs + coeffInfo[planet].offset;
-    	u = 2.0 * (tjd - rec->t0) / daysPerInterval - 1.0;
+    	coeffs = recCoeffs + coeffInfo[planet].offset;
+    	u = 2.0 * (tjd - t0) / daysPerInterval - 1.0;
     }
     else
     {
 	double daysPerGranule = daysPerInterval / coeffInfo[planet].nGranules;
-	int granule = (int) ((tjd - rec->t0) / daysPerGranule);
-	double granuleStartDate = rec->t0 + daysPerGranule * (double) granule;
-	coeffs = rec->coeffs + coeffInfo[planet].offset +
+	int granule = (int) ((tjd - t0) / daysPerGranule);
+	double granuleStartDate = t0 + daysPerGranule * (double) granule;
+	coeffs = recCoeffs + coeffInfo[planet].offset +
             granule * coeffInfo[planet].nCoeffs * 3;
 	u = 2.0 * (tjd - granuleStartDate) / daysPerGranule - 1.0;
     }
@@ -178,42 +257,38 @@ Vector3d JPLEphemeris::getPlanetPosition(JPLEphemItem planet, double tjd) const
 }
 
 
-JPLEphemeris* JPLEphemeris::load(istream& in)
+// Read the header and constants records of an ephemeris; the stream is
+// left positioned at the start of the first data record.
+bool JPLEphemeris::loadHeader(istream& in)
 {
-
-    JPLEphemeris* eph = NULL;
-    eph = new JPLEphemeris();
-    if (eph == NULL)
-        return NULL;
-
     // Figure out ephemeris type and endianess
 
     // Skip past three header labels
     in.ignore(LabelSize * 3);
     if (!in.good())
-        return NULL;
+        return false;
     // Skip past the constant names
     in.ignore(NConstants * ConstantNameLength);
     if (!in.good())
-        return NULL;
+        return false;
     if (!in.good())
-        return NULL;
+        return false;
     // Skip past the start time, end time, and time interval
     in.ignore(3 * 8);
     if (!in.good())
-        return NULL;
+        return false;
     // Skip past number of constants with valid values
     in.ignore(4);
     if (!in.good())
-        return NULL;
+        return false;
     // Skip past AU and Earth-Moon ratio
     in.ignore(2 * 8);
     if (!in.good())
-        return NULL;
+        return false;
     // Skip past coefficient information for each item in the ephemeris
     in.ignore(4 * 3 * JPLEph_NItems);
     if (!in.good())
-        return NULL;
+        return false;
 
     // read DE number
     uint32 deNum = readUint(in,false);
@@ -221,27 +296,26 @@ JPLEphemeris* JPLEphemeris::load(istream& in)
 
     if (deNum==100) {
        // INPOP ephemeris with same endianess as CPU
-       eph->swapBytes=false;
-       eph->DENum=deNum;
+       swapBytes=false;
+       DENum=deNum;
     }
     else if (deNum2==100) {
        // INPOP ephemeris with different endianess
-       eph->swapBytes=true;
-       eph->DENum=deNum2;
+       swapBytes=true;
+       DENum=deNum2;
     }
     else if ((deNum>(1U<<15)) && (deNum2>=200)){
        // DE ephemeris with different endianess
-       eph->swapBytes=true;
-       eph->DENum=deNum2;      
+       swapBytes=true;
+       DENum=deNum2;      
     }
     else if ((deNum<=(1U<<15)) && (deNum>=200)){
        // DE ephemeris with same endianess as CPU
-       eph->swapBytes=false;
-       eph->DENum=deNum;
+       swapBytes=false;
+       DENum=deNum;
     }
     else {
-        delete eph;
-        return NULL;
+        return false;
     }
    
     // Rewind input file
@@ -250,82 +324,92 @@ JPLEphemeris* JPLEphemeris::load(istream& in)
     // Skip past three header labels
     in.ignore(LabelSize * 3);
     if (!in.good())
-        return NULL;
+        return false;
 
     // Skip past the constant names
     in.ignore(NConstants * ConstantNameLength);
     if (!in.good())
-        return NULL;
+        return false;
 
     // Read the start time, end time, and time interval
-    eph->startDate = readDouble(in,eph->swapBytes);
-    eph->endDate = readDouble(in,eph->swapBytes);
-    eph->daysPerInterval = readDouble(in,eph->swapBytes);
+    startDate = readDouble(in,swapBytes);
+    endDate = readDouble(in,swapBytes);
+    daysPerInterval = readDouble(in,swapBytes);
     if (!in.good())
     {
-        delete eph;
-        return NULL;
+        return false;
     }
 
     // Number of constants with valid values; not useful for us
-    (void) readUint(in,eph->swapBytes);
+    (void) readUint(in,swapBytes);
 
-    eph->au = readDouble(in,eph->swapBytes);     // kilometers per astronomical unit
-    eph->earthMoonMassRatio = readDouble(in,eph->swapBytes);
+    au = readDouble(in,swapBytes);     // kilometers per astronomical unit
+    earthMoonMassRatio = readDouble(in,swapBytes);
 
     // Read the coefficient information for each item in the ephemeris
     unsigned int i;
-    eph->recordSize=0;
+    recordSize=0;
     for (i = 0; i < JPLEph_NItems; i++)
     {
-        eph->coeffInfo[i].offset = readUint(in,eph->swapBytes) - 3;
-        eph->coeffInfo[i].nCoeffs = readUint(in,eph->swapBytes);
-        eph->coeffInfo[i].nGranules = readUint(in,eph->swapBytes);
-        eph->recordSize+=eph->coeffInfo[i].nCoeffs*eph->coeffInfo[i].nGranules*((i==11)?2:3); // last item is the nutation ephemeris (only 2 components)
+        coeffInfo[i].offset = readUint(in,swapBytes) - 3;
+        coeffInfo[i].nCoeffs = readUint(in,swapBytes);
+        coeffInfo[i].nGranules = readUint(in,swapBytes);
+        recordSize+=coeffInfo[i].nCoeffs*coeffInfo[i].nGranules*((i==11)?2:3); // last item is the nutation ephemeris (only 2 components)
     }
     if (!in.good())
     {
-        delete eph;
-        return NULL;
+        return false;
     }
     // Skip DE number
     in.ignore(4);
 
-    eph->librationCoeffInfo.offset        = readUint(in,eph->swapBytes);
-    eph->librationCoeffInfo.nCoeffs       = readUint(in,eph->swapBytes);
-    eph->librationCoeffInfo.nGranules     = readUint(in,eph->swapBytes);
-    eph->recordSize+=eph->librationCoeffInfo.nCoeffs*eph->librationCoeffInfo.nGranules*3;
-    eph->recordSize+=2;   // record start and end time
+    librationCoeffInfo.offset        = readUint(in,swapBytes);
+    librationCoeffInfo.nCoeffs       = readUint(in,swapBytes);
+    librationCoeffInfo.nGranules     = readUint(in,swapBytes);
+    recordSize+=librationCoeffInfo.nCoeffs*librationCoeffInfo.nGranules*3;
+    recordSize+=2;   // record start and end time
 
     if (!in.good())
     {
-        delete eph;
-        return NULL;
+        return false;
     }
 
     // if INPOP ephemeris, read record size
     if (deNum==100) {
-       eph->recordSize=readUint(in,eph->swapBytes);
+       recordSize=readUint(in,swapBytes);
        // Skip past the rest of the record
-       in.ignore(eph->recordSize * 8 - 2860);
+       in.ignore(recordSize * 8 - 2860);
     }
     else {
        // Skip past the rest of the record
-       in.ignore(eph->recordSize * 8 - 2856);
+       in.ignore(recordSize * 8 - 2856);
     }
 
     // The next record contains constant values (which we don't need)
-    in.ignore(eph->recordSize * 8);
+    in.ignore(recordSize * 8);
     if (!in.good())
+    {
+        return false;
+    }
+
+    nRecords = (unsigned int) ((endDate - startDate) / daysPerInterval);
+
+    return true;
+}
+
+
+JPLEphemeris* JPLEphemeris::load(istream& in)
+{
+    JPLEphemeris* eph = new JPLEphemeris();
+    if (!eph->loadHeader(in))
     {
         delete eph;
         return NULL;
     }
 
-    unsigned int nRecords = (unsigned int) ((eph->endDate - eph->startDate) /
-					    eph->daysPerInterval);
-    eph->records.resize(nRecords);
-    for (i = 0; i < nRecords; i++)
+    unsigned int i;
+    eph->records.resize(eph->nRecords);
+    for (i = 0; i < eph->nRecords; i++)
     {
     	eph->records[i].t0 = readDouble(in,eph->swapBytes);
     	eph->records[i].t1 = readDouble(in,eph->swapBytes);
@@ -346,3 +430,36 @@ JPLEphemeris* JPLEphemeris::load(istream& in)
 
     return eph;
 }
+
+
+JPLEphemeris* JPLEphemeris::loadMapped(const string& filename)
+{
+    ifstream in(filename.c_str(), ios::in | ios::binary);
+    if (!in.good())
+        return NULL;
+
+    JPLEphemeris* eph = new JPLEphemeris();
+    if (!eph->loadHeader(in) || eph->nRecords == 0)
+    {
+        delete eph;
+        return NULL;
+    }
+    in.close();
+
+    eph->mappedFile = OpenMappedFile(filename);
+    if (eph->mappedFile == NULL)
+    {
+        delete eph;
+        return NULL;
+    }
+
+    // The header and constants records precede the data records
+    size_t recordBytes = (size_t) eph->recordSize * sizeof(double);
+    if (eph->mappedFile->size() / recordBytes < (size_t) eph->nRecords + 2)
+    {
+        delete eph;
+        return NULL;
+    }
+
+    return eph;
+}
@@ -14,8 +14,12 @@
 #define _CELENGINE_JPLEPH_H_
 
 #include <iostream>
+#include <string>
 #include <vector>
 #include <Eigen/Core>
+#include <celutil/thread.h>
+
+class MappedFile;
 
 enum JPLEphemItem
 {
@@ -69,6 +73,11 @@ public:
 
     static JPLEphemeris* load(std::istream&);
 
+    // Memory map an ephemeris file instead of reading all records into
+    // memory. Records are decoded on demand, so the time required to load
+    // the ephemeris and the memory used don't depend on its span.
+    static JPLEphemeris* loadMapped(const std::string& filename);
+
     unsigned int getDENumber() const;
     double getStartDate() const;
     double getEndDate() const;
@@ -89,7 +98,28 @@ private:
     unsigned int DENum;       // ephemeris version
     unsigned int recordSize;  // number of doubles per record
     bool swapBytes;
+    unsigned int nRecords;
     std::vector<JPLEphRecord> records;
+
+    // Records of a mapped ephemeris file that has to be byte swapped are
+    // decoded into a small cache.
+    struct CachedRecord
+    {
+        unsigned int recNo;
+        unsigned int lastUsed;
+        double* coeffs;
+    };
+
+    enum { RecordCacheSize = 8 };
+
+    MappedFile* mappedFile;
+    mutable CachedRecord recordCache[RecordCacheSize];
+    mutable unsigned int recordCacheClock;
+    mutable Mutex recordCacheMutex;
+
+    bool loadHeader(std::istream&);
+    const double* getMappedRecord(unsigned int recNo) const;
+    Eigen::Vector3d evaluate(JPLEphemItem, double tjd, double t0, const double* coeffs) const;
 };
 
 #endif // _CELENGINE_JPLEPH_H_
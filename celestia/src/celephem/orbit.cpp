@@ -9,6 +9,7 @@
 // of the License, or (at your option) any later version.
 
 #include "orbit.h"
+#include "orbitbatch.h"
 #include <celengine/body.h>
 #include <celmath/mathlib.h>
 #include <celmath/solve.h>
@@ -37,139 +38,72 @@ static Vector3d cubicInterpolate(const Vector3d& p0, const Vector3d& v0,
 }
 
 
-/** Sample the orbit over the time range [ startTime, endTime ] using the
-  * default sampling parameters for the orbit type.
-  *
-  * Subclasses of orbit should override this method as necessary. The default
-  * implementation uses an adaptive sampling scheme with the following defaults:
-  *    tolerance: 1 km
-  *    start step: T / 1e5
-  *    min step: T / 1e7
-  *    max step: T / 100
-  *
-  * Where T is either the mean orbital period for periodic orbits or the valid
-  * time span for aperiodic trajectories.
-  */
-void Orbit::sample(double startTime, double endTime, OrbitSampleProc& proc) const
+// Number of intervals into which the sampled time range is first divided
+static const unsigned int InitialSampleIntervals = 16;
+
+// Limit on the number of times that each of the initial intervals is halved
+static const unsigned int MaxSampleBisections = 20;
+
+
+// Add the samples needed to cover the interval (t0, t1] within the tolerance,
+// halving the interval until the cubic curve between its end points passes
+// within the tolerance of the orbit at the midpoint.
+static void sampleInterval(const Orbit& orbit,
+                           double t0, const Vector3d& p0, const Vector3d& v0,
+                           double t1, const Vector3d& p1, const Vector3d& v1,
+                           double tolerance,
+                           unsigned int bisections,
+                           OrbitSampleProc& proc)
 {
-    double span = 0.0;
-    if (isPeriodic())
+    double dt = t1 - t0;
+    double tmid = t0 + dt * 0.5;
+    Vector3d pmid = orbit.positionAtTime(tmid);
+    Vector3d pInterp = cubicInterpolate(p0, v0 * dt, p1, v1 * dt, 0.5);
+
+    if ((pInterp - pmid).norm() > tolerance && bisections > 0)
     {
-        span = getPeriod();
+        Vector3d vmid = orbit.velocityAtTime(tmid);
+        sampleInterval(orbit, t0, p0, v0, tmid, pmid, vmid, tolerance, bisections - 1, proc);
+        sampleInterval(orbit, tmid, pmid, vmid, t1, p1, v1, tolerance, bisections - 1, proc);
     }
     else
     {
-        double startValidInterval = 0.0;
-        double endValidInterval = 0.0;
-        getValidRange(startValidInterval, endValidInterval);
-        if (startValidInterval == endValidInterval)
-        {
-            span = endValidInterval - startValidInterval;
-        }
-        else
-        {
-            span = endTime - startTime;
-        }
+        proc.sample(t1, p1, v1);
     }
-
-    AdaptiveSamplingParameters samplingParams;
-    samplingParams.tolerance = 1.0; // kilometers
-    samplingParams.maxStep = span / 100.0;
-    samplingParams.minStep = span / 1.0e7;
-    samplingParams.startStep = span / 1.0e5;
-
-    adaptiveSample(startTime, endTime, proc, samplingParams);
 }
 
 
-/** Adaptively sample the orbit over the range [ startTime, endTime ].
+/** Sample the orbit over the time range [ startTime, endTime ].
+  *
+  * Subclasses of orbit should override this method as necessary. The default
+  * implementation divides the range into a few intervals and then halves
+  * each interval until the error of the cubic curve at its midpoint is
+  * within the tolerance, so that samples are dense only where the orbit
+  * curves sharply, such as near the pericenter of an eccentric orbit.
   */
-void Orbit::adaptiveSample(double startTime, double endTime, OrbitSampleProc& proc, const AdaptiveSamplingParameters& samplingParams) const
-{
-    double startStepSize = samplingParams.startStep;
-    double maxStepSize   = samplingParams.maxStep;
-    double minStepSize   = samplingParams.minStep;
-    double tolerance     = samplingParams.tolerance;
-    double t = startTime;
-    const double stepFactor = 1.25;
-
-    Vector3d lastP = positionAtTime(t);
-    Vector3d lastV = velocityAtTime(t);
-    proc.sample(t, lastP, lastV);
-    int sampCount = 0;
-    int nTests = 0;
-
-    while (t < endTime)
+void Orbit::sample(double startTime, double endTime, double tolerance, OrbitSampleProc& proc) const
+{
+    double t0 = startTime;
+    Vector3d p0 = positionAtTime(t0);
+    Vector3d v0 = velocityAtTime(t0);
+    proc.sample(t0, p0, v0);
+
+    if (endTime <= startTime)
+        return;
+
+    double dt = (endTime - startTime) / InitialSampleIntervals;
+    for (unsigned int i = 1; i <= InitialSampleIntervals; i++)
     {
-        // Make sure that we don't go past the end of the sample interval
-        maxStepSize = min(maxStepSize, endTime - t);
-        double dt = min(maxStepSize, startStepSize * 2.0);
-
-        Vector3d p1 = positionAtTime(t + dt);
-        Vector3d v1 = velocityAtTime(t + dt);
-
-        double tmid = t + dt / 2.0;
-        Vector3d pTest = positionAtTime(tmid);
-        Vector3d pInterp = cubicInterpolate(lastP, lastV * dt,
-                                            p1, v1 * dt,
-                                            0.5);
-        nTests++;
-
-        double positionError = (pInterp - pTest).norm();
-
-        // Error is greater than tolerance; decrease the step until the
-        // error is within the tolerance.
-        if (positionError > tolerance)
-        {
-            while (positionError > tolerance && dt > minStepSize)
-            {
-                dt /= stepFactor;
-
-                p1 = positionAtTime(t + dt);
-                v1 = velocityAtTime(t + dt);
-
-                tmid = t + dt / 2.0;
-                pTest = positionAtTime(tmid);
-                pInterp = cubicInterpolate(lastP, lastV * dt,
-                                           p1, v1 * dt,
-                                           0.5);
-                nTests++;
-
-                positionError = (pInterp - pTest).norm();
-            }
-        }
-        else
-        {
-            // Error is less than the tolerance; increase the step size until the
-            // tolerance is just exceeded.
-            while (positionError < tolerance && dt < maxStepSize)
-            {
-                dt *= stepFactor;
-
-                p1 = positionAtTime(t + dt);
-                v1 = velocityAtTime(t + dt);
-
-                tmid = t + dt / 2.0;
-                pTest = positionAtTime(tmid);
-                pInterp = cubicInterpolate(lastP, lastV * dt,
-                                           p1, v1 * dt,
-                                           0.5);
-                nTests++;
-
-                positionError = (pInterp - pTest).norm();
-            }
-        }
-
-        t = t + dt;
-        lastP = p1;
-        lastV = v1;
-
-        proc.sample(t, lastP, lastV);
-        sampCount++;
-    }
+        double t1 = i == InitialSampleIntervals ? endTime : startTime + dt * i;
+        Vector3d p1 = positionAtTime(t1);
+        Vector3d v1 = velocityAtTime(t1);
 
-    // Statistics for debugging
-    // clog << "Orbit samples: " << sampCount << ", nTests: " << nTests << endl;
+        sampleInterval(*this, t0, p0, v0, t1, p1, v1, tolerance, MaxSampleBisections, proc);
+
+        t0 = t1;
+        p0 = p1;
+        v0 = v1;
+    }
 }
 
 
@@ -432,6 +366,28 @@ double EllipticalOrbit::getBoundingRadius() const
 }
 
 
+bool EllipticalOrbit::addToBatch(OrbitBatch& batch, unsigned int index) const
+{
+    return batch.addEllipticalOrbit(pericenterDistance, eccentricity,
+                                    meanAnomalyAtEpoch, period, epoch,
+                                    orbitPlaneRotation, index);
+}
+
+
+// An object in a closed orbit moves fastest at pericenter, where its
+// speed is n * a * sqrt((1 + e) / (1 - e)).
+double EllipticalOrbit::getMaximumSpeed() const
+{
+    if (eccentricity >= 1.0)
+        return -1.0;
+
+    double semiMajorAxis = pericenterDistance / (1.0 - eccentricity);
+    double meanMotion = 2.0 * PI / period;
+
+    return meanMotion * semiMajorAxis * sqrt((1.0 + eccentricity) / (1.0 - eccentricity));
+}
+
+
 
 
 CachingOrbit::CachingOrbit() :
@@ -447,41 +403,53 @@ CachingOrbit::~CachingOrbit()
 }
 
 
+// The cache is checked and updated while holding its mutex, but the
+// position or velocity is computed without it, both so that threads
+// evaluating the orbit at different times don't wait for each other, and
+// because computeVelocity() usually calls positionAtTime().
 Vector3d CachingOrbit::positionAtTime(double jd) const
 {
+    {
+        MutexLock lock(cacheMutex);
+        if (jd == lastTime && positionCacheValid)
+            return lastPosition;
+    }
+
+    Vector3d position = computePosition(jd);
+
+    MutexLock lock(cacheMutex);
     if (jd != lastTime)
     {
         lastTime = jd;
-        lastPosition = computePosition(jd);
-		positionCacheValid = true;
-		velocityCacheValid = false;
+        velocityCacheValid = false;
     }
-	else if (!positionCacheValid)
-	{
-		lastPosition = computePosition(jd);
-		positionCacheValid = true;
-	}
+    lastPosition = position;
+    positionCacheValid = true;
 
-    return lastPosition;
+    return position;
 }
 
 
 Vector3d CachingOrbit::velocityAtTime(double jd) const
 {
-	if (jd != lastTime)
-	{
-		lastVelocity = computeVelocity(jd);
-		lastTime = jd;  // must be set *after* call to computeVelocity
-		positionCacheValid = false;
-		velocityCacheValid = true;
-	}
-	else if (!velocityCacheValid)
-	{
-		lastVelocity = computeVelocity(jd);
-		velocityCacheValid = true;
-	}
+    {
+        MutexLock lock(cacheMutex);
+        if (jd == lastTime && velocityCacheValid)
+            return lastVelocity;
+    }
+
+    Vector3d velocity = computeVelocity(jd);
+
+    MutexLock lock(cacheMutex);
+    if (jd != lastTime)
+    {
+        lastTime = jd;
+        positionCacheValid = false;
+    }
+    lastVelocity = velocity;
+    velocityCacheValid = true;
 
-	return lastVelocity;
+    return velocity;
 }
 
 
@@ -633,7 +601,7 @@ double MixedOrbit::getBoundingRadius() const
 }
 
 
-void MixedOrbit::sample(double startTime, double endTime, OrbitSampleProc& proc) const
+void MixedOrbit::sample(double startTime, double endTime, double tolerance, OrbitSampleProc& proc) const
 {
     Orbit* o;
     if (startTime < begin)
@@ -642,7 +610,21 @@ void MixedOrbit::sample(double startTime, double endTime, OrbitSampleProc& proc)
         o = primary;
     else
         o = afterApprox;
-    o->sample(startTime, endTime, proc);
+    o->sample(startTime, endTime, tolerance, proc);
+}
+
+
+// The approximations before and after the span of the primary orbit are
+// elliptical orbits, which can always be sampled concurrently.
+bool MixedOrbit::canSampleConcurrently() const
+{
+    return primary->canSampleConcurrently();
+}
+
+
+bool MixedOrbit::isThreadSafe() const
+{
+    return primary->isThreadSafe();
 }
 
 
@@ -687,8 +669,16 @@ FixedOrbit::getBoundingRadius() const
 }
 
 
+double
+FixedOrbit::getMaximumSpeed() const
+{
+    return 0.0;
+}
+
+
 void
-FixedOrbit::sample(double /* startTime */, double /* endTime */, OrbitSampleProc&) const
+FixedOrbit::sample(double /* startTime */, double /* endTime */, double /* tolerance */,
+                   OrbitSampleProc&) const
 {
     // Don't add any samples. This will prevent a fixed trajectory from
     // every being drawn when orbit visualization is enabled.
@@ -728,7 +718,8 @@ double SynchronousOrbit::getBoundingRadius() const
 }
 
 
-void SynchronousOrbit::sample(double /* startTime */, double /* endTime */, OrbitSampleProc&) const
+void SynchronousOrbit::sample(double /* startTime */, double /* endTime */, double /* tolerance */,
+                              OrbitSampleProc&) const
 {
     // Empty method--we never want to show a synchronous orbit.
 }
@@ -11,9 +11,11 @@
 #define _CELENGINE_ORBIT_H_
 
 #include <Eigen/Core>
+#include <celutil/thread.h>
 
 
 class OrbitSampleProc;
+class OrbitBatch;
 
 class Orbit
 {
@@ -35,7 +37,20 @@ class Orbit
     virtual double getPeriod() const = 0;
     virtual double getBoundingRadius() const = 0;
 
-    virtual void sample(double startTime, double endTime, OrbitSampleProc& proc) const;
+    /*! Sample the orbit over the time range [ startTime, endTime ] closely
+     *  enough that the cubic curves through successive samples, defined by
+     *  their positions and velocities, stay within tolerance kilometers of
+     *  the orbit.
+     */
+    virtual void sample(double startTime, double endTime, double tolerance, OrbitSampleProc& proc) const;
+
+    /*! Return true if the orbit may be sampled or evaluated on several
+     *  threads at once, which lets orbit paths be sampled in the background
+     *  and eclipse searches be divided among threads. This isn't the case
+     *  for orbits that keep unprotected state from one evaluation to the
+     *  next.
+     */
+    virtual bool canSampleConcurrently() const { return false; };
 
     virtual bool isPeriodic() const { return true; };
 
@@ -44,15 +59,24 @@ class Orbit
     virtual void getValidRange(double& begin, double& end) const
         { begin = 0.0; end = 0.0; };
 
-    struct AdaptiveSamplingParameters
-    {
-        double tolerance;
-        double startStep;
-        double minStep;
-        double maxStep;
-    };
+    /*! Add the orbit to a batch of orbits whose positions are computed
+     *  together (see OrbitBatch); the position will be stored at the
+     *  specified index of the batch's position table. Returns false if
+     *  the orbit can't be computed in a batch.
+     */
+    virtual bool addToBatch(OrbitBatch& /* batch */, unsigned int /* index */) const { return false; };
 
-    void adaptiveSample(double startTime, double endTime, OrbitSampleProc& proc, const AdaptiveSamplingParameters& samplingParameters) const;
+    /*! Return true if the orbit may be evaluated on one thread while
+     *  other orbits are evaluated on other threads. Orbits that rely on
+     *  shared interpreter or library state must return false.
+     */
+    virtual bool isThreadSafe() const { return true; };
+
+    /*! Return an upper bound on the speed of the orbiting object in km/day,
+     *  or a negative value if no bound is known. The bound is used to
+     *  predict how far an object may move from a known position.
+     */
+    virtual double getMaximumSpeed() const { return -1.0; };
 };
 
 
@@ -69,6 +93,10 @@ class EllipticalOrbit : public Orbit
     double getPeriod() const;
     double getBoundingRadius() const;
 
+    virtual bool addToBatch(OrbitBatch& batch, unsigned int index) const;
+    virtual double getMaximumSpeed() const;
+    virtual bool canSampleConcurrently() const { return true; };
+
  private:
     double eccentricAnomaly(double) const;
     Eigen::Vector3d positionAtE(double) const;
@@ -102,7 +130,10 @@ class OrbitSampleProc
  * Celestia may need require position of a planet more than once per frame; in
  * order to avoid redundant calculation, the CachingOrbit class saves the
  * result of the last calculation and uses it if the time matches the cached
- * time.
+ * time. The cache is protected by a mutex, so a caching orbit may be used on
+ * several threads at once as long as computePosition() and computeVelocity()
+ * don't modify any state; subclasses for which this isn't true must override
+ * canSampleConcurrently().
  */
 class CachingOrbit : public Orbit
 {
@@ -118,7 +149,10 @@ class CachingOrbit : public Orbit
     Eigen::Vector3d positionAtTime(double jd) const;
     Eigen::Vector3d velocityAtTime(double jd) const;
 
+    virtual bool canSampleConcurrently() const { return true; };
+
  private:
+    mutable Mutex cacheMutex;
     mutable Eigen::Vector3d lastPosition;
     mutable Eigen::Vector3d lastVelocity;
     mutable double lastTime;
@@ -143,7 +177,9 @@ class MixedOrbit : public Orbit
     virtual Eigen::Vector3d velocityAtTime(double jd) const;
     virtual double getPeriod() const;
     virtual double getBoundingRadius() const;
-    virtual void sample(double startTime, double endTime, OrbitSampleProc& proc) const;
+    virtual void sample(double startTime, double endTime, double tolerance, OrbitSampleProc& proc) const;
+    virtual bool canSampleConcurrently() const;
+    virtual bool isThreadSafe() const;
 
  private:
     Orbit* primary;
@@ -172,7 +208,8 @@ class SynchronousOrbit : public Orbit
     virtual Eigen::Vector3d positionAtTime(double jd) const;
     virtual double getPeriod() const;
     virtual double getBoundingRadius() const;
-    virtual void sample(double, double, OrbitSampleProc& proc) const;
+    virtual void sample(double, double, double, OrbitSampleProc& proc) const;
+    virtual bool canSampleConcurrently() const { return true; };
 
  private:
     const Body& body;
@@ -194,7 +231,9 @@ class FixedOrbit : public Orbit
     virtual double getPeriod() const;
     virtual bool isPeriodic() const;
     virtual double getBoundingRadius() const;
-    virtual void sample(double, double, OrbitSampleProc&) const;
+    virtual void sample(double, double, double, OrbitSampleProc&) const;
+    virtual bool canSampleConcurrently() const { return true; };
+    virtual double getMaximumSpeed() const;
 
  private:
     Eigen::Vector3d position;
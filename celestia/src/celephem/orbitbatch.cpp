@@ -0,0 +1,371 @@
+// orbitbatch.cpp
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// Batch evaluation of Keplerian orbits. The methods used to solve Kepler's
+// equation, and their iteration counts, are exactly those of
+// EllipticalOrbit::eccentricAnomaly(), so that objects are drawn where
+// the rest of Celestia believes them to be.
+
+#include "orbitbatch.h"
+#include <celmath/mathlib.h>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ORBIT_BATCH_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace Eigen;
+using namespace std;
+
+
+// 2*pi split into a double and a correction term, for accurate reduction of
+// mean anomalies that have grown large over many revolutions.
+static const double TwoPiHigh = 6.28318530717958623200;
+static const double TwoPiLow  = 2.44929359829470635445e-16;
+
+// Iteration counts of the three methods; these must match the ones used by
+// EllipticalOrbit::eccentricAnomaly().
+static const int LowEccentricityIterations    = 5;
+static const int MediumEccentricityIterations = 6;
+static const int HighEccentricityIterations   = 8;
+
+
+// Mean anomaly at time t, reduced to the range [-pi, pi]. Since every
+// iteration below is unchanged by adding a multiple of 2*pi to both the mean
+// and eccentric anomalies, the reduction doesn't affect the position.
+static inline double ReducedMeanAnomaly(double meanAnomalyAtEpoch,
+                                        double meanMotion,
+                                        double epoch,
+                                        double t)
+{
+    double M = meanAnomalyAtEpoch + (t - epoch) * meanMotion;
+    double revolutions = floor(M * (1.0 / TwoPiHigh) + 0.5);
+    return (M - revolutions * TwoPiHigh) - revolutions * TwoPiLow;
+}
+
+
+static double EccentricAnomaly(int method, double ecc, double M)
+{
+    double E = M;
+    switch (method)
+    {
+    case 0:
+        // Standard iteration
+        for (int i = 0; i < LowEccentricityIterations; i++)
+            E = M + ecc * sin(E);
+        break;
+
+    case 1:
+        // Faster converging iteration from Meeus
+        for (int i = 0; i < MediumEccentricityIterations; i++)
+            E = E + (M + ecc * sin(E) - E) / (1 - ecc * cos(E));
+        break;
+
+    default:
+        // Laguerre-Conway
+        E = M + 0.85 * ecc * sign(sin(M));
+        for (int i = 0; i < HighEccentricityIterations; i++)
+        {
+            double s = ecc * sin(E);
+            double c = ecc * cos(E);
+            double f = E - s - M;
+            double f1 = 1 - c;
+            double f2 = s;
+            E += -5 * f / (f1 + sign(f1) * sqrt(abs(16 * f1 * f1 - 20 * f * f2)));
+        }
+        break;
+    }
+
+    return E;
+}
+
+
+#ifdef ORBIT_BATCH_SSE2
+
+// Sine and cosine of two values at once, using the range reduction and
+// polynomials of the Cephes math library. Accuracy is within a couple of
+// units in the last place for the arguments that occur here.
+static const double FourOverPi = 1.27323954473516268615;
+static const double PiOver4A = 7.85398125648498535156e-1;
+static const double PiOver4B = 3.77489470793079817668e-8;
+static const double PiOver4C = 2.69515142907905952645e-15;
+
+static inline __m128d Polynomial6(__m128d x,
+                                  double c0, double c1, double c2,
+                                  double c3, double c4, double c5)
+{
+    __m128d p = _mm_set1_pd(c0);
+    p = _mm_add_pd(_mm_mul_pd(p, x), _mm_set1_pd(c1));
+    p = _mm_add_pd(_mm_mul_pd(p, x), _mm_set1_pd(c2));
+    p = _mm_add_pd(_mm_mul_pd(p, x), _mm_set1_pd(c3));
+    p = _mm_add_pd(_mm_mul_pd(p, x), _mm_set1_pd(c4));
+    p = _mm_add_pd(_mm_mul_pd(p, x), _mm_set1_pd(c5));
+    return p;
+}
+
+
+static inline void SinCos2(__m128d x, __m128d& sinx, __m128d& cosx)
+{
+    const __m128d signMask = _mm_set1_pd(-0.0);
+    __m128d xSign = _mm_and_pd(x, signMask);
+    __m128d ax = _mm_andnot_pd(signMask, x);
+
+    // Octant, rounded up to an even number
+    __m128i j = _mm_cvttpd_epi32(_mm_mul_pd(ax, _mm_set1_pd(FourOverPi)));
+    j = _mm_and_si128(_mm_add_epi32(j, _mm_set1_epi32(1)), _mm_set1_epi32(~1));
+    __m128d y = _mm_cvtepi32_pd(j);
+
+    // Widen the octants to 64-bit lanes
+    j = _mm_shuffle_epi32(j, _MM_SHUFFLE(1, 1, 0, 0));
+
+    __m128d z = _mm_sub_pd(ax, _mm_mul_pd(y, _mm_set1_pd(PiOver4A)));
+    z = _mm_sub_pd(z, _mm_mul_pd(y, _mm_set1_pd(PiOver4B)));
+    z = _mm_sub_pd(z, _mm_mul_pd(y, _mm_set1_pd(PiOver4C)));
+    __m128d zz = _mm_mul_pd(z, z);
+
+    __m128d sinPoly = Polynomial6(zz,
+                                  1.58962301576546568060e-10,
+                                  -2.50507477628578072866e-8,
+                                  2.75573136213857245213e-6,
+                                  -1.98412698295895385996e-4,
+                                  8.33333333332211858878e-3,
+                                  -1.66666666666666307295e-1);
+    sinPoly = _mm_add_pd(z, _mm_mul_pd(_mm_mul_pd(z, zz), sinPoly));
+
+    __m128d cosPoly = Polynomial6(zz,
+                                  -1.13585365213876817300e-11,
+                                  2.08757008419747316778e-9,
+                                  -2.75573141792967388112e-7,
+                                  2.48015872888517045348e-5,
+                                  -1.38888888888730564116e-3,
+                                  4.16666666666665929218e-2);
+    cosPoly = _mm_add_pd(_mm_sub_pd(_mm_set1_pd(1.0), _mm_mul_pd(_mm_set1_pd(0.5), zz)),
+                         _mm_mul_pd(_mm_mul_pd(zz, zz), cosPoly));
+
+    // In octants 2 and 6, the sine and cosine polynomials are swapped
+    __m128d swap = _mm_castsi128_pd(_mm_cmpeq_epi32(_mm_and_si128(j, _mm_set1_epi32(2)),
+                                                    _mm_set1_epi32(2)));
+    sinx = _mm_or_pd(_mm_and_pd(swap, cosPoly), _mm_andnot_pd(swap, sinPoly));
+    cosx = _mm_or_pd(_mm_and_pd(swap, sinPoly), _mm_andnot_pd(swap, cosPoly));
+
+    // The sine is negated in octants 4 and 6 and for negative arguments, the
+    // cosine in octants 2 and 4. Move the deciding bit of the octant into
+    // the sign bit.
+    __m128d sinSign = _mm_and_pd(_mm_castsi128_pd(_mm_slli_epi32(j, 29)), signMask);
+    __m128i cosBit = _mm_xor_si128(j, _mm_slli_epi32(j, 1));
+    __m128d cosSign = _mm_and_pd(_mm_castsi128_pd(_mm_slli_epi32(cosBit, 29)), signMask);
+
+    sinx = _mm_xor_pd(sinx, _mm_xor_pd(sinSign, xSign));
+    cosx = _mm_xor_pd(cosx, cosSign);
+}
+
+
+static inline __m128d Sign2(__m128d x)
+{
+    const __m128d zero = _mm_setzero_pd();
+    const __m128d one = _mm_set1_pd(1.0);
+    return _mm_sub_pd(_mm_and_pd(_mm_cmpgt_pd(x, zero), one),
+                      _mm_and_pd(_mm_cmplt_pd(x, zero), one));
+}
+
+
+static __m128d EccentricAnomaly2(int method, __m128d ecc, __m128d M)
+{
+    __m128d E = M;
+    __m128d s, c;
+    const __m128d one = _mm_set1_pd(1.0);
+
+    switch (method)
+    {
+    case 0:
+        for (int i = 0; i < LowEccentricityIterations; i++)
+        {
+            SinCos2(E, s, c);
+            E = _mm_add_pd(M, _mm_mul_pd(ecc, s));
+        }
+        break;
+
+    case 1:
+        for (int i = 0; i < MediumEccentricityIterations; i++)
+        {
+            SinCos2(E, s, c);
+            __m128d num = _mm_sub_pd(_mm_add_pd(M, _mm_mul_pd(ecc, s)), E);
+            __m128d den = _mm_sub_pd(one, _mm_mul_pd(ecc, c));
+            E = _mm_add_pd(E, _mm_div_pd(num, den));
+        }
+        break;
+
+    default:
+        {
+            SinCos2(M, s, c);
+            E = _mm_add_pd(M, _mm_mul_pd(_mm_mul_pd(_mm_set1_pd(0.85), ecc), Sign2(s)));
+            for (int i = 0; i < HighEccentricityIterations; i++)
+            {
+                SinCos2(E, s, c);
+                s = _mm_mul_pd(ecc, s);
+                c = _mm_mul_pd(ecc, c);
+                __m128d f = _mm_sub_pd(_mm_sub_pd(E, s), M);
+                __m128d f1 = _mm_sub_pd(one, c);
+                __m128d f2 = s;
+                __m128d d = _mm_sub_pd(_mm_mul_pd(_mm_set1_pd(16.0), _mm_mul_pd(f1, f1)),
+                                       _mm_mul_pd(_mm_set1_pd(20.0), _mm_mul_pd(f, f2)));
+                d = _mm_sqrt_pd(_mm_andnot_pd(_mm_set1_pd(-0.0), d));
+                __m128d den = _mm_add_pd(f1, _mm_mul_pd(Sign2(f1), d));
+                E = _mm_add_pd(E, _mm_div_pd(_mm_mul_pd(_mm_set1_pd(-5.0), f), den));
+            }
+        }
+        break;
+    }
+
+    return E;
+}
+
+#endif // ORBIT_BATCH_SSE2
+
+
+OrbitBatch::OrbitBatch()
+{
+}
+
+
+bool OrbitBatch::addEllipticalOrbit(double pericenterDistance,
+                                    double eccentricity,
+                                    double meanAnomalyAtEpoch,
+                                    double period,
+                                    double epoch,
+                                    const Matrix3d& orbitPlaneRotation,
+                                    unsigned int index)
+{
+    if (!(eccentricity >= 0.0 && eccentricity < 1.0))
+        return false;
+
+    // Choose the same method as EllipticalOrbit::eccentricAnomaly();
+    // circular orbits are included with the low eccentricity orbits, since
+    // the standard iteration leaves the mean anomaly unchanged for them.
+    OrbitGroup* group;
+    if (eccentricity < 0.2)
+        group = &groups[LowEccentricity];
+    else if (eccentricity < 0.9)
+        group = &groups[MediumEccentricity];
+    else
+        group = &groups[HighEccentricity];
+
+    double a = pericenterDistance / (1.0 - eccentricity);
+
+    group->index.push_back(index);
+    group->epoch.push_back(epoch);
+    group->meanMotion.push_back(2.0 * PI / period);
+    group->meanAnomalyAtEpoch.push_back(meanAnomalyAtEpoch);
+    group->eccentricity.push_back(eccentricity);
+    group->semiMajorAxis.push_back(a);
+    group->semiMinorAxis.push_back(a * sqrt(1 - square(eccentricity)));
+
+    // EllipticalOrbit::positionAtE() maps (x, y, z) in the orbit's frame to
+    // (x, z, -y) in Celestia's coordinate system.
+    group->xAxis[0].push_back(orbitPlaneRotation(0, 0));
+    group->xAxis[1].push_back(orbitPlaneRotation(2, 0));
+    group->xAxis[2].push_back(-orbitPlaneRotation(1, 0));
+    group->yAxis[0].push_back(orbitPlaneRotation(0, 1));
+    group->yAxis[1].push_back(orbitPlaneRotation(2, 1));
+    group->yAxis[2].push_back(-orbitPlaneRotation(1, 1));
+
+    return true;
+}
+
+
+void OrbitBatch::OrbitGroup::clear()
+{
+    index.clear();
+    epoch.clear();
+    meanMotion.clear();
+    meanAnomalyAtEpoch.clear();
+    eccentricity.clear();
+    semiMajorAxis.clear();
+    semiMinorAxis.clear();
+    for (int i = 0; i < 3; i++)
+    {
+        xAxis[i].clear();
+        yAxis[i].clear();
+    }
+}
+
+
+void OrbitBatch::clear()
+{
+    for (int i = 0; i < GroupCount; i++)
+        groups[i].clear();
+}
+
+
+unsigned int OrbitBatch::size() const
+{
+    unsigned int n = 0;
+    for (int i = 0; i < GroupCount; i++)
+        n += groups[i].index.size();
+    return n;
+}
+
+
+void OrbitBatch::computePositions(double tdb, Vector3d* positions) const
+{
+    for (int method = 0; method < GroupCount; method++)
+    {
+        const OrbitGroup& group = groups[method];
+        unsigned int n = group.index.size();
+        unsigned int i = 0;
+
+#ifdef ORBIT_BATCH_SSE2
+        const __m128d t = _mm_set1_pd(tdb);
+        const __m128d twoPiHigh = _mm_set1_pd(TwoPiHigh);
+        const __m128d twoPiLow = _mm_set1_pd(TwoPiLow);
+
+        for (; i + 2 <= n; i += 2)
+        {
+            __m128d M = _mm_add_pd(_mm_loadu_pd(&group.meanAnomalyAtEpoch[i]),
+                                   _mm_mul_pd(_mm_sub_pd(t, _mm_loadu_pd(&group.epoch[i])),
+                                              _mm_loadu_pd(&group.meanMotion[i])));
+            __m128d revolutions = _mm_cvtepi32_pd(_mm_cvtpd_epi32(_mm_mul_pd(M, _mm_set1_pd(1.0 / TwoPiHigh))));
+            M = _mm_sub_pd(_mm_sub_pd(M, _mm_mul_pd(revolutions, twoPiHigh)),
+                           _mm_mul_pd(revolutions, twoPiLow));
+
+            __m128d ecc = _mm_loadu_pd(&group.eccentricity[i]);
+            __m128d E = EccentricAnomaly2(method, ecc, M);
+
+            __m128d sinE, cosE;
+            SinCos2(E, sinE, cosE);
+            __m128d x = _mm_mul_pd(_mm_loadu_pd(&group.semiMajorAxis[i]), _mm_sub_pd(cosE, ecc));
+            __m128d y = _mm_mul_pd(_mm_loadu_pd(&group.semiMinorAxis[i]), sinE);
+
+            double p[3][2];
+            for (int k = 0; k < 3; k++)
+            {
+                _mm_storeu_pd(p[k], _mm_add_pd(_mm_mul_pd(x, _mm_loadu_pd(&group.xAxis[k][i])),
+                                               _mm_mul_pd(y, _mm_loadu_pd(&group.yAxis[k][i]))));
+            }
+
+            positions[group.index[i]]     = Vector3d(p[0][0], p[1][0], p[2][0]);
+            positions[group.index[i + 1]] = Vector3d(p[0][1], p[1][1], p[2][1]);
+        }
+#endif
+
+        for (; i < n; i++)
+        {
+            double M = ReducedMeanAnomaly(group.meanAnomalyAtEpoch[i], group.meanMotion[i], group.epoch[i], tdb);
+            double ecc = group.eccentricity[i];
+            double E = EccentricAnomaly(method, ecc, M);
+
+            double x = group.semiMajorAxis[i] * (cos(E) - ecc);
+            double y = group.semiMinorAxis[i] * sin(E);
+            positions[group.index[i]] = Vector3d(x * group.xAxis[0][i] + y * group.yAxis[0][i],
+                                                 x * group.xAxis[1][i] + y * group.yAxis[1][i],
+                                                 x * group.xAxis[2][i] + y * group.yAxis[2][i]);
+        }
+    }
+}
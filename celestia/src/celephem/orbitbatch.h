@@ -0,0 +1,83 @@
+// orbitbatch.h
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#ifndef _CELEPHEM_ORBITBATCH_H_
+#define _CELEPHEM_ORBITBATCH_H_
+
+#include <vector>
+#include <Eigen/Core>
+
+
+/*! An OrbitBatch computes the positions of many Keplerian orbits at once.
+ *  Solar systems with large populations of asteroids and comets spend most
+ *  of the time required to position their objects solving Kepler's equation
+ *  one orbit at a time. A batch stores the orbital elements as a structure
+ *  of arrays, grouped by the method used to solve Kepler's equation, so that
+ *  the equation can be solved for several orbits with each SIMD instruction.
+ *  The results are the same as those of EllipticalOrbit::positionAtTime()
+ *  to within rounding error.
+ */
+class OrbitBatch
+{
+ public:
+    OrbitBatch();
+
+    /*! Add an elliptical orbit to the batch; its position will be stored
+     *  at the specified index of the position table. Only closed
+     *  (eccentricity < 1) orbits are accepted.
+     */
+    bool addEllipticalOrbit(double pericenterDistance,
+                            double eccentricity,
+                            double meanAnomalyAtEpoch,
+                            double period,
+                            double epoch,
+                            const Eigen::Matrix3d& orbitPlaneRotation,
+                            unsigned int index);
+
+    void clear();
+    unsigned int size() const;
+
+    /*! Compute the positions of all orbits in the batch at time tdb and
+     *  store them in the position table. The table must have room for
+     *  the largest index that was given when the orbits were added.
+     */
+    void computePositions(double tdb, Eigen::Vector3d* positions) const;
+
+ private:
+    // Orbital elements of a group of orbits that use the same method to
+    // solve Kepler's equation
+    struct OrbitGroup
+    {
+        std::vector<unsigned int> index;
+        std::vector<double> epoch;
+        std::vector<double> meanMotion;
+        std::vector<double> meanAnomalyAtEpoch;
+        std::vector<double> eccentricity;
+        std::vector<double> semiMajorAxis;
+        std::vector<double> semiMinorAxis;
+        // Images of the x and y axes of the orbit plane, in Celestia's
+        // coordinate system
+        std::vector<double> xAxis[3];
+        std::vector<double> yAxis[3];
+
+        void clear();
+    };
+
+    enum
+    {
+        LowEccentricity     = 0,
+        MediumEccentricity  = 1,
+        HighEccentricity    = 2,
+        GroupCount          = 3,
+    };
+
+    OrbitGroup groups[GroupCount];
+};
+
+#endif // _CELEPHEM_ORBITBATCH_H_
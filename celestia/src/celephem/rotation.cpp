@@ -76,63 +76,75 @@ CachingRotationModel::~CachingRotationModel()
 Quaterniond
 CachingRotationModel::spin(double tjd) const
 {
+    {
+        MutexLock lock(cacheMutex);
+        if (tjd == lastTime && spinCacheValid)
+            return lastSpin;
+    }
+
+    Quaterniond q = computeSpin(tjd);
+
+    MutexLock lock(cacheMutex);
     if (tjd != lastTime)
     {
         lastTime = tjd;
-        lastSpin = computeSpin(tjd);
-        spinCacheValid = true;
         equatorCacheValid = false;
         angularVelocityCacheValid = false;
     }
-    else if (!spinCacheValid)
-    {
-        lastSpin = computeSpin(tjd);
-        spinCacheValid = true;
-    }
-    
-    return lastSpin;
+    lastSpin = q;
+    spinCacheValid = true;
+
+    return q;
 }
 
 
 Quaterniond
 CachingRotationModel::equatorOrientationAtTime(double tjd) const
 {
+    {
+        MutexLock lock(cacheMutex);
+        if (tjd == lastTime && equatorCacheValid)
+            return lastEquator;
+    }
+
+    Quaterniond q = computeEquatorOrientation(tjd);
+
+    MutexLock lock(cacheMutex);
     if (tjd != lastTime)
     {
         lastTime = tjd;
-        lastEquator = computeEquatorOrientation(tjd);
         spinCacheValid = false;
-        equatorCacheValid = true;
         angularVelocityCacheValid = false;
     }
-    else if (!equatorCacheValid)
-    {
-        lastEquator = computeEquatorOrientation(tjd);
-        equatorCacheValid = true;
-    }
-    
-    return lastEquator;    
+    lastEquator = q;
+    equatorCacheValid = true;
+
+    return q;
 }
 
 
 Vector3d
 CachingRotationModel::angularVelocityAtTime(double tjd) const
 {
+    {
+        MutexLock lock(cacheMutex);
+        if (tjd == lastTime && angularVelocityCacheValid)
+            return lastAngularVelocity;
+    }
+
+    Vector3d v = computeAngularVelocity(tjd);
+
+    MutexLock lock(cacheMutex);
     if (tjd != lastTime)
     {
-        lastAngularVelocity = computeAngularVelocity(tjd);
         lastTime = tjd;
         spinCacheValid = false;
         equatorCacheValid = false;
-        angularVelocityCacheValid = true;
-    }
-    else if (!angularVelocityCacheValid)
-    {
-        lastAngularVelocity = computeAngularVelocity(tjd);
-        angularVelocityCacheValid = true;
     }
-    
-    return lastAngularVelocity;    
+    lastAngularVelocity = v;
+    angularVelocityCacheValid = true;
+
+    return v;
 }
 
 
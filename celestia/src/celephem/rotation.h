@@ -11,6 +11,7 @@
 #ifndef _CELENGINE_ROTATION_H_
 #define _CELENGINE_ROTATION_H_
 
+#include <celutil/thread.h>
 #include <Eigen/Geometry>
 
 
@@ -71,6 +72,23 @@ class RotationModel
         begin = 0.0;
         end = 0.0;
     };
+
+    /*! Return true if the rotation model may be evaluated on one thread
+     *  while other rotation models are evaluated on other threads.
+     */
+    virtual bool isThreadSafe() const
+    {
+        return true;
+    };
+
+    /*! Return true if the rotation model may be evaluated on several
+     *  threads at once. This isn't the case for rotation models that keep
+     *  unprotected state from one evaluation to the next.
+     */
+    virtual bool canEvaluateConcurrently() const
+    {
+        return false;
+    };
 };
 
 
@@ -82,7 +100,9 @@ class RotationModel
  *  of computeAngularVelocity uses differentiation to approximate the
  *  the instantaneous angular velocity. It may be overridden if there is some
  *  better means to calculate the angular velocity for a specific rotation
- *  model.
+ *  model. The cache is protected by a mutex, so a caching rotation model may
+ *  be evaluated on several threads at once as long as the compute methods
+ *  don't modify any state.
  */
 class CachingRotationModel : public RotationModel
 {
@@ -101,8 +121,10 @@ class CachingRotationModel : public RotationModel
     virtual Eigen::Vector3d computeAngularVelocity(double tjd) const;
     virtual double getPeriod() const = 0;
     virtual bool isPeriodic() const = 0;
+    virtual bool canEvaluateConcurrently() const { return true; };
     
 private:
+    mutable Mutex cacheMutex;
     mutable Eigen::Quaterniond lastSpin;
     mutable Eigen::Quaterniond lastEquator;
     mutable Eigen::Vector3d lastAngularVelocity;
@@ -126,6 +148,7 @@ class ConstantOrientation : public RotationModel
 
     virtual Eigen::Quaterniond spin(double tjd) const;
     virtual Eigen::Vector3d angularVelocityAtTime(double tjd) const;
+    virtual bool canEvaluateConcurrently() const { return true; };
 
  private:
     Eigen::Quaterniond orientation;
@@ -150,6 +173,7 @@ class UniformRotationModel : public RotationModel
     virtual Eigen::Quaterniond equatorOrientationAtTime(double tjd) const;
     virtual Eigen::Quaterniond spin(double tjd) const;
     virtual Eigen::Vector3d angularVelocityAtTime(double tjd) const;
+    virtual bool canEvaluateConcurrently() const { return true; };
 
  private:
     double period;       // sidereal rotation period
@@ -178,6 +202,7 @@ class PrecessingRotationModel : public RotationModel
     virtual double getPeriod() const;
     virtual Eigen::Quaterniond equatorOrientationAtTime(double tjd) const;
     virtual Eigen::Quaterniond spin(double tjd) const;
+    virtual bool canEvaluateConcurrently() const { return true; };
 
  private:
     double period;       // sidereal rotation period (in Julian days)
@@ -14,7 +14,11 @@
 #include "samporbit.h"
 #include <celengine/astro.h>
 #include <celmath/mathlib.h>
+#include <celutil/basictypes.h>
+#include <celutil/bytes.h>
+#include <celutil/mappedfile.h>
 #include <cmath>
+#include <cstring>
 #include <string>
 #include <algorithm>
 #include <vector>
@@ -60,6 +64,75 @@ template <typename T> bool operator<(const SampleXYZV<T>& a, const SampleXYZV<T>
 }
 
 
+// A uniform time index divides the time span of a trajectory into intervals
+// of equal length. Entry k is the index of the first sample at or after
+// startTime + k * interval; there are nEntries + 1 entries, so that the
+// samples bracketing any time within the span can be found in constant time
+// for all but very unevenly sampled trajectories.
+struct SampleTimeIndex
+{
+    SampleTimeIndex() :
+        startTime(0.0),
+        interval(0.0),
+        nEntries(0),
+        entries(NULL)
+    {
+    }
+
+    double startTime;
+    double interval;
+    unsigned int nEntries;
+    const uint32* entries;
+};
+
+
+// Return the index of the first sample with a time not less than jd, or
+// nSamples if there is no such sample. The time index is used to narrow the
+// range searched, but it is ignored if it is inconsistent with the samples.
+template <typename S> static int FindSample(const S* samples,
+                                            unsigned int nSamples,
+                                            const SampleTimeIndex& timeIndex,
+                                            double jd)
+{
+    const S* first = samples;
+    const S* last = samples + nSamples;
+
+    if (timeIndex.entries != NULL)
+    {
+        double k = floor((jd - timeIndex.startTime) / timeIndex.interval);
+        unsigned int lo;
+        unsigned int hi;
+        if (!(k >= 0.0))
+        {
+            lo = 0;
+            hi = timeIndex.entries[0];
+        }
+        else if (k >= (double) timeIndex.nEntries)
+        {
+            lo = timeIndex.entries[timeIndex.nEntries];
+            hi = nSamples;
+        }
+        else
+        {
+            lo = timeIndex.entries[(unsigned int) k];
+            hi = timeIndex.entries[(unsigned int) k + 1];
+        }
+
+        if (lo <= hi && hi <= nSamples &&
+            (lo == 0 || samples[lo - 1].t < jd) &&
+            (hi == nSamples || samples[hi].t >= jd))
+        {
+            first = samples + lo;
+            last = samples + hi;
+        }
+    }
+
+    S samp;
+    samp.t = jd;
+    return lower_bound(first, last, samp) - samples;
+}
+
+
 template <typename T> class SampledOrbit : public CachingOrbit
 {
 public:
@@ -77,10 +150,29 @@ public:
     bool isPeriodic() const;
     void getValidRange(double& begin, double& end) const;
 
-    virtual void sample(double startTime, double endTime, OrbitSampleProc& proc) const;
+    // Sampling reads only the trajectory samples, which don't change once
+    // they're loaded.
+    virtual void sample(double startTime, double endTime, double tolerance, OrbitSampleProc& proc) const;
+    virtual bool canSampleConcurrently() const { return true; };
+
+    void setMappedSamples(MappedFile* file,
+                          const Sample<T>* _samples,
+                          unsigned int _nSamples,
+                          double _boundingRadius,
+                          const SampleTimeIndex& _timeIndex);
+
+private:
+    int findSample(double jd) const;
 
 private:
-    vector<Sample<T> > samples;
+    // Samples are either stored in sampleStorage or in a memory mapped
+    // binary trajectory file; samples points to whichever is in use.
+    vector<Sample<T> > sampleStorage;
+    MappedFile* mappedFile;
+    const Sample<T>* samples;
+    unsigned int nSamples;
+    SampleTimeIndex timeIndex;
+
     double boundingRadius;
     double period;
     mutable int lastSample;
@@ -90,6 +182,9 @@ private:
 
 
 template <typename T> SampledOrbit<T>::SampledOrbit(TrajectoryInterpolation _interpolation) :
+    mappedFile(NULL),
+    samples(NULL),
+    nSamples(0),
     boundingRadius(0.0),
     period(1.0),
     lastSample(0),
@@ -100,6 +195,7 @@ template <typename T> SampledOrbit<T>::SampledOrbit(TrajectoryInterpolation _int
 
 template <typename T> SampledOrbit<T>::~SampledOrbit()
 {
+    delete mappedFile;
 }
 
 
@@ -114,12 +210,15 @@ template <typename T> void SampledOrbit<T>::addSample(double t, double x, double
     samp.y = (T) y;
     samp.z = (T) z;
     samp.t = t;
-    samples.insert(samples.end(), samp);
+    sampleStorage.push_back(samp);
+
+    samples = &sampleStorage[0];
+    nSamples = sampleStorage.size();
 }
 
 template <typename T> double SampledOrbit<T>::getPeriod() const
 {
-    return samples[samples.size() - 1].t - samples[0].t;
+    return samples[nSamples - 1].t - samples[0].t;
 }
 
 
@@ -132,7 +231,7 @@ template <typename T> bool SampledOrbit<T>::isPeriodic() const
 template <typename T> void SampledOrbit<T>::getValidRange(double& begin, double& end) const
 {
     begin = samples[0].t;
-    end = samples[samples.size() - 1].t;
+    end = samples[nSamples - 1].t;
 }
 
 
@@ -142,6 +241,44 @@ template <typename T> double SampledOrbit<T>::getBoundingRadius() const
 }
 
 
+/*! Use samples from a memory mapped binary trajectory file. The orbit takes
+ *  ownership of the file, which must remain mapped for as long as the
+ *  samples are in use.
+ */
+template <typename T> void SampledOrbit<T>::setMappedSamples(MappedFile* file,
+                                                             const Sample<T>* _samples,
+                                                             unsigned int _nSamples,
+                                                             double _boundingRadius,
+                                                             const SampleTimeIndex& _timeIndex)
+{
+    delete mappedFile;
+    sampleStorage.clear();
+
+    mappedFile = file;
+    samples = _samples;
+    nSamples = _nSamples;
+    boundingRadius = _boundingRadius;
+    timeIndex = _timeIndex;
+    lastSample = 0;
+}
+
+
+// Find the samples bracketing the specified time; the previous result is
+// reused when possible, since consecutive calls usually request nearby
+// times.
+template <typename T> int SampledOrbit<T>::findSample(double jd) const
+{
+    int n = lastSample;
+    if (n < 1 || n >= (int) nSamples || jd < samples[n - 1].t || jd > samples[n].t)
+    {
+        n = FindSample(samples, nSamples, timeIndex, jd);
+        lastSample = n;
+    }
+
+    return n;
+}
+
+
 static Vector3d cubicInterpolate(const Vector3d& p0, const Vector3d& v0,
                                  const Vector3d& p1, const Vector3d& v1,
                                  double t)
@@ -165,38 +302,23 @@ static Vector3d cubicInterpolateVelocity(const Vector3d& p0, const Vector3d& v0,
 template <typename T> Vector3d SampledOrbit<T>::computePosition(double jd) const
 {
     Vector3d pos;
-    if (samples.size() == 0)
+    if (nSamples == 0)
     {
         pos = Vector3d::Zero();
     }
-    else if (samples.size() == 1)
+    else if (nSamples == 1)
     {
         pos = Vector3d(samples[0].x, samples[0].y, samples[0].z);
     }
     else
     {
-        Sample<T> samp;
-        samp.t = jd;
-        int n = lastSample;
-
-        if (n < 1 || n >= (int) samples.size() || jd < samples[n - 1].t || jd > samples[n].t)
-        {
-            typename vector<Sample<T> >::const_iterator iter = lower_bound(samples.begin(),
-                                                                           samples.end(),
-                                                                           samp);
-            if (iter == samples.end())
-                n = samples.size();
-            else
-                n = iter - samples.begin();
-
-            lastSample = n;
-        }
+        int n = findSample(jd);
 
         if (n == 0)
         {
             pos = Vector3d(samples[n].x, samples[n].y, samples[n].z);
         }
-        else if (n < (int) samples.size())
+        else if (n < (int) nSamples)
         {
             if (interpolation == TrajectoryInterpolationLinear)
             {
@@ -217,7 +339,7 @@ template <typename T> Vector3d SampledOrbit<T>::computePosition(double jd) const
                     s0 = samples[n - 1];
                 s1 = samples[n - 1];
                 s2 = samples[n];
-                if (n < (int) samples.size() - 1)
+                if (n < (int) nSamples - 1)
                     s3 = samples[n + 1];
                 else
                     s3 = samples[n];
@@ -252,7 +374,7 @@ template <typename T> Vector3d SampledOrbit<T>::computePosition(double jd) const
                 }
                 
                 Vector3d v1;
-                if (n < (int) samples.size() - 1)
+                if (n < (int) nSamples - 1)
                 {
                     v1 = v21 * (0.5 * ih) + v32 * (0.5 / (s3.t - s2.t));
                     v1 *= h;
@@ -284,33 +406,19 @@ template <typename T> Vector3d SampledOrbit<T>::computePosition(double jd) const
 template <typename T> Vector3d SampledOrbit<T>::computeVelocity(double jd) const
 {
     Vector3d vel;
-    if (samples.size() < 2)
+    if (nSamples < 2)
     {
         vel = Vector3d::Zero();
     }
     else
     {
-        Sample<T> samp;
-        samp.t = jd;
-        int n = lastSample;
-
-        if (n < 1 || n >= (int) samples.size() || jd < samples[n - 1].t || jd > samples[n].t)
-        {
-            typename vector<Sample<T> >::const_iterator iter = lower_bound(samples.begin(),
-                                                                           samples.end(),
-                                                                           samp);
-            if (iter == samples.end())
-                n = samples.size();
-            else
-                n = iter - samples.begin();
-            lastSample = n;
-        }
+        int n = findSample(jd);
 
         if (n == 0)
         {
             vel = Vector3d::Zero();
         }
-        else if (n < (int) samples.size())
+        else if (n < (int) nSamples)
         {
             if (interpolation == TrajectoryInterpolationLinear)
             {
@@ -329,7 +437,7 @@ template <typename T> Vector3d SampledOrbit<T>::computeVelocity(double jd) const
                     s0 = samples[n - 1];
                 s1 = samples[n - 1];
                 s2 = samples[n];
-                if (n < (int) samples.size() - 1)
+                if (n < (int) nSamples - 1)
                     s3 = samples[n + 1];
                 else
                     s3 = samples[n];
@@ -364,7 +472,7 @@ template <typename T> Vector3d SampledOrbit<T>::computeVelocity(double jd) const
                 }
                 
                 Vector3d v1;
-                if (n < (int) samples.size() - 1)
+                if (n < (int) nSamples - 1)
                 {
                     v1 = v21 * (0.5 * ih) + v32 * (0.5 / (s3.t - s2.t));
                     v1 *= h;
@@ -393,42 +501,155 @@ template <typename T> Vector3d SampledOrbit<T>::computeVelocity(double jd) const
 }
 
 
-template <typename T> void SampledOrbit<T>::sample(double /* startTime */, double /* endTime */,
-                                                   OrbitSampleProc& proc) const
+// Position of a trajectory sample
+template <typename T> static Vector3d SamplePosition(const Sample<T>& samp)
 {
-    for (unsigned int i = 0; i < samples.size(); i++)
+    return Vector3d(samp.x, samp.y, samp.z);
+}
+
+template <typename T> static Vector3d SamplePosition(const SampleXYZV<T>& samp)
+{
+    return samp.position.template cast<double>();
+}
+
+
+// Velocity at a trajectory sample; for position-only samples, it's estimated
+// from the neighboring samples.
+template <typename T> static Vector3d SampleVelocity(const Sample<T>* samples,
+                                                     unsigned int nSamples,
+                                                     unsigned int i)
+{
+    Vector3d v;
+    Vector3d p = SamplePosition(samples[i]);
+
+    if (nSamples == 1)
+    {
+        v = Vector3d::Zero();
+    }
+    else if (i == 0)
     {
-        Vector3d v;
-        Vector3d p(samples[i].x, samples[i].y, samples[i].z);
+        double dt = samples[i + 1].t - samples[i].t;
+        v = (SamplePosition(samples[i + 1]) - p) / dt;
+    }
+    else if (i == nSamples - 1)
+    {
+        double dt = samples[i].t - samples[i - 1].t;
+        v = (p - SamplePosition(samples[i - 1])) / dt;
+    }
+    else
+    {
+        double dt0 = samples[i + 1].t - samples[i].t;
+        Vector3d v0 = (SamplePosition(samples[i + 1]) - p) / dt0;
+        double dt1 = samples[i].t - samples[i - 1].t;
+        Vector3d v1 = (p - SamplePosition(samples[i - 1])) / dt1;
+        v = (v0 + v1) * 0.5;
+    }
 
-        if (samples.size() == 1)
-        {
-            v = Vector3d::Zero();
-        }
-        else if (i == 0)
-        {
-            double dt = samples[i + 1].t - samples[i].t;
-            v = (Vector3d(samples[i + 1].x, samples[i + 1].y, samples[i + 1].z) - p) / dt;
-        }
-        else if (i == samples.size() - 1)
+    return v;
+}
+
+template <typename T> static Vector3d SampleVelocity(const SampleXYZV<T>* samples,
+                                                     unsigned int /* nSamples */,
+                                                     unsigned int i)
+{
+    return samples[i].velocity.template cast<double>();
+}
+
+
+// Return true if the cubic curve between samples first and last passes
+// within the tolerance of every sample in between.
+template <typename S> static bool CurveFitsSamples(const S* samples,
+                                                   unsigned int nSamples,
+                                                   unsigned int first,
+                                                   unsigned int last,
+                                                   double tolerance)
+{
+    double t0 = samples[first].t;
+    double h = samples[last].t - t0;
+    Vector3d p0 = SamplePosition(samples[first]);
+    Vector3d v0 = SampleVelocity(samples, nSamples, first) * h;
+    Vector3d p1 = SamplePosition(samples[last]);
+    Vector3d v1 = SampleVelocity(samples, nSamples, last) * h;
+
+    for (unsigned int i = first + 1; i < last; i++)
+    {
+        Vector3d p = cubicInterpolate(p0, v0, p1, v1, (samples[i].t - t0) / h);
+        if ((p - SamplePosition(samples[i])).norm() > tolerance)
+            return false;
+    }
+
+    return true;
+}
+
+
+template <typename S> static void ProcessSample(const S* samples,
+                                                unsigned int nSamples,
+                                                unsigned int i,
+                                                OrbitSampleProc& proc)
+{
+    Vector3d p = SamplePosition(samples[i]);
+    Vector3d v = SampleVelocity(samples, nSamples, i);
+
+    // Add correction for Celestia's coordinate system
+    proc.sample(samples[i].t, Vector3d(p.x(), p.z(), -p.y()), Vector3d(v.x(), v.z(), -v.y()));
+}
+
+
+// Pass a trajectory's samples to proc, leaving out those that are within the
+// tolerance of the cubic curve through the samples kept. Starting from each
+// sample kept, the next one is found by doubling the number of samples
+// skipped until the curve no longer fits, and then bisecting.
+template <typename S> static void DecimateSamples(const S* samples,
+                                                  unsigned int nSamples,
+                                                  double tolerance,
+                                                  OrbitSampleProc& proc)
+{
+    if (nSamples == 0)
+        return;
+
+    unsigned int first = 0;
+    unsigned int lastIndex = nSamples - 1;
+    ProcessSample(samples, nSamples, first, proc);
+
+    while (first < lastIndex)
+    {
+        unsigned int good = first + 1;
+        unsigned int bad = good;
+        for (unsigned int span = 2; good < lastIndex; span *= 2)
         {
-            double dt = samples[i].t - samples[i - 1].t;
-            v = (p - Vector3d(samples[i - 1].x, samples[i - 1].y, samples[i - 1].z)) / dt;
+            unsigned int next = min(first + span, lastIndex);
+            if (!CurveFitsSamples(samples, nSamples, first, next, tolerance))
+            {
+                bad = next;
+                break;
+            }
+            good = next;
         }
-        else
+
+        while (bad > good + 1)
         {
-            double dt0 = samples[i + 1].t - samples[i].t;
-            Vector3d v0 = (Vector3d(samples[i + 1].x, samples[i + 1].y, samples[i + 1].z) - p) / dt0;
-            double dt1 = samples[i].t - samples[i - 1].t;
-            Vector3d v1 = (p - Vector3d(samples[i - 1].x, samples[i - 1].y, samples[i - 1].z)) / dt1;
-            v = (v0 + v1) * 0.5;
+            unsigned int mid = good + (bad - good) / 2;
+            if (CurveFitsSamples(samples, nSamples, first, mid, tolerance))
+                good = mid;
+            else
+                bad = mid;
         }
 
-        proc.sample(samples[i].t, Vector3d(p.x(), p.z(), -p.y()), Vector3d(v.x(), v.z(), -v.y()));
+        ProcessSample(samples, nSamples, good, proc);
+        first = good;
     }
 }
 
 
+// The whole trajectory is sampled, regardless of the time range.
+template <typename T> void SampledOrbit<T>::sample(double /* startTime */, double /* endTime */,
+                                                   double tolerance,
+                                                   OrbitSampleProc& proc) const
+{
+    DecimateSamples(samples, nSamples, tolerance, proc);
+}
+
+
 // Sampled orbit with positions and velocities
 template <typename T> class SampledOrbitXYZV : public CachingOrbit
 {
@@ -447,10 +668,27 @@ public:
     bool isPeriodic() const;
     void getValidRange(double& begin, double& end) const;
 
-    virtual void sample(double startTime, double endTime, OrbitSampleProc& proc) const;
+    // Sampling reads only the trajectory samples, which don't change once
+    // they're loaded.
+    virtual void sample(double startTime, double endTime, double tolerance, OrbitSampleProc& proc) const;
+    virtual bool canSampleConcurrently() const { return true; };
+
+    void setMappedSamples(MappedFile* file,
+                          const SampleXYZV<T>* _samples,
+                          unsigned int _nSamples,
+                          double _boundingRadius,
+                          const SampleTimeIndex& _timeIndex);
+
+private:
+    int findSample(double jd) const;
 
 private:
-    vector<SampleXYZV<T> > samples;
+    vector<SampleXYZV<T> > sampleStorage;
+    MappedFile* mappedFile;
+    const SampleXYZV<T>* samples;
+    unsigned int nSamples;
+    SampleTimeIndex timeIndex;
+
     double boundingRadius;
     double period;
     mutable int lastSample;
@@ -460,6 +698,9 @@ private:
 
 
 template <typename T> SampledOrbitXYZV<T>::SampledOrbitXYZV(TrajectoryInterpolation _interpolation) :
+    mappedFile(NULL),
+    samples(NULL),
+    nSamples(0),
     boundingRadius(0.0),
     period(1.0),
     lastSample(0),
@@ -470,6 +711,7 @@ template <typename T> SampledOrbitXYZV<T>::SampledOrbitXYZV(TrajectoryInterpolat
 
 template <typename T> SampledOrbitXYZV<T>::~SampledOrbitXYZV()
 {
+    delete mappedFile;
 }
 
 
@@ -488,15 +730,18 @@ template <typename T> void SampledOrbitXYZV<T>::addSample(double t, const Vector
     //samp.velocity = Matrix<T, 3, 1>((T) velocity.x, (T) velocity.y, (T) velocity.z);
     samp.position = position.cast<T>();
     samp.velocity = velocity.cast<T>();
-    samples.push_back(samp);
+    sampleStorage.push_back(samp);
+
+    samples = &sampleStorage[0];
+    nSamples = sampleStorage.size();
 }
 
 template <typename T> double SampledOrbitXYZV<T>::getPeriod() const
 {
-    if (samples.empty())
+    if (nSamples == 0)
         return 0.0;
     else
-        return samples[samples.size() - 1].t - samples[0].t;
+        return samples[nSamples - 1].t - samples[0].t;
 }
 
 
@@ -509,7 +754,7 @@ template <typename T> bool SampledOrbitXYZV<T>::isPeriodic() const
 template <typename T> void SampledOrbitXYZV<T>::getValidRange(double& begin, double& end) const
 {
     begin = samples[0].t;
-    end = samples[samples.size() - 1].t;
+    end = samples[nSamples - 1].t;
 }
 
 
@@ -519,41 +764,64 @@ template <typename T> double SampledOrbitXYZV<T>::getBoundingRadius() const
 }
 
 
+/*! Use samples from a memory mapped binary trajectory file. The orbit takes
+ *  ownership of the file, which must remain mapped for as long as the
+ *  samples are in use.
+ */
+template <typename T> void SampledOrbitXYZV<T>::setMappedSamples(MappedFile* file,
+                                                                 const SampleXYZV<T>* _samples,
+                                                                 unsigned int _nSamples,
+                                                                 double _boundingRadius,
+                                                                 const SampleTimeIndex& _timeIndex)
+{
+    delete mappedFile;
+    sampleStorage.clear();
+
+    mappedFile = file;
+    samples = _samples;
+    nSamples = _nSamples;
+    boundingRadius = _boundingRadius;
+    timeIndex = _timeIndex;
+    lastSample = 0;
+}
+
+
+// Find the samples bracketing the specified time; the previous result is
+// reused when possible, since consecutive calls usually request nearby
+// times.
+template <typename T> int SampledOrbitXYZV<T>::findSample(double jd) const
+{
+    int n = lastSample;
+    if (n < 1 || n >= (int) nSamples || jd < samples[n - 1].t || jd > samples[n].t)
+    {
+        n = FindSample(samples, nSamples, timeIndex, jd);
+        lastSample = n;
+    }
+
+    return n;
+}
+
+
 template <typename T> Vector3d SampledOrbitXYZV<T>::computePosition(double jd) const
 {
     Vector3d pos;
-    if (samples.size() == 0)
+    if (nSamples == 0)
     {
         pos = Vector3d::Zero();
     }
-    else if (samples.size() == 1)
+    else if (nSamples == 1)
     {
-        pos = Vector3d(samples[0].position.x(), samples[1].position.y(), samples[2].position.z());
+        pos = Vector3d(samples[0].position.x(), samples[0].position.y(), samples[0].position.z());
     }
     else
     {
-        SampleXYZV<T> samp;
-        samp.t = jd;
-        int n = lastSample;
-
-        if (n < 1 || n >= (int) samples.size() || jd < samples[n - 1].t || jd > samples[n].t)
-        {
-            typename vector<SampleXYZV<T> >::const_iterator iter = lower_bound(samples.begin(),
-                                                                               samples.end(),
-                                                                               samp);
-            if (iter == samples.end())
-                n = samples.size();
-            else
-                n = iter - samples.begin();
-
-            lastSample = n;
-        }
+        int n = findSample(jd);
 
         if (n == 0)
         {
             pos = Vector3d(samples[n].position.x(), samples[n].position.y(), samples[n].position.z());
         }
-        else if (n < (int) samples.size())
+        else if (n < (int) nSamples)
         {
             SampleXYZV<T> s0 = samples[n - 1];
             SampleXYZV<T> s1 = samples[n];
@@ -601,26 +869,11 @@ template <typename T> Vector3d SampledOrbitXYZV<T>::computeVelocity(double jd) c
 {
     Vector3d vel(Vector3d::Zero());
 
-    if (samples.size() >= 2)
+    if (nSamples >= 2)
     {
-        SampleXYZV<T> samp;
-        samp.t = jd;
-        int n = lastSample;
+        int n = findSample(jd);
 
-        if (n < 1 || n >= (int) samples.size() || jd < samples[n - 1].t || jd > samples[n].t)
-        {
-            typename vector<SampleXYZV<T> >::const_iterator iter = lower_bound(samples.begin(),
-                                                                               samples.end(),
-                                                                               samp);
-            if (iter == samples.end())
-                n = samples.size();
-            else
-                n = iter - samples.begin();
-
-            lastSample = n;
-        }
-
-        if (n > 0 && n < (int) samples.size())
+        if (n > 0 && n < (int) nSamples)
         {
             SampleXYZV<T> s0 = samples[n - 1];
             SampleXYZV<T> s1 = samples[n];
@@ -659,15 +912,10 @@ template <typename T> Vector3d SampledOrbitXYZV<T>::computeVelocity(double jd) c
 
 
 template <typename T> void SampledOrbitXYZV<T>::sample(double /* startTime */, double /* endTime */,
+                                                       double tolerance,
                                                        OrbitSampleProc& proc) const
 {
-    for (typename vector<SampleXYZV<T> >::const_iterator iter = samples.begin();
-         iter != samples.end(); iter++)
-    {
-        proc.sample(iter->t,
-                    Vector3d(iter->position.x(), iter->position.z(), -iter->position.y()),
-                    Vector3d(iter->velocity.x(), iter->velocity.z(), -iter->velocity.y()));
-    }
+    DecimateSamples(samples, nSamples, tolerance, proc);
 }
 
 
@@ -829,6 +1077,186 @@ template <typename T> SampledOrbitXYZV<T>* LoadSampledOrbitXYZV(const string& fi
 }
 
 
+// Binary trajectory files hold the same data as xyz and xyzv files, but
+// they can be memory mapped and used directly instead of being parsed. All
+// values are little endian. The file begins with a 48 byte header:
+//
+//  0: magic number "CELXYZVB"
+//  8: version (16-bit unsigned integer, currently 0x0100)
+// 10: flags (16-bit unsigned integer, BinaryTrajectoryFlags)
+// 12: number of samples (32-bit unsigned integer)
+// 16: number of time index intervals (32-bit unsigned integer)
+// 20: reserved (32-bit unsigned integer)
+// 24: bounding radius of the trajectory in kilometers (double)
+// 32: start time of the time index (double)
+// 40: length of a time index interval in days (double)
+//
+// The header is followed by the samples, each of which is a TDB time, a
+// position in kilometers and--if the file has velocities--a velocity in
+// kilometers per Julian day. All are double precision values and the
+// samples must be in order of strictly increasing time. If the file has a
+// time index, the samples are followed by the number of time index
+// intervals plus one 32-bit unsigned integers (see SampleTimeIndex.)
+
+static const char BinaryTrajectoryMagic[] = "CELXYZVB";
+static const unsigned int BinaryTrajectoryHeaderSize = 48;
+static const uint16 BinaryTrajectoryVersion = 0x0100;
+
+enum BinaryTrajectoryFlags
+{
+    BinaryTrajectoryVelocities = 0x0001,
+    BinaryTrajectoryTimeIndex  = 0x0002,
+};
+
+#if defined(WORDS_BIGENDIAN) || defined(__BIG_ENDIAN__)
+static const bool NativeLittleEndian = false;
+#else
+static const bool NativeLittleEndian = true;
+#endif
+
+
+static uint16 ReadLEUint16(const char* p)
+{
+    uint16 n;
+    memcpy(&n, p, sizeof(n));
+    LE_TO_CPU_INT16(n, n);
+    return n;
+}
+
+
+static uint32 ReadLEUint32(const char* p)
+{
+    uint32 n;
+    memcpy(&n, p, sizeof(n));
+    LE_TO_CPU_INT32(n, n);
+    return n;
+}
+
+
+static double ReadLEDouble(const char* p)
+{
+    double d;
+    memcpy(&d, p, sizeof(d));
+    if (!NativeLittleEndian)
+        d = bswap_double(d);
+    return d;
+}
+
+
+static Vector3d ReadLEVector(const char* p)
+{
+    return Vector3d(ReadLEDouble(p),
+                    ReadLEDouble(p + sizeof(double)),
+                    ReadLEDouble(p + 2 * sizeof(double)));
+}
+
+
+/*! Load a binary trajectory file. Binary trajectories always have double
+ *  precision positions, and velocities if the file contains them. When the
+ *  layout of the samples in the file matches that of samples in memory, the
+ *  file is mapped and used without copying, so that samples are only read
+ *  from disk when they are first needed. Otherwise, the samples are copied
+ *  and the time index is ignored.
+ */
+Orbit* LoadBinaryTrajectory(const string& filename, TrajectoryInterpolation interpolation)
+{
+    MappedFile* file = OpenMappedFile(filename);
+    if (file == NULL)
+        return NULL;
+
+    const char* data = file->data();
+    size_t size = file->size();
+    if (size < BinaryTrajectoryHeaderSize ||
+        memcmp(data, BinaryTrajectoryMagic, 8) != 0 ||
+        ReadLEUint16(data + 8) != BinaryTrajectoryVersion)
+    {
+        cerr << "Bad header in binary trajectory file " << filename << '\n';
+        delete file;
+        return NULL;
+    }
+
+    uint16 flags = ReadLEUint16(data + 10);
+    uint32 nSamples = ReadLEUint32(data + 12);
+    uint32 nIndexEntries = ReadLEUint32(data + 16);
+    double boundingRadius = ReadLEDouble(data + 24);
+
+    size_t sampleSize = ((flags & BinaryTrajectoryVelocities) ? 7 : 4) * sizeof(double);
+    size_t indexOffset = BinaryTrajectoryHeaderSize + nSamples * sampleSize;
+    bool truncated = false;
+    if (nSamples == 0 || nSamples > (size - BinaryTrajectoryHeaderSize) / sampleSize)
+        truncated = true;
+    else if ((flags & BinaryTrajectoryTimeIndex) != 0 &&
+             (size - indexOffset) / sizeof(uint32) <= nIndexEntries)
+        truncated = true;
+
+    if (truncated)
+    {
+        cerr << "Binary trajectory file " << filename << " is truncated\n";
+        delete file;
+        return NULL;
+    }
+
+    SampleTimeIndex timeIndex;
+    if ((flags & BinaryTrajectoryTimeIndex) != 0)
+    {
+        timeIndex.startTime = ReadLEDouble(data + 32);
+        timeIndex.interval = ReadLEDouble(data + 40);
+        timeIndex.nEntries = nIndexEntries;
+        timeIndex.entries = reinterpret_cast<const uint32*>(data + indexOffset);
+        if (nIndexEntries == 0 || !(timeIndex.interval > 0.0))
+            timeIndex = SampleTimeIndex();
+    }
+
+    const char* sampleData = data + BinaryTrajectoryHeaderSize;
+
+    if ((flags & BinaryTrajectoryVelocities) != 0)
+    {
+        SampledOrbitXYZV<double>* orbit = new SampledOrbitXYZV<double>(interpolation);
+        if (NativeLittleEndian && sizeof(SampleXYZV<double>) == sampleSize)
+        {
+            orbit->setMappedSamples(file,
+                                    reinterpret_cast<const SampleXYZV<double>*>(sampleData),
+                                    nSamples, boundingRadius, timeIndex);
+        }
+        else
+        {
+            for (uint32 i = 0; i < nSamples; i++)
+            {
+                const char* p = sampleData + i * sampleSize;
+                orbit->addSample(ReadLEDouble(p),
+                                 ReadLEVector(p + sizeof(double)),
+                                 ReadLEVector(p + 4 * sizeof(double)));
+            }
+            delete file;
+        }
+
+        return orbit;
+    }
+    else
+    {
+        SampledOrbit<double>* orbit = new SampledOrbit<double>(interpolation);
+        if (NativeLittleEndian && sizeof(Sample<double>) == sampleSize)
+        {
+            orbit->setMappedSamples(file,
+                                    reinterpret_cast<const Sample<double>*>(sampleData),
+                                    nSamples, boundingRadius, timeIndex);
+        }
+        else
+        {
+            for (uint32 i = 0; i < nSamples; i++)
+            {
+                const char* p = sampleData + i * sampleSize;
+                Vector3d position = ReadLEVector(p + sizeof(double));
+                orbit->addSample(ReadLEDouble(p), position.x(), position.y(), position.z());
+            }
+            delete file;
+        }
+
+        return orbit;
+    }
+}
+
+
 /*! Load a trajectory file containing single precision positions.
  */
 Orbit* LoadSampledTrajectorySinglePrec(const string& filename, TrajectoryInterpolation interpolation)
@@ -859,3 +1287,4 @@ Orbit* LoadXYZVTrajectoryDoublePrec(const string& filename, TrajectoryInterpolat
 {
     return LoadSampledOrbitXYZV(filename, interpolation, 0.0);
 }
+
@@ -29,5 +29,6 @@ extern Orbit* LoadSampledTrajectoryDoublePrec(const std::string& name, Trajector
 extern Orbit* LoadSampledTrajectorySinglePrec(const std::string& name, TrajectoryInterpolation interpolation);
 extern Orbit* LoadXYZVTrajectoryDoublePrec(const std::string& name, TrajectoryInterpolation interpolation);
 extern Orbit* LoadXYZVTrajectorySinglePrec(const std::string& name, TrajectoryInterpolation interpolation);
+extern Orbit* LoadBinaryTrajectory(const std::string& name, TrajectoryInterpolation interpolation);
 
 #endif // _CELENGINE_SAMPORBIT_H_
@@ -94,6 +94,10 @@ public:
 
     virtual void getValidRange(double& begin, double& end) const;
 
+    // The samples don't change once they're loaded, and the cached sample
+    // index is only a hint that is checked before it's used.
+    virtual bool canEvaluateConcurrently() const { return true; };
+
 private:
     Quaternionf getOrientation(double tjd) const;
 
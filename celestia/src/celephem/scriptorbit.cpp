@@ -256,6 +256,14 @@ ScriptedOrbit::getValidRange(double& begin, double& end) const
 }
 
 
+// Lua states may only be used by one thread at a time.
+bool
+ScriptedOrbit::isThreadSafe() const
+{
+    return false;
+}
+
+
 double
 ScriptedOrbit::getBoundingRadius() const
 {
@@ -33,6 +33,8 @@ class ScriptedOrbit : public CachingOrbit
     virtual double getPeriod() const;
     virtual double getBoundingRadius() const;
     virtual void getValidRange(double& begin, double& end) const;
+    virtual bool isThreadSafe() const;
+    virtual bool canSampleConcurrently() const { return false; };
 
  private:
     lua_State* luaState;
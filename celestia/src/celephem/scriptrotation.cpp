@@ -238,3 +238,11 @@ ScriptedRotation::getValidRange(double& begin, double& end) const
     begin = validRangeBegin;
     end = validRangeEnd;
 }
+
+
+// Lua states may only be used by one thread at a time.
+bool
+ScriptedRotation::isThreadSafe() const
+{
+    return false;
+}
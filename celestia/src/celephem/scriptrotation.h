@@ -33,6 +33,7 @@ class ScriptedRotation : public RotationModel
     virtual bool isPeriodic() const;
     virtual double getPeriod() const;
     virtual void getValidRange(double& begin, double& end) const;
+    virtual bool isThreadSafe() const;
 
  private:
     lua_State* luaState;
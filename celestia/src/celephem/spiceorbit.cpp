@@ -336,3 +336,10 @@ void SpiceOrbit::getValidRange(double& begin, double& end) const
     begin = validIntervalBegin;
     end = validIntervalEnd;
 }
+
+
+// The SPICE library isn't reentrant.
+bool SpiceOrbit::isThreadSafe() const
+{
+    return false;
+}
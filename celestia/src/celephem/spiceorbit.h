@@ -47,6 +47,8 @@ class SpiceOrbit : public CachingOrbit
     Eigen::Vector3d computeVelocity(double jd) const;
 
     virtual void getValidRange(double& begin, double& end) const;
+    virtual bool isThreadSafe() const;
+    virtual bool canSampleConcurrently() const { return false; };
 
  private:
     const std::string targetBodyName;
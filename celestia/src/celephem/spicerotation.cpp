@@ -85,6 +85,14 @@ SpiceRotation::isPeriodic() const
 };
 
 
+// The SPICE library isn't reentrant.
+bool
+SpiceRotation::isThreadSafe() const
+{
+    return false;
+}
+
+
 double
 SpiceRotation::getPeriod() const
 {
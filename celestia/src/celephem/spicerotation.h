@@ -36,6 +36,8 @@ class SpiceRotation : public CachingRotationModel
 
     bool isPeriodic() const;
     double getPeriod() const;
+    bool isThreadSafe() const;
+    bool canEvaluateConcurrently() const { return false; };
 
     // No notion of an equator for SPICE rotation models
     Eigen::Quaterniond computeEquatorOrientation(double /* tdb */) const
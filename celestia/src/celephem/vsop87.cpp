@@ -16,11 +16,18 @@
 #include <celmath/mathlib.h>
 #include <celengine/astro.h>
 #include "vsop87.h"
+#include "chebyshevorbit.h"
 
 using namespace Eigen;
 using namespace std;
 
 
+// Maximum error of the Chebyshev approximations to the VSOP87 series, in
+// kilometers. This is orders of magnitude smaller than the error of the
+// truncated series themselves.
+static const double VSOP87Tolerance = 1.0e-3;
+
+
 struct VSOPTerm
 {
     double A, B, C;
@@ -11095,28 +11102,17 @@ class VSOP87Orbit : public CachingOrbit
                         cos(b) * r,
                         -sin(l) * sin(b) * r);
     }
+};
 
 
-    /** Custom implementation of sample() for VSOP87 orbits. The default
-      * implementation runs too slowly and produces too many samples.
-      */
-    void sample(double startTime, double endTime, OrbitSampleProc& proc) const
+// VSOP87 series are evaluated through a Chebyshev cache
+class CachedVSOP87Orbit : public ChebyshevCachedOrbit
+{
+ public:
+    CachedVSOP87Orbit(CachingOrbit* orbit) :
+        ChebyshevCachedOrbit(orbit, VSOP87Tolerance)
     {
-        double span = getPeriod();
-
-        AdaptiveSamplingParameters samplingParams;
-        samplingParams.tolerance = 1.0; // kilometers
-
-        // startStep, minStep, and maxStep are all set to identical values,
-        // so the adaptive sampling function actuall behaves like uniform
-        // sampling.
-        samplingParams.startStep = span / 150.0;
-        samplingParams.minStep   = samplingParams.startStep;
-        samplingParams.maxStep   = samplingParams.startStep;
-
-        adaptiveSample(startTime, endTime, proc, samplingParams);
     }
-
 };
 
 
@@ -11216,92 +11212,92 @@ Orbit* CreateVSOP87Orbit(const string& name)
 {
     if (name == "vsop87-mercury")
     {
-        Orbit* o = new VSOP87Orbit(mercury_L, 6,
-                                   mercury_B, 6,
-                                   mercury_R, 5,
-                                   0.2408 * 365.25,
-                                   60000000.0);
-        return new MixedOrbit(o, yearToJD(-4000), yearToJD(4000),
+        CachingOrbit* o = new VSOP87Orbit(mercury_L, 6,
+                                          mercury_B, 6,
+                                          mercury_R, 5,
+                                          0.2408 * 365.25,
+                                          60000000.0);
+        return new MixedOrbit(new CachedVSOP87Orbit(o), yearToJD(-4000), yearToJD(4000),
                               astro::SolarMass);
     }
     else if (name == "vsop87-venus")
     {
-        Orbit* o = new VSOP87Orbit(venus_L, 6,
-                                   venus_B, 6,
-                                   venus_R, 5,
-                                   0.6152 * 365.25,
-                                   100000000.0);
-        return new MixedOrbit(o, yearToJD(-4000), yearToJD(4000),
+        CachingOrbit* o = new VSOP87Orbit(venus_L, 6,
+                                          venus_B, 6,
+                                          venus_R, 5,
+                                          0.6152 * 365.25,
+                                          100000000.0);
+        return new MixedOrbit(new CachedVSOP87Orbit(o), yearToJD(-4000), yearToJD(4000),
                               astro::SolarMass);
     }
     else if (name == "vsop87-earth")
     {
-        Orbit* o = new VSOP87Orbit(earth_L, 6,
-                                   earth_B, 3,
-                                   earth_R, 6,
-                                   365.25,
-                                   160000000.0);
-        return new MixedOrbit(o, yearToJD(-4000), yearToJD(4000),
+        CachingOrbit* o = new VSOP87Orbit(earth_L, 6,
+                                          earth_B, 3,
+                                          earth_R, 6,
+                                          365.25,
+                                          160000000.0);
+        return new MixedOrbit(new CachedVSOP87Orbit(o), yearToJD(-4000), yearToJD(4000),
                               astro::SolarMass);
     }
     else if (name == "vsop87-mars")
     {
-        Orbit* o = new VSOP87Orbit(mars_L, 6,
-                                   mars_B, 6,
-                                   mars_R, 6,
-                                   1.8809 * 365.25,
-                                   240000000);
-        return new MixedOrbit(o, yearToJD(-4000), yearToJD(4000),
+        CachingOrbit* o = new VSOP87Orbit(mars_L, 6,
+                                          mars_B, 6,
+                                          mars_R, 6,
+                                          1.8809 * 365.25,
+                                          240000000);
+        return new MixedOrbit(new CachedVSOP87Orbit(o), yearToJD(-4000), yearToJD(4000),
                               astro::SolarMass);
     }
     else if (name == "vsop87-jupiter")
     {
-        Orbit* o = new VSOP87Orbit(jupiter_L, 6,
-                                   jupiter_B, 6,
-                                   jupiter_R, 6,
-                                   11.86 * 365.25,
-                                   800000000.0);
-        return new MixedOrbit(o, yearToJD(-4000), yearToJD(4000),
+        CachingOrbit* o = new VSOP87Orbit(jupiter_L, 6,
+                                          jupiter_B, 6,
+                                          jupiter_R, 6,
+                                          11.86 * 365.25,
+                                          800000000.0);
+        return new MixedOrbit(new CachedVSOP87Orbit(o), yearToJD(-4000), yearToJD(4000),
                               astro::SolarMass);
     }
     else if (name == "vsop87-saturn")
     {
-        Orbit* o = new VSOP87Orbit(saturn_L, 6,
-                                   saturn_B, 6,
-                                   saturn_R, 6,
-                                   29.4577 * 365.25,
-                                   1.5e9);
-        return new MixedOrbit(o, yearToJD(-4000), yearToJD(4000),
+        CachingOrbit* o = new VSOP87Orbit(saturn_L, 6,
+                                          saturn_B, 6,
+                                          saturn_R, 6,
+                                          29.4577 * 365.25,
+                                          1.5e9);
+        return new MixedOrbit(new CachedVSOP87Orbit(o), yearToJD(-4000), yearToJD(4000),
                               astro::SolarMass);
     }
     else if (name == "vsop87-uranus")
     {
-        Orbit* o = new VSOP87Orbit(uranus_L, 5,
-                                   uranus_B, 4,
-                                   uranus_R, 5,
-                                   84.0139 * 365.25,
-                                   3.0e9);
-        return new MixedOrbit(o, yearToJD(-4000), yearToJD(4000),
+        CachingOrbit* o = new VSOP87Orbit(uranus_L, 5,
+                                          uranus_B, 4,
+                                          uranus_R, 5,
+                                          84.0139 * 365.25,
+                                          3.0e9);
+        return new MixedOrbit(new CachedVSOP87Orbit(o), yearToJD(-4000), yearToJD(4000),
                               astro::SolarMass);
     }
     else if (name == "vsop87-neptune")
     {
-        Orbit* o = new VSOP87Orbit(neptune_L, 4,
-                                   neptune_B, 4,
-                                   neptune_R, 5,
-                                   164.793 * 365.25,
-                                   4.7e9);
-        return new MixedOrbit(o, yearToJD(-4000), yearToJD(4000),
+        CachingOrbit* o = new VSOP87Orbit(neptune_L, 4,
+                                          neptune_B, 4,
+                                          neptune_R, 5,
+                                          164.793 * 365.25,
+                                          4.7e9);
+        return new MixedOrbit(new CachedVSOP87Orbit(o), yearToJD(-4000), yearToJD(4000),
                               astro::SolarMass);
     }
     else if (name == "vsop87-sun")
     {
-        Orbit* o = new VSOP87OrbitRect(sun_X, 5,
-                                       sun_Y, 5,
-                                       sun_Z, 3,
-                                       0.0,
-                                       2000000);
-        return new MixedOrbit(o, yearToJD(-4000), yearToJD(6000),
+        CachingOrbit* o = new VSOP87OrbitRect(sun_X, 5,
+                                              sun_Y, 5,
+                                              sun_Z, 3,
+                                              0.0,
+                                              2000000);
+        return new MixedOrbit(new ChebyshevCachedOrbit(o, VSOP87Tolerance), yearToJD(-4000), yearToJD(6000),
                               astro::SolarMass);
     }
 
@@ -0,0 +1,220 @@
+// benchcapture.cpp
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// Measure the frame rate of Theora movie capture, using synthetic frames
+// in place of the OpenGL frame buffer: first the YUV color conversion
+// alone, with and without SIMD instructions, and then the complete capture
+// pipeline writing an Ogg file. The program exits with an error if the
+// conversions with and without SIMD instructions produce different values.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <celutil/timer.h>
+#include <celutil/yuvconvert.h>
+#include "oggtheoracapture.h"
+
+using namespace std;
+
+
+static int frameWidth = 1920;
+static int frameHeight = 1080;
+static int frameCount = 300;
+static float quality = 10.0f;
+static string outputFilename;
+
+// Number of distinct synthetic frames, which are shown in turn
+static const int PatternCount = 8;
+
+
+void Usage()
+{
+    cerr << "Usage: benchcapture [options] <output file>\n";
+    cerr << "   --size <w> <h> (or -s <w> <h>) : frame size (default 1920 1080)\n";
+    cerr << "   --frames <n> (or -f <n>)       : number of frames captured (default 300)\n";
+    cerr << "   --quality <q> (or -q <q>)      : video quality, 0 to 10 (default 10)\n";
+}
+
+
+bool parseCommandLine(int argc, char* argv[])
+{
+    int i = 1;
+
+    while (i < argc)
+    {
+        if (argv[i][0] == '-')
+        {
+            if (!strcmp(argv[i], "--size") || !strcmp(argv[i], "-s"))
+            {
+                if (i + 2 >= argc)
+                    return false;
+                frameWidth = atoi(argv[i + 1]);
+                frameHeight = atoi(argv[i + 2]);
+                if (frameWidth <= 0 || frameHeight <= 0)
+                    return false;
+                i += 2;
+            }
+            else if (!strcmp(argv[i], "--frames") || !strcmp(argv[i], "-f"))
+            {
+                if (i == argc - 1)
+                    return false;
+                i++;
+                frameCount = atoi(argv[i]);
+                if (frameCount <= 0)
+                    return false;
+            }
+            else if (!strcmp(argv[i], "--quality") || !strcmp(argv[i], "-q"))
+            {
+                if (i == argc - 1)
+                    return false;
+                i++;
+                quality = (float) atof(argv[i]);
+            }
+            else
+            {
+                cerr << "Unknown command line switch: " << argv[i] << '\n';
+                return false;
+            }
+        }
+        else
+        {
+            if (!outputFilename.empty())
+                return false;
+            outputFilename = string(argv[i]);
+        }
+        i++;
+    }
+
+    return !outputFilename.empty();
+}
+
+
+// Fill a BGRA frame with a gradient that moves with the pattern number and
+// a scattering of bright pixels, loosely like a rendered star field.
+void MakePattern(vector<unsigned char>& pixels, int pattern)
+{
+    pixels.resize(frameWidth * frameHeight * 4);
+    srand(pattern + 1);
+
+    unsigned char* p = &pixels[0];
+    for (int y = 0; y < frameHeight; y++)
+    {
+        for (int x = 0; x < frameWidth; x++)
+        {
+            p[0] = (unsigned char) ((x + pattern * 16) * 255 / (frameWidth + PatternCount * 16));
+            p[1] = (unsigned char) (y * 128 / frameHeight);
+            p[2] = (unsigned char) ((x + y) & 0x3f);
+            p[3] = 0xff;
+            if ((rand() & 0xff) == 0)
+                p[0] = p[1] = p[2] = 0xff;
+            p += 4;
+        }
+    }
+}
+
+
+// A capture that reads its frames from the synthetic patterns instead of
+// the frame buffer.
+class SyntheticCapture : public OggTheoraCapture
+{
+ public:
+    SyntheticCapture(const vector<unsigned char>* _patterns) :
+        patterns(_patterns),
+        nextPattern(0)
+    {
+    }
+
+ protected:
+    void readFrame(unsigned char* pixels)
+    {
+        const vector<unsigned char>& pattern = patterns[nextPattern];
+        memcpy(pixels, &pattern[0], pattern.size());
+        nextPattern = (nextPattern + 1) % PatternCount;
+    }
+
+ private:
+    const vector<unsigned char>* patterns;
+    int nextPattern;
+};
+
+
+double BenchConversion(const vector<unsigned char>* patterns, bool allowSIMD, Timer* timer, unsigned int& checksum)
+{
+    int uvWidth = (frameWidth + 1) / 2;
+    int uvHeight = (frameHeight + 1) / 2;
+    vector<unsigned char> y(frameWidth * frameHeight);
+    vector<unsigned char> u(uvWidth * uvHeight);
+    vector<unsigned char> v(uvWidth * uvHeight);
+
+    checksum = 0;
+    double startTime = timer->getTime();
+    for (int i = 0; i < frameCount; i++)
+    {
+        const vector<unsigned char>& pattern = patterns[i % PatternCount];
+        ConvertBGRAToYUV420(&pattern[0], frameWidth * 4, frameWidth, frameHeight,
+                            &y[0], frameWidth, &u[0], &v[0], uvWidth,
+                            allowSIMD);
+        checksum = checksum * 31 + y[i % y.size()] + u[i % u.size()] + v[i % v.size()];
+    }
+
+    return frameCount / (timer->getTime() - startTime);
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (!parseCommandLine(argc, argv))
+    {
+        Usage();
+        return 1;
+    }
+
+    vector<unsigned char> patterns[PatternCount];
+    for (int i = 0; i < PatternCount; i++)
+        MakePattern(patterns[i], i);
+
+    Timer* timer = CreateTimer();
+
+    unsigned int scalarChecksum = 0;
+    unsigned int simdChecksum = 0;
+    double scalarRate = BenchConversion(patterns, false, timer, scalarChecksum);
+    double simdRate = BenchConversion(patterns, true, timer, simdChecksum);
+    printf("%dx%d, %d frames\n", frameWidth, frameHeight, frameCount);
+    printf("color conversion, scalar: %8.1f fps\n", scalarRate);
+    printf("color conversion, SIMD:   %8.1f fps\n", simdRate);
+    if (scalarChecksum != simdChecksum)
+    {
+        cerr << "Scalar and SIMD color conversion produced different values\n";
+        return 1;
+    }
+
+    SyntheticCapture capture(patterns);
+    capture.setQuality(quality);
+    if (!capture.start(outputFilename, frameWidth, frameHeight, 30.0f))
+    {
+        cerr << "Error starting capture to " << outputFilename << '\n';
+        return 1;
+    }
+
+    double startTime = timer->getTime();
+    for (int i = 0; i < frameCount; i++)
+        capture.captureFrame();
+    double submitTime = timer->getTime() - startTime;
+    capture.end();
+    double totalTime = timer->getTime() - startTime;
+
+    printf("capture, frames submitted: %8.1f fps\n", frameCount / submitTime);
+    printf("capture, frames written:   %8.1f fps (%d bytes)\n",
+           frameCount / totalTime, capture.getBytesOut());
+
+    return 0;
+}
@@ -0,0 +1,222 @@
+// benchparser.cpp
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// Measure the throughput of the tokenizer and parser used for Celestia's
+// text catalogs (ssc, stc, and dsc files), reading both from a stream and
+// from a memory mapped file, and check that both produce the same values.
+// The fastest of several reads is reported in megabytes per second, and
+// the program exits with an error if the two methods disagree.
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <celutil/timer.h>
+#include <celutil/mappedfile.h>
+#include <celengine/tokenizer.h>
+#include <celengine/parser.h>
+
+using namespace std;
+
+
+static vector<string> catalogFilenames;
+static unsigned int repeatCount = 3;
+
+
+void Usage()
+{
+    cerr << "Usage: benchparser [options] <catalog file> [<catalog file> ...]\n";
+    cerr << "   --repeat <n> (or -r <n>)   : number of times each file is read\n";
+}
+
+
+bool parseCommandLine(int argc, char* argv[])
+{
+    int i = 1;
+
+    while (i < argc)
+    {
+        if (argv[i][0] == '-')
+        {
+            if (!strcmp(argv[i], "--repeat") || !strcmp(argv[i], "-r"))
+            {
+                if (i == argc - 1)
+                    return false;
+                i++;
+                repeatCount = (unsigned int) atoi(argv[i]);
+                if (repeatCount == 0)
+                    return false;
+            }
+            else
+            {
+                cerr << "Unknown command line switch: " << argv[i] << '\n';
+                return false;
+            }
+        }
+        else
+        {
+            catalogFilenames.push_back(string(argv[i]));
+        }
+        i++;
+    }
+
+    return !catalogFilenames.empty();
+}
+
+
+// Accumulate a checksum of a value, so that trees read in different ways
+// can be compared.
+void ChecksumValue(const Value* value, double& checksum)
+{
+    switch (value->getType())
+    {
+    case Value::NumberType:
+        checksum = checksum * 1.000001 + value->getNumber();
+        break;
+    case Value::StringType:
+        checksum = checksum * 1.000001 + value->getString().length();
+        break;
+    case Value::BooleanType:
+        checksum = checksum * 1.000001 + (value->getBoolean() ? 1.0 : 0.0);
+        break;
+    case Value::ArrayType:
+        {
+            const Array* array = value->getArray();
+            for (unsigned int i = 0; i < array->size(); i++)
+                ChecksumValue((*array)[i], checksum);
+        }
+        break;
+    case Value::HashType:
+        {
+            Hash* hash = value->getHash();
+            for (HashIterator iter = hash->begin(); iter != hash->end(); iter++)
+            {
+                checksum = checksum * 1.000001 + iter->first.length();
+                ChecksumValue(iter->second, checksum);
+            }
+        }
+        break;
+    }
+}
+
+
+// Read every token in the input, and when parse is true, read every array
+// and property list into a tree the way the catalog loaders do. Returns
+// the number of tokens read outside of trees.
+unsigned int ReadCatalog(Tokenizer& tokenizer, bool parse, double& checksum)
+{
+    Parser parser(&tokenizer);
+    unsigned int tokenCount = 0;
+
+    for (;;)
+    {
+        Tokenizer::TokenType tok = tokenizer.nextToken();
+        if (tok == Tokenizer::TokenEnd)
+            break;
+        tokenCount++;
+
+        if (tok == Tokenizer::TokenNumber)
+        {
+            checksum = checksum * 1.000001 + tokenizer.getNumberValue();
+        }
+        else if (parse && (tok == Tokenizer::TokenBeginGroup || tok == Tokenizer::TokenBeginArray))
+        {
+            tokenizer.pushBack();
+            Value* value = parser.readValue();
+            if (value == NULL)
+                break;
+            ChecksumValue(value, checksum);
+            delete value;
+        }
+    }
+
+    return tokenCount;
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (!parseCommandLine(argc, argv))
+    {
+        Usage();
+        return 1;
+    }
+
+    Timer* timer = CreateTimer();
+    bool identical = true;
+
+    cout << "file  size (MB)  stream tokenize  mapped tokenize  stream parse  mapped parse (MB/s)\n";
+    for (vector<string>::const_iterator iter = catalogFilenames.begin();
+         iter != catalogFilenames.end(); ++iter)
+    {
+        MappedFile* mappedFile = OpenMappedFile(*iter);
+        if (mappedFile == NULL)
+        {
+            cerr << "Error opening catalog file " << *iter << '\n';
+            return 1;
+        }
+
+        double megabytes = (double) mappedFile->size() / (1024.0 * 1024.0);
+        double bestTimes[4] = { 0.0, 0.0, 0.0, 0.0 };
+        double checksums[4] = { 0.0, 0.0, 0.0, 0.0 };
+
+        for (unsigned int i = 0; i < repeatCount; i++)
+        {
+            for (unsigned int method = 0; method < 4; method++)
+            {
+                bool parse = method >= 2;
+                bool mapped = (method % 2) == 1;
+                double checksum = 0.0;
+
+                double startTime = timer->getTime();
+                if (mapped)
+                {
+                    Tokenizer tokenizer(mappedFile->data(), mappedFile->data() + mappedFile->size());
+                    ReadCatalog(tokenizer, parse, checksum);
+                }
+                else
+                {
+                    ifstream in(iter->c_str(), ios::in | ios::binary);
+                    Tokenizer tokenizer(&in);
+                    ReadCatalog(tokenizer, parse, checksum);
+                }
+                double elapsed = timer->getTime() - startTime;
+
+                if (i == 0 || elapsed < bestTimes[method])
+                    bestTimes[method] = elapsed;
+                checksums[method] = checksum;
+            }
+        }
+
+        if (checksums[0] != checksums[1] || checksums[2] != checksums[3])
+        {
+            cerr << "Stream and mapped file produced different values for " << *iter << '\n';
+            identical = false;
+        }
+
+        cout << *iter << "  " << megabytes;
+        for (unsigned int method = 0; method < 4; method++)
+            cout << "  " << (bestTimes[method] > 0.0 ? megabytes / bestTimes[method] : 0.0);
+        cout << '\n';
+
+        delete mappedFile;
+    }
+
+    delete timer;
+
+    if (!identical)
+    {
+        cerr << "Reading from a stream and from a mapped file gave different results!\n";
+        return 1;
+    }
+
+    return 0;
+}
@@ -16,6 +16,7 @@
 #include "celestiacore.h"
 #include "favorites.h"
 #include "url.h"
+#include "imagecapture.h"
 #include <celengine/astro.h>
 #include <celengine/asterism.h>
 #include <celengine/boundaries.h>
@@ -24,10 +25,13 @@
 #include <celengine/execution.h>
 #include <celengine/cmdparser.h>
 #include <celengine/multitexture.h>
+#include <celengine/texmanager.h>
+#include <celengine/meshmanager.h>
 #include <celephem/spiceinterface.h>
 #include <celengine/axisarrow.h>
 #include <celengine/planetgrid.h>
 #include <celengine/visibleregion.h>
+#include <celengine/framestatecache.h>
 #include <celengine/eigenport.h>
 #include <celmath/geomutil.h>
 #include <celutil/util.h>
@@ -36,10 +40,12 @@
 #include <celutil/formatnum.h>
 #include <celutil/debug.h>
 #include <celutil/utf8.h>
+#include <celutil/workerpool.h>
 #include <GL/glew.h>
 #include <cstdio>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <iomanip>
 #include <algorithm>
 #include <cstdlib>
@@ -73,6 +79,17 @@ static const float RotationBraking = 10.0f;
 static const float RotationDecay = 2.0f;
 static const double MaximumTimeRate = 1.0e15;
 static const double MinimumTimeRate = 1.0e-15;
+
+// Memory allowed for the pixels of screenshots still being compressed
+static const size_t MaxPendingScreenshotBytes = 256 * 1024 * 1024;
+
+// Real time step of each exported frame, used for script timing and camera
+// motion; simulation time advances by the export time step instead.
+static const double FrameExportInterval = 1.0 / 30.0;
+
+// Limit on the number of names offered while typing an object name
+static const unsigned int MaxTypedTextCompletions = 100;
+
 static const float stdFOV = degToRad(45.0f);
 static const float MaximumFOV = degToRad(120.0f);
 static const float MinimumFOV = degToRad(0.001f);
@@ -326,6 +343,7 @@ CelestiaCore::CelestiaCore() :
     lightTravelFlag(false),
     flashFrameStart(0.0),
     timer(NULL),
+    resourceLoaderPool(NULL),
     runningScript(NULL),
     execEnv(NULL),
 #ifdef CELX
@@ -352,6 +370,12 @@ CelestiaCore::CelestiaCore() :
     KeyAccel(1.0),
     movieCapture(NULL),
     recording(false),
+    screenshotService(NULL),
+    frameExportCount(0),
+    frameExportNumber(0),
+    frameExportPending(false),
+    frameExportStartTime(0.0),
+    frameExportTimeStep(0.0),
     contextMenuCallback(NULL),
     logoTexture(NULL),
     alerter(NULL),
@@ -392,6 +416,11 @@ CelestiaCore::~CelestiaCore()
     if (movieCapture != NULL)
         recordEnd();
 
+#ifndef TARGET_OS_MAC
+    // Waits for screenshots still being written
+    delete screenshotService;
+#endif
+
 #ifdef CELX
     // Clean up all scripts
     if (celxScript != NULL)
@@ -404,7 +433,12 @@ CelestiaCore::~CelestiaCore()
 
     delete execEnv;
 
-
+    if (resourceLoaderPool != NULL)
+    {
+        GetTextureManager()->setWorkerPool(NULL);
+        GetGeometryManager()->setWorkerPool(NULL);
+        delete resourceLoaderPool;
+    }
 }
 
 void CelestiaCore::readFavoritesFile()
@@ -1272,7 +1306,7 @@ void CelestiaCore::charEntered(const char *c_p, int modifiers)
 #endif
         {
             typedText += string(c_p);
-            typedTextCompletion = sim->getObjectCompletion(typedText, (renderer->getLabelMode() & Renderer::LocationLabels) != 0);
+            typedTextCompletion = sim->getObjectCompletion(typedText, (renderer->getLabelMode() & Renderer::LocationLabels) != 0, MaxTypedTextCompletions);
             typedTextCompletionIdx = -1;
 #ifdef AUTO_COMPLETION
             if (typedTextCompletion.size() == 1)
@@ -1303,7 +1337,7 @@ void CelestiaCore::charEntered(const char *c_p, int modifiers)
                     typedText = string(typedText, 0, typedText.size() - 1);
                     if (typedText.size() > 0)
                     {
-                        typedTextCompletion = sim->getObjectCompletion(typedText, (renderer->getLabelMode() & Renderer::LocationLabels) != 0);
+                        typedTextCompletion = sim->getObjectCompletion(typedText, (renderer->getLabelMode() & Renderer::LocationLabels) != 0, MaxTypedTextCompletions);
                     } else {
                         typedTextCompletion.clear();
                     }
@@ -2261,6 +2295,10 @@ void CelestiaCore::tick()
     {
         dt = 1.0 / movieCapture->getFrameRate();
     }
+    else if (frameExportCount > 0)
+    {
+        dt = FrameExportInterval;
+    }
     else
     {
         dt = sysTime - lastTime;
@@ -2447,6 +2485,14 @@ void CelestiaCore::tick()
 #endif // CELX
 
     sim->update(dt);
+
+    // Exported frames are a fixed step of simulation time apart, whatever
+    // the time scale.
+    if (frameExportCount > 0)
+    {
+        sim->setTime(frameExportStartTime + frameExportNumber * frameExportTimeStep);
+        frameExportPending = true;
+    }
 }
 
 
@@ -2456,6 +2502,21 @@ void CelestiaCore::draw()
         return;
     viewChanged = false;
 
+    // Unload textures and models to stay within their memory budgets
+    GetTextureManager()->beginFrame();
+    GetGeometryManager()->beginFrame();
+
+    // Create the textures and models that finished loading in the
+    // background since the last frame.
+    if (resourceLoaderPool != NULL)
+    {
+        double budget = config->resourceLoadTimeBudget;
+        double startTime = timer->getTime();
+        GetTextureManager()->finishLoads(budget);
+        budget -= timer->getTime() - startTime;
+        GetGeometryManager()->finishLoads(max(0.0, budget));
+    }
+
     if (views.size() == 1)
     {
         // I'm not certain that a special case for one view is required; but,
@@ -2471,6 +2532,18 @@ void CelestiaCore::draw()
     }
     else
     {
+        unsigned int viewCount = 0;
+        for (list<View*>::const_iterator iter = views.begin();
+             iter != views.end(); iter++)
+        {
+            if ((*iter)->type == View::ViewWindow)
+                viewCount++;
+        }
+
+        // Views looking out from the same place, as for a dome, share the
+        // work that doesn't depend on the direction of view.
+        renderer->beginFrame(viewCount);
+
         glEnable(GL_SCISSOR_TEST);
         for (list<View*>::iterator iter = views.begin();
              iter != views.end(); iter++)
@@ -2492,6 +2565,7 @@ void CelestiaCore::draw()
             }
         }
         glDisable(GL_SCISSOR_TEST);
+        renderer->endFrame();
         glViewport(0, 0, width, height);
     }
 
@@ -2516,6 +2590,28 @@ void CelestiaCore::draw()
     if (movieCapture != NULL && recording)
         movieCapture->captureFrame();
 
+#ifndef TARGET_OS_MAC
+    if (frameExportCount > 0 && frameExportPending)
+    {
+        char filename[32];
+        sprintf(filename, "%06d.png", frameExportNumber + 1);
+        bool success = getScreenshotService()->capture(frameExportPrefix + filename,
+                                                       ScreenshotService::PNG,
+                                                       0, 0, width, height);
+        frameExportPending = false;
+        frameExportNumber++;
+        if (!success)
+        {
+            endFrameExport();
+            flash(_("Unable to write exported frame"));
+        }
+        else if (frameExportNumber == frameExportCount)
+        {
+            endFrameExport();
+        }
+    }
+#endif
+
     // Frame rate counter
     nFrames++;
     if (nFrames == 100 || sysTime - fpsCounterStartTime > 10.0)
@@ -3628,7 +3724,8 @@ void CelestiaCore::renderOverlay()
         glTranslatef(0.0f, (float) (height - titleFont->getHeight()), 0.0f);
 
         overlay->beginText();
-        Vector3d v = sel.getPosition(sim->getTime()).offsetFromKm(sim->getObserver().getPosition());
+        const FrameStateCache& frameState = sim->getUniverse()->getFrameStateCache(sim->getTime());
+        Vector3d v = frameState.getPosition(sel, sim->getTime()).offsetFromKm(sim->getObserver().getPosition());
 
         switch (sel.getType())
         {
@@ -3997,82 +4094,6 @@ void CelestiaCore::renderOverlay()
 }
 
 
-class SolarSystemLoader : public EnumFilesHandler
-{
- public:
-    Universe* universe;
-    ProgressNotifier* notifier;
-    SolarSystemLoader(Universe* u, ProgressNotifier* pn) : universe(u), notifier(pn) {};
-
-    bool process(const string& filename)
-    {
-        if (DetermineFileType(filename) == Content_CelestiaCatalog)
-        {
-            string fullname = getPath() + '/' + filename;
-            clog << _("Loading solar system catalog: ") << fullname << '\n';
-            if (notifier)
-                notifier->update(filename);
-
-            ifstream solarSysFile(fullname.c_str(), ios::in);
-            if (solarSysFile.good())
-            {
-                LoadSolarSystemObjects(solarSysFile,
-                                       *universe,
-                                       getPath());
-            }
-        }
-
-        return true;
-    };
-};
-
-template <class OBJDB> class CatalogLoader : public EnumFilesHandler
-{
-public:
-    OBJDB*      objDB;
-    string      typeDesc;
-    ContentType contentType;
-    ProgressNotifier* notifier;
-
-    CatalogLoader(OBJDB* db,
-                  const std::string& typeDesc,
-                  const ContentType& contentType,
-                  ProgressNotifier* pn) :
-        objDB      (db),
-        typeDesc   (typeDesc),
-        contentType(contentType),
-        notifier(pn)
-    {
-    }
-
-    bool process(const string& filename)
-    {
-        if (DetermineFileType(filename) == contentType)
-        {
-            string fullname = getPath() + '/' + filename;
-            clog << _("Loading ") << typeDesc << " catalog: " << fullname << '\n';
-            if (notifier)
-                notifier->update(filename);
-
-            ifstream catalogFile(fullname.c_str(), ios::in);
-            if (catalogFile.good())
-            {
-                bool success = objDB->load(catalogFile, getPath());
-                if (!success)
-                {
-                    //DPRINTF(0, _("Error reading star file: %s\n"), fullname.c_str());
-                    DPRINTF(0, "Error reading %s catalog file: %s\n", typeDesc.c_str(), fullname.c_str());
-                }
-            }
-        }
-        return true;
-    }
-};
-
-typedef CatalogLoader<StarDatabase> StarLoader;
-typedef CatalogLoader<DSODatabase>  DeepSkyLoader;
-
-
 bool CelestiaCore::initSimulation(const string* configFileName,
                                   const vector<string>* extrasDirs,
                                   ProgressNotifier* progressNotifier)
@@ -4157,144 +4178,13 @@ bool CelestiaCore::initSimulation(const string* configFileName,
     if (favorites == NULL)
         favorites = new FavoritesList();
 
-    universe = new Universe();
-
-
-    /***** Load star catalogs *****/
-
-    if (!readStars(*config, progressNotifier))
+    universe = LoadUniverse(*config, progressNotifier);
+    if (universe == NULL)
     {
-        fatalError(_("Cannot read star database."));
+        fatalError(_("Cannot read star and deep sky catalogs."));
         return false;
     }
 
-
-    /***** Load the deep sky catalogs *****/
-
-    DSONameDatabase* dsoNameDB  = new DSONameDatabase;
-    DSODatabase*     dsoDB      = new DSODatabase;
-    dsoDB->setNameDatabase(dsoNameDB);
-	    
-	// Load first the vector of dsoCatalogFiles in the data directory (deepsky.dsc, globulars.dsc,...):
-	 
-	for (vector<string>::const_iterator iter = config->dsoCatalogFiles.begin();
-    iter != config->dsoCatalogFiles.end(); iter++)
-    {
-    	if (progressNotifier)
-        	progressNotifier->update(*iter);
-	
-		ifstream dsoFile(iter->c_str(), ios::in);
-        if (!dsoFile.good())
-        {
-        	cerr<< _("Error opening deepsky catalog file.") << '\n';
-            delete dsoDB;
-            return false;
-		}
-        else if (!dsoDB->load(dsoFile, ""))		
-	    {
-    		cerr << "Cannot read Deep Sky Objects database." << '\n';
-        	delete dsoDB;
-           	return false;
-        }
-    }
-
-    // Next, read all the deep sky files in the extras directories
-    {
-        for (vector<string>::const_iterator iter = config->extrasDirs.begin();
-             iter != config->extrasDirs.end(); iter++)
-        {
-            if (*iter != "")
-            {
-                Directory* dir = OpenDirectory(*iter);
-
-                DeepSkyLoader loader(dsoDB,
-                                     "deep sky object",
-                                     Content_CelestiaDeepSkyCatalog,
-                                     progressNotifier);
-                loader.pushDir(*iter);
-                dir->enumFiles(loader, true);
-
-                delete dir;
-            }
-        }
-    }
-    dsoDB->finish();
-    universe->setDSOCatalog(dsoDB);
-
-
-    /***** Load the solar system catalogs *****/
-    // First read the solar system files listed individually in the
-    // config file.
-    {
-        SolarSystemCatalog* solarSystemCatalog = new SolarSystemCatalog();
-        universe->setSolarSystemCatalog(solarSystemCatalog);
-        for (vector<string>::const_iterator iter = config->solarSystemFiles.begin();
-             iter != config->solarSystemFiles.end();
-             iter++)
-        {
-            if (progressNotifier)
-                progressNotifier->update(*iter);
-
-            ifstream solarSysFile(iter->c_str(), ios::in);
-            if (!solarSysFile.good())
-            {
-                warning(_("Error opening solar system catalog.\n"));
-            }
-            else
-            {
-                LoadSolarSystemObjects(solarSysFile, *universe, "");
-            }
-        }
-    }
-
-    // Next, read all the solar system files in the extras directories
-    {
-        for (vector<string>::const_iterator iter = config->extrasDirs.begin();
-             iter != config->extrasDirs.end(); iter++)
-        {
-            if (*iter != "")
-            {
-                Directory* dir = OpenDirectory(*iter);
-
-                SolarSystemLoader loader(universe, progressNotifier);
-                loader.pushDir(*iter);
-                dir->enumFiles(loader, true);
-
-                delete dir;
-            }
-        }
-    }
-
-    // Load asterisms:
-    if (config->asterismsFile != "")
-    {
-        ifstream asterismsFile(config->asterismsFile.c_str(), ios::in);
-        if (!asterismsFile.good())
-        {
-            warning(_("Error opening asterisms file."));
-        }
-        else
-        {
-            AsterismList* asterisms = ReadAsterismList(asterismsFile,
-                                                       *universe->getStarCatalog());
-            universe->setAsterisms(asterisms);
-        }
-    }
-
-    if (config->boundariesFile != "")
-    {
-        ifstream boundariesFile(config->boundariesFile.c_str(), ios::in);
-        if (!boundariesFile.good())
-        {
-            warning(_("Error opening constellation boundaries files."));
-        }
-        else
-        {
-            ConstellationBoundaries* boundaries = ReadBoundaries(boundariesFile);
-            universe->setBoundaries(boundaries);
-        }
-    }
-
     // Load destinations list
     if (config->destinationsFile != "")
     {
@@ -4357,7 +4247,7 @@ bool CelestiaCore::initRenderer()
 
     Renderer::DetailOptions detailOptions;
     detailOptions.ringSystemSections = config->ringSystemSections;
-    detailOptions.orbitPathSamplePoints = config->orbitPathSamplePoints;
+    detailOptions.orbitPathTolerance = config->orbitPathTolerance;
     detailOptions.shadowTextureSize = config->shadowTextureSize;
     detailOptions.eclipseTextureSize = config->eclipseTextureSize;
 
@@ -4423,118 +4313,17 @@ bool CelestiaCore::initRenderer()
         logoTexture = LoadTextureFromFile(string("textures") + "/" + config->logoTextureFile);
     }
 
-    return true;
-}
-
-
-static void loadCrossIndex(StarDatabase* starDB,
-                           StarDatabase::Catalog catalog,
-                           const string& filename)
-{
-    if (!filename.empty())
+    // Loading is mostly waiting for the disk and decoding, so use a loader
+    // thread even on single processor systems.
+    if (config->asyncResourceLoading)
     {
-        ifstream xrefFile(filename.c_str(), ios::in | ios::binary);
-        if (xrefFile.good())
-        {
-            if (!starDB->loadCrossIndex(catalog, xrefFile))
-                cerr << _("Error reading cross index ") << filename << '\n';
-            else
-                clog << _("Loaded cross index ") << filename << '\n';
-        }
+        resourceLoaderPool = new WorkerPool(max(1u, DefaultWorkerThreadCount()));
+        GetTextureManager()->setWorkerPool(resourceLoaderPool);
+        GetGeometryManager()->setWorkerPool(resourceLoaderPool);
     }
-}
 
-
-bool CelestiaCore::readStars(const CelestiaConfig& cfg,
-                             ProgressNotifier* progressNotifier)
-{
-    StarDetails::SetStarTextures(cfg.starTextures);
-
-    ifstream starNamesFile(cfg.starNamesFile.c_str(), ios::in);
-    if (!starNamesFile.good())
-    {
-	cerr << _("Error opening ") << cfg.starNamesFile << '\n';
-        return false;
-    }
-
-    StarNameDatabase* starNameDB = StarNameDatabase::readNames(starNamesFile);
-    if (starNameDB == NULL)
-    {
-        cerr << _("Error reading star names file\n");
-        return false;
-    }
-
-    // First load the binary star database file.  The majority of stars
-    // will be defined here.
-    StarDatabase* starDB = new StarDatabase();
-    if (!cfg.starDatabaseFile.empty())
-    {
-        if (progressNotifier)
-            progressNotifier->update(cfg.starDatabaseFile);
-
-        ifstream starFile(cfg.starDatabaseFile.c_str(), ios::in | ios::binary);
-        if (!starFile.good())
-        {
-            cerr << _("Error opening ") << cfg.starDatabaseFile << '\n';
-            delete starDB;
-            return false;
-        }
-
-        if (!starDB->loadBinary(starFile))
-        {
-            delete starDB;
-            cerr << _("Error reading stars file\n");
-            return false;
-        }
-    }
-
-    starDB->setNameDatabase(starNameDB);
-
-    loadCrossIndex(starDB, StarDatabase::HenryDraper, cfg.HDCrossIndexFile);
-    loadCrossIndex(starDB, StarDatabase::SAO,         cfg.SAOCrossIndexFile);
-    loadCrossIndex(starDB, StarDatabase::Gliese,      cfg.GlieseCrossIndexFile);
-
-    // Next, read any ASCII star catalog files specified in the StarCatalogs
-    // list.
-    if (!cfg.starCatalogFiles.empty())
-    {
-        for (vector<string>::const_iterator iter = config->starCatalogFiles.begin();
-             iter != config->starCatalogFiles.end(); iter++)
-        {
-            if (*iter != "")
-            {
-                ifstream starFile(iter->c_str(), ios::in);
-                if (starFile.good())
-                {
-                    starDB->load(starFile, "");
-                }
-                else
-                {
-                    cerr << _("Error opening star catalog ") << *iter << '\n';
-                }
-            }
-        }
-    }
-
-    // Now, read supplemental star files from the extras directories
-    for (vector<string>::const_iterator iter = config->extrasDirs.begin();
-         iter != config->extrasDirs.end(); iter++)
-    {
-        if (*iter != "")
-        {
-            Directory* dir = OpenDirectory(*iter);
-
-            StarLoader loader(starDB, "star", Content_CelestiaStarCatalog, progressNotifier);
-            loader.pushDir(*iter);
-            dir->enumFiles(loader, true);
-
-            delete dir;
-        }
-    }
-
-    starDB->finish();
-
-    universe->setStarCatalog(starDB);
+    GetTextureManager()->setMemoryBudget((size_t) config->textureMemoryBudget << 20);
+    GetGeometryManager()->setMemoryBudget((size_t) config->modelMemoryBudget << 20);
 
     return true;
 }
@@ -4751,6 +4540,51 @@ bool CelestiaCore::isRecording()
     return recording;
 }
 
+ScreenshotService* CelestiaCore::getScreenshotService()
+{
+#ifndef TARGET_OS_MAC
+    if (screenshotService == NULL)
+    {
+        screenshotService = new ScreenshotService(max(1u, DefaultWorkerThreadCount()),
+                                                  MaxPendingScreenshotBytes);
+    }
+#endif
+    return screenshotService;
+}
+
+/*! Render frameCount frames timeStep days of simulation time apart,
+ *  starting at the current time, and write them as PNG files named by
+ *  appending a six digit frame number to filenamePrefix. The frames are
+ *  compressed on worker threads while the following frames are rendered.
+ */
+bool CelestiaCore::beginFrameExport(const string& filenamePrefix,
+                                    int frameCount,
+                                    double timeStep)
+{
+    if (frameCount <= 0 || getScreenshotService() == NULL)
+        return false;
+
+    frameExportPrefix = filenamePrefix;
+    frameExportCount = frameCount;
+    frameExportNumber = 0;
+    frameExportPending = false;
+    frameExportStartTime = sim->getTime();
+    frameExportTimeStep = timeStep;
+
+    return true;
+}
+
+void CelestiaCore::endFrameExport()
+{
+    frameExportCount = 0;
+    frameExportPending = false;
+}
+
+bool CelestiaCore::isExportingFrames() const
+{
+    return frameExportCount > 0;
+}
+
 void CelestiaCore::flash(const string& s, double duration)
 {
     if (hudDetail > 0)
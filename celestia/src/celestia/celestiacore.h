@@ -26,10 +26,12 @@
 #include "favorites.h"
 #include "destination.h"
 #include "moviecapture.h"
+#include "universeloader.h"
 #ifdef CELX
 #include "celx.h"
 #endif
 class Url;
+class ScreenshotService;
 
 // class CelestiaWatcher;
 class CelestiaCore;
@@ -38,15 +40,6 @@ class CelestiaCore;
 
 typedef Watcher<CelestiaCore> CelestiaWatcher;
 
-class ProgressNotifier
-{
-public:
-    ProgressNotifier() {};
-    virtual ~ProgressNotifier() {};
-    
-    virtual void update(const std::string&) = 0;
-};
-
 class View
 {
  public:
@@ -272,6 +265,13 @@ class CelestiaCore // : public Watchable<CelestiaCore>
     bool isCaptureActive();
     bool isRecording();
 
+    ScreenshotService* getScreenshotService();
+    bool beginFrameExport(const std::string& filenamePrefix,
+                          int frameCount,
+                          double timeStep);
+    void endFrameExport();
+    bool isExportingFrames() const;
+
     void runScript(CommandSequence*);
     void runScript(const std::string& filename);
     void cancelScript();
@@ -345,7 +345,6 @@ class CelestiaCore // : public Watchable<CelestiaCore>
     bool referenceMarkEnabled(const std::string& refMark, Selection sel = Selection()) const;
     
  private:
-    bool readStars(const CelestiaConfig&, ProgressNotifier*);
     void renderOverlay();
     void fatalError(const std::string&);
 #ifdef CELX
@@ -394,6 +393,9 @@ class CelestiaCore // : public Watchable<CelestiaCore>
 
     Timer* timer;
 
+    // Worker threads for loading textures and models in the background
+    WorkerPool* resourceLoaderPool;
+
     Execution* runningScript;
     ExecutionEnvironment* execEnv;
 
@@ -441,6 +443,14 @@ class CelestiaCore // : public Watchable<CelestiaCore>
     MovieCapture* movieCapture;
     bool recording;
 
+    ScreenshotService* screenshotService;
+    std::string frameExportPrefix;
+    int frameExportCount;
+    int frameExportNumber;
+    bool frameExportPending;
+    double frameExportStartTime;
+    double frameExportTimeStep;
+
     ContextMenuFunc contextMenuCallback;
 
     Texture* logoTexture;
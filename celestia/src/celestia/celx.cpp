@@ -24,6 +24,8 @@
 #include <celmath/vecmath.h>
 #include <celengine/timeline.h>
 #include <celengine/timelinephase.h>
+#include <celengine/texmanager.h>
+#include <celengine/meshmanager.h>
 #include "imagecapture.h"
 #include "url.h"
 
@@ -510,6 +512,7 @@ LuaState::LuaState() :
     state = lua_open();
     timer = CreateTimer();
     screenshotCount = 0;
+    screenshotFailureCount = 0;
 }
 
 LuaState::~LuaState()
@@ -2675,6 +2678,46 @@ static int celestia_getstarcount(lua_State* l)
 }
 
 
+static void pushResourceUsageStats(lua_State* l, const ResourceUsageStats& stats)
+{
+    lua_newtable(l);
+    lua_pushstring(l, "residentbytes");
+    lua_pushnumber(l, (lua_Number) stats.residentBytes);
+    lua_settable(l, -3);
+    lua_pushstring(l, "residentcount");
+    lua_pushnumber(l, stats.residentCount);
+    lua_settable(l, -3);
+    lua_pushstring(l, "hits");
+    lua_pushnumber(l, (lua_Number) stats.hits);
+    lua_settable(l, -3);
+    lua_pushstring(l, "misses");
+    lua_pushnumber(l, (lua_Number) stats.misses);
+    lua_settable(l, -3);
+    lua_pushstring(l, "evictions");
+    lua_pushnumber(l, (lua_Number) stats.evictions);
+    lua_settable(l, -3);
+}
+
+// Return memory use and cache statistics for textures and models
+static int celestia_getresourceusage(lua_State* l)
+{
+    Celx_CheckArgs(l, 1, 1, "No arguments expected to function celestia:getresourceusage");
+
+    // error checking only:
+    this_celestia(l);
+
+    lua_newtable(l);
+    lua_pushstring(l, "textures");
+    pushResourceUsageStats(l, GetTextureManager()->getUsageStats());
+    lua_settable(l, -3);
+    lua_pushstring(l, "models");
+    pushResourceUsageStats(l, GetGeometryManager()->getUsageStats());
+    lua_settable(l, -3);
+
+    return 1;
+}
+
+
 // Stars iterator function; two upvalues expected
 static int celestia_stars_iter(lua_State* l)
 {
@@ -2998,6 +3041,80 @@ static int celestia_getstar(lua_State* l)
     return 1;
 }
 
+// Get the position for a star query: the optional argument at index, or
+// the position of the active observer.
+static Vector3f getStarQueryPosition(lua_State* l, int index, const char* errorMsg)
+{
+    CelestiaCore* appCore = this_celestia(l);
+    UniversalCoord pos = appCore->getSimulation()->getObserver().getPosition();
+    if (lua_gettop(l) >= index)
+    {
+        UniversalCoord* uc = to_position(l, index);
+        if (uc == NULL)
+            Celx_DoError(l, errorMsg);
+        else
+            pos = *uc;
+    }
+
+    return pos.toLy().cast<float>();
+}
+
+static void pushStarList(lua_State* l, const vector<const Star*>& stars)
+{
+    lua_newtable(l);
+    for (unsigned int i = 0; i < stars.size(); i++)
+    {
+        object_new(l, Selection(const_cast<Star*>(stars[i])));
+        lua_rawseti(l, -2, i + 1);
+    }
+}
+
+static int celestia_getneareststars(lua_State* l)
+{
+    Celx_CheckArgs(l, 2, 3, "One or two arguments expected to function celestia:getneareststars");
+
+    CelestiaCore* appCore = this_celestia(l);
+    double nStars = Celx_SafeGetNumber(l, 2, AllErrors, "First arg to celestia:getneareststars must be a number");
+    Vector3f pos = getStarQueryPosition(l, 3, "Second arg to celestia:getneareststars must be a position");
+
+    // The count is clamped to the size of the catalog before it's
+    // converted, so that huge counts don't overflow.
+    if (!(nStars >= 1.0))
+        Celx_DoError(l, "First arg to celestia:getneareststars must be at least 1");
+    const StarDatabase* stardb = appCore->getSimulation()->getUniverse()->getStarCatalog();
+    nStars = min(nStars, (double) stardb->size());
+
+    vector<const Star*> stars;
+    if (nStars >= 1.0)
+        stardb->findNearestStars(pos, (unsigned int) nStars, stars);
+    pushStarList(l, stars);
+
+    return 1;
+}
+
+static int celestia_getbrighteststars(lua_State* l)
+{
+    Celx_CheckArgs(l, 2, 3, "One or two arguments expected to function celestia:getbrighteststars");
+
+    CelestiaCore* appCore = this_celestia(l);
+    double nStars = Celx_SafeGetNumber(l, 2, AllErrors, "First arg to celestia:getbrighteststars must be a number");
+    Vector3f pos = getStarQueryPosition(l, 3, "Second arg to celestia:getbrighteststars must be a position");
+
+    // The count is clamped to the size of the catalog before it's
+    // converted, so that huge counts don't overflow.
+    if (!(nStars >= 1.0))
+        Celx_DoError(l, "First arg to celestia:getbrighteststars must be at least 1");
+    const StarDatabase* stardb = appCore->getSimulation()->getUniverse()->getStarCatalog();
+    nStars = min(nStars, (double) stardb->size());
+
+    vector<const Star*> stars;
+    if (nStars >= 1.0)
+        stardb->findBrightestStars(pos, (unsigned int) nStars, stars);
+    pushStarList(l, stars);
+
+    return 1;
+}
+
 static int celestia_getdso(lua_State* l)
 {
     Celx_CheckArgs(l, 2, 2, "One argument expected to function celestia:getdso");
@@ -3015,6 +3132,247 @@ static int celestia_getdso(lua_State* l)
 }
 
 
+// The parameters of a celestia:findstars or celestia:finddsos query: the
+// objects within radius light years of position, within angle radians of
+// direction and brighter than magnitude.
+struct SpatialQuery
+{
+    Vector3d position;
+    Vector3d direction;
+    double angle;
+    double radius;
+    float magnitude;
+};
+
+// Get the number in field of the table at index, or defaultValue if the
+// field is missing.
+static double getQueryNumber(lua_State* l, int index, const char* field,
+                             double defaultValue, const char* errorMsg)
+{
+    lua_pushstring(l, field);
+    lua_gettable(l, index);
+    double value = defaultValue;
+    if (!lua_isnil(l, -1))
+        value = Celx_SafeGetNumber(l, lua_gettop(l), AllErrors, errorMsg, defaultValue);
+    lua_pop(l, 1);
+
+    return value;
+}
+
+// Read a spatial query from the optional table at index; missing fields
+// leave the query unrestricted, and the default position is that of the
+// active observer.
+static void getSpatialQuery(lua_State* l, int index, const char* funcName, SpatialQuery& query)
+{
+    CelestiaCore* appCore = this_celestia(l);
+    UniversalCoord pos = appCore->getSimulation()->getObserver().getPosition();
+    query.direction = Vector3d::UnitZ();
+    query.angle = PI;
+    query.radius = 1.0e30;
+    query.magnitude = 1.0e30f;
+
+    if (lua_gettop(l) < index || lua_isnil(l, index))
+    {
+        query.position = pos.toLy();
+        return;
+    }
+
+    char errorMsg[128];
+    if (!lua_istable(l, index))
+    {
+        sprintf(errorMsg, "Argument to %s must be a table", funcName);
+        Celx_DoError(l, errorMsg);
+    }
+
+    lua_pushstring(l, "position");
+    lua_gettable(l, index);
+    if (!lua_isnil(l, -1))
+    {
+        UniversalCoord* uc = to_position(l, lua_gettop(l));
+        if (uc == NULL)
+        {
+            sprintf(errorMsg, "position field of %s query must be a position", funcName);
+            Celx_DoError(l, errorMsg);
+        }
+        else
+        {
+            pos = *uc;
+        }
+    }
+    lua_pop(l, 1);
+
+    sprintf(errorMsg, "angle field of %s query must be a number", funcName);
+    query.angle = getQueryNumber(l, index, "angle", PI, errorMsg);
+    sprintf(errorMsg, "radius field of %s query must be a number", funcName);
+    query.radius = getQueryNumber(l, index, "radius", 1.0e30, errorMsg);
+    sprintf(errorMsg, "magnitude field of %s query must be a number", funcName);
+    query.magnitude = (float) getQueryNumber(l, index, "magnitude", 1.0e30, errorMsg);
+
+    lua_pushstring(l, "direction");
+    lua_gettable(l, index);
+    if (!lua_isnil(l, -1))
+    {
+        Vec3d* v = to_vector(l, lua_gettop(l));
+        if (v == NULL || (v->x == 0.0 && v->y == 0.0 && v->z == 0.0))
+        {
+            sprintf(errorMsg, "direction field of %s query must be a nonzero vector", funcName);
+            Celx_DoError(l, errorMsg);
+        }
+        else
+        {
+            query.direction = Vector3d(v->x, v->y, v->z).normalized();
+        }
+    }
+    else if (query.angle < PI)
+    {
+        sprintf(errorMsg, "%s query with an angle requires a direction", funcName);
+        Celx_DoError(l, errorMsg);
+    }
+    lua_pop(l, 1);
+
+    query.position = pos.toLy();
+}
+
+class StarQueryHandler : public StarHandler
+{
+ public:
+    void process(const Star& star, float distance, float appMag)
+    {
+        stars.push_back(&star);
+        distances.push_back(distance);
+        appMags.push_back(appMag);
+    }
+
+    vector<const Star*> stars;
+    vector<double> distances;
+    vector<double> appMags;
+};
+
+class DSOQueryHandler : public DSOHandler
+{
+ public:
+    void process(DeepSkyObject* const& dso, double /* distance */, float /* absMag */)
+    {
+        dsos.push_back(dso);
+    }
+
+    vector<const DeepSkyObject*> dsos;
+};
+
+// Find the stars matching a spatial query. Instead of one object per star,
+// the results are returned as a table of arrays, which is far cheaper for
+// scripts that process many stars:
+//   count     number of stars found
+//   index     index for celestia:getstar
+//   catalog   catalog number
+//   x, y, z   universal position in light years
+//   distance  distance from the query position in light years
+//   appmag    apparent magnitude from the query position
+//   absmag    absolute magnitude
+static int celestia_findstars(lua_State* l)
+{
+    Celx_CheckArgs(l, 1, 2, "One table or no argument expected to function celestia:findstars");
+
+    CelestiaCore* appCore = this_celestia(l);
+    SpatialQuery query;
+    getSpatialQuery(l, 2, "celestia:findstars", query);
+
+    const StarDatabase* starDB = appCore->getSimulation()->getUniverse()->getStarCatalog();
+    StarQueryHandler handler;
+    starDB->findStarsInCone(handler,
+                            query.position.cast<float>(),
+                            query.direction.cast<float>(),
+                            (float) min(query.angle, PI),
+                            (float) min(query.radius, 1.0e30),
+                            query.magnitude);
+
+    unsigned int count = handler.stars.size();
+    vector<double> index(count), catalog(count), absmag(count), x(count), y(count), z(count);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        const Star* star = handler.stars[i];
+        Vector3f pos = star->getPosition();
+        index[i] = (double) (star - starDB->getStar(0));
+        catalog[i] = star->getCatalogNumber();
+        absmag[i] = star->getAbsoluteMagnitude();
+        x[i] = pos.x();
+        y[i] = pos.y();
+        z[i] = pos.z();
+    }
+
+    CelxLua celx(l);
+    lua_newtable(l);
+    celx.setTable("count", (lua_Number) count);
+    celx.setTable("index", index);
+    celx.setTable("catalog", catalog);
+    celx.setTable("x", x);
+    celx.setTable("y", y);
+    celx.setTable("z", z);
+    celx.setTable("distance", handler.distances);
+    celx.setTable("appmag", handler.appMags);
+    celx.setTable("absmag", absmag);
+
+    return 1;
+}
+
+// Find the deep sky objects whose centers match a spatial query. The
+// results are returned in the same form as by celestia:findstars, without
+// the index field and with an additional radius field; the distance is
+// to the center of the object.
+static int celestia_finddsos(lua_State* l)
+{
+    Celx_CheckArgs(l, 1, 2, "One table or no argument expected to function celestia:finddsos");
+
+    CelestiaCore* appCore = this_celestia(l);
+    SpatialQuery query;
+    getSpatialQuery(l, 2, "celestia:finddsos", query);
+
+    const DSODatabase* dsoDB = appCore->getSimulation()->getUniverse()->getDSOCatalog();
+    DSOQueryHandler handler;
+    dsoDB->findDSOsInCone(handler,
+                          query.position,
+                          query.direction,
+                          min(query.angle, PI),
+                          query.radius,
+                          query.magnitude);
+
+    unsigned int count = handler.dsos.size();
+    vector<double> catalog(count), x(count), y(count), z(count);
+    vector<double> distance(count), appmag(count), absmag(count), radius(count);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        const DeepSkyObject* dso = handler.dsos[i];
+        Vector3d pos = dso->getPosition();
+        catalog[i] = dso->getCatalogNumber();
+        x[i] = pos.x();
+        y[i] = pos.y();
+        z[i] = pos.z();
+        distance[i] = (pos - query.position).norm();
+        absmag[i] = dso->getAbsoluteMagnitude();
+        radius[i] = dso->getRadius();
+
+        // Apparent magnitudes are computed as by the renderer, from the
+        // distance to the edge of the object
+        double edgeDistance = distance[i] - dso->getBoundingSphereRadius();
+        appmag[i] = edgeDistance >= 32.6167 ? astro::absToAppMag(absmag[i], edgeDistance) : absmag[i];
+    }
+
+    CelxLua celx(l);
+    lua_newtable(l);
+    celx.setTable("count", (lua_Number) count);
+    celx.setTable("catalog", catalog);
+    celx.setTable("x", x);
+    celx.setTable("y", y);
+    celx.setTable("z", z);
+    celx.setTable("distance", distance);
+    celx.setTable("appmag", appmag);
+    celx.setTable("absmag", absmag);
+    celx.setTable("radius", radius);
+
+    return 1;
+}
+
+
 static int celestia_newvector(lua_State* l)
 {
     Celx_CheckArgs(l, 4, 4, "Expected 3 arguments for celestia:newvector");
@@ -3237,20 +3595,13 @@ static int celestia_geteventhandler(lua_State* l)
     return 1;
 }
 
-static int celestia_takescreenshot(lua_State* l)
+// Return the directory for script screenshots followed by the start of a
+// filename and the part of it that a script may choose, reduced to a safe
+// set of characters.
+static string screenshotPathPrefix(CelestiaCore* appCore,
+                                   const char* stem,
+                                   const char* fileid_ptr)
 {
-    Celx_CheckArgs(l, 1, 3, "Need 0 to 2 arguments for celestia:takescreenshot");
-    CelestiaCore* appCore = this_celestia(l);
-    LuaState* luastate = getLuaStateObject(l);
-    // make sure we don't timeout because of taking a screenshot:
-    double timeToTimeout = luastate->timeout - luastate->getTime();
-
-    const char* filetype = Celx_SafeGetString(l, 2, WrongType, "First argument to celestia:takescreenshot must be a string");
-    if (filetype == NULL)
-        filetype = "png";
-
-    // Let the script safely contribute one part of the filename:
-    const char* fileid_ptr = Celx_SafeGetString(l, 3, WrongType, "Second argument to celestia:takescreenshot must be a string");
     if (fileid_ptr == NULL)
         fileid_ptr = "";
     string fileid(fileid_ptr);
@@ -3277,27 +3628,51 @@ static int celestia_takescreenshot(lua_State* l)
 
         path.append("/");
 
+    return path + stem + fileid;
+}
+
+static int celestia_takescreenshot(lua_State* l)
+{
+    Celx_CheckArgs(l, 1, 3, "Need 0 to 2 arguments for celestia:takescreenshot");
+    CelestiaCore* appCore = this_celestia(l);
+    LuaState* luastate = getLuaStateObject(l);
+    // make sure we don't timeout because of taking a screenshot:
+    double timeToTimeout = luastate->timeout - luastate->getTime();
+
+    const char* filetype = Celx_SafeGetString(l, 2, WrongType, "First argument to celestia:takescreenshot must be a string");
+    if (filetype == NULL)
+        filetype = "png";
+
+    // Let the script safely contribute one part of the filename:
+    const char* fileid_ptr = Celx_SafeGetString(l, 3, WrongType, "Second argument to celestia:takescreenshot must be a string");
+    string prefix = screenshotPathPrefix(appCore, "screenshot-", fileid_ptr);
     luastate->screenshotCount++;
     bool success = false;
     char filenamestem[48];
-    sprintf(filenamestem, "screenshot-%s%06i", fileid.c_str(), luastate->screenshotCount);
+    sprintf(filenamestem, "%06i", luastate->screenshotCount);
 
     // Get the dimensions of the current viewport
     GLint viewport[4];
     glGetIntegerv(GL_VIEWPORT, viewport);
 
 #ifndef TARGET_OS_MAC
+    // The image is compressed and written in the background, so success
+    // only means that the file was opened; errors while writing it are
+    // reported by celestia:waitforscreenshots().
+    ScreenshotService* screenshots = appCore->getScreenshotService();
+    if (luastate->screenshotCount == 1)
+        luastate->screenshotFailureCount = screenshots->getFailureCount();
     if (strncmp(filetype, "jpg", 3) == 0)
     {
-        string filepath = path + filenamestem + ".jpg";
-        success = CaptureGLBufferToJPEG(string(filepath),
+        string filepath = prefix + filenamestem + ".jpg";
+        success = screenshots->capture(filepath, ScreenshotService::JPEG,
                                        viewport[0], viewport[1],
                                        viewport[2], viewport[3]);
     }
     else
     {
-        string filepath = path + filenamestem + ".png";
-        success = CaptureGLBufferToPNG(string(filepath),
+        string filepath = prefix + filenamestem + ".png";
+        success = screenshots->capture(filepath, ScreenshotService::PNG,
                                        viewport[0], viewport[1],
                                        viewport[2], viewport[3]);
     }
@@ -3309,6 +3684,60 @@ static int celestia_takescreenshot(lua_State* l)
     return 1;
 }
 
+// Wait until the screenshots taken by the script have been written, and
+// return false if any of them failed since the last call.
+static int celestia_waitforscreenshots(lua_State* l)
+{
+    Celx_CheckArgs(l, 1, 1, "No arguments expected for celestia:waitforscreenshots");
+    CelestiaCore* appCore = this_celestia(l);
+    LuaState* luastate = getLuaStateObject(l);
+    double timeToTimeout = luastate->timeout - luastate->getTime();
+
+    bool success = true;
+    ScreenshotService* screenshots = appCore->getScreenshotService();
+    if (screenshots != NULL && luastate->screenshotCount > 0)
+    {
+        screenshots->finish();
+        unsigned int failureCount = screenshots->getFailureCount();
+        success = failureCount == luastate->screenshotFailureCount;
+        luastate->screenshotFailureCount = failureCount;
+    }
+    lua_pushboolean(l, success);
+
+    // Waiting doesn't count against the script's timeslice
+    luastate->timeout = luastate->getTime() + timeToTimeout;
+    return 1;
+}
+
+static int celestia_exportframes(lua_State* l)
+{
+    Celx_CheckArgs(l, 3, 4, "Need 2 or 3 arguments for celestia:exportframes");
+    CelestiaCore* appCore = this_celestia(l);
+
+    int frameCount = (int) Celx_SafeGetNumber(l, 2, AllErrors, "First argument to celestia:exportframes must be a number");
+    double timeStep = Celx_SafeGetNumber(l, 3, AllErrors, "Second argument to celestia:exportframes must be a number");
+    const char* fileid_ptr = Celx_SafeGetString(l, 4, WrongType, "Third argument to celestia:exportframes must be a string");
+    if (frameCount <= 0)
+    {
+        Celx_DoError(l, "Frame count for celestia:exportframes must be positive");
+        return 0;
+    }
+
+    string prefix = screenshotPathPrefix(appCore, "frame-", fileid_ptr);
+    lua_pushboolean(l, appCore->beginFrameExport(prefix, frameCount, timeStep));
+
+    return 1;
+}
+
+static int celestia_isexportingframes(lua_State* l)
+{
+    Celx_CheckArgs(l, 1, 1, "No arguments expected for celestia:isexportingframes");
+    CelestiaCore* appCore = this_celestia(l);
+    lua_pushboolean(l, appCore->isExportingFrames());
+
+    return 1;
+}
+
 static int celestia_createcelscript(lua_State* l)
 {
     Celx_CheckArgs(l, 2, 2, "Need one argument for celestia:createcelscript()");
@@ -3499,8 +3928,13 @@ static void CreateCelestiaMetaTable(lua_State* l)
     Celx_RegisterMethod(l, "getsystemtime", celestia_getsystemtime);
     Celx_RegisterMethod(l, "getstarcount", celestia_getstarcount);
     Celx_RegisterMethod(l, "getdsocount", celestia_getdsocount);
+    Celx_RegisterMethod(l, "getresourceusage", celestia_getresourceusage);
     Celx_RegisterMethod(l, "getstar", celestia_getstar);
+    Celx_RegisterMethod(l, "getneareststars", celestia_getneareststars);
+    Celx_RegisterMethod(l, "getbrighteststars", celestia_getbrighteststars);
     Celx_RegisterMethod(l, "getdso", celestia_getdso);
+    Celx_RegisterMethod(l, "findstars", celestia_findstars);
+    Celx_RegisterMethod(l, "finddsos", celestia_finddsos);
     Celx_RegisterMethod(l, "newframe", celestia_newframe);
     Celx_RegisterMethod(l, "newvector", celestia_newvector);
     Celx_RegisterMethod(l, "newposition", celestia_newposition);
@@ -3508,6 +3942,9 @@ static void CreateCelestiaMetaTable(lua_State* l)
     Celx_RegisterMethod(l, "getscripttime", celestia_getscripttime);
     Celx_RegisterMethod(l, "requestkeyboard", celestia_requestkeyboard);
     Celx_RegisterMethod(l, "takescreenshot", celestia_takescreenshot);
+    Celx_RegisterMethod(l, "waitforscreenshots", celestia_waitforscreenshots);
+    Celx_RegisterMethod(l, "exportframes", celestia_exportframes);
+    Celx_RegisterMethod(l, "isexportingframes", celestia_isexportingframes);
     Celx_RegisterMethod(l, "createcelscript", celestia_createcelscript);
     Celx_RegisterMethod(l, "requestsystemaccess", celestia_requestsystemaccess);
     Celx_RegisterMethod(l, "getscriptpath", celestia_getscriptpath);
@@ -4437,6 +4874,20 @@ void CelxLua::setTable(const char* field, const char* value)
     lua_settable(m_lua, -3);
 }
 
+// Set field to an array of numbers, for results too large to return as
+// tables of objects
+void CelxLua::setTable(const char* field, const vector<double>& values)
+{
+    lua_pushstring(m_lua, field);
+    lua_newtable(m_lua);
+    for (unsigned int i = 0; i < values.size(); i++)
+    {
+        lua_pushnumber(m_lua, values[i]);
+        lua_rawseti(m_lua, -2, i + 1);
+    }
+    lua_settable(m_lua, -3);
+}
+
 
 lua_Number CelxLua::safeGetNumber(int index,
                                   FatalErrors fatalErrors,
@@ -59,6 +59,8 @@ public:
     bool charEntered(const char*);
     double getTime() const;
     int screenshotCount;
+    // Screenshot failures already reported by celestia:waitforscreenshots()
+    unsigned int screenshotFailureCount;
     double timeout;
 
     // Celx script event handlers
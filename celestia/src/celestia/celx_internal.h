@@ -15,6 +15,7 @@
 
 #include <map>
 #include <string>
+#include <vector>
 #include <Eigen/Core>
 #include <Eigen/Geometry>
 
@@ -106,6 +107,7 @@ public:
     
     void setTable(const char* field, lua_Number value);
     void setTable(const char* field, const char* value);
+    void setTable(const char* field, const std::vector<double>& values);
         
     void newFrame(const ObserverFrame& f);
     void newVector(const Vec3d& v);
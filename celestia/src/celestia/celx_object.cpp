@@ -15,6 +15,8 @@
 #include "celx_object.h"
 #include <celengine/body.h>
 #include <celengine/timelinephase.h>
+#include <celengine/eclipsesearch.h>
+#include <celengine/objectstate.h>
 #include <celengine/axisarrow.h>
 #include <celengine/visibleregion.h>
 #include <celengine/planetgrid.h>
@@ -827,6 +829,89 @@ static int object_getposition(lua_State* l)
     return 1;
 }
 
+// Return the states of the object at an array of times, as a table of
+// arrays: count, t, the position x, y, z in km, the velocity vx, vy, vz in
+// km/day, the orientation qw, qx, qy, qz and the apparent magnitude
+// appmag as seen from the frame center. Positions, velocities and
+// orientations are relative to the frame, which is universal by default.
+static int object_getstates(lua_State* l)
+{
+    CelxLua celx(l);
+    celx.checkArgs(2, 3, "One or two arguments expected to object:getstates");
+
+    Selection* sel = this_object(l);
+
+    if (!lua_istable(l, 2))
+        celx.doError("First argument to object:getstates must be a table of times");
+
+    ObserverFrame frame;
+    if (lua_gettop(l) >= 3)
+    {
+        ObserverFrame* f = celx.toFrame(3);
+        if (f == NULL)
+            celx.doError("Second argument to object:getstates must be a frame");
+        else
+            frame = *f;
+    }
+
+    vector<double> times;
+    for (int i = 1; ; i++)
+    {
+        lua_rawgeti(l, 2, i);
+        if (lua_isnil(l, -1))
+        {
+            lua_pop(l, 1);
+            break;
+        }
+        if (!lua_isnumber(l, -1))
+            celx.doError("Times passed to object:getstates must be numbers");
+        times.push_back(lua_tonumber(l, -1));
+        lua_pop(l, 1);
+    }
+
+    unsigned int count = times.size();
+    vector<ObjectState, aligned_allocator<ObjectState> > states(count);
+    if (count > 0)
+        ComputeObjectStates(*sel, frame, &times[0], count, &states[0]);
+
+    vector<double> x(count), y(count), z(count);
+    vector<double> vx(count), vy(count), vz(count);
+    vector<double> qw(count), qx(count), qy(count), qz(count);
+    vector<double> appmag(count);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        const ObjectState& state = states[i];
+        x[i] = state.position.x();
+        y[i] = state.position.y();
+        z[i] = state.position.z();
+        vx[i] = state.velocity.x();
+        vy[i] = state.velocity.y();
+        vz[i] = state.velocity.z();
+        qw[i] = state.orientation.w();
+        qx[i] = state.orientation.x();
+        qy[i] = state.orientation.y();
+        qz[i] = state.orientation.z();
+        appmag[i] = state.appMag;
+    }
+
+    lua_newtable(l);
+    celx.setTable("count", (lua_Number) count);
+    celx.setTable("t", times);
+    celx.setTable("x", x);
+    celx.setTable("y", y);
+    celx.setTable("z", z);
+    celx.setTable("vx", vx);
+    celx.setTable("vy", vy);
+    celx.setTable("vz", vz);
+    celx.setTable("qw", qw);
+    celx.setTable("qx", qx);
+    celx.setTable("qy", qy);
+    celx.setTable("qz", qz);
+    celx.setTable("appmag", appmag);
+
+    return 1;
+}
+
 static int object_getchildren(lua_State* l)
 {
     CelxLua celx(l);
@@ -1297,6 +1382,79 @@ static int object_phases(lua_State* l)
 }
 
 
+/*! object:findeclipses(number starttime, number endtime [, string type])
+*
+* Find the eclipses between a solar system body and its satellites from
+* starttime to endtime (TDB). The type may be "solar", for eclipses where
+* the shadow of a satellite falls on the body, "lunar", for eclipses of
+* satellites by the body, or "all"; the default is "all". The eclipses are
+* returned in a table sorted by start time, each one a table with the
+* fields occulter, receiver, starttime and endtime. The table is empty if
+* the object isn't a solar system body.
+*
+* \verbatim
+* -- Example: list the eclipses of Jupiter's moons in January 2010
+* --
+* jupiter = celestia:find("Sol/Jupiter")
+* eclipses = jupiter:findeclipses(celestia:utctotdb(2010, 1, 1),
+*                                 celestia:utctotdb(2010, 2, 1),
+*                                 "lunar")
+* for i, eclipse in ipairs(eclipses) do
+*     celestia:print(eclipse.receiver:name() .. " " .. eclipse.starttime)
+* end
+*
+* \endverbatim
+*/
+static int object_findeclipses(lua_State* l)
+{
+    CelxLua celx(l);
+    celx.checkArgs(3, 4, "Two or three arguments expected to object:findeclipses");
+
+    Selection* sel = this_object(l);
+
+    double startTime = celx.safeGetNumber(2, AllErrors, "First argument to object:findeclipses must be a number");
+    double endTime = celx.safeGetNumber(3, AllErrors, "Second argument to object:findeclipses must be a number");
+    const char* typeName = celx.safeGetString(4, WrongType, "Third argument to object:findeclipses must be a string");
+
+    int eclipseTypeMask = EclipseSearch::SolarEclipse | EclipseSearch::LunarEclipse;
+    if (typeName != NULL)
+    {
+        if (!strcmp(typeName, "solar"))
+            eclipseTypeMask = EclipseSearch::SolarEclipse;
+        else if (!strcmp(typeName, "lunar"))
+            eclipseTypeMask = EclipseSearch::LunarEclipse;
+        else if (strcmp(typeName, "all"))
+            celx.doError("Unknown eclipse type for object:findeclipses");
+    }
+
+    vector<EclipseEvent> eclipses;
+    if (sel->body() != NULL)
+    {
+        EclipseSearch search(sel->body());
+        search.findEclipses(startTime, endTime, eclipseTypeMask, eclipses);
+    }
+
+    lua_newtable(l);
+    for (unsigned int i = 0; i < eclipses.size(); i++)
+    {
+        lua_newtable(l);
+
+        lua_pushstring(l, "occulter");
+        object_new(l, Selection(eclipses[i].occulter));
+        lua_settable(l, -3);
+        lua_pushstring(l, "receiver");
+        object_new(l, Selection(eclipses[i].receiver));
+        lua_settable(l, -3);
+        celx.setTable("starttime", eclipses[i].startTime);
+        celx.setTable("endtime", eclipses[i].endTime);
+
+        lua_rawseti(l, -2, i + 1);
+    }
+
+    return 1;
+}
+
+
 void CreateObjectMetaTable(lua_State* l)
 {
     CelxLua celx(l);
@@ -1325,6 +1483,7 @@ void CreateObjectMetaTable(lua_State* l)
     celx.registerMethod("mark", object_mark);
     celx.registerMethod("unmark", object_unmark);
     celx.registerMethod("getposition", object_getposition);
+    celx.registerMethod("getstates", object_getstates);
     celx.registerMethod("getchildren", object_getchildren);
     celx.registerMethod("locations", object_locations);
     celx.registerMethod("bodyfixedframe", object_bodyfixedframe);
@@ -1333,6 +1492,7 @@ void CreateObjectMetaTable(lua_State* l)
     celx.registerMethod("bodyframe", object_bodyframe);
     celx.registerMethod("getphase", object_getphase);
     celx.registerMethod("phases", object_phases);
+    celx.registerMethod("findeclipses", object_findeclipses);
     celx.registerMethod("preloadtexture", object_preloadtexture);
     
     lua_pop(l, 1); // pop metatable off the stack
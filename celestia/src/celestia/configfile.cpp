@@ -100,6 +100,8 @@ CelestiaConfig* ReadCelestiaConfig(string filename, CelestiaConfig *config)
     config->SAOCrossIndexFile = WordExp(config->SAOCrossIndexFile);
     configParams->getString("GlieseCrossIndex", config->GlieseCrossIndexFile);
     config->GlieseCrossIndexFile = WordExp(config->GlieseCrossIndexFile);
+    configParams->getString("CatalogCache", config->catalogCacheDirectory);
+    config->catalogCacheDirectory = WordExp(config->catalogCacheDirectory);
     configParams->getString("Font", config->mainFont);
     configParams->getString("LabelFont", config->labelFont);
     configParams->getString("TitleFont", config->titleFont);
@@ -125,12 +127,22 @@ CelestiaConfig* ReadCelestiaConfig(string filename, CelestiaConfig *config)
     configParams->getString("ScriptSystemAccessPolicy", config->scriptSystemAccessPolicy);
 
     config->ringSystemSections = getUint(configParams, "RingSystemSections", 100);
-    config->orbitPathSamplePoints = getUint(configParams, "OrbitPathSamplePoints", 100);
+    double orbitPathTolerance = 0.5;
+    configParams->getNumber("OrbitPathTolerance", orbitPathTolerance);
+    config->orbitPathTolerance = (float) orbitPathTolerance;
     config->shadowTextureSize = getUint(configParams, "ShadowTextureSize", 256);
     config->eclipseTextureSize = getUint(configParams, "EclipseTextureSize", 128);
 
     config->consoleLogRows = getUint(configParams, "LogSize", 200);
 
+    config->asyncResourceLoading = true;
+    configParams->getBoolean("AsyncResourceLoading", config->asyncResourceLoading);
+    double resourceLoadTimeBudget = 5.0;
+    configParams->getNumber("ResourceLoadTimeBudget", resourceLoadTimeBudget);
+    config->resourceLoadTimeBudget = (float) (resourceLoadTimeBudget / 1000.0);
+    config->textureMemoryBudget = getUint(configParams, "TextureMemoryBudget", 0);
+    config->modelMemoryBudget = getUint(configParams, "ModelMemoryBudget", 0);
+
     Value* solarSystemsVal = configParams->getValue("SolarSystemCatalogs");
     if (solarSystemsVal != NULL)
     {
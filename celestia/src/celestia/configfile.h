@@ -52,6 +52,10 @@ public:
     std::string HDCrossIndexFile;
     std::string SAOCrossIndexFile;
     std::string GlieseCrossIndexFile;
+
+    // Directory for the catalog cache, which speeds up later startups;
+    // empty if the cache is disabled.
+    std::string catalogCacheDirectory;
     
     StarDetails::StarTextureSet starTextures;
 
@@ -59,10 +63,20 @@ public:
     unsigned int shadowTextureSize;
     unsigned int eclipseTextureSize;
     unsigned int ringSystemSections;
-    unsigned int orbitPathSamplePoints;
+    float orbitPathTolerance;
 
     unsigned int aaSamples;
 
+    // Load textures and models on worker threads, spending at most
+    // resourceLoadTimeBudget seconds per frame finishing them.
+    bool asyncResourceLoading;
+    float resourceLoadTimeBudget;
+
+    // Maximum memory in MB for loaded textures and models; the least
+    // recently used are unloaded when exceeded. Zero means no limit.
+    unsigned int textureMemoryBudget;
+    unsigned int modelMemoryBudget;
+
     bool hdr;
 
     unsigned int consoleLogRows;
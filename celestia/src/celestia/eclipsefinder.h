@@ -65,9 +65,6 @@ class EclipseFinder
     bool toProcess;
     
     int CalculateEclipses();
-    bool testEclipse(const Body& receiver, const Body& caster, double now) const;
-    double findEclipseSpan(const Body& receiver, const Body& caster, double now, double dt) const;
-
 };
 #endif // _ECLIPSEFINDER_H_
 
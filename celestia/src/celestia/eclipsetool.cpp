@@ -0,0 +1,320 @@
+// eclipsetool.cpp
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// Command line tool that loads the same catalogs as Celestia and prints a
+// table of the eclipses between a body and its satellites, without opening
+// a window.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <celengine/astro.h>
+#include <celengine/body.h>
+#include <celengine/universe.h>
+#include <celengine/eclipsesearch.h>
+#include <celephem/spiceinterface.h>
+#include <celutil/directory.h>
+#include <celutil/workerpool.h>
+#include "configfile.h"
+#include "universeloader.h"
+
+using namespace std;
+
+
+static string configFileName;
+static string dataDir;
+static vector<string> extrasDirs;
+static string bodyName;
+static string startDate;
+static string endDate;
+static int eclipseTypeMask = EclipseSearch::SolarEclipse | EclipseSearch::LunarEclipse;
+static unsigned int threadCount = DefaultWorkerThreadCount();
+static double precision = 1.0;
+static bool csvOutput = false;
+
+static const long MaxThreadCount = 256;
+
+
+void Usage()
+{
+    cerr << "Usage: celestia-eclipses [options] <body> <start date> <end date>\n";
+    cerr << "  Dates are UTC, as \"YYYY-MM-DD\" or \"YYYY-MM-DD HH:MM:SS\", or TDB\n";
+    cerr << "  Julian dates. The body is a path such as Sol/Jupiter.\n";
+    cerr << "  Options:\n";
+    cerr << "    --conf <file>        : configuration file (default celestia.cfg)\n";
+    cerr << "    --dir <directory>    : Celestia data directory\n";
+    cerr << "    --extrasdir <dir>    : additional extras directory\n";
+    cerr << "    --type <type>        : solar, lunar or all (default all)\n";
+    cerr << "    --threads <n>        : worker threads, in addition to the main one\n";
+    cerr << "    --precision <secs>   : precision of contact times (default 1)\n";
+    cerr << "    --csv                : print comma separated values\n";
+}
+
+
+static bool parseThreadCount(const string& s, unsigned int& count)
+{
+    char* end = NULL;
+    long n = strtol(s.c_str(), &end, 10);
+    if (end == s.c_str() || *end != '\0' || n < 0 || n > MaxThreadCount)
+        return false;
+
+    count = (unsigned int) n;
+    return true;
+}
+
+
+bool parseCommandLine(int argc, char* argv[])
+{
+    int i = 1;
+    int argCount = 0;
+
+    while (i < argc)
+    {
+        if (argv[i][0] == '-' && argv[i][1] == '-')
+        {
+            if (!strcmp(argv[i], "--csv"))
+            {
+                csvOutput = true;
+                i++;
+                continue;
+            }
+
+            if (i + 1 >= argc)
+            {
+                cerr << "Missing value for " << argv[i] << '\n';
+                return false;
+            }
+
+            string value(argv[i + 1]);
+            if (!strcmp(argv[i], "--conf"))
+            {
+                configFileName = value;
+            }
+            else if (!strcmp(argv[i], "--dir"))
+            {
+                dataDir = value;
+            }
+            else if (!strcmp(argv[i], "--extrasdir"))
+            {
+                extrasDirs.push_back(value);
+            }
+            else if (!strcmp(argv[i], "--type"))
+            {
+                if (value == "solar")
+                    eclipseTypeMask = EclipseSearch::SolarEclipse;
+                else if (value == "lunar")
+                    eclipseTypeMask = EclipseSearch::LunarEclipse;
+                else if (value == "all")
+                    eclipseTypeMask = EclipseSearch::SolarEclipse | EclipseSearch::LunarEclipse;
+                else
+                {
+                    cerr << "Unknown eclipse type: " << value << '\n';
+                    return false;
+                }
+            }
+            else if (!strcmp(argv[i], "--threads"))
+            {
+                if (!parseThreadCount(value, threadCount))
+                {
+                    cerr << "Thread count must be a number from 0 to " << MaxThreadCount << '\n';
+                    return false;
+                }
+            }
+            else if (!strcmp(argv[i], "--precision"))
+            {
+                precision = atof(value.c_str());
+                if (precision <= 0.0)
+                {
+                    cerr << "Precision must be greater than zero\n";
+                    return false;
+                }
+            }
+            else
+            {
+                cerr << "Unknown command line switch: " << argv[i] << '\n';
+                return false;
+            }
+            i += 2;
+        }
+        else
+        {
+            if (argCount == 0)
+                bodyName = string(argv[i]);
+            else if (argCount == 1)
+                startDate = string(argv[i]);
+            else if (argCount == 2)
+                endDate = string(argv[i]);
+            else
+                return false;
+            argCount++;
+            i++;
+        }
+    }
+
+    return argCount == 3;
+}
+
+
+// Convert a UTC calendar date or a TDB Julian date to TDB
+static bool parseTime(const string& s, double& tdb)
+{
+    // Accept ISO style separators as well as the spaces that parseDate
+    // expects; the first character may be the sign of the year.
+    string dateString = s;
+    for (unsigned int i = 1; i < dateString.size(); i++)
+    {
+        if (dateString[i] == '-' || dateString[i] == 'T')
+            dateString[i] = ' ';
+    }
+
+    astro::Date date;
+    if (astro::parseDate(dateString, date))
+    {
+        tdb = astro::UTCtoTDB(date);
+        return true;
+    }
+
+    char* end = NULL;
+    tdb = strtod(s.c_str(), &end);
+    return end != s.c_str() && *end == '\0';
+}
+
+
+static string formatTime(double tdb)
+{
+    astro::Date date = astro::TDBtoUTC(tdb);
+
+    char buf[64];
+    sprintf(buf, "%04d-%02d-%02d %02d:%02d:%02d",
+            date.year, date.month, date.day,
+            date.hour, date.minute, (int) date.seconds);
+
+    return string(buf);
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (!parseCommandLine(argc, argv))
+    {
+        Usage();
+        return 1;
+    }
+
+    double startTime = 0.0;
+    double endTime = 0.0;
+    if (!parseTime(startDate, startTime) || !parseTime(endDate, endTime))
+    {
+        cerr << "Bad date; expected YYYY-MM-DD [HH:MM:SS] or a Julian date\n";
+        return 1;
+    }
+
+    if (endTime < startTime)
+    {
+        cerr << "End date is earlier than start date\n";
+        return 1;
+    }
+
+    if (!dataDir.empty() && chdir(dataDir.c_str()) == -1)
+    {
+        cerr << "Cannot chdir to '" << dataDir << "'\n";
+        return 1;
+    }
+
+    CelestiaConfig* config = NULL;
+    if (!configFileName.empty())
+    {
+        config = ReadCelestiaConfig(configFileName);
+    }
+    else
+    {
+        config = ReadCelestiaConfig("celestia.cfg");
+
+        string localConfigFile = WordExp("~/.celestia.cfg");
+        if (localConfigFile != "")
+            ReadCelestiaConfig(localConfigFile.c_str(), config);
+    }
+
+    if (config == NULL)
+    {
+        cerr << "Error reading configuration file.\n";
+        return 1;
+    }
+
+    for (vector<string>::const_iterator iter = extrasDirs.begin();
+         iter != extrasDirs.end(); iter++)
+    {
+        config->extrasDirs.push_back(*iter);
+    }
+
+#ifdef USE_SPICE
+    if (!InitializeSpice())
+    {
+        cerr << "Initialization of SPICE library failed.\n";
+        return 1;
+    }
+#endif
+
+    // Don't list every catalog loaded ahead of the table
+    clog.rdbuf(NULL);
+
+    Universe* universe = LoadUniverse(*config, NULL);
+    if (universe == NULL)
+        return 1;
+
+    Body* body = universe->findPath(bodyName).body();
+    if (body == NULL)
+        body = universe->findPath(string("Sol/") + bodyName).body();
+    if (body == NULL)
+    {
+        cerr << bodyName << " is not a solar system body\n";
+        return 1;
+    }
+
+    EclipseSearch search(body);
+    search.setThreadCount(threadCount);
+    search.setPrecision(precision / 86400.0);
+
+    vector<EclipseEvent> eclipses;
+    search.findEclipses(startTime, endTime, eclipseTypeMask, eclipses);
+
+    if (csvOutput)
+        printf("occulter,receiver,start,end,start_tdb,end_tdb,duration_min\n");
+
+    for (vector<EclipseEvent>::const_iterator iter = eclipses.begin();
+         iter != eclipses.end(); iter++)
+    {
+        double duration = (iter->endTime - iter->startTime) * 24.0 * 60.0;
+        if (csvOutput)
+        {
+            printf("%s,%s,%s,%s,%.6f,%.6f,%.1f\n",
+                   iter->occulter->getName().c_str(),
+                   iter->receiver->getName().c_str(),
+                   formatTime(iter->startTime).c_str(),
+                   formatTime(iter->endTime).c_str(),
+                   iter->startTime, iter->endTime,
+                   duration);
+        }
+        else
+        {
+            printf("%-16s %-16s %s  %s  %7.1f min\n",
+                   iter->occulter->getName().c_str(),
+                   iter->receiver->getName().c_str(),
+                   formatTime(iter->startTime).c_str(),
+                   formatTime(iter->endTime).c_str(),
+                   duration);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,688 @@
+// ephemtool.cpp
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// Command line tool that loads the same catalogs as Celestia and writes
+// tables of the positions, velocities, orientations and apparent
+// magnitudes of objects over ranges of time, without opening a window.
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <limits>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <celengine/astro.h>
+#include <celengine/universe.h>
+#include <celengine/observer.h>
+#include <celengine/objectstate.h>
+#include <celephem/spiceinterface.h>
+#include <celutil/directory.h>
+#include <celutil/workerpool.h>
+#include "configfile.h"
+#include "universeloader.h"
+
+using namespace Eigen;
+using namespace std;
+
+
+// Number of samples evaluated by one task; large enough that the cost of
+// queueing a task is negligible.
+static const unsigned int ChunkSize = 512;
+
+// Number of chunks per worker thread evaluated before results are written;
+// this bounds the memory used for results that are waiting to be written.
+static const unsigned int ChunksPerThread = 4;
+
+// Queries with more samples than this are rejected; a billion samples is
+// already about 100 GB of binary output.
+static const double MaxSamplesPerQuery = 1.0e9;
+
+static const long MaxThreadCount = 256;
+
+static string configFileName;
+static string dataDir;
+static vector<string> extrasDirs;
+static vector<string> queryFiles;
+static vector<string> queryLines;
+static string outputFileName;
+static unsigned int threadCount = DefaultWorkerThreadCount();
+static bool binaryOutput = false;
+
+
+void Usage()
+{
+    cerr << "Usage: celestia-ephemeris [options] [<query file> ...]\n";
+    cerr << "  Each line of a query file (or of the standard input, if no file or\n";
+    cerr << "  --query option is given) is a query:\n";
+    cerr << "    <object> <frame> <start> <end> <step>\n";
+    cerr << "  The object is a path such as Sol/Jupiter; quote names containing\n";
+    cerr << "  spaces. The frame is universal, or ecliptic, equatorial or bodyfixed\n";
+    cerr << "  followed by :<center>, or phaselock or chase followed by\n";
+    cerr << "  :<center>:<target>. Times are UTC, as YYYY-MM-DD or\n";
+    cerr << "  YYYY-MM-DDTHH:MM:SS, or TDB Julian dates. The step is in days, or\n";
+    cerr << "  in seconds, minutes or hours with the suffix s, m or h. Blank lines\n";
+    cerr << "  and lines starting with # are ignored.\n";
+    cerr << "  Each sample gives the TDB Julian date, the position (km) and velocity\n";
+    cerr << "  (km/s) in the frame, the orientation relative to the frame as a\n";
+    cerr << "  quaternion w, x, y, z, and the apparent magnitude seen from the frame\n";
+    cerr << "  center (empty in CSV and NaN in binary output if unknown.) Binary\n";
+    cerr << "  records are 13 doubles in native byte order: the query number,\n";
+    cerr << "  followed by the same values as the CSV columns.\n";
+    cerr << "  Options:\n";
+    cerr << "    --conf <file>        : configuration file (default celestia.cfg)\n";
+    cerr << "    --dir <directory>    : Celestia data directory\n";
+    cerr << "    --extrasdir <dir>    : additional extras directory\n";
+    cerr << "    --query <query>      : evaluate a query given on the command line\n";
+    cerr << "    --output <file>      : write to a file instead of standard output\n";
+    cerr << "    --binary             : write binary records instead of CSV\n";
+    cerr << "    --threads <n>        : worker threads, in addition to the main one\n";
+}
+
+
+static bool parseThreadCount(const string& s, unsigned int& count)
+{
+    char* end = NULL;
+    long n = strtol(s.c_str(), &end, 10);
+    if (end == s.c_str() || *end != '\0' || n < 0 || n > MaxThreadCount)
+        return false;
+
+    count = (unsigned int) n;
+    return true;
+}
+
+
+bool parseCommandLine(int argc, char* argv[])
+{
+    int i = 1;
+
+    while (i < argc)
+    {
+        if (argv[i][0] == '-' && argv[i][1] == '-')
+        {
+            if (!strcmp(argv[i], "--binary"))
+            {
+                binaryOutput = true;
+                i++;
+                continue;
+            }
+
+            if (i + 1 >= argc)
+            {
+                cerr << "Missing value for " << argv[i] << '\n';
+                return false;
+            }
+
+            string value(argv[i + 1]);
+            if (!strcmp(argv[i], "--conf"))
+            {
+                configFileName = value;
+            }
+            else if (!strcmp(argv[i], "--dir"))
+            {
+                dataDir = value;
+            }
+            else if (!strcmp(argv[i], "--extrasdir"))
+            {
+                extrasDirs.push_back(value);
+            }
+            else if (!strcmp(argv[i], "--query"))
+            {
+                queryLines.push_back(value);
+            }
+            else if (!strcmp(argv[i], "--output"))
+            {
+                outputFileName = value;
+            }
+            else if (!strcmp(argv[i], "--threads"))
+            {
+                if (!parseThreadCount(value, threadCount))
+                {
+                    cerr << "Thread count must be a number from 0 to " << MaxThreadCount << '\n';
+                    return false;
+                }
+            }
+            else
+            {
+                cerr << "Unknown command line switch: " << argv[i] << '\n';
+                return false;
+            }
+            i += 2;
+        }
+        else
+        {
+            queryFiles.push_back(string(argv[i]));
+            i++;
+        }
+    }
+
+    return true;
+}
+
+
+// Convert a UTC calendar date or a TDB Julian date to TDB
+static bool parseTime(const string& s, double& tdb)
+{
+    // Accept ISO style separators as well as the spaces that parseDate
+    // expects; the first character may be the sign of the year.
+    string dateString = s;
+    for (unsigned int i = 1; i < dateString.size(); i++)
+    {
+        if (dateString[i] == '-' || dateString[i] == 'T')
+            dateString[i] = ' ';
+    }
+
+    astro::Date date;
+    if (astro::parseDate(dateString, date))
+    {
+        tdb = astro::UTCtoTDB(date);
+        return true;
+    }
+
+    char* end = NULL;
+    tdb = strtod(s.c_str(), &end);
+    return end != s.c_str() && *end == '\0';
+}
+
+
+// Convert a time step with an optional unit suffix to days
+static bool parseStep(const string& s, double& step)
+{
+    char* end = NULL;
+    step = strtod(s.c_str(), &end);
+    if (end == s.c_str())
+        return false;
+
+    string unit(end);
+    if (unit == "s")
+        step /= 86400.0;
+    else if (unit == "m")
+        step /= 1440.0;
+    else if (unit == "h")
+        step /= 24.0;
+    else if (unit != "" && unit != "d")
+        return false;
+
+    return step > 0.0;
+}
+
+
+// Split a query line into fields separated by white space; double quotes
+// group a field containing spaces.
+static vector<string> splitFields(const string& line)
+{
+    vector<string> fields;
+    unsigned int i = 0;
+    while (i < line.size())
+    {
+        if (isspace((unsigned char) line[i]))
+        {
+            i++;
+            continue;
+        }
+
+        string field;
+        bool quoted = false;
+        while (i < line.size() && (quoted || !isspace((unsigned char) line[i])))
+        {
+            if (line[i] == '"')
+                quoted = !quoted;
+            else
+                field += line[i];
+            i++;
+        }
+        fields.push_back(field);
+    }
+
+    return fields;
+}
+
+
+static Selection findObject(Universe* universe, const string& name)
+{
+    Selection sel = universe->findPath(name);
+    if (sel.empty())
+        sel = universe->findPath(string("Sol/") + name);
+
+    return sel;
+}
+
+
+class EphemerisQuery
+{
+ public:
+    EphemerisQuery() :
+        frame(NULL),
+        startTime(0.0),
+        step(0.0),
+        sampleCount(0),
+        concurrent(false)
+    {
+    }
+
+    string objectName;
+    Selection object;
+    ObserverFrame* frame;
+    double startTime;
+    double step;
+    unsigned int sampleCount;
+    bool concurrent;
+};
+
+
+static bool parseFrame(Universe* universe, const string& s, ObserverFrame*& frame)
+{
+    vector<string> parts;
+    string::size_type start = 0;
+    for (;;)
+    {
+        string::size_type colon = s.find(':', start);
+        parts.push_back(s.substr(start, colon == string::npos ? string::npos : colon - start));
+        if (colon == string::npos)
+            break;
+        start = colon + 1;
+    }
+
+    ObserverFrame::CoordinateSystem coordSys;
+    unsigned int objectCount = 1;
+    if (parts[0] == "universal")
+    {
+        coordSys = ObserverFrame::Universal;
+        objectCount = 0;
+    }
+    else if (parts[0] == "ecliptic")
+        coordSys = ObserverFrame::Ecliptical;
+    else if (parts[0] == "equatorial")
+        coordSys = ObserverFrame::Equatorial;
+    else if (parts[0] == "bodyfixed")
+        coordSys = ObserverFrame::BodyFixed;
+    else if (parts[0] == "phaselock")
+    {
+        coordSys = ObserverFrame::PhaseLock;
+        objectCount = 2;
+    }
+    else if (parts[0] == "chase")
+    {
+        coordSys = ObserverFrame::Chase;
+        objectCount = 2;
+    }
+    else
+    {
+        cerr << "Unknown frame: " << parts[0] << '\n';
+        return false;
+    }
+
+    if (parts.size() != objectCount + 1)
+    {
+        cerr << "Wrong number of objects for frame " << s << '\n';
+        return false;
+    }
+
+    Selection objects[2];
+    for (unsigned int i = 0; i < objectCount; i++)
+    {
+        objects[i] = findObject(universe, parts[i + 1]);
+        if (objects[i].empty())
+        {
+            cerr << "Object " << parts[i + 1] << " not found\n";
+            return false;
+        }
+    }
+
+    if (coordSys == ObserverFrame::Universal)
+        frame = new ObserverFrame();
+    else
+        frame = new ObserverFrame(coordSys, objects[0], objects[1]);
+
+    return true;
+}
+
+
+static bool parseQuery(Universe* universe, const string& line, EphemerisQuery& query)
+{
+    vector<string> fields = splitFields(line);
+    if (fields.size() != 5)
+    {
+        cerr << "Expected <object> <frame> <start> <end> <step>\n";
+        return false;
+    }
+
+    query.objectName = fields[0];
+    query.object = findObject(universe, fields[0]);
+    if (query.object.empty())
+    {
+        cerr << "Object " << fields[0] << " not found\n";
+        return false;
+    }
+
+    double endTime = 0.0;
+    if (!parseTime(fields[2], query.startTime) || !parseTime(fields[3], endTime))
+    {
+        cerr << "Bad date; expected YYYY-MM-DD[THH:MM:SS] or a Julian date\n";
+        return false;
+    }
+
+    if (endTime < query.startTime)
+    {
+        cerr << "End date is earlier than start date\n";
+        return false;
+    }
+
+    if (!parseStep(fields[4], query.step))
+    {
+        cerr << "Bad time step: " << fields[4] << '\n';
+        return false;
+    }
+
+    if (!parseFrame(universe, fields[1], query.frame))
+        return false;
+
+    // Allow for rounding so that the end time is included when the range
+    // is a whole number of steps. The count is checked before it's
+    // converted, since it may not fit in an unsigned int.
+    double sampleCount = floor((endTime - query.startTime) / query.step + 1.0e-6) + 1.0;
+    if (!(sampleCount <= MaxSamplesPerQuery))
+    {
+        cerr << "Too many samples in query; at most " << MaxSamplesPerQuery << " are allowed\n";
+        return false;
+    }
+    query.sampleCount = (unsigned int) sampleCount;
+    query.concurrent = CanComputeStatesConcurrently(query.object, *query.frame);
+
+    return true;
+}
+
+
+static bool readQueries(Universe* universe, istream& in, const string& sourceName,
+                        vector<EphemerisQuery>& queries)
+{
+    string line;
+    unsigned int lineNumber = 0;
+    while (getline(in, line))
+    {
+        lineNumber++;
+        string::size_type first = line.find_first_not_of(" \t\r");
+        if (first == string::npos || line[first] == '#')
+            continue;
+
+        EphemerisQuery query;
+        if (!parseQuery(universe, line, query))
+        {
+            cerr << sourceName << ", line " << lineNumber << ": bad query\n";
+            return false;
+        }
+        queries.push_back(query);
+    }
+
+    return true;
+}
+
+
+// Evaluates a range of the samples of one query
+class EphemerisChunkTask : public WorkerTask
+{
+ public:
+    EphemerisChunkTask(const EphemerisQuery& _query,
+                       unsigned int _queryIndex,
+                       unsigned int _firstSample,
+                       unsigned int _sampleCount) :
+        query(_query),
+        queryIndex(_queryIndex),
+        firstSample(_firstSample),
+        sampleCount(_sampleCount)
+    {
+    }
+
+    void run()
+    {
+        // Times are computed from the start of the range rather than
+        // accumulated, so that they don't depend on how the range is
+        // divided into chunks.
+        times.resize(sampleCount);
+        for (unsigned int i = 0; i < sampleCount; i++)
+            times[i] = query.startTime + (firstSample + i) * query.step;
+
+        states.resize(sampleCount);
+        ComputeObjectStates(query.object, *query.frame, &times[0], sampleCount, &states[0]);
+    }
+
+    const EphemerisQuery& query;
+    unsigned int queryIndex;
+    unsigned int firstSample;
+    unsigned int sampleCount;
+    vector<double> times;
+    vector<ObjectState, aligned_allocator<ObjectState> > states;
+};
+
+
+// Quote a CSV field if it contains separators or quotes
+static string csvField(const string& s)
+{
+    if (s.find_first_of(",\"\n") == string::npos)
+        return s;
+
+    string quoted("\"");
+    for (unsigned int i = 0; i < s.size(); i++)
+    {
+        if (s[i] == '"')
+            quoted += '"';
+        quoted += s[i];
+    }
+    quoted += '"';
+
+    return quoted;
+}
+
+
+static void writeChunk(FILE* out, const EphemerisChunkTask& task)
+{
+    string name = csvField(task.query.objectName);
+
+    for (unsigned int i = 0; i < task.sampleCount; i++)
+    {
+        const ObjectState& state = task.states[i];
+        Vector3d velocity = state.velocity / 86400.0;
+        bool magKnown = state.appMag != ObjectState::UnknownMagnitude;
+
+        if (binaryOutput)
+        {
+            double record[13];
+            record[0] = task.queryIndex;
+            record[1] = task.times[i];
+            record[2] = state.position.x();
+            record[3] = state.position.y();
+            record[4] = state.position.z();
+            record[5] = velocity.x();
+            record[6] = velocity.y();
+            record[7] = velocity.z();
+            record[8] = state.orientation.w();
+            record[9] = state.orientation.x();
+            record[10] = state.orientation.y();
+            record[11] = state.orientation.z();
+            record[12] = magKnown ? state.appMag : numeric_limits<double>::quiet_NaN();
+            fwrite(record, sizeof(record), 1, out);
+        }
+        else
+        {
+            fprintf(out, "%u,%s,%.9f,%.6f,%.6f,%.6f,%.9f,%.9f,%.9f,%.12f,%.12f,%.12f,%.12f,",
+                    task.queryIndex, name.c_str(), task.times[i],
+                    state.position.x(), state.position.y(), state.position.z(),
+                    velocity.x(), velocity.y(), velocity.z(),
+                    state.orientation.w(), state.orientation.x(),
+                    state.orientation.y(), state.orientation.z());
+            if (magKnown)
+                fprintf(out, "%.3f", state.appMag);
+            fputc('\n', out);
+        }
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (!parseCommandLine(argc, argv))
+    {
+        Usage();
+        return 1;
+    }
+
+    if (!dataDir.empty() && chdir(dataDir.c_str()) == -1)
+    {
+        cerr << "Cannot chdir to '" << dataDir << "'\n";
+        return 1;
+    }
+
+    CelestiaConfig* config = NULL;
+    if (!configFileName.empty())
+    {
+        config = ReadCelestiaConfig(configFileName);
+    }
+    else
+    {
+        config = ReadCelestiaConfig("celestia.cfg");
+
+        string localConfigFile = WordExp("~/.celestia.cfg");
+        if (localConfigFile != "")
+            ReadCelestiaConfig(localConfigFile.c_str(), config);
+    }
+
+    if (config == NULL)
+    {
+        cerr << "Error reading configuration file.\n";
+        return 1;
+    }
+
+    for (vector<string>::const_iterator iter = extrasDirs.begin();
+         iter != extrasDirs.end(); iter++)
+    {
+        config->extrasDirs.push_back(*iter);
+    }
+
+#ifdef USE_SPICE
+    if (!InitializeSpice())
+    {
+        cerr << "Initialization of SPICE library failed.\n";
+        return 1;
+    }
+#endif
+
+    // Don't list every catalog loaded ahead of the table
+    clog.rdbuf(NULL);
+
+    Universe* universe = LoadUniverse(*config, NULL);
+    if (universe == NULL)
+        return 1;
+
+    // Read all of the queries before evaluating any of them, so that
+    // mistakes are reported before a long run rather than part way through.
+    vector<EphemerisQuery> queries;
+    for (unsigned int i = 0; i < queryLines.size(); i++)
+    {
+        EphemerisQuery query;
+        if (!parseQuery(universe, queryLines[i], query))
+        {
+            cerr << "Bad query: " << queryLines[i] << '\n';
+            return 1;
+        }
+        queries.push_back(query);
+    }
+
+    for (unsigned int i = 0; i < queryFiles.size(); i++)
+    {
+        if (queryFiles[i] == "-")
+        {
+            if (!readQueries(universe, cin, "standard input", queries))
+                return 1;
+            continue;
+        }
+
+        ifstream in(queryFiles[i].c_str());
+        if (!in.good())
+        {
+            cerr << "Error opening " << queryFiles[i] << '\n';
+            return 1;
+        }
+        if (!readQueries(universe, in, queryFiles[i], queries))
+            return 1;
+    }
+
+    if (queryLines.empty() && queryFiles.empty())
+    {
+        if (!readQueries(universe, cin, "standard input", queries))
+            return 1;
+    }
+
+    FILE* out = stdout;
+    if (!outputFileName.empty())
+    {
+        out = fopen(outputFileName.c_str(), binaryOutput ? "wb" : "w");
+        if (out == NULL)
+        {
+            cerr << "Error opening " << outputFileName << '\n';
+            return 1;
+        }
+    }
+
+    if (!binaryOutput)
+        fprintf(out, "query,object,tdb,x,y,z,vx,vy,vz,qw,qx,qy,qz,appmag\n");
+
+    // Queries are divided into chunks of samples, which are evaluated a
+    // round at a time on the worker threads and then written in order.
+    // Chunks of objects that can't be evaluated concurrently are evaluated
+    // on the main thread once the worker threads have finished the round.
+    WorkerPool pool(threadCount);
+    unsigned int chunksPerRound = (pool.getThreadCount() + 1) * ChunksPerThread;
+
+    unsigned int queryIndex = 0;
+    unsigned int nextSample = 0;
+    while (queryIndex < queries.size())
+    {
+        vector<EphemerisChunkTask*> round;
+        vector<WorkerTask*> concurrentTasks;
+        while (round.size() < chunksPerRound && queryIndex < queries.size())
+        {
+            const EphemerisQuery& query = queries[queryIndex];
+            unsigned int count = min(ChunkSize, query.sampleCount - nextSample);
+            EphemerisChunkTask* task = new EphemerisChunkTask(query, queryIndex, nextSample, count);
+            round.push_back(task);
+            if (query.concurrent)
+                concurrentTasks.push_back(task);
+
+            nextSample += count;
+            if (nextSample == query.sampleCount)
+            {
+                queryIndex++;
+                nextSample = 0;
+            }
+        }
+
+        pool.run(concurrentTasks);
+
+        for (vector<EphemerisChunkTask*>::iterator iter = round.begin(); iter != round.end(); iter++)
+        {
+            EphemerisChunkTask* task = *iter;
+            if (!task->query.concurrent)
+                task->run();
+            writeChunk(out, *task);
+            delete task;
+        }
+    }
+
+    for (vector<EphemerisQuery>::iterator iter = queries.begin(); iter != queries.end(); iter++)
+        delete iter->frame;
+
+    if (out != stdout)
+        fclose(out);
+
+    return 0;
+}
@@ -9,6 +9,7 @@
 
 #include <cstdio>
 #include <celutil/debug.h>
+#include <celutil/workerpool.h>
 #include <GL/glew.h>
 #include <celengine/celestia.h>
 #include "imagecapture.h"
@@ -49,13 +50,14 @@ extern "C" {
 using namespace std;
 
 
-bool CaptureGLBufferToJPEG(const string& filename,
-                           int x, int y,
-                           int width, int height)
+// Read a rectangle of the back buffer as RGB rows, bottom row first, each
+// padded to a multiple of four bytes.
+static unsigned char* ReadGLBuffer(int x, int y,
+                                   int width, int height,
+                                   int& rowStride)
 {
-    int rowStride = (width * 3 + 3) & ~0x3;
-    int imageSize = height * rowStride;
-    unsigned char* pixels = new unsigned char[imageSize];
+    rowStride = (width * 3 + 3) & ~0x3;
+    unsigned char* pixels = new unsigned char[height * rowStride];
 
     glReadBuffer(GL_BACK);
     glReadPixels(x, y, width, height,
@@ -64,15 +66,15 @@ bool CaptureGLBufferToJPEG(const string& filename,
 
     // TODO: Check for GL errors
 
-    FILE* out;
-    out = fopen(filename.c_str(), "wb");
-    if (out == NULL)
-    {
-        DPRINTF(0, "Can't open screen capture file '%s'\n", filename.c_str());
-        delete[] pixels;
-        return false;
-    }
+    return pixels;
+}
 
+
+static bool WriteJPEG(FILE* out,
+                      const unsigned char* pixels,
+                      int width, int height,
+                      int rowStride)
+{
     struct jpeg_compress_struct cinfo;
 
     struct jpeg_error_mgr jerr;
@@ -96,16 +98,13 @@ bool CaptureGLBufferToJPEG(const string& filename,
 
     while (cinfo.next_scanline < cinfo.image_height)
     {
-        row[0] = &pixels[rowStride * (cinfo.image_height - cinfo.next_scanline - 1)];
+        row[0] = (JSAMPROW) &pixels[rowStride * (cinfo.image_height - cinfo.next_scanline - 1)];
         (void) jpeg_write_scanlines(&cinfo, row, 1);
     }
 
     jpeg_finish_compress(&cinfo);
-    fclose(out);
     jpeg_destroy_compress(&cinfo);
 
-    delete[] pixels;
-
     return true;
 }
 
@@ -116,31 +115,12 @@ void PNGWriteData(png_structp png_ptr, png_bytep data, png_size_t length)
     fwrite((void*) data, 1, length, fp);
 }
 
-                           
-bool CaptureGLBufferToPNG(const string& filename,
-                           int x, int y,
-                           int width, int height)
-{
-    int rowStride = (width * 3 + 3) & ~0x3;
-    int imageSize = height * rowStride;
-    unsigned char* pixels = new unsigned char[imageSize];
-
-    glReadBuffer(GL_BACK);
-    glReadPixels(x, y, width, height,
-                 GL_RGB, GL_UNSIGNED_BYTE,
-                 pixels);
-
-    // TODO: Check for GL errors
-
-    FILE* out;
-    out = fopen(filename.c_str(), "wb");
-    if (out == NULL)
-    {
-        DPRINTF(0, "Can't open screen capture file '%s'\n", filename.c_str());
-        delete[] pixels;
-        return false;
-    }
 
+static bool WritePNG(FILE* out,
+                     const unsigned char* pixels,
+                     int width, int height,
+                     int rowStride)
+{
     png_bytep* row_pointers = new png_bytep[height];
     for (int i = 0; i < height; i++)
         row_pointers[i] = (png_bytep) &pixels[rowStride * (height - i - 1)];
@@ -154,8 +134,6 @@ bool CaptureGLBufferToPNG(const string& filename,
     if (png_ptr == NULL)
     {
         DPRINTF(0, "Screen capture: error allocating png_ptr\n");
-        fclose(out);
-        delete[] pixels;
         delete[] row_pointers;
         return false;
     }
@@ -164,8 +142,6 @@ bool CaptureGLBufferToPNG(const string& filename,
     if (info_ptr == NULL)
     {
         DPRINTF(0, "Screen capture: error allocating info_ptr\n");
-        fclose(out);
-        delete[] pixels;
         delete[] row_pointers;
         png_destroy_write_struct(&png_ptr, (png_infopp) NULL);
         return false;
@@ -173,9 +149,6 @@ bool CaptureGLBufferToPNG(const string& filename,
 
     if (setjmp(png_jmpbuf(png_ptr)))
     {
-        DPRINTF(0, "Error writing PNG file '%s'\n", filename.c_str());
-        fclose(out);
-        delete[] pixels;
         delete[] row_pointers;
         png_destroy_write_struct(&png_ptr, &info_ptr);
         return false;
@@ -200,10 +173,215 @@ bool CaptureGLBufferToPNG(const string& filename,
     // Clean up everything . . .
     png_destroy_write_struct(&png_ptr, &info_ptr);
     delete[] row_pointers;
+
+    return true;
+}
+
+
+static FILE* OpenCaptureFile(const string& filename)
+{
+    FILE* out = fopen(filename.c_str(), "wb");
+    if (out == NULL)
+    {
+        DPRINTF(0, "Can't open screen capture file '%s'\n", filename.c_str());
+    }
+
+    return out;
+}
+
+
+bool CaptureGLBufferToJPEG(const string& filename,
+                           int x, int y,
+                           int width, int height)
+{
+    int rowStride = 0;
+    unsigned char* pixels = ReadGLBuffer(x, y, width, height, rowStride);
+
+    FILE* out = OpenCaptureFile(filename);
+    if (out == NULL)
+    {
+        delete[] pixels;
+        return false;
+    }
+
+    bool success = WriteJPEG(out, pixels, width, height, rowStride);
+    fclose(out);
     delete[] pixels;
+
+    return success;
+}
+
+
+bool CaptureGLBufferToPNG(const string& filename,
+                           int x, int y,
+                           int width, int height)
+{
+    int rowStride = 0;
+    unsigned char* pixels = ReadGLBuffer(x, y, width, height, rowStride);
+
+    FILE* out = OpenCaptureFile(filename);
+    if (out == NULL)
+    {
+        delete[] pixels;
+        return false;
+    }
+
+    bool success = WritePNG(out, pixels, width, height, rowStride);
     fclose(out);
+    delete[] pixels;
+
+    if (!success)
+    {
+        DPRINTF(0, "Error writing PNG file '%s'\n", filename.c_str());
+    }
+
+    return success;
+}
+
+
+// A screenshot waiting to be compressed; it deletes itself once written.
+class ScreenshotService::Screenshot : public WorkerTask
+{
+ public:
+    Screenshot(ScreenshotService* _service,
+               const string& _filename,
+               ImageFormat _format,
+               FILE* _out,
+               unsigned char* _pixels,
+               int _width, int _height,
+               int _rowStride) :
+        service(_service),
+        filename(_filename),
+        format(_format),
+        out(_out),
+        pixels(_pixels),
+        width(_width),
+        height(_height),
+        rowStride(_rowStride)
+    {
+    }
+
+    ~Screenshot()
+    {
+        delete[] pixels;
+    }
+
+    size_t size() const
+    {
+        return (size_t) height * rowStride;
+    }
+
+    void run()
+    {
+        bool success;
+        if (format == JPEG)
+            success = WriteJPEG(out, pixels, width, height, rowStride);
+        else
+            success = WritePNG(out, pixels, width, height, rowStride);
+        if (fclose(out) != 0)
+            success = false;
+
+        if (!success)
+        {
+            DPRINTF(0, "Error writing screen capture file '%s'\n", filename.c_str());
+        }
+
+        // The service may be destroyed as soon as it has been told that
+        // this screenshot is written.
+        size_t bytes = size();
+        ScreenshotService* s = service;
+        delete this;
+        s->screenshotWritten(bytes, success);
+    }
+
+ private:
+    ScreenshotService* service;
+    string filename;
+    ImageFormat format;
+    FILE* out;
+    unsigned char* pixels;
+    int width;
+    int height;
+    int rowStride;
+};
+
+
+ScreenshotService::ScreenshotService(unsigned int threadCount,
+                                     size_t _maxPendingBytes) :
+    pool(NULL),
+    maxPendingBytes(_maxPendingBytes),
+    pendingBytes(0),
+    pendingCount(0),
+    failureCount(0)
+{
+    pool = new WorkerPool(threadCount);
+}
+
+
+ScreenshotService::~ScreenshotService()
+{
+    finish();
+    delete pool;
+}
+
+
+bool ScreenshotService::capture(const string& filename,
+                                ImageFormat format,
+                                int x, int y,
+                                int width, int height)
+{
+    FILE* out = OpenCaptureFile(filename);
+    if (out == NULL)
+        return false;
+
+    size_t size = (size_t) height * ((width * 3 + 3) & ~0x3);
+    {
+        // A screenshot larger than the limit is still taken, once nothing
+        // else is pending.
+        MutexLock lock(mutex);
+        while (pendingCount > 0 && pendingBytes + size > maxPendingBytes)
+            written.wait(mutex);
+        pendingBytes += size;
+        pendingCount++;
+    }
+
+    int rowStride = 0;
+    unsigned char* pixels = ReadGLBuffer(x, y, width, height, rowStride);
+    pool->submit(new Screenshot(this, filename, format, out,
+                                pixels, width, height, rowStride));
 
     return true;
 }
 
 
+void ScreenshotService::finish()
+{
+    MutexLock lock(mutex);
+    while (pendingCount > 0)
+        written.wait(mutex);
+}
+
+
+unsigned int ScreenshotService::getPendingCount() const
+{
+    MutexLock lock(mutex);
+    return pendingCount;
+}
+
+
+unsigned int ScreenshotService::getFailureCount() const
+{
+    MutexLock lock(mutex);
+    return failureCount;
+}
+
+
+void ScreenshotService::screenshotWritten(size_t size, bool success)
+{
+    MutexLock lock(mutex);
+    pendingBytes -= size;
+    pendingCount--;
+    if (!success)
+        failureCount++;
+    written.broadcast();
+}
@@ -11,6 +11,10 @@
 #define _IMAGECAPTURE_H_
 
 #include <string>
+#include <cstddef>
+#include <celutil/thread.h>
+
+class WorkerPool;
 
 
 extern bool CaptureGLBufferToJPEG(const std::string& filename,
@@ -20,4 +24,55 @@ extern bool CaptureGLBufferToPNG(const std::string& filename,
                                  int x, int y,
                                  int width, int height);
 
+
+/*! A ScreenshotService reads back the frame buffer on the calling thread,
+ *  which must have the GL context current, and then compresses and writes
+ *  the image on a pool of worker threads, so that taking a screenshot
+ *  costs the renderer little more than the copy of the pixels. The pixels
+ *  of unwritten screenshots are limited to a maximum number of bytes;
+ *  capture() waits for earlier screenshots to be written when a new one
+ *  would exceed it.
+ */
+class ScreenshotService
+{
+ public:
+    enum ImageFormat
+    {
+        JPEG,
+        PNG,
+    };
+
+    ScreenshotService(unsigned int threadCount, std::size_t maxPendingBytes);
+    // Waits for all screenshots to be written
+    ~ScreenshotService();
+
+    /*! Capture a rectangle of the back buffer. The file is opened
+     *  immediately, and false is returned if that fails; errors while
+     *  writing the image are counted by getFailureCount().
+     */
+    bool capture(const std::string& filename,
+                 ImageFormat format,
+                 int x, int y,
+                 int width, int height);
+
+    //! Wait until every screenshot captured so far has been written.
+    void finish();
+
+    unsigned int getPendingCount() const;
+    unsigned int getFailureCount() const;
+
+ private:
+    class Screenshot;
+
+    void screenshotWritten(std::size_t size, bool success);
+
+    WorkerPool* pool;
+    std::size_t maxPendingBytes;
+    std::size_t pendingBytes;
+    unsigned int pendingCount;
+    unsigned int failureCount;
+    mutable Mutex mutex;
+    Condition written;
+};
+
 #endif // _IMAGECAPTURE_H_
@@ -62,8 +62,11 @@
 #include <cstdlib>
 #include <cstdio>
 #include <cmath>
+#include <algorithm>
 #include <celutil/debug.h>
 #include <celutil/util.h>
+#include <celutil/workerpool.h>
+#include <celutil/yuvconvert.h>
 #include <GL/glew.h>
 #include <string>
 #include <cstring>
@@ -81,6 +84,65 @@ using namespace std;
 //  {"framerate-denominator",optional_argument,NULL,'F'},
 
 
+// Frame buffers beyond one per conversion thread: one being read back, one
+// held by the encoder until the next frame arrives, and one spare so that
+// a slow frame doesn't immediately stall the renderer.
+static const unsigned int ExtraFrameBuffers = 3;
+
+
+class OggTheoraCapture::Frame : public WorkerTask
+{
+ public:
+    enum State
+    {
+        Free       = 0,
+        Converting = 1,
+        Converted  = 2,
+    };
+
+    Frame(OggTheoraCapture* _capture, int pixelBytes, int yuvBytes) :
+        capture(_capture),
+        pixels(new unsigned char[pixelBytes]),
+        yuv(new unsigned char[yuvBytes]),
+        state(Free),
+        number(-1)
+    {
+    }
+
+    ~Frame()
+    {
+        delete[] pixels;
+        delete[] yuv;
+    }
+
+    void run()
+    {
+        capture->convertFrame(this);
+    }
+
+    OggTheoraCapture* capture;
+    unsigned char* pixels;
+    unsigned char* yuv;
+    State state;
+    int number;
+};
+
+
+class OggTheoraCapture::EncoderThread : public Thread
+{
+ public:
+    EncoderThread(OggTheoraCapture* _capture) : capture(_capture) {};
+
+    void run()
+    {
+        capture->encodeFrames();
+    }
+
+ private:
+    OggTheoraCapture* capture;
+};
+
+
 OggTheoraCapture::OggTheoraCapture():
     video_x(0),
     video_y(0),
@@ -97,12 +159,11 @@ OggTheoraCapture::OggTheoraCapture():
     capturing(false),
     video_frame_count(0),
     video_bytesout(0),
-    rowStride(0),
-    pixels(NULL),
+    convertPool(NULL),
+    encoder(NULL),
+    finishing(false),
     outfile(NULL)
 {
-    yuvframe[0] = NULL;
-    yuvframe[1] = NULL;
     // Just being anal
     memset(&yuv, 0, sizeof(yuv));
     memset(&to, 0, sizeof(to));
@@ -278,29 +339,26 @@ bool OggTheoraCapture::start(const std::string& filename,
         fwrite(videopage.header,1,videopage.header_len,outfile);
         fwrite(videopage.body,1,  videopage.body_len,outfile);
     }
-    /* Initialize the double frame buffer.
-     * We allocate enough for a 4:4:4 color sampling
+    /* Initialize the ring of frame buffers, with 4:2:0 YUV frames.
+     * Clear the YUV frames as they may be larger than the actual video
+     * data: fill the Y plane with 0x10 and the UV planes with 0x80, for
+     * black. Only the part covered by the video data changes afterward.
      */
-    yuvframe[0]= new unsigned char[video_x*video_y*3];
-    yuvframe[1]= new unsigned char[video_x*video_y*3];
-
-    // Now the buffer for reading the GL RGB pixels
-    rowStride = (frame_x * 3 + 3) & ~0x3;
-    pixels = new unsigned char[rowStride*frame_y];
-
-        /* clear initial frame as it may be larger than actual video data */
-        /* fill Y plane with 0x10 and UV planes with 0x80, for black data */
-    // The UV plane must be 4:2:0
-    memset(yuvframe[0],0x10,video_x*video_y);
-    memset(yuvframe[0]+video_x*video_y,0x80,video_x*video_y*2);
-    memset(yuvframe[1],0x10,video_x*video_y);
-    memset(yuvframe[1]+video_x*video_y,0x80,video_x*video_y*2);
+    unsigned int convertThreads = max(1u, DefaultWorkerThreadCount());
+    int pixelBytes = frame_x * frame_y * 4;
+    int yuvBytes = video_x * video_y * 3 / 2;
+    for (unsigned int i = 0; i < convertThreads + ExtraFrameBuffers; i++)
+    {
+        Frame* frame = new Frame(this, pixelBytes, yuvBytes);
+        memset(frame->yuv, 0x10, video_x * video_y);
+        memset(frame->yuv + video_x * video_y, 0x80, video_x * video_y / 2);
+        frames.push_back(frame);
+    }
 
     yuv.y_width=video_x;
     yuv.y_height=video_y;
     yuv.y_stride=video_x;
 
-    // Note we lie here by saying it's 4:2:0 and we will convert 4:4:4 to 4:2;0 later
     yuv.uv_width=video_x/2;
     yuv.uv_height=video_y/2;
     yuv.uv_stride=video_x/2;
@@ -313,6 +371,17 @@ bool OggTheoraCapture::start(const std::string& filename,
            video_x,video_y,
            frame_x_offset,frame_y_offset);
 
+    finishing = false;
+    convertPool = new WorkerPool(convertThreads);
+    encoder = new EncoderThread(this);
+    if (!encoder->start())
+    {
+        cerr << _("Error starting the video encoder thread.") << endl;
+        delete encoder;
+        encoder = NULL;
+        return false;
+    }
+
     capturing = true;
     return true;
 }
@@ -322,15 +391,33 @@ bool OggTheoraCapture::captureFrame()
     if (!capturing)
         return false;
 
-    while (ogg_stream_pageout(&to,&videopage)>0)
+    // Wait until the encoder is done with the buffer of this frame
+    Frame* frame = frames[video_frame_count % frames.size()];
     {
-        /* flush a video page */
-        video_bytesout+=fwrite(videopage.header,1,videopage.header_len,outfile);
-        video_bytesout+=fwrite(videopage.body,1,videopage.body_len,outfile);
+        MutexLock lock(mutex);
+        while (frame->state != Frame::Free)
+            frameFree.wait(mutex);
+    }
+
+    readFrame(frame->pixels);
 
+    {
+        MutexLock lock(mutex);
+        frame->state = Frame::Converting;
+        frame->number = video_frame_count;
+        video_frame_count += 1;
     }
-    if(ogg_stream_eos(&to)) return false;
+    convertPool->submit(frame);
+
+    //if ((video_frame_count % 10) == 0)
+    //    printf("Writing frame %d\n", video_frame_count);
+    frameCaptured();
 
+    return true;
+}
+
+void OggTheoraCapture::readFrame(unsigned char* pixels)
+{
     // Get the dimensions of the current viewport
     int viewport[4];
     glGetIntegerv(GL_VIEWPORT, viewport);
@@ -338,81 +425,101 @@ bool OggTheoraCapture::captureFrame()
     int x = viewport[0] + (viewport[2] - frame_x) / 2;
     int y = viewport[1] + (viewport[3] - frame_y) / 2;
     glReadPixels(x, y, frame_x, frame_y,
-             GL_RGB, GL_UNSIGNED_BYTE,
+             GL_BGRA_EXT, GL_UNSIGNED_BYTE,
              pixels);
+}
 
-    unsigned char *ybase = yuvframe[0];
-    unsigned char *ubase = yuvframe[0]+ video_x*video_y;
-    unsigned char *vbase = yuvframe[0]+ video_x*video_y*2;
-    // We go ahead and build 4:4:4 frames
-    for (int y=0; y<frame_y; y++)
-    {
-        unsigned char *yptr = ybase + (video_x*(y+frame_y_offset))+frame_x_offset;
-        unsigned char *uptr = ubase + (video_x*(y+frame_y_offset))+frame_x_offset;
-        unsigned char *vptr = vbase + (video_x*(y+frame_y_offset))+frame_x_offset;
-        unsigned char *rgb = pixels + ((frame_y-1-y)*rowStride); // The video is inverted
-        for (int x=0; x<frame_x; x++)
-        {
-            unsigned char r = *rgb++;
-            unsigned char g = *rgb++;
-            unsigned char b = *rgb++;
-            *yptr++ = min(abs(r * 2104 + g * 4130 + b * 802 + 4096 + 131072) >> 13,235);
-            *uptr++ = min(abs(r * -1214 + g * -2384 + b * 3598 + 4096 + 1048576) >> 13,240);
-            *vptr++ = min(abs(r * 3598 + g * -3013 + b * -585 + 4096 + 1048576) >> 13,240);
-        }
-    }
+// Convert a frame to 4:2:0 YUV; called on one of the conversion threads
+void OggTheoraCapture::convertFrame(Frame* frame)
+{
+    int uvStride = video_x / 2;
+    unsigned char* y = frame->yuv + video_x * frame_y_offset + frame_x_offset;
+    unsigned char* u = frame->yuv + video_x * video_y + uvStride * (frame_y_offset / 2) + frame_x_offset / 2;
+    unsigned char* v = u + uvStride * (video_y / 2);
+
+    // The video is inverted
+    int rowStride = frame_x * 4;
+    ConvertBGRAToYUV420(frame->pixels + rowStride * (frame_y - 1), -rowStride,
+                        frame_x, frame_y,
+                        y, video_x, u, v, uvStride);
+
+    MutexLock lock(mutex);
+    frame->state = Frame::Converted;
+    frameConverted.signal();
+}
 
-    /*
-     * The video strategy is to capture one frame ahead so when we're at end of
-     * stream we can mark last video frame as such.  Have two YUV frames before
-     * encoding. Theora is a one-frame-in,one-frame-out system; submit a frame
-     * for compression and pull out the packet
-     */
+/*
+ * Encode the converted frames in order and write them to the file; run by
+ * the encoder thread until capture ends. The strategy is to keep one frame
+ * ahead so that when we're at end of stream we can mark the last video
+ * frame as such. Theora is a one-frame-in,one-frame-out system; submit a
+ * frame for compression and pull out the packet.
+ */
+void OggTheoraCapture::encodeFrames()
+{
+    Frame* previous = NULL;
+    int next = 0;
 
-    if (video_frame_count > 0)
+    for (;;)
     {
-        yuv.y= yuvframe[1];
-        yuv.u= yuvframe[1]+ video_x*video_y;
-        yuv.v= yuvframe[1]+ video_x*video_y*2;
-        // Convert to 4:2:0
-        unsigned char * uin0 = yuv.u;
-        unsigned char * uin1 = yuv.u + video_x;
-        unsigned char * uout = yuv.u;
-        unsigned char * vin0 = yuv.v;
-        unsigned char * vin1 = yuv.v + video_x;
-        unsigned char * vout = yuv.v; 
-        for (int y = 0; y < video_y; y += 2)
+        // Wait for the next frame to be converted, or for capture to end
+        // with no more frames.
+        Frame* frame = frames[next % frames.size()];
         {
-            for (int x = 0; x < video_x; x += 2)
+            MutexLock lock(mutex);
+            while ((frame->number != next || frame->state != Frame::Converted) &&
+                   !(finishing && next == video_frame_count))
             {
-                *uout = (uin0[0] + uin0[1] + uin1[0] + uin1[1]) >> 2;
-                uin0 += 2;
-                uin1 += 2;
-                uout++;
-                *vout = (vin0[0] + vin0[1] + vin1[0] + vin1[1]) >> 2;
-                vin0 += 2;
-                vin1 += 2;
-                vout++;
+                frameConverted.wait(mutex);
             }
-            uin0 += video_x;
-            uin1 += video_x;
-            vin0 += video_x;
-            vin1 += video_x;
+
+            if (frame->number != next || frame->state != Frame::Converted)
+                frame = NULL;
         }
-        theora_encode_YUVin(&td,&yuv);
-        theora_encode_packetout(&td,0,&op);
-        ogg_stream_packetin(&to,&op);
+
+        if (previous != NULL)
+        {
+            yuv.y= previous->yuv;
+            yuv.u= previous->yuv + video_x*video_y;
+            yuv.v= previous->yuv + video_x*video_y*5/4;
+            theora_encode_YUVin(&td,&yuv);
+            theora_encode_packetout(&td,frame == NULL ? 1 : 0,&op);
+            ogg_stream_packetin(&to,&op);
+            writePages(frame == NULL);
+
+            MutexLock lock(mutex);
+            previous->state = Frame::Free;
+            frameFree.signal();
+        }
+
+        if (frame == NULL)
+            break;
+
+        previous = frame;
+        next++;
     }
-    video_frame_count += 1;
-    //if ((video_frame_count % 10) == 0)
-    //    printf("Writing frame %d\n", video_frame_count);
-    unsigned char *temp = yuvframe[0];
-    yuvframe[0] = yuvframe[1];
-    yuvframe[1] = temp;
-    frameCaptured();
+}
 
-    return true;
+void OggTheoraCapture::writePages(bool flush)
+{
+    int bytesOut = 0;
+    while (ogg_stream_pageout(&to,&videopage)>0)
+    {
+        /* flush a video page */
+        bytesOut+=fwrite(videopage.header,1,videopage.header_len,outfile);
+        bytesOut+=fwrite(videopage.body,1,videopage.body_len,outfile);
+    }
+    if (flush && ogg_stream_flush(&to,&videopage)>0)
+    {
+        /* flush a video page */
+        bytesOut+=fwrite(videopage.header,1,videopage.header_len,outfile);
+        bytesOut+=fwrite(videopage.body,1,videopage.body_len,outfile);
+    }
+
+    MutexLock lock(mutex);
+    video_bytesout += bytesOut;
 }
+
 void OggTheoraCapture::cleanup()
 {
     capturing = false;
@@ -420,64 +527,31 @@ void OggTheoraCapture::cleanup()
 
     if(outfile)
     {
-        printf(_("OggTheoraCapture::cleanup() - wrote %d frames\n"), video_frame_count);
-        if (video_frame_count > 0)
+        // Let the encoder finish the frames still in the pipeline
+        if (encoder != NULL)
         {
-            yuv.y= yuvframe[1];
-            yuv.u= yuvframe[1]+ video_x*video_y;
-            yuv.v= yuvframe[1]+ video_x*video_y*2 ;
-            // Convert to 4:2:0
-            unsigned char * uin0 = yuv.u;
-            unsigned char * uin1 = yuv.u + video_x;
-            unsigned char * uout = yuv.u;
-            unsigned char * vin0 = yuv.v;
-            unsigned char * vin1 = yuv.v + video_x;
-            unsigned char * vout = yuv.v;
-            for (int y = 0; y < video_y; y += 2)
             {
-                for (int x = 0; x < video_x; x += 2)
-                {
-                    *uout = (uin0[0] + uin0[1] + uin1[0] + uin1[1]) >> 2;
-                    uin0 += 2;
-                    uin1 += 2;
-                    uout++;
-                    *vout = (vin0[0] + vin0[1] + vin1[0] + vin1[1]) >> 2;
-                    vin0 += 2;
-                    vin1 += 2;
-                    vout++;
-                }
-                uin0 += video_x;
-                uin1 += video_x;
-                vin0 += video_x;
-                vin1 += video_x;
+                MutexLock lock(mutex);
+                finishing = true;
+                frameConverted.signal();
             }
-            theora_encode_YUVin(&td,&yuv);
-            theora_encode_packetout(&td,1,&op);
-            ogg_stream_packetin(&to,&op);
+            encoder->join();
+            delete encoder;
+            encoder = NULL;
         }
-        while(ogg_stream_pageout(&to,&videopage)>0)
-        {
-            /* flush a video page */
-            video_bytesout+=fwrite(videopage.header,1,videopage.header_len,outfile);
-            video_bytesout+=fwrite(videopage.body,1,videopage.body_len,outfile);
+        delete convertPool;
+        convertPool = NULL;
 
-        }
-        if(ogg_stream_flush(&to,&videopage)>0)
-        {
-            /* flush a video page */
-            video_bytesout+=fwrite(videopage.header,1,videopage.header_len,outfile);
-            video_bytesout+=fwrite(videopage.body,1,videopage.body_len,outfile);
-
-        }
+        printf(_("OggTheoraCapture::cleanup() - wrote %d frames\n"), video_frame_count);
         theora_clear(&td);
         ogg_stream_clear(&to);
         //ogg_stream_destroy(&to); /* Documentation says to do this however we are seeing a double free libogg 1.1.2 */
 
         std::fclose(outfile);
         outfile = NULL;
-        delete [] yuvframe[0];
-        delete [] yuvframe[1];
-        delete [] pixels;
+        for (vector<Frame*>::iterator iter = frames.begin(); iter != frames.end(); ++iter)
+            delete *iter;
+        frames.clear();
     }
 }
 
@@ -498,6 +572,11 @@ int OggTheoraCapture::getFrameCount() const
 {
     return video_frame_count;
 }
+int OggTheoraCapture::getBytesOut() const
+{
+    MutexLock lock(mutex);
+    return video_bytesout;
+}
 float OggTheoraCapture::getFrameRate() const
 {
     return float(video_hzn)/float(video_hzd);
@@ -2,9 +2,19 @@
 #ifndef _OGGTHEORACAPTURE_H_
 #define _OGGTHEORACAPTURE_H_
 
+#include <vector>
+#include <celutil/thread.h>
 #include "theora/theora.h"
 #include "moviecapture.h"
 
+class WorkerPool;
+
+/*! Captured frames pass through a pipeline: the frame is read back on the
+ *  rendering thread, converted to YUV on a worker thread, and encoded and
+ *  written to the file on an encoder thread, in order. The frames in the
+ *  pipeline are kept in a fixed ring of buffers, and captureFrame() only
+ *  waits when all of them are in use.
+ */
 class OggTheoraCapture : public MovieCapture
 {
 public:
@@ -19,13 +29,24 @@ public:
     int getHeight() const;
     float getFrameRate() const;
     int getFrameCount() const;
-    int getBytesOut() const { return video_bytesout; } ;
+    int getBytesOut() const;
     void setAspectRatio(int, int);
     void setQuality(float);
     void recordingStatus(bool) {};  // Added to allow GTK compilation
 
+protected:
+    // Read the current frame, frame_x by frame_y BGRA pixels stored bottom
+    // row first. The default reads from the OpenGL frame buffer.
+    virtual void readFrame(unsigned char* pixels);
+
 private:
+    class Frame;
+    class EncoderThread;
+
     void cleanup();
+    void convertFrame(Frame* frame);
+    void encodeFrames();
+    void writePages(bool flush);
 
 private:
     int video_x;
@@ -45,13 +66,16 @@ private:
     int        video_frame_count;
     int        video_bytesout;
 
-    // Consider RGB to YUV Color converstion table - jpeglib has one
-    // but according the standards it's incorrect (generates values 0-255,
-    // instead of clamped to 16-240).
+    // The ring of frame buffers; frame n of the video uses buffer n modulo
+    // the number of buffers.
+    std::vector<Frame*> frames;
+    WorkerPool*    convertPool;
+    EncoderThread* encoder;
+    bool           finishing;
+    mutable Mutex  mutex;
+    Condition      frameFree;
+    Condition      frameConverted;
 
-    int        rowStride;
-    unsigned char  *pixels;
-    unsigned char  *yuvframe[2];
     yuv_buffer    yuv;
     FILE           *outfile;
     ogg_stream_state to; /* take physical pages, weld into a logical
@@ -12,7 +12,6 @@
 
 #include "celestia/celestiacore.h"
 #include "qteventfinder.h"
-#include "celmath/distance.h"
 #include "celmath/intersect.h"
 #include "celmath/geomutil.h"
 #include <QRadioButton>
@@ -30,69 +29,11 @@
 #include <QMenu>
 #include <vector>
 #include <algorithm>
-#include <cassert>
 
 using namespace Eigen;
 using namespace std;
 
 
-// Based on eclipsefinder.h; should be moved back.
-
-class EclipseRecord
-{
-public:
-    EclipseRecord() :
-        occulter(NULL),
-        receiver(NULL)
-    {
-    }
-
-    Body* occulter;
-    Body* receiver;
-    double startTime;
-    double endTime;
-};
-
-
-class QtEclipseFinder
-{
- public:
-    QtEclipseFinder(Body* _body,
-                    EclipseFinderWatcher* _watcher) :
-        body(_body),
-        watcher(_watcher)
-    {
-    }
-
-    enum
-    {
-        SolarEclipse = 0x1,
-        LunarEclipse = 0x2,
-    };
-
-    void findEclipses(double startDate,
-                      double endDate,
-                      int eclipseTypeMask,
-                      vector<EclipseRecord>& eclipses);
-
- private:
-    bool testEclipse(const Body& receiver, const Body& occulter, double now) const;
-    double findEclipseStart(const Body& recever, const Body& occulter, double now, double startStep, double minStep) const;
-    double findEclipseEnd(const Body& recever, const Body& occulter, double now, double startStep, double minStep) const;
-
- private:                    
-    Body* body;
-    EclipseFinderWatcher* watcher;
-};
-
-
-
-// TODO: share this constant and function with render.cpp
-static const float MinRelativeOccluderRadius = 0.005f;
-
-static const int EclipseObjectMask = Body::Planet | Body::Moon | Body::DwarfPlanet | Body::Asteroid;
-
-
 // Functions to convert between Qt dates and Celestia dates.
 // TODO: Qt's date class doesn't support leap seconds
 static double QDateToTDB(const QDate& date)
@@ -113,225 +54,9 @@ static QDateTime TDBToQDate(double tdb)
 }
 
 
-
-bool QtEclipseFinder::testEclipse(const Body& receiver, const Body& occulter,
-                                  double now) const
-{
-    // Ignore situations where the shadow casting body is much smaller than
-    // the receiver, as these shadows aren't likely to be relevant.  Also,
-    // ignore eclipses where the occulter is not an ellipsoid, since we can't
-    // generate correct shadows in this case.
-    if (occulter.getRadius() >= receiver.getRadius() * MinRelativeOccluderRadius &&
-        occulter.isEllipsoid())
-    {
-        // All of the eclipse related code assumes that both the occulter
-        // and receiver are spherical.  Irregular receivers will work more
-        // or less correctly, but occulters that are sufficiently non-spherical
-        // will produce obviously incorrect shadows.  Another assumption we
-        // make is that the distance between the occulter and receiver is much
-        // less than the distance between the sun and the receiver.  This
-        // approximation works everywhere in the solar system, and likely
-        // works for any orbitally stable pair of objects orbiting a star.
-        Vector3d posReceiver = receiver.getAstrocentricPosition(now);
-        Vector3d posOcculter = occulter.getAstrocentricPosition(now);
-
-        const Star* sun = receiver.getSystem()->getStar();
-        assert(sun != NULL);
-        double distToSun = posReceiver.norm();
-        float appSunRadius = (float) (sun->getRadius() / distToSun);
-
-        Vector3d dir = posOcculter - posReceiver;
-        double distToOcculter = dir.norm() - receiver.getRadius();
-        float appOccluderRadius = (float) (occulter.getRadius() / distToOcculter);
-
-        // The shadow radius is the radius of the occluder plus some additional
-        // amount that depends upon the apparent radius of the sun.  For
-        // a sun that's distant/small and effectively a point, the shadow
-        // radius will be the same as the radius of the occluder.
-        float shadowRadius = (1 + appSunRadius / appOccluderRadius) *
-            occulter.getRadius();
-
-        // Test whether a shadow is cast on the receiver.  We want to know
-        // if the receiver lies within the shadow volume of the occulter.  Since
-        // we're assuming that everything is a sphere and the sun is far
-        // away relative to the occulter, the shadow volume is a
-        // cylinder capped at one end.  Testing for the intersection of a
-        // singly capped cylinder is as simple as checking the distance
-        // from the center of the receiver to the axis of the shadow cylinder.
-        // If the distance is less than the sum of the occulter's and receiver's
-        // radii, then we have an eclipse.
-        float R = receiver.getRadius() + shadowRadius;
-        double dist = distance(posReceiver,
-                               Ray3d(posOcculter, posOcculter - Vector3d::Zero()));
-        if (dist < R)
-        {
-            // Ignore "eclipses" where the occulter and receiver have
-            // intersecting bounding spheres.
-            if (distToOcculter > occulter.getRadius())
-                return true;
-        }
-    }
-
-    return false;
-}
-
-
-// Given a time during an eclipse, find the start of the eclipse to
-// a precision of minStep.
-double QtEclipseFinder::findEclipseStart(const Body& receiver, const Body& occulter,
-                                         double now,
-                                         double startStep,
-                                         double minStep) const
-{
-    double step = startStep / 2;
-    double t = now - step;
-    bool eclipsed = true;
-
-    // Perform a binary search to find the end of the eclipse
-    while (step > minStep)
-    {
-        eclipsed = testEclipse(receiver, occulter, t);
-        step *= 0.5;
-        if (eclipsed)
-            t -= step;
-        else
-            t += step;
-    }
-
-    // Always return a time when the receiver is /not/ in eclipse
-    if (eclipsed)
-        t -= step;
-
-    return t;
-}
-
-
-// Given a time during an eclipse, find the end of the eclipse to
-// a precision of minStep.
-double QtEclipseFinder::findEclipseEnd(const Body& receiver, const Body& occulter,
-                                       double now,
-                                       double startStep,
-                                       double minStep) const
-{
-    // First do a coarse search to find the eclipse end to within the precision
-    // of startStep.
-    while (testEclipse(receiver, occulter, now + startStep))
-        now += startStep;
-    
-    double step = startStep / 2;
-    double t = now + step;
-    bool eclipsed = true;
-
-    
-    // Perform a binary search to find the end of the eclipse
-    while (step > minStep)
-    {
-        eclipsed = testEclipse(receiver, occulter, t);
-        step *= 0.5;
-        if (eclipsed)
-            t += step;
-        else
-            t -= step;
-    }
-
-    // Always return a time when the receiver is /not/ in eclipse
-    if (eclipsed)
-        t += step;
-
-    return t;
-}
-
-
-
-
-
-void QtEclipseFinder::findEclipses(double startDate,
-                                   double endDate,
-                                   int eclipseTypeMask,
-                                   vector<EclipseRecord>& eclipses)
-{
-    PlanetarySystem* satellites = body->getSatellites();
- 
-    // See if there's anything that could test
-    if (satellites == NULL)
-        return;
-
-    // For each body, we'll need to store the time when the last eclipse ended
-    vector<double> previousEclipseEndTimes;
-
-    // Make a list of satellites that we'll actually test for eclipses; ignore
-    // spacecraft and very small objects.
-    vector<Body*> testBodies;
-    for (int i = 0; i < satellites->getSystemSize(); i++)
-    {
-        Body* obj = satellites->getBody(i);
-        if ((obj->getClassification() & EclipseObjectMask) != 0 &&
-            obj->getRadius() >= body->getRadius() * MinRelativeOccluderRadius)
-        {
-            testBodies.push_back(obj);
-            previousEclipseEndTimes.push_back(startDate - 1.0);
-        }
-    }
-
-    if (testBodies.empty())
-        return;
-
-    // TODO: Use a fixed step of one hour for now; we should use a binary
-    // search instead.
-    double searchStep = 1.0 / 24.0; // one hour
-
-    // Precision of eclipse duration calculation
-    double durationPrecision = 1.0 / (24.0 * 360.0); // ten seconds
-
-    for (double t = startDate; t <= endDate; t += searchStep)
-    {
-        if (watcher != NULL)
-        {
-            if (watcher->eclipseFinderProgressUpdate(t) == EclipseFinderWatcher::AbortOperation)
-                return;
-        }
-
-        for (unsigned int i = 0; i < testBodies.size(); i++)
-        {
-            Body* occulter = NULL;
-            Body* receiver = NULL;
-
-            if (eclipseTypeMask == SolarEclipse)
-            {
-                occulter = testBodies[i];
-                receiver = body;
-            }
-            else
-            {
-                occulter = body;
-                receiver = testBodies[i];
-            }
-
-            // Only test for an eclipse if we're not in the middle of
-            // of previous one.
-            if (t > previousEclipseEndTimes[i])
-            {
-                if (testEclipse(*receiver, *occulter, t))
-                {
-                    EclipseRecord eclipse;
-                    eclipse.startTime = findEclipseStart(*receiver, *occulter, t, searchStep, durationPrecision);
-                    eclipse.endTime = findEclipseEnd(*receiver, *occulter, t, searchStep, durationPrecision);
-                    eclipse.receiver = receiver;
-                    eclipse.occulter = occulter;
-                    eclipses.push_back(eclipse);
-
-                    previousEclipseEndTimes[i] = eclipse.endTime;
-                }
-            }
-        }
-    }
-
-}
-
-
 struct EclipseOcculterSortPredicate
 {
-    bool operator()(const EclipseRecord& e0, const EclipseRecord& e1)
+    bool operator()(const EclipseEvent& e0, const EclipseEvent& e1)
     {
         return e0.occulter->getName() < e1.occulter->getName();
     }
@@ -341,7 +66,7 @@ struct EclipseOcculterSortPredicate
 
 struct EclipseReceiverSortPredicate
 {
-    bool operator()(const EclipseRecord& e0, const EclipseRecord& e1)
+    bool operator()(const EclipseEvent& e0, const EclipseEvent& e1)
     {
         return e0.receiver->getName() < e1.receiver->getName();
     }
@@ -351,7 +76,7 @@ struct EclipseReceiverSortPredicate
 
 struct EclipseStartTimeSortPredicate
 {
-    bool operator()(const EclipseRecord& e0, const EclipseRecord& e1)
+    bool operator()(const EclipseEvent& e0, const EclipseEvent& e1)
     {
         return e0.startTime < e1.startTime;
     }
@@ -361,7 +86,7 @@ struct EclipseStartTimeSortPredicate
 
 struct EclipseDurationSortPredicate
 {
-    bool operator()(const EclipseRecord& e0, const EclipseRecord& e1)
+    bool operator()(const EclipseEvent& e0, const EclipseEvent& e1)
     {
         return e0.endTime - e0.startTime < e1.endTime - e1.startTime;
     }
@@ -385,9 +110,9 @@ public:
     int columnCount(const QModelIndex& index) const;
     void sort(int column, Qt::SortOrder order);
 
-    void setEclipses(const vector<EclipseRecord>& _eclipses);
+    void setEclipses(const vector<EclipseEvent>& _eclipses);
 
-    const EclipseRecord* eclipseAtIndex(const QModelIndex& index) const;
+    const EclipseEvent* eclipseAtIndex(const QModelIndex& index) const;
 
     enum
     {
@@ -398,7 +123,7 @@ public:
     };
 
 private:
-    vector<EclipseRecord> eclipses;
+    vector<EclipseEvent> eclipses;
 };
 
 
@@ -426,7 +151,7 @@ QVariant EventTableModel::data(const QModelIndex& index, int role) const
         return QVariant();
     }
 
-    const EclipseRecord& eclipse = eclipses[index.row()];
+    const EclipseEvent& eclipse = eclipses[index.row()];
 
     if (role == Qt::DisplayRole)
     {
@@ -513,7 +238,7 @@ void EventTableModel::sort(int column, Qt::SortOrder order)
 }
 
 
-void EventTableModel::setEclipses(const vector<EclipseRecord>& _eclipses)
+void EventTableModel::setEclipses(const vector<EclipseEvent>& _eclipses)
 {
     beginResetModel();
     eclipses = _eclipses;
@@ -521,7 +246,7 @@ void EventTableModel::setEclipses(const vector<EclipseRecord>& _eclipses)
 }
 
 
-const EclipseRecord* EventTableModel::eclipseAtIndex(const QModelIndex& index) const
+const EclipseEvent* EventTableModel::eclipseAtIndex(const QModelIndex& index) const
 {
     int row = index.row();
     if (row >= 0 && row < (int) eclipses.size())
@@ -633,7 +358,7 @@ EventFinder::~EventFinder()
 }
 
 
-EclipseFinderWatcher::Status EventFinder::eclipseFinderProgressUpdate(double t)
+bool EventFinder::eclipseSearchProgress(double t)
 {
     if (progress != NULL)
     {
@@ -648,22 +373,22 @@ EclipseFinderWatcher::Status EventFinder::eclipseFinderProgressUpdate(double t)
             lastProgressUpdate = t;
         }
 
-        return progress->wasCanceled() ? AbortOperation : ContinueOperation;
+        return !progress->wasCanceled();
     }
     else
     {
-        return EclipseFinderWatcher::ContinueOperation;
+        return true;
     }
 }
 
 
 void EventFinder::slotFindEclipses()
 {
-    int eclipseTypeMask = QtEclipseFinder::SolarEclipse;
+    int eclipseTypeMask = EclipseSearch::SolarEclipse;
     if (lunarOnlyButton->isChecked())
-        eclipseTypeMask = QtEclipseFinder::LunarEclipse;
+        eclipseTypeMask = EclipseSearch::LunarEclipse;
     else if (allEclipsesButton->isChecked())
-        eclipseTypeMask = QtEclipseFinder::SolarEclipse | QtEclipseFinder::LunarEclipse;
+        eclipseTypeMask = EclipseSearch::SolarEclipse | EclipseSearch::LunarEclipse;
 
     QString bodyName = QString("Sol/") + planetSelect->currentText();
     Selection obj = appCore->getSimulation()->findObjectFromPath(bodyName.toUtf8().data(), true);
@@ -687,7 +412,7 @@ void EventFinder::slotFindEclipses()
         return;
     }
 
-    QtEclipseFinder finder(obj.body(), this);
+    EclipseSearch finder(obj.body());
     searchTimer.start();
     
     double startTimeTDB = QDateToTDB(startDate);
@@ -702,10 +427,11 @@ void EventFinder::slotFindEclipses()
     progress->show();
     
 
-    vector<EclipseRecord> eclipses;
+    vector<EclipseEvent> eclipses;
     finder.findEclipses(startTimeTDB, endTimeTDB,
                         eclipseTypeMask,
-                        eclipses);
+                        eclipses,
+                        this);
     delete progress;
     progress = NULL;
     
@@ -15,6 +15,7 @@
 
 #include <QDockWidget>
 #include <QTime>
+#include <celengine/eclipsesearch.h>
 
 class QTreeView;
 class QRadioButton;
@@ -24,24 +25,9 @@ class QProgressDialog;
 class QMenu;
 class EventTableModel;
 class CelestiaCore;
-class EclipseRecord;
-
-class EclipseFinderWatcher
-{
-public:
-    virtual ~EclipseFinderWatcher() {};
-    
-    enum Status
-    {
-        ContinueOperation = 0,
-        AbortOperation = 1,
-    };
-
-    virtual Status eclipseFinderProgressUpdate(double t) = 0;
-};
 
 
-class EventFinder : public QDockWidget, EclipseFinderWatcher
+class EventFinder : public QDockWidget, EclipseSearchWatcher
 {
 Q_OBJECT
 
@@ -49,7 +35,7 @@ Q_OBJECT
     EventFinder(CelestiaCore* _appCore, const QString& title, QWidget* parent);
     ~EventFinder();
 
-    EclipseFinderWatcher::Status eclipseFinderProgressUpdate(double t);
+    bool eclipseSearchProgress(double t);
     
  public slots:
     void slotFindEclipses();
@@ -83,7 +69,7 @@ Q_OBJECT
 
 	QTime searchTimer;
 
-	const EclipseRecord* activeEclipse;
+	const EclipseEvent* activeEclipse;
 };
 
 #endif // _QTEVENTFINDER_H_
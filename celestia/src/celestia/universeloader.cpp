@@ -0,0 +1,501 @@
+// universeloader.cpp
+//
+// Copyright (C) 2001-2009, the Celestia Development Team
+//
+// Loading of the star, deep sky and solar system catalogs, moved here from
+// celestiacore.cpp so that it can be shared with tools that don't render.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include "universeloader.h"
+#include "configfile.h"
+#include <celengine/universe.h>
+#include <celengine/asterism.h>
+#include <celengine/boundaries.h>
+#include <celengine/catalogreader.h>
+#include <celengine/catalogcache.h>
+#include <celutil/util.h>
+#include <celutil/filetype.h>
+#include <celutil/directory.h>
+#include <celutil/debug.h>
+#include <celutil/workerpool.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+
+
+class SolarSystemLoader : public EnumFilesHandler
+{
+ public:
+    Universe* universe;
+    CatalogReader* reader;
+    ProgressNotifier* notifier;
+    SolarSystemLoader(Universe* u, CatalogReader* r, ProgressNotifier* pn) : universe(u), reader(r), notifier(pn) {};
+
+    bool process(const string& filename)
+    {
+        if (DetermineFileType(filename) == Content_CelestiaCatalog)
+        {
+            string fullname = getPath() + '/' + filename;
+            clog << _("Loading solar system catalog: ") << fullname << '\n';
+            if (notifier)
+                notifier->update(filename);
+
+            CatalogFile* solarSysFile = reader->open(fullname);
+            if (solarSysFile != NULL)
+            {
+                LoadSolarSystemObjects(solarSysFile->getTokenizer(),
+                                       *universe,
+                                       getPath());
+                delete solarSysFile;
+            }
+        }
+
+        return true;
+    };
+};
+
+template <class OBJDB> class CatalogLoader : public EnumFilesHandler
+{
+public:
+    OBJDB*      objDB;
+    string      typeDesc;
+    ContentType contentType;
+    CatalogReader* reader;
+    ProgressNotifier* notifier;
+    vector<string> loadedFiles;
+
+    CatalogLoader(OBJDB* db,
+                  const std::string& typeDesc,
+                  const ContentType& contentType,
+                  CatalogReader* r,
+                  ProgressNotifier* pn) :
+        objDB      (db),
+        typeDesc   (typeDesc),
+        contentType(contentType),
+        reader(r),
+        notifier(pn)
+    {
+    }
+
+    bool process(const string& filename)
+    {
+        if (DetermineFileType(filename) == contentType)
+        {
+            string fullname = getPath() + '/' + filename;
+            clog << _("Loading ") << typeDesc << " catalog: " << fullname << '\n';
+            if (notifier)
+                notifier->update(filename);
+
+            CatalogFile* catalogFile = reader->open(fullname);
+            if (catalogFile != NULL)
+            {
+                loadedFiles.push_back(fullname);
+                bool success = objDB->load(catalogFile->getTokenizer(), getPath());
+                if (!success)
+                {
+                    //DPRINTF(0, _("Error reading star file: %s\n"), fullname.c_str());
+                    DPRINTF(0, "Error reading %s catalog file: %s\n", typeDesc.c_str(), fullname.c_str());
+                }
+                delete catalogFile;
+            }
+        }
+        return true;
+    }
+};
+
+// Queues the catalog files of one type in the extras directories for
+// parsing, in the order in which the loaders above will visit them.
+class CatalogPrefetcher : public EnumFilesHandler
+{
+ public:
+    CatalogPrefetcher(CatalogReader* r, ContentType type) : reader(r), contentType(type) {};
+
+    bool process(const string& filename)
+    {
+        if (DetermineFileType(filename) == contentType)
+            reader->prefetch(getPath() + '/' + filename);
+        return true;
+    }
+
+ private:
+    CatalogReader* reader;
+    ContentType contentType;
+};
+
+typedef CatalogLoader<StarDatabase> StarLoader;
+typedef CatalogLoader<DSODatabase>  DeepSkyLoader;
+
+
+static void prefetchExtrasCatalogs(CatalogReader& reader,
+                                   const vector<string>& extrasDirs,
+                                   ContentType contentType)
+{
+    for (vector<string>::const_iterator iter = extrasDirs.begin();
+         iter != extrasDirs.end(); iter++)
+    {
+        if (*iter != "")
+        {
+            Directory* dir = OpenDirectory(*iter);
+
+            CatalogPrefetcher prefetcher(&reader, contentType);
+            prefetcher.pushDir(*iter);
+            dir->enumFiles(prefetcher, true);
+
+            delete dir;
+        }
+    }
+}
+
+
+static void prefetchCatalogList(CatalogReader& reader,
+                                const vector<string>& catalogFiles)
+{
+    for (vector<string>::const_iterator iter = catalogFiles.begin();
+         iter != catalogFiles.end(); iter++)
+    {
+        if (*iter != "")
+            reader.prefetch(*iter);
+    }
+}
+
+
+static void loadCrossIndex(StarDatabase* starDB,
+                           StarDatabase::Catalog catalog,
+                           const string& filename)
+{
+    if (!filename.empty())
+    {
+        ifstream xrefFile(filename.c_str(), ios::in | ios::binary);
+        if (xrefFile.good())
+        {
+            if (!starDB->loadCrossIndex(catalog, xrefFile))
+                cerr << _("Error reading cross index ") << filename << '\n';
+            else
+                clog << _("Loaded cross index ") << filename << '\n';
+        }
+    }
+}
+
+
+static bool readStars(const CelestiaConfig& cfg,
+                      Universe* universe,
+                      ProgressNotifier* progressNotifier,
+                      CatalogReader& catalogReader,
+                      const CatalogCache* cache)
+{
+    StarDetails::SetStarTextures(cfg.starTextures);
+
+    ifstream starNamesFile(cfg.starNamesFile.c_str(), ios::in);
+    if (!starNamesFile.good())
+    {
+	cerr << _("Error opening ") << cfg.starNamesFile << '\n';
+        return false;
+    }
+
+    StarNameDatabase* starNameDB = StarNameDatabase::readNames(starNamesFile);
+    if (starNameDB == NULL)
+    {
+        cerr << _("Error reading star names file\n");
+        return false;
+    }
+
+    // All of the files that stars were loaded from, in order
+    vector<string> starCatalogs;
+
+    // First load the binary star database file.  The majority of stars
+    // will be defined here.
+    StarDatabase* starDB = new StarDatabase();
+    if (!cfg.starDatabaseFile.empty())
+    {
+        starCatalogs.push_back(cfg.starDatabaseFile);
+
+        if (progressNotifier)
+            progressNotifier->update(cfg.starDatabaseFile);
+
+        // A presorted star database is memory mapped and used directly;
+        // anything else is read as an ordinary binary star database.
+        if (!starDB->loadSortedBinary(cfg.starDatabaseFile))
+        {
+            ifstream starFile(cfg.starDatabaseFile.c_str(), ios::in | ios::binary);
+            if (!starFile.good())
+            {
+                cerr << _("Error opening ") << cfg.starDatabaseFile << '\n';
+                delete starDB;
+                return false;
+            }
+
+            if (!starDB->loadBinary(starFile))
+            {
+                delete starDB;
+                cerr << _("Error reading stars file\n");
+                return false;
+            }
+        }
+    }
+
+    starDB->setNameDatabase(starNameDB);
+
+    loadCrossIndex(starDB, StarDatabase::HenryDraper, cfg.HDCrossIndexFile);
+    loadCrossIndex(starDB, StarDatabase::SAO,         cfg.SAOCrossIndexFile);
+    loadCrossIndex(starDB, StarDatabase::Gliese,      cfg.GlieseCrossIndexFile);
+
+    // Next, read any ASCII star catalog files specified in the StarCatalogs
+    // list.
+    if (!cfg.starCatalogFiles.empty())
+    {
+        for (vector<string>::const_iterator iter = cfg.starCatalogFiles.begin();
+             iter != cfg.starCatalogFiles.end(); iter++)
+        {
+            if (*iter != "")
+            {
+                CatalogFile* starFile = catalogReader.open(*iter);
+                if (starFile != NULL)
+                {
+                    starDB->load(starFile->getTokenizer(), "");
+                    delete starFile;
+                    starCatalogs.push_back(*iter);
+                }
+                else
+                {
+                    cerr << _("Error opening star catalog ") << *iter << '\n';
+                }
+            }
+        }
+    }
+
+    // Now, read supplemental star files from the extras directories
+    for (vector<string>::const_iterator iter = cfg.extrasDirs.begin();
+         iter != cfg.extrasDirs.end(); iter++)
+    {
+        if (*iter != "")
+        {
+            Directory* dir = OpenDirectory(*iter);
+
+            StarLoader loader(starDB, "star", Content_CelestiaStarCatalog, &catalogReader, progressNotifier);
+            loader.pushDir(*iter);
+            dir->enumFiles(loader, true);
+            starCatalogs.insert(starCatalogs.end(), loader.loadedFiles.begin(), loader.loadedFiles.end());
+
+            delete dir;
+        }
+    }
+
+    // Sorting the stars into the octree is the slowest part of finishing
+    // the database; reuse the octree from the last session with the same
+    // star catalogs.
+    if (cache != NULL)
+    {
+        string snapshot;
+        if (cache->load("star octree", starCatalogs, snapshot))
+            starDB->setOctreeSnapshot(snapshot);
+    }
+
+    starDB->finish();
+    starDB->buildStarArrays();
+
+    if (cache != NULL && !starDB->usedOctreeSnapshot())
+    {
+        ostringstream out(ios::out | ios::binary);
+        if (starDB->writeOctreeSnapshot(out))
+            cache->save("star octree", starCatalogs, out.str());
+    }
+
+    universe->setStarCatalog(starDB);
+
+    return true;
+}
+
+
+Universe* LoadUniverse(const CelestiaConfig& cfg,
+                       ProgressNotifier* progressNotifier)
+{
+    Universe* universe = new Universe();
+
+    // Parsed catalogs and the indexes built from them are kept in the
+    // catalog cache, if there is one, for the next time that Celestia is
+    // started with the same catalogs.
+    CatalogCache catalogCache(cfg.catalogCacheDirectory);
+    const CatalogCache* cache = NULL;
+    if (!cfg.catalogCacheDirectory.empty())
+        cache = &catalogCache;
+
+    // Catalog files are parsed on worker threads while the star database
+    // and the catalogs preceding them are loaded.
+    CatalogReader catalogReader(DefaultWorkerThreadCount(), cache);
+    prefetchCatalogList(catalogReader, cfg.starCatalogFiles);
+    prefetchExtrasCatalogs(catalogReader, cfg.extrasDirs, Content_CelestiaStarCatalog);
+    prefetchCatalogList(catalogReader, cfg.dsoCatalogFiles);
+    prefetchExtrasCatalogs(catalogReader, cfg.extrasDirs, Content_CelestiaDeepSkyCatalog);
+    prefetchCatalogList(catalogReader, cfg.solarSystemFiles);
+    prefetchExtrasCatalogs(catalogReader, cfg.extrasDirs, Content_CelestiaCatalog);
+
+
+    /***** Load star catalogs *****/
+
+    if (!readStars(cfg, universe, progressNotifier, catalogReader, cache))
+    {
+        cerr << _("Cannot read star database.") << '\n';
+        return NULL;
+    }
+
+
+    /***** Load the deep sky catalogs *****/
+
+    DSONameDatabase* dsoNameDB  = new DSONameDatabase;
+    DSODatabase*     dsoDB      = new DSODatabase;
+    dsoDB->setNameDatabase(dsoNameDB);
+    vector<string> dsoCatalogs;
+	    
+	// Load first the vector of dsoCatalogFiles in the data directory (deepsky.dsc, globulars.dsc,...):
+	 
+	for (vector<string>::const_iterator iter = cfg.dsoCatalogFiles.begin();
+    iter != cfg.dsoCatalogFiles.end(); iter++)
+    {
+    	if (progressNotifier)
+        	progressNotifier->update(*iter);
+	
+		CatalogFile* dsoFile = catalogReader.open(*iter);
+        if (dsoFile == NULL)
+        {
+        	cerr<< _("Error opening deepsky catalog file.") << '\n';
+            delete dsoDB;
+            return NULL;
+		}
+
+        bool success = dsoDB->load(dsoFile->getTokenizer(), "");
+        delete dsoFile;
+        dsoCatalogs.push_back(*iter);
+        if (!success)
+	    {
+    		cerr << "Cannot read Deep Sky Objects database." << '\n';
+        	delete dsoDB;
+           	return NULL;
+        }
+    }
+
+    // Next, read all the deep sky files in the extras directories
+    {
+        for (vector<string>::const_iterator iter = cfg.extrasDirs.begin();
+             iter != cfg.extrasDirs.end(); iter++)
+        {
+            if (*iter != "")
+            {
+                Directory* dir = OpenDirectory(*iter);
+
+                DeepSkyLoader loader(dsoDB,
+                                     "deep sky object",
+                                     Content_CelestiaDeepSkyCatalog,
+                                     &catalogReader,
+                                     progressNotifier);
+                loader.pushDir(*iter);
+                dir->enumFiles(loader, true);
+                dsoCatalogs.insert(dsoCatalogs.end(), loader.loadedFiles.begin(), loader.loadedFiles.end());
+
+                delete dir;
+            }
+        }
+    }
+
+    // Building the index for completing the many DSO names is a large
+    // part of the time spent finishing the DSO database.
+    bool completionIndexRestored = false;
+    if (cache != NULL)
+    {
+        string snapshot;
+        if (cache->load("dso name completion", dsoCatalogs, snapshot))
+            completionIndexRestored = dsoNameDB->readCompletionIndex(snapshot.data(), snapshot.size());
+    }
+
+    dsoDB->finish();
+    universe->setDSOCatalog(dsoDB);
+
+    if (cache != NULL && !completionIndexRestored)
+    {
+        ostringstream out(ios::out | ios::binary);
+        if (dsoNameDB->writeCompletionIndex(out))
+            cache->save("dso name completion", dsoCatalogs, out.str());
+    }
+
+
+    /***** Load the solar system catalogs *****/
+    // First read the solar system files listed individually in the
+    // config file.
+    {
+        SolarSystemCatalog* solarSystemCatalog = new SolarSystemCatalog();
+        universe->setSolarSystemCatalog(solarSystemCatalog);
+        for (vector<string>::const_iterator iter = cfg.solarSystemFiles.begin();
+             iter != cfg.solarSystemFiles.end();
+             iter++)
+        {
+            if (progressNotifier)
+                progressNotifier->update(*iter);
+
+            CatalogFile* solarSysFile = catalogReader.open(*iter);
+            if (solarSysFile == NULL)
+            {
+                cerr << _("Error opening solar system catalog.\n");
+            }
+            else
+            {
+                LoadSolarSystemObjects(solarSysFile->getTokenizer(), *universe, "");
+                delete solarSysFile;
+            }
+        }
+    }
+
+    // Next, read all the solar system files in the extras directories
+    {
+        for (vector<string>::const_iterator iter = cfg.extrasDirs.begin();
+             iter != cfg.extrasDirs.end(); iter++)
+        {
+            if (*iter != "")
+            {
+                Directory* dir = OpenDirectory(*iter);
+
+                SolarSystemLoader loader(universe, &catalogReader, progressNotifier);
+                loader.pushDir(*iter);
+                dir->enumFiles(loader, true);
+
+                delete dir;
+            }
+        }
+    }
+
+    // Load asterisms:
+    if (cfg.asterismsFile != "")
+    {
+        ifstream asterismsFile(cfg.asterismsFile.c_str(), ios::in);
+        if (!asterismsFile.good())
+        {
+            cerr << _("Error opening asterisms file.") << '\n';
+        }
+        else
+        {
+            AsterismList* asterisms = ReadAsterismList(asterismsFile,
+                                                       *universe->getStarCatalog());
+            universe->setAsterisms(asterisms);
+        }
+    }
+
+    if (cfg.boundariesFile != "")
+    {
+        ifstream boundariesFile(cfg.boundariesFile.c_str(), ios::in);
+        if (!boundariesFile.good())
+        {
+            cerr << _("Error opening constellation boundaries files.") << '\n';
+        }
+        else
+        {
+            ConstellationBoundaries* boundaries = ReadBoundaries(boundariesFile);
+            universe->setBoundaries(boundaries);
+        }
+    }
+
+    return universe;
+}
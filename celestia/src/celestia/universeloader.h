@@ -0,0 +1,38 @@
+// universeloader.h
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#ifndef _UNIVERSELOADER_H_
+#define _UNIVERSELOADER_H_
+
+#include <string>
+
+class Universe;
+class CelestiaConfig;
+
+
+class ProgressNotifier
+{
+public:
+    ProgressNotifier() {};
+    virtual ~ProgressNotifier() {};
+
+    virtual void update(const std::string&) = 0;
+};
+
+
+/*! Load the star, deep sky and solar system catalogs listed in the
+ *  configuration and those found in its extras directories, along with
+ *  the asterisms and constellation boundaries. This needs no renderer, so
+ *  that tools without a window can load the same universe as Celestia.
+ *  Returns NULL if the star or deep sky catalogs couldn't be read.
+ */
+extern Universe* LoadUniverse(const CelestiaConfig& config,
+                              ProgressNotifier* progressNotifier);
+
+#endif // _UNIVERSELOADER_H_
@@ -11,7 +11,6 @@
 
 #include <string>
 #include <algorithm>
-#include <set>
 #include <windows.h>
 #include <commctrl.h>
 #include <cstring>
@@ -93,6 +92,7 @@ struct CloserStarPredicate
     }
 };
 
+
 struct BrighterStarPredicate
 {
     Vector3f pos;
@@ -108,94 +108,88 @@ struct BrighterStarPredicate
             d0 = ucPos.offsetFromLy(star0->getPosition()).norm();
         if (d1 < 1.0f)
             d1 = ucPos.offsetFromLy(star1->getPosition()).norm();
-#if CELVEC
-        if (d0 < 1.0f)
-            d0 = (toMicroLY(star0->getPosition()) - toEigen((Point3f) ucPos)).norm() * 1e-6f;
-        if (d1 < 1.0f)
-            d1 = (toMicroLY(star1->getPosition()) - toEigen((Point3f) ucPos)).norm() * 1e-6f;
-#endif
 
         return (star0->getApparentMagnitude(d0) <
                 star1->getApparentMagnitude(d1));
     }
 };
 
-struct SolarSystemPredicate
-{
-    Vector3f pos;
-    SolarSystemCatalog* solarSystems;
-
-    bool operator()(const Star* star0, const Star* star1) const
-    {
-        SolarSystemCatalog::iterator iter;
 
-        iter = solarSystems->find(star0->getCatalogNumber());
-        bool hasPlanets0 = (iter != solarSystems->end());
-        iter = solarSystems->find(star1->getCatalogNumber());
-        bool hasPlanets1 = (iter != solarSystems->end());
-        if (hasPlanets1 == hasPlanets0)
-        {
-            return ((pos - star0->getPosition()).squaredNorm() <
-                    (pos - star1->getPosition()).squaredNorm());
-        }
-        else
-        {
-            return hasPlanets0;
-        }
-    }
-};
+static bool IsStarHidden(const Star* star)
+{
+    return !star->getVisibility();
+}
 
 
-// Find the nearest/brightest/X-est N stars in a database.  The
-// supplied predicate determines which of two stars is a better match.
-template<class Pred> vector<const Star*>*
-FindStars(const StarDatabase& stardb, Pred pred, int nStars)
+// Find the nStars visible stars nearest to or brightest as seen from pos
+// with an octree query. Stars hidden by their catalog definitions are
+// skipped, so the query is repeated for more stars if any were found.
+// The octree only measures distances in single precision light years, so
+// the brightest stars are sorted again using the precise distances of
+// stars closer than a light year.
+vector<const Star*>*
+FindStars(const StarDatabase& stardb,
+          int predicate,
+          const Vector3f& pos,
+          const UniversalCoord& ucPos,
+          unsigned int nStars)
 {
-    vector<const Star*>* finalStars = new vector<const Star*>();
+    vector<const Star*>* stars = new vector<const Star*>();
     if (nStars == 0)
-        return finalStars;
+        return stars;
 
-    typedef multiset<const Star*, Pred> StarSet;
-    StarSet firstStars(pred);
-
-    int totalStars = stardb.size();
-    if (totalStars < nStars)
-        nStars = totalStars;
-
-    // We'll need at least nStars in the set, so first fill
-    // up the list indiscriminately.
-    int i = 0;
-    for (i = 0; i < nStars; i++)
+    unsigned int nRequested = nStars;
+    for (;;)
     {
-        Star* star = stardb.getStar(i);
-        if (star->getVisibility())
-            firstStars.insert(star);
+        stars->clear();
+        if (predicate == BrightestStars)
+            stardb.findBrightestStars(pos, nRequested, *stars);
+        else
+            stardb.findNearestStars(pos, nRequested, *stars);
+
+        unsigned int nFound = stars->size();
+        stars->erase(remove_if(stars->begin(), stars->end(), IsStarHidden), stars->end());
+        if (stars->size() >= nStars || nFound < nRequested)
+            break;
+        nRequested += nStars - stars->size();
     }
 
-    // From here on, only add a star to the set if it's
-    // a better match than the worst matching star already
-    // in the set.
-    const Star* lastStar = *--firstStars.end();
-    for (; i < totalStars; i++)
+    if (stars->size() > nStars)
+        stars->resize(nStars);
+
+    if (predicate == BrightestStars)
     {
-        Star* star = stardb.getStar(i);
-        if (star->getVisibility() && pred(star, lastStar))
-        {
-            firstStars.insert(star);
-            firstStars.erase(--firstStars.end());
-            lastStar = *--firstStars.end();
-        }
+        BrighterStarPredicate brighterPred;
+        brighterPred.pos = pos;
+        brighterPred.ucPos = ucPos;
+        stable_sort(stars->begin(), stars->end(), brighterPred);
     }
 
-    // Move the best matching stars into the vector
-    finalStars->reserve(nStars);
-    for (StarSet::const_iterator iter = firstStars.begin();
-         iter != firstStars.end(); iter++)
+    return stars;
+}
+
+
+// Find the nStars visible stars with planets nearest to pos; only the
+// stars in the solar system catalog need to be examined.
+vector<const Star*>*
+FindStarsWithPlanets(const SolarSystemCatalog& solarSystems, const Vector3f& pos, unsigned int nStars)
+{
+    vector<const Star*>* stars = new vector<const Star*>();
+    for (SolarSystemCatalog::const_iterator iter = solarSystems.begin();
+         iter != solarSystems.end(); iter++)
     {
-        finalStars->insert(finalStars->end(), *iter);
+        const Star* star = iter->second->getStar();
+        if (star != NULL && star->getVisibility())
+            stars->push_back(star);
     }
 
-    return finalStars;
+    CloserStarPredicate closerPred;
+    closerPred.pos = pos;
+    nStars = min(nStars, (unsigned int) stars->size());
+    partial_sort(stars->begin(), stars->begin() + nStars, stars->end(), closerPred);
+    stars->resize(nStars);
+
+    return stars;
 }
 
 
@@ -230,31 +224,15 @@ bool InitStarBrowserItems(HWND listView, StarBrowser* browser)
     switch (browser->predicate)
     {
     case BrightestStars:
-        {
-            BrighterStarPredicate brighterPred;
-            brighterPred.pos = browser->pos;
-            brighterPred.ucPos = browser->ucPos;
-            stars = FindStars(*stardb, brighterPred, browser->nStars);
-        }
-        break;
-
     case NearestStars:
-        {
-            CloserStarPredicate closerPred;
-            closerPred.pos = browser->pos;
-            stars = FindStars(*stardb, closerPred, browser->nStars);
-        }
+        stars = FindStars(*stardb, browser->predicate, browser->pos, browser->ucPos, browser->nStars);
         break;
 
     case StarsWithPlanets:
         {
             if (solarSystems == NULL)
                 return false;
-            SolarSystemPredicate solarSysPred;
-            solarSysPred.pos = browser->pos;
-            solarSysPred.solarSystems = solarSystems;
-            stars = FindStars(*stardb, solarSysPred,
-                              min((unsigned int) browser->nStars, solarSystems->size()));
+            stars = FindStarsWithPlanets(*solarSystems, browser->pos, browser->nStars);
         }
         break;
 
@@ -0,0 +1,38 @@
+// hash.h
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// Hashing of byte strings, used to detect changed files and data.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#ifndef _CELUTIL_HASH_H_
+#define _CELUTIL_HASH_H_
+
+#include <cstddef>
+#include <celutil/basictypes.h>
+
+// Hash of an empty string; longer strings can be hashed in pieces by
+// passing the hash of the preceding pieces.
+static const uint64 InitialHashValue = 0xcbf29ce484222325ULL;
+
+/*! Return a 64-bit FNV-1a hash of size bytes of data. This isn't a
+ *  cryptographic hash: it's meant for recognizing data that has changed,
+ *  not data that has been deliberately altered.
+ */
+inline uint64 HashBytes(const void* data, std::size_t size, uint64 hash = InitialHashValue)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (std::size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+#endif // _CELUTIL_HASH_H_
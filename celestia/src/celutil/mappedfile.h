@@ -0,0 +1,38 @@
+// mappedfile.h
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// Read-only memory mapped files.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#ifndef _CELUTIL_MAPPEDFILE_H_
+#define _CELUTIL_MAPPEDFILE_H_
+
+#include <string>
+#include <cstddef>
+
+/*! A MappedFile gives read-only access to the contents of a file through
+ *  the virtual memory system. Pages of the file are brought into memory
+ *  only when they are touched, so opening even a very large file is
+ *  cheap. The contents remain valid until the MappedFile is deleted.
+ */
+class MappedFile
+{
+ public:
+    MappedFile() {};
+    virtual ~MappedFile() {};
+
+    virtual const char* data() const = 0;
+    virtual std::size_t size() const = 0;
+};
+
+/*! Map the named file into memory. Returns NULL if the file cannot be
+ *  opened or mapped.
+ */
+extern MappedFile* OpenMappedFile(const std::string& filename);
+
+#endif // _CELUTIL_MAPPEDFILE_H_
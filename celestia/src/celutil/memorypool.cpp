@@ -46,7 +46,7 @@ MemoryPool::MemoryPool(unsigned int alignment, unsigned int blockSize) :
 MemoryPool::~MemoryPool()
 {
     for (list<Block>::iterator iter = m_blockList.begin(); iter != m_blockList.end(); iter++)
-        delete iter->m_memory;
+        delete[] iter->m_memory;
 }
 
 
@@ -0,0 +1,187 @@
+// prefixindex.cpp
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include <algorithm>
+#include <cstring>
+#include "prefixindex.h"
+#include "utf8.h"
+
+using namespace std;
+
+
+// Compare normalized names byte by byte; as with strings, a name that is
+// a prefix of another sorts before it.
+static int compareKeys(const char* key0, unsigned int length0,
+                       const char* key1, unsigned int length1)
+{
+    int result = memcmp(key0, key1, min(length0, length1));
+    if (result != 0)
+        return result;
+    else if (length0 < length1)
+        return -1;
+    else if (length0 > length1)
+        return 1;
+    else
+        return 0;
+}
+
+
+class PrefixIndex::EntryOrderingPredicate
+{
+ public:
+    EntryOrderingPredicate(const char* _buffer) : buffer(_buffer) {};
+
+    bool operator()(const Entry& e0, const Entry& e1) const
+    {
+        return compareKeys(key(e0), e0.keyLength, key(e1), e1.keyLength) < 0;
+    }
+
+    // Used to search for the first entry that isn't less than a prefix
+    bool operator()(const Entry& e, const string& prefix) const
+    {
+        return compareKeys(key(e), e.keyLength, prefix.data(), prefix.length()) < 0;
+    }
+
+ private:
+    const char* key(const Entry& e) const
+    {
+        return buffer + e.offset + e.nameLength;
+    }
+
+    const char* buffer;
+};
+
+
+PrefixIndex::PrefixIndex()
+{
+}
+
+
+void PrefixIndex::add(const string& name)
+{
+    string key = UTF8Normalize(name);
+
+    // Names this long aren't useful for completion
+    if (name.length() > 0xffff || key.length() > 0xffff)
+        return;
+
+    Entry e;
+    e.offset = buffer.size();
+    e.nameLength = (uint16) name.length();
+    e.keyLength = (uint16) key.length();
+    entries.push_back(e);
+
+    buffer.insert(buffer.end(), name.begin(), name.end());
+    buffer.insert(buffer.end(), key.begin(), key.end());
+}
+
+
+void PrefixIndex::sort()
+{
+    if (!buffer.empty())
+        std::sort(entries.begin(), entries.end(), EntryOrderingPredicate(&buffer[0]));
+}
+
+
+void PrefixIndex::clear()
+{
+    buffer.clear();
+    entries.clear();
+}
+
+
+unsigned int PrefixIndex::size() const
+{
+    return entries.size();
+}
+
+
+unsigned int PrefixIndex::getCompletion(const string& prefix,
+                                        vector<string>& completion,
+                                        unsigned int maxCompletions) const
+{
+    if (entries.empty())
+        return 0;
+
+    const char* names = &buffer[0];
+    string key = UTF8Normalize(prefix);
+
+    // All names beginning with the prefix follow the first one that isn't
+    // less than it.
+    unsigned int nMatches = 0;
+    for (vector<Entry>::const_iterator iter =
+             lower_bound(entries.begin(), entries.end(), key, EntryOrderingPredicate(names));
+         iter != entries.end(); iter++)
+    {
+        if (maxCompletions != 0 && nMatches == maxCompletions)
+            break;
+
+        const char* entryKey = names + iter->offset + iter->nameLength;
+        if (iter->keyLength < key.length() ||
+            memcmp(entryKey, key.data(), key.length()) != 0)
+        {
+            break;
+        }
+
+        completion.push_back(string(names + iter->offset, iter->nameLength));
+        nMatches++;
+    }
+
+    return nMatches;
+}
+
+
+bool PrefixIndex::write(ostream& out) const
+{
+    uint32 header[2];
+    header[0] = (uint32) entries.size();
+    header[1] = (uint32) buffer.size();
+    out.write(reinterpret_cast<const char*>(header), sizeof header);
+    if (!entries.empty())
+        out.write(reinterpret_cast<const char*>(&entries[0]), entries.size() * sizeof(Entry));
+    if (!buffer.empty())
+        out.write(&buffer[0], buffer.size());
+
+    return out.good();
+}
+
+
+/*! Restore an index saved by write(). Returns false and leaves the index
+ *  empty if the data is truncated or inconsistent.
+ */
+bool PrefixIndex::read(const char* data, size_t size)
+{
+    clear();
+
+    uint32 header[2];
+    if (size < sizeof header)
+        return false;
+    memcpy(header, data, sizeof header);
+
+    size_t entryBytes = (size_t) header[0] * sizeof(Entry);
+    if (size != sizeof header + entryBytes + header[1])
+        return false;
+
+    entries.resize(header[0]);
+    if (!entries.empty())
+        memcpy(&entries[0], data + sizeof header, entryBytes);
+    buffer.assign(data + sizeof header + entryBytes, data + size);
+
+    for (vector<Entry>::const_iterator iter = entries.begin(); iter != entries.end(); iter++)
+    {
+        if (iter->offset > buffer.size() ||
+            (size_t) iter->nameLength + iter->keyLength > buffer.size() - iter->offset)
+        {
+            clear();
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,70 @@
+// prefixindex.h
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#ifndef _CELUTIL_PREFIXINDEX_H_
+#define _CELUTIL_PREFIXINDEX_H_
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <cstddef>
+#include <celutil/basictypes.h>
+
+
+/*! A PrefixIndex finds the names beginning with a prefix, for completing
+ *  object names as they're typed. Names are matched in normalized form
+ *  (see UTF8Normalize()), so case and diacritics are ignored just as by
+ *  UTF8StringCompare(). The names and their normalized forms are packed
+ *  into a single buffer with a sorted array of offsets into it; a search
+ *  takes time proportional to the log of the number of names plus the
+ *  number of names returned.
+ */
+class PrefixIndex
+{
+ public:
+    PrefixIndex();
+
+    //! Add a name; sort() must be called before the index is searched.
+    void add(const std::string& name);
+    void sort();
+    void clear();
+
+    unsigned int size() const;
+
+    /*! Append the names beginning with prefix to completion in normalized
+     *  order, stopping after maxCompletions names unless maxCompletions is
+     *  zero. Returns the number of names appended.
+     */
+    unsigned int getCompletion(const std::string& prefix,
+                               std::vector<std::string>& completion,
+                               unsigned int maxCompletions = 0) const;
+
+    /*! Save a sorted index in the byte order of this machine, so that it
+     *  can be restored with read() instead of being built again.
+     */
+    bool write(std::ostream& out) const;
+    bool read(const char* data, std::size_t size);
+
+ private:
+    // The normalized name immediately follows the name in the buffer.
+    struct Entry
+    {
+        uint32 offset;
+        uint16 nameLength;
+        uint16 keyLength;
+    };
+
+    class EntryOrderingPredicate;
+    friend class EntryOrderingPredicate;
+
+    std::vector<char> buffer;
+    std::vector<Entry> entries;
+};
+
+#endif // _CELUTIL_PREFIXINDEX_H_
@@ -12,33 +12,93 @@
 
 #include <string>
 #include <vector>
+#include <deque>
 #include <map>
+#include <algorithm>
+#include <cstddef>
 #include <celutil/reshandle.h>
+#include <celutil/thread.h>
+#include <celutil/workerpool.h>
+#include <celutil/timer.h>
 
 
 enum ResourceState {
     ResourceNotLoaded     = 0,
     ResourceLoaded        = 1,
     ResourceLoadingFailed = 2,
+    ResourceLoadPending   = 3,
+};
+
+
+/*! Data produced by the first, thread-safe step of loading a resource
+ *  asynchronously, such as a decoded image.
+ */
+class PreparedResource
+{
+ public:
+    PreparedResource() {};
+    virtual ~PreparedResource() {};
+};
+
+
+//! Memory use and cache statistics for a resource manager
+struct ResourceUsageStats
+{
+    ResourceUsageStats() :
+        residentBytes(0), residentCount(0), hits(0), misses(0), evictions(0) {};
+
+    std::size_t residentBytes;
+    unsigned int residentCount;
+    unsigned long hits;       // lookups of a resource that was already loaded
+    unsigned long misses;     // lookups that had to load the resource
+    unsigned long evictions;  // resources unloaded to stay within budget
 };
 
 
 template<class T> class ResourceInfo
 {
  public:
-    ResourceInfo() : state(ResourceNotLoaded), resource(NULL) {};
+    ResourceInfo() : state(ResourceNotLoaded), resource(NULL), lastUsed(0) {};
     virtual ~ResourceInfo() {};
 
     virtual std::string resolve(const std::string&) = 0;
     virtual T* load(const std::string&) = 0;
 
+    /*! Asynchronous loading is done in two steps. prepare() is called on a
+     *  worker thread with a copy of the resource info, and must not use
+     *  OpenGL or anything else that is only safe on the main thread. The
+     *  result is passed to create(), which is called on the main thread to
+     *  finish the resource and takes ownership of the prepared data. By
+     *  default, nothing is prepared and create() calls load().
+     */
+    virtual PreparedResource* prepare(const std::string&) const { return NULL; }
+    virtual T* create(const std::string& name, PreparedResource*) { return load(name); }
+
+    /*! Return the number of bytes of memory used by a loaded resource.
+     *  Resources reporting zero are never evicted.
+     */
+    virtual std::size_t getMemoryUsage(const T*) const { return 0; }
+
     typedef T ResourceType;
     ResourceState state;
     std::string resolvedName;
     T* resource;
+    unsigned int lastUsed;  // frame in which the resource was last found
 };
 
 
+/*! A ResourceManager loads resources the first time that they are found.
+ *  By default, resources are loaded synchronously by find(). When a worker
+ *  pool is set, find() instead queues the resource to be prepared on the
+ *  pool and returns NULL until finishLoads() has created it. Handles may be
+ *  requested from any thread, but all other methods must be called from
+ *  the main thread.
+ *
+ *  Loaded resources are shared by all handles with the same resolved name.
+ *  When a memory budget is set, beginFrame() unloads the resources that
+ *  have gone unused the longest until the budget is met; their handles
+ *  return to ResourceNotLoaded so that they are reloaded on demand.
+ */
 template<class T> class ResourceManager
 {
  private:
@@ -46,15 +106,59 @@ template<class T> class ResourceManager
 
  public:
     ResourceManager();
-    ResourceManager(std::string _baseDir) : baseDir(_baseDir) {};
+    ResourceManager(std::string _baseDir) :
+        baseDir(_baseDir),
+        memoryBudget(0),
+        currentFrame(1),
+        workerPool(NULL),
+        timer(NULL)
+    {
+    };
     ~ResourceManager();
 
     typedef typename T::ResourceType ResourceType;
 
  private:
-    typedef std::vector<T> ResourceTable;
+    class LoadTask : public WorkerTask
+    {
+     public:
+        LoadTask(ResourceManager* _manager, const T& _info) :
+            manager(_manager),
+            info(_info),
+            prepared(NULL)
+        {
+        }
+
+        virtual void run()
+        {
+            prepared = info.prepare(info.resolvedName);
+
+            MutexLock lock(manager->mutex);
+            manager->finishedLoads.push_back(this);
+        }
+
+        ResourceManager* manager;
+        T info;
+        PreparedResource* prepared;
+        // All handles resolving to the same resource share one task
+        std::vector<ResourceHandle> handles;
+    };
+
+    friend class LoadTask;
+
+    // A deque is used so that references to resources remain valid while
+    // handles are added by other threads.
+    struct LoadedResource
+    {
+        ResourceType* resource;
+        std::size_t size;
+        std::vector<ResourceHandle> handles;
+    };
+
+    typedef std::deque<T> ResourceTable;
     typedef std::map<T, ResourceHandle> ResourceHandleMap;
-    typedef std::map<std::string, ResourceType*> NameMap;
+    typedef std::map<std::string, LoadedResource> NameMap;
+    typedef std::map<std::string, LoadTask*> LoadTaskMap;
 
     typedef typename ResourceHandleMap::value_type ResourceHandleMapValue;
     typedef typename NameMap::value_type NameMapValue;
@@ -63,9 +167,93 @@ template<class T> class ResourceManager
     ResourceHandleMap handles;
     NameMap loadedResources;
 
+    std::size_t memoryBudget;
+    unsigned int currentFrame;
+    ResourceUsageStats stats;
+
+    WorkerPool* workerPool;
+    LoadTaskMap pendingLoads;
+    Timer* timer;
+
+    // The mutex guards resources, handles, and finishedLoads
+    Mutex mutex;
+    std::deque<LoadTask*> finishedLoads;
+
+    T* getInfo(ResourceHandle h)
+    {
+        MutexLock lock(mutex);
+        if (h >= (int) handles.size() || h < 0)
+            return NULL;
+        else
+            return &resources[h];
+    }
+
+    void queueLoad(ResourceHandle h, T& info)
+    {
+        typename LoadTaskMap::iterator iter = pendingLoads.find(info.resolvedName);
+        if (iter != pendingLoads.end())
+        {
+            iter->second->handles.push_back(h);
+        }
+        else
+        {
+            LoadTask* task = new LoadTask(this, info);
+            task->handles.push_back(h);
+            pendingLoads.insert(typename LoadTaskMap::value_type(info.resolvedName, task));
+            workerPool->submit(task);
+        }
+
+        info.state = ResourceLoadPending;
+    }
+
+    void addLoadedResource(const T& info, ResourceType* resource,
+                           const std::vector<ResourceHandle>& resHandles)
+    {
+        LoadedResource& loaded = loadedResources[info.resolvedName];
+        loaded.resource = resource;
+        loaded.size = info.getMemoryUsage(resource);
+        loaded.handles = resHandles;
+        stats.residentBytes += loaded.size;
+        stats.residentCount++;
+    }
+
+    // Used to sort loaded resources from least to most recently used
+    struct LoadedResourceAge
+    {
+        LoadedResourceAge(typename NameMap::iterator _iter, unsigned int _lastUsed) :
+            iter(_iter), lastUsed(_lastUsed) {};
+
+        bool operator<(const LoadedResourceAge& other) const
+        {
+            return lastUsed < other.lastUsed;
+        }
+
+        typename NameMap::iterator iter;
+        unsigned int lastUsed;
+    };
+
+    void evict(typename NameMap::iterator iter)
+    {
+        LoadedResource& loaded = iter->second;
+        for (std::vector<ResourceHandle>::const_iterator h = loaded.handles.begin();
+             h != loaded.handles.end(); h++)
+        {
+            T* info = getInfo(*h);
+            info->resource = NULL;
+            info->state = ResourceNotLoaded;
+        }
+
+        delete loaded.resource;
+        stats.residentBytes -= loaded.size;
+        stats.residentCount--;
+        stats.evictions++;
+        loadedResources.erase(iter);
+    }
+
  public:
     ResourceHandle getHandle(const T& info)
     {
+        MutexLock lock(mutex);
         typename ResourceHandleMap::iterator iter = handles.find(info);
         if (iter != handles.end())
         {
@@ -74,7 +262,7 @@ template<class T> class ResourceManager
         else
         {
             ResourceHandle h = handles.size();
-            resources.insert(resources.end(), info);
+            resources.push_back(info);
             handles.insert(ResourceHandleMapValue(info, h));
             return h;
         }
@@ -82,52 +270,209 @@ template<class T> class ResourceManager
 
     ResourceType* find(ResourceHandle h)
     {
-        if (h >= (int) handles.size() || h < 0)
-        {
+        T* info = getInfo(h);
+        if (info == NULL)
             return NULL;
-        }
-        else
+
+        if (info->state == ResourceNotLoaded)
         {
-            if (resources[h].state == ResourceNotLoaded)
+            info->resolvedName = info->resolve(baseDir);
+            typename NameMap::iterator iter =
+                loadedResources.find(info->resolvedName);
+            if (iter != loadedResources.end())
+            {
+                info->resource = iter->second.resource;
+                info->state = ResourceLoaded;
+                iter->second.handles.push_back(h);
+                stats.hits++;
+            }
+            else if (workerPool != NULL)
+            {
+                queueLoad(h, *info);
+                stats.misses++;
+            }
+            else
             {
-                resources[h].resolvedName = resources[h].resolve(baseDir);
-                typename NameMap::iterator iter =
-                    loadedResources.find(resources[h].resolvedName);
-                if (iter != loadedResources.end())
+                info->resource = info->load(info->resolvedName);
+                if (info->resource == NULL)
                 {
-                    resources[h].resource = iter->second;
-                    resources[h].state = ResourceLoaded;
+                    info->state = ResourceLoadingFailed;
                 }
                 else
                 {
-                    resources[h].resource = resources[h].load(resources[h].resolvedName);
-                    if (resources[h].resource == NULL)
-                    {
-                        resources[h].state = ResourceLoadingFailed;
-                    }
-                    else
-                    {
-                        resources[h].state = ResourceLoaded;
-                        loadedResources.insert(NameMapValue(resources[h].resolvedName, resources[h].resource));
-                    }
+                    info->state = ResourceLoaded;
+                    addLoadedResource(*info, info->resource,
+                                      std::vector<ResourceHandle>(1, h));
                 }
+                stats.misses++;
             }
+        }
+        else if (info->state == ResourceLoaded)
+        {
+            stats.hits++;
+        }
 
-            if (resources[h].state == ResourceLoaded)
-                return resources[h].resource;
-            else
-                return NULL;
+        if (info->state == ResourceLoaded)
+        {
+            info->lastUsed = currentFrame;
+            return info->resource;
+        }
+        else
+        {
+            return NULL;
         }
     }
 
     const T* getResourceInfo(ResourceHandle h)
     {
-        if (h >= (int) handles.size() || h < 0)
-            return NULL;
-        else
-            return &resources[h];
+        return getInfo(h);
+    }
+
+    /*! Load resources asynchronously on the specified worker pool, or
+     *  synchronously if the pool is NULL. Loads that are already pending
+     *  will still be completed by finishLoads().
+     */
+    void setWorkerPool(WorkerPool* pool)
+    {
+        workerPool = pool;
+    }
+
+    WorkerPool* getWorkerPool() const
+    {
+        return workerPool;
+    }
+
+    /*! Create the resources that have been prepared by the worker pool.
+     *  If any are ready, at least one is created; more are created only
+     *  until timeBudget seconds have been spent, so that the cost of
+     *  creating many resources is spread over several frames. Returns the
+     *  number of resources created.
+     */
+    unsigned int finishLoads(double timeBudget)
+    {
+        if (pendingLoads.empty())
+            return 0;
+
+        if (timer == NULL)
+            timer = CreateTimer();
+        double startTime = timer->getTime();
+
+        unsigned int nFinished = 0;
+        for (;;)
+        {
+            LoadTask* task = NULL;
+            {
+                MutexLock lock(mutex);
+                if (!finishedLoads.empty())
+                {
+                    task = finishedLoads.front();
+                    finishedLoads.pop_front();
+                }
+            }
+
+            if (task == NULL)
+                break;
+
+            const std::string& name = task->info.resolvedName;
+            ResourceType* resource = task->info.create(name, task->prepared);
+            if (resource != NULL)
+                addLoadedResource(task->info, resource, task->handles);
+
+            for (std::vector<ResourceHandle>::const_iterator iter = task->handles.begin();
+                 iter != task->handles.end(); iter++)
+            {
+                T* info = getInfo(*iter);
+                info->resource = resource;
+                info->state = resource == NULL ? ResourceLoadingFailed : ResourceLoaded;
+            }
+
+            pendingLoads.erase(name);
+            delete task;
+            nFinished++;
+
+            if (timer->getTime() - startTime >= timeBudget)
+                break;
+        }
+
+        return nFinished;
+    }
+
+    //! Number of resources queued for asynchronous loading but not yet created
+    unsigned int getPendingLoadCount() const
+    {
+        return pendingLoads.size();
+    }
+
+    /*! Set the maximum number of bytes of loaded resources to keep in
+     *  memory. A budget of zero means that resources are never unloaded.
+     */
+    void setMemoryBudget(std::size_t bytes)
+    {
+        memoryBudget = bytes;
+    }
+
+    std::size_t getMemoryBudget() const
+    {
+        return memoryBudget;
+    }
+
+    /*! Start a new frame. If the loaded resources exceed the memory budget,
+     *  the least recently used ones are unloaded until the budget is met.
+     *  Resources found during the previous frame are never unloaded, since
+     *  they would most likely be needed again immediately; the budget may
+     *  thus be exceeded when more resources than it allows are in view.
+     *  Pointers returned by find() must not be kept past this call.
+     */
+    void beginFrame()
+    {
+        unsigned int lastFrame = currentFrame;
+        currentFrame++;
+
+        // Measure the resources again, since some of them (such as virtual
+        // textures) change size as they are used.
+        stats.residentBytes = 0;
+        for (typename NameMap::iterator iter = loadedResources.begin();
+             iter != loadedResources.end(); iter++)
+        {
+            LoadedResource& loaded = iter->second;
+            loaded.size = getInfo(loaded.handles.front())->getMemoryUsage(loaded.resource);
+            stats.residentBytes += loaded.size;
+        }
+
+        if (memoryBudget == 0 || stats.residentBytes <= memoryBudget)
+            return;
+
+        std::vector<LoadedResourceAge> candidates;
+        for (typename NameMap::iterator iter = loadedResources.begin();
+             iter != loadedResources.end(); iter++)
+        {
+            if (iter->second.size == 0)
+                continue;
+
+            unsigned int lastUsed = 0;
+            const std::vector<ResourceHandle>& resHandles = iter->second.handles;
+            for (std::vector<ResourceHandle>::const_iterator h = resHandles.begin();
+                 h != resHandles.end(); h++)
+            {
+                lastUsed = std::max(lastUsed, getInfo(*h)->lastUsed);
+            }
+
+            if (lastUsed < lastFrame)
+                candidates.push_back(LoadedResourceAge(iter, lastUsed));
+        }
+
+        std::sort(candidates.begin(), candidates.end());
+        for (typename std::vector<LoadedResourceAge>::const_iterator iter = candidates.begin();
+             iter != candidates.end() && stats.residentBytes > memoryBudget; iter++)
+        {
+            evict(iter->iter);
+        }
+    }
+
+    const ResourceUsageStats& getUsageStats() const
+    {
+        return stats;
     }
 };
 
 #endif // _CELUTIL_RESMANAGER_H_
-
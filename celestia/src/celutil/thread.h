@@ -0,0 +1,109 @@
+// thread.h
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// Minimal portable threading primitives.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#ifndef _CELUTIL_THREAD_H_
+#define _CELUTIL_THREAD_H_
+
+class Condition;
+
+class Mutex
+{
+ public:
+    Mutex();
+    ~Mutex();
+
+    void lock();
+    void unlock();
+
+ private:
+    // Prohibit copying of mutexes
+    Mutex(const Mutex&);
+    Mutex& operator=(const Mutex&);
+
+    void* handle;
+
+    friend class Condition;
+};
+
+
+/*! MutexLock locks a mutex for the lifetime of the MutexLock object. */
+class MutexLock
+{
+ public:
+    MutexLock(Mutex& _mutex) : mutex(_mutex)
+    {
+        mutex.lock();
+    }
+
+    ~MutexLock()
+    {
+        mutex.unlock();
+    }
+
+ private:
+    MutexLock(const MutexLock&);
+    MutexLock& operator=(const MutexLock&);
+
+    Mutex& mutex;
+};
+
+
+class Condition
+{
+ public:
+    Condition();
+    ~Condition();
+
+    // The mutex must be locked by the calling thread; it is released while
+    // waiting and locked again before wait() returns. A condition must
+    // always be used with the same mutex, and signal() and broadcast() may
+    // only be called while holding it.
+    void wait(Mutex& mutex);
+    void signal();
+    void broadcast();
+
+ private:
+    Condition(const Condition&);
+    Condition& operator=(const Condition&);
+
+    void* handle;
+};
+
+
+/*! Subclasses of Thread override run() with the code to be executed
+ *  in the new thread. A thread that has been started must be joined
+ *  before the Thread object is destroyed.
+ */
+class Thread
+{
+ public:
+    Thread();
+    virtual ~Thread();
+
+    bool start();
+    void join();
+
+    virtual void run() = 0;
+
+ private:
+    Thread(const Thread&);
+    Thread& operator=(const Thread&);
+
+    void* handle;
+};
+
+
+/*! Return the number of processors available to run threads; always at
+ *  least one.
+ */
+extern unsigned int GetProcessorCount();
+
+#endif // _CELUTIL_THREAD_H_
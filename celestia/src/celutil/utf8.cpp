@@ -511,6 +511,37 @@ inline wchar_t UTF8Normalize(wchar_t ch)
 }
 
 
+//! Return a copy of a UTF-8 string with every character normalized in the
+//! same way as by UTF8StringCompare(). Comparing normalized strings byte by
+//! byte gives the same order as UTF8StringCompare(). If the string contains
+//! an invalid character, the rest of the string is copied unchanged.
+std::string UTF8Normalize(const std::string& s)
+{
+    std::string normalized;
+    normalized.reserve(s.length());
+
+    int len = s.length();
+    int i = 0;
+    while (i < len)
+    {
+        wchar_t ch = 0;
+        if (!UTF8Decode(s, i, ch))
+        {
+            normalized.append(s, i, std::string::npos);
+            break;
+        }
+
+        i += UTF8EncodedSize(ch);
+
+        char buf[8];
+        int n = UTF8Encode(UTF8Normalize(ch), buf);
+        normalized.append(buf, n);
+    }
+
+    return normalized;
+}
+
+
 //! Perform a normalized comparison of two UTF-8 strings.  The normalization
 //! only works for characters in the WGL-4 subset, and no multicharacter
 //! translations are performed.
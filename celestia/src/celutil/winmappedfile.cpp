@@ -0,0 +1,96 @@
+// winmappedfile.cpp
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include <windows.h>
+#include "mappedfile.h"
+
+using namespace std;
+
+
+class WindowsMappedFile : public MappedFile
+{
+public:
+    WindowsMappedFile(HANDLE _mapping, const void* _view, size_t _length);
+    virtual ~WindowsMappedFile();
+
+    virtual const char* data() const;
+    virtual size_t size() const;
+
+private:
+    HANDLE mapping;
+    const void* view;
+    size_t length;
+};
+
+
+WindowsMappedFile::WindowsMappedFile(HANDLE _mapping, const void* _view, size_t _length) :
+    mapping(_mapping),
+    view(_view),
+    length(_length)
+{
+}
+
+
+WindowsMappedFile::~WindowsMappedFile()
+{
+    if (view != NULL)
+        UnmapViewOfFile(view);
+    if (mapping != NULL)
+        CloseHandle(mapping);
+}
+
+
+const char* WindowsMappedFile::data() const
+{
+    return reinterpret_cast<const char*>(view);
+}
+
+
+size_t WindowsMappedFile::size() const
+{
+    return length;
+}
+
+
+MappedFile* OpenMappedFile(const string& filename)
+{
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                              NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+
+    DWORD sizeHigh = 0;
+    DWORD sizeLow = GetFileSize(file, &sizeHigh);
+    if ((sizeLow == 0 && sizeHigh == 0) || sizeLow == INVALID_FILE_SIZE)
+    {
+        CloseHandle(file);
+        return NULL;
+    }
+
+    HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+    // The mapping object keeps the file open
+    CloseHandle(file);
+    if (mapping == NULL)
+        return NULL;
+
+    const void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (view == NULL)
+    {
+        CloseHandle(mapping);
+        return NULL;
+    }
+
+    size_t length = (size_t) sizeLow;
+#ifdef _WIN64
+    length |= ((size_t) sizeHigh) << 32;
+#endif
+
+    return new WindowsMappedFile(mapping, view, length);
+}
@@ -0,0 +1,166 @@
+// winthread.cpp
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include <windows.h>
+#include <process.h>
+#include <vector>
+#include "thread.h"
+
+using namespace std;
+
+
+Mutex::Mutex()
+{
+    CRITICAL_SECTION* section = new CRITICAL_SECTION;
+    InitializeCriticalSection(section);
+    handle = section;
+}
+
+
+Mutex::~Mutex()
+{
+    CRITICAL_SECTION* section = reinterpret_cast<CRITICAL_SECTION*>(handle);
+    DeleteCriticalSection(section);
+    delete section;
+}
+
+
+void Mutex::lock()
+{
+    EnterCriticalSection(reinterpret_cast<CRITICAL_SECTION*>(handle));
+}
+
+
+void Mutex::unlock()
+{
+    LeaveCriticalSection(reinterpret_cast<CRITICAL_SECTION*>(handle));
+}
+
+
+// Native condition variables require Windows Vista or later, so conditions
+// are built from events instead: every waiting thread blocks on an event of
+// its own, and signal() sets the event of the longest waiting thread. The
+// waiter list is protected by the mutex that the condition is used with.
+struct WinCondition
+{
+    vector<HANDLE> waiters;
+    vector<HANDLE> freeEvents;
+};
+
+
+Condition::Condition()
+{
+    handle = new WinCondition();
+}
+
+
+Condition::~Condition()
+{
+    WinCondition* cond = reinterpret_cast<WinCondition*>(handle);
+    for (vector<HANDLE>::iterator iter = cond->freeEvents.begin(); iter != cond->freeEvents.end(); iter++)
+        CloseHandle(*iter);
+    delete cond;
+}
+
+
+void Condition::wait(Mutex& mutex)
+{
+    WinCondition* cond = reinterpret_cast<WinCondition*>(handle);
+
+    HANDLE event;
+    if (cond->freeEvents.empty())
+    {
+        event = CreateEvent(NULL, FALSE, FALSE, NULL);
+    }
+    else
+    {
+        event = cond->freeEvents.back();
+        cond->freeEvents.pop_back();
+    }
+    cond->waiters.push_back(event);
+
+    mutex.unlock();
+    WaitForSingleObject(event, INFINITE);
+    mutex.lock();
+
+    cond->freeEvents.push_back(event);
+}
+
+
+void Condition::signal()
+{
+    WinCondition* cond = reinterpret_cast<WinCondition*>(handle);
+    if (!cond->waiters.empty())
+    {
+        SetEvent(cond->waiters.front());
+        cond->waiters.erase(cond->waiters.begin());
+    }
+}
+
+
+void Condition::broadcast()
+{
+    WinCondition* cond = reinterpret_cast<WinCondition*>(handle);
+    for (vector<HANDLE>::iterator iter = cond->waiters.begin(); iter != cond->waiters.end(); iter++)
+        SetEvent(*iter);
+    cond->waiters.clear();
+}
+
+
+static unsigned int __stdcall ThreadEntry(void* arg)
+{
+    reinterpret_cast<Thread*>(arg)->run();
+    return 0;
+}
+
+
+Thread::Thread() :
+    handle(NULL)
+{
+}
+
+
+Thread::~Thread()
+{
+    if (handle != NULL)
+        CloseHandle(reinterpret_cast<HANDLE>(handle));
+}
+
+
+bool Thread::start()
+{
+    if (handle != NULL)
+        return false;
+
+    uintptr_t thread = _beginthreadex(NULL, 0, ThreadEntry, this, 0, NULL);
+    if (thread == 0)
+        return false;
+
+    handle = reinterpret_cast<void*>(thread);
+    return true;
+}
+
+
+void Thread::join()
+{
+    if (handle != NULL)
+    {
+        WaitForSingleObject(reinterpret_cast<HANDLE>(handle), INFINITE);
+        CloseHandle(reinterpret_cast<HANDLE>(handle));
+        handle = NULL;
+    }
+}
+
+
+unsigned int GetProcessorCount()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (unsigned int) info.dwNumberOfProcessors : 1;
+}
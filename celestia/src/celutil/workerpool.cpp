@@ -0,0 +1,161 @@
+// workerpool.cpp
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#include <cstddef>
+#include "workerpool.h"
+
+using namespace std;
+
+
+void WorkerPool::WorkerThread::run()
+{
+    pool->workerLoop();
+}
+
+
+WorkerPool::WorkerPool(unsigned int threadCount) :
+    shuttingDown(false)
+{
+    for (unsigned int i = 0; i < threadCount; i++)
+    {
+        WorkerThread* thread = new WorkerThread(this);
+        if (!thread->start())
+        {
+            delete thread;
+            break;
+        }
+        threads.push_back(thread);
+    }
+}
+
+
+WorkerPool::~WorkerPool()
+{
+    {
+        MutexLock lock(mutex);
+        shuttingDown = true;
+        taskAvailable.broadcast();
+    }
+
+    for (vector<WorkerThread*>::iterator iter = threads.begin(); iter != threads.end(); iter++)
+    {
+        (*iter)->join();
+        delete *iter;
+    }
+}
+
+
+unsigned int WorkerPool::getThreadCount() const
+{
+    return threads.size();
+}
+
+
+void WorkerPool::submit(WorkerTask* task)
+{
+    if (threads.empty())
+    {
+        task->run();
+        return;
+    }
+
+    MutexLock lock(mutex);
+    QueuedTask queued;
+    queued.task = task;
+    queued.batch = NULL;
+    queue.push_back(queued);
+    taskAvailable.signal();
+}
+
+
+void WorkerPool::run(const vector<WorkerTask*>& tasks)
+{
+    if (threads.empty() || tasks.size() == 1)
+    {
+        for (vector<WorkerTask*>::const_iterator iter = tasks.begin(); iter != tasks.end(); iter++)
+            (*iter)->run();
+        return;
+    }
+
+    TaskBatch batch;
+    batch.remaining = tasks.size();
+
+    mutex.lock();
+    for (vector<WorkerTask*>::const_iterator iter = tasks.begin(); iter != tasks.end(); iter++)
+    {
+        QueuedTask queued;
+        queued.task = *iter;
+        queued.batch = &batch;
+        queue.push_back(queued);
+    }
+    taskAvailable.broadcast();
+
+    // Help out with tasks from this batch; tasks queued by other callers
+    // are left to the worker threads.
+    while (batch.remaining > 0)
+    {
+        deque<QueuedTask>::iterator iter = queue.begin();
+        while (iter != queue.end() && iter->batch != &batch)
+            iter++;
+
+        if (iter == queue.end())
+        {
+            batchFinished.wait(mutex);
+        }
+        else
+        {
+            QueuedTask queued = *iter;
+            queue.erase(iter);
+            mutex.unlock();
+            queued.task->run();
+            mutex.lock();
+            finishTask(queued);
+        }
+    }
+    mutex.unlock();
+}
+
+
+void WorkerPool::workerLoop()
+{
+    mutex.lock();
+    for (;;)
+    {
+        while (queue.empty() && !shuttingDown)
+            taskAvailable.wait(mutex);
+        if (shuttingDown)
+            break;
+
+        QueuedTask queued = queue.front();
+        queue.pop_front();
+        mutex.unlock();
+        queued.task->run();
+        mutex.lock();
+        finishTask(queued);
+    }
+    mutex.unlock();
+}
+
+
+// Must be called with the mutex locked
+void WorkerPool::finishTask(const QueuedTask& queued)
+{
+    if (queued.batch != NULL)
+    {
+        queued.batch->remaining--;
+        if (queued.batch->remaining == 0)
+            batchFinished.broadcast();
+    }
+}
+
+
+unsigned int DefaultWorkerThreadCount()
+{
+    return GetProcessorCount() - 1;
+}
@@ -0,0 +1,91 @@
+// workerpool.h
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// A pool of worker threads executing queued tasks.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#ifndef _CELUTIL_WORKERPOOL_H_
+#define _CELUTIL_WORKERPOOL_H_
+
+#include <deque>
+#include <vector>
+#include <celutil/thread.h>
+
+class WorkerTask
+{
+ public:
+    WorkerTask() {};
+    virtual ~WorkerTask() {};
+
+    virtual void run() = 0;
+};
+
+
+class WorkerPool
+{
+ public:
+    // A pool with no threads is valid; tasks are then executed by the
+    // thread calling submit() or run().
+    WorkerPool(unsigned int threadCount);
+
+    // Tasks that are still queued when the pool is destroyed are discarded
+    // without being run; tasks already running are waited for.
+    ~WorkerPool();
+
+    unsigned int getThreadCount() const;
+
+    // Queue a task for execution on one of the worker threads. The pool
+    // doesn't take ownership of the task, which must remain valid until
+    // it has finished running.
+    void submit(WorkerTask* task);
+
+    // Execute a batch of tasks and wait until all of them have completed.
+    // The calling thread executes tasks from the batch too, so a pool
+    // with N threads runs up to N + 1 tasks of the batch concurrently.
+    void run(const std::vector<WorkerTask*>& tasks);
+
+ private:
+    struct TaskBatch
+    {
+        unsigned int remaining;
+    };
+
+    struct QueuedTask
+    {
+        WorkerTask* task;
+        TaskBatch* batch;
+    };
+
+    class WorkerThread : public Thread
+    {
+     public:
+        WorkerThread(WorkerPool* _pool) : pool(_pool) {};
+        virtual void run();
+
+     private:
+        WorkerPool* pool;
+    };
+
+    void workerLoop();
+    void finishTask(const QueuedTask&);
+
+    std::vector<WorkerThread*> threads;
+    std::deque<QueuedTask> queue;
+    Mutex mutex;
+    Condition taskAvailable;
+    Condition batchFinished;
+    bool shuttingDown;
+};
+
+
+/*! Return the number of worker threads that should be used so that the
+ *  worker threads plus the calling thread occupy every processor.
+ */
+extern unsigned int DefaultWorkerThreadCount();
+
+#endif // _CELUTIL_WORKERPOOL_H_
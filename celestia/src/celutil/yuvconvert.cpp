@@ -0,0 +1,220 @@
+// yuvconvert.cpp
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// The fixed point coefficients are those that movie capture has always
+// used, from http://en.wikipedia.org/wiki/YUV/RGB_conversion_formulas:
+//  Y := min((r *  2104 + g *  4130 + b *  802 + 4096 +  131072) >> 13, 235)
+//  U := min((r * -1214 + g * -2384 + b * 3598 + 4096 + 1048576) >> 13, 240)
+//  V := min((r *  3598 + g * -3013 + b * -585 + 4096 + 1048576) >> 13, 240)
+// Chroma is computed from the sum of four pixels, and so is shifted by two
+// more bits. Neither expression can be negative for 8-bit components.
+
+#include <algorithm>
+#include <cstring>
+#include "yuvconvert.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define YUV_CONVERT_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+
+static const int YR =  2104;
+static const int YG =  4130;
+static const int YB =   802;
+static const int UR = -1214;
+static const int UG = -2384;
+static const int UB =  3598;
+static const int VR =  3598;
+static const int VG = -3013;
+static const int VB =  -585;
+
+static const int LumaOffset   = 4096 + 131072;
+static const int ChromaOffset = (4096 + 1048576) * 4;
+static const int LumaShift    = 13;
+static const int ChromaShift  = 15;
+static const int MaxLuma      = 235;
+static const int MaxChroma    = 240;
+
+// Byte offsets of the components in a BGRA pixel
+enum
+{
+    Blue  = 0,
+    Green = 1,
+    Red   = 2,
+};
+
+
+static inline unsigned char luma(const unsigned char* p)
+{
+    int y = (p[Red] * YR + p[Green] * YG + p[Blue] * YB + LumaOffset) >> LumaShift;
+    return (unsigned char) min(y, MaxLuma);
+}
+
+
+// Convert the 2x2 block of pixels whose top left corner is at column x;
+// row1 and x1 are the second row and column, which may repeat the first
+// at the edges of the image.
+static inline void convertBlock(const unsigned char* row0,
+                                const unsigned char* row1,
+                                int x,
+                                int x1,
+                                unsigned char* y0,
+                                unsigned char* y1,
+                                unsigned char* u,
+                                unsigned char* v)
+{
+    const unsigned char* p00 = row0 + x * 4;
+    const unsigned char* p01 = row0 + x1 * 4;
+    const unsigned char* p10 = row1 + x * 4;
+    const unsigned char* p11 = row1 + x1 * 4;
+
+    y0[x] = luma(p00);
+    y0[x1] = luma(p01);
+    if (y1 != NULL)
+    {
+        y1[x] = luma(p10);
+        y1[x1] = luma(p11);
+    }
+
+    int r = p00[Red] + p01[Red] + p10[Red] + p11[Red];
+    int g = p00[Green] + p01[Green] + p10[Green] + p11[Green];
+    int b = p00[Blue] + p01[Blue] + p10[Blue] + p11[Blue];
+    u[x / 2] = (unsigned char) min((r * UR + g * UG + b * UB + ChromaOffset) >> ChromaShift, MaxChroma);
+    v[x / 2] = (unsigned char) min((r * VR + g * VG + b * VB + ChromaOffset) >> ChromaShift, MaxChroma);
+}
+
+
+#ifdef YUV_CONVERT_SSE2
+
+// Sum adjacent pairs of 32-bit values from a and b: the result is
+// (a0 + a1, a2 + a3, b0 + b1, b2 + b3).
+static inline __m128i addPairs(__m128i a, __m128i b)
+{
+    __m128 fa = _mm_castsi128_ps(a);
+    __m128 fb = _mm_castsi128_ps(b);
+    __m128i even = _mm_castps_si128(_mm_shuffle_ps(fa, fb, _MM_SHUFFLE(2, 0, 2, 0)));
+    __m128i odd  = _mm_castps_si128(_mm_shuffle_ps(fa, fb, _MM_SHUFFLE(3, 1, 3, 1)));
+    return _mm_add_epi32(even, odd);
+}
+
+
+// Luma of four pixels, given as 16-bit components of two pixels each
+static inline __m128i luma4(__m128i lo, __m128i hi, __m128i coeff, __m128i offset)
+{
+    __m128i sum = addPairs(_mm_madd_epi16(lo, coeff), _mm_madd_epi16(hi, coeff));
+    return _mm_srai_epi32(_mm_add_epi32(sum, offset), LumaShift);
+}
+
+
+// Convert the 2x4 block of pixels starting at column x; four luma samples
+// are written to each row, and two samples to each chroma row.
+static inline void convertBlockSSE2(const unsigned char* row0,
+                                    const unsigned char* row1,
+                                    int x,
+                                    unsigned char* y0,
+                                    unsigned char* y1,
+                                    unsigned char* u,
+                                    unsigned char* v)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lumaCoeff = _mm_set_epi16(0, YR, YG, YB, 0, YR, YG, YB);
+    const __m128i uCoeff = _mm_set_epi16(0, UR, UG, UB, 0, UR, UG, UB);
+    const __m128i vCoeff = _mm_set_epi16(0, VR, VG, VB, 0, VR, VG, VB);
+    const __m128i lumaOffset = _mm_set1_epi32(LumaOffset);
+    const __m128i chromaOffset = _mm_set1_epi32(ChromaOffset);
+
+    __m128i p0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + x * 4));
+    __m128i p1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + x * 4));
+    __m128i p0lo = _mm_unpacklo_epi8(p0, zero);
+    __m128i p0hi = _mm_unpackhi_epi8(p0, zero);
+    __m128i p1lo = _mm_unpacklo_epi8(p1, zero);
+    __m128i p1hi = _mm_unpackhi_epi8(p1, zero);
+
+    // Luma; the first four bytes are for row 0 and the next four for row 1
+    __m128i luma = _mm_packs_epi32(luma4(p0lo, p0hi, lumaCoeff, lumaOffset),
+                                   luma4(p1lo, p1hi, lumaCoeff, lumaOffset));
+    luma = _mm_min_epi16(luma, _mm_set1_epi16(MaxLuma));
+    luma = _mm_packus_epi16(luma, luma);
+
+    int yBytes = _mm_cvtsi128_si32(luma);
+    memcpy(y0 + x, &yBytes, 4);
+    if (y1 != NULL)
+    {
+        yBytes = _mm_cvtsi128_si32(_mm_srli_si128(luma, 4));
+        memcpy(y1 + x, &yBytes, 4);
+    }
+
+    // Sum the components of each 2x2 block
+    __m128i sumLo = _mm_add_epi16(p0lo, p1lo);
+    __m128i sumHi = _mm_add_epi16(p0hi, p1hi);
+    sumLo = _mm_add_epi16(sumLo, _mm_srli_si128(sumLo, 8));
+    sumHi = _mm_add_epi16(sumHi, _mm_srli_si128(sumHi, 8));
+    __m128i sums = _mm_unpacklo_epi64(sumLo, sumHi);
+
+    // Chroma: U for both blocks followed by V for both blocks
+    __m128i chroma = addPairs(_mm_madd_epi16(sums, uCoeff), _mm_madd_epi16(sums, vCoeff));
+    chroma = _mm_srai_epi32(_mm_add_epi32(chroma, chromaOffset), ChromaShift);
+    chroma = _mm_packs_epi32(chroma, chroma);
+    chroma = _mm_min_epi16(chroma, _mm_set1_epi16(MaxChroma));
+    chroma = _mm_packus_epi16(chroma, chroma);
+
+    unsigned int uvBytes = (unsigned int) _mm_cvtsi128_si32(chroma);
+    u[x / 2]     = (unsigned char) uvBytes;
+    u[x / 2 + 1] = (unsigned char) (uvBytes >> 8);
+    v[x / 2]     = (unsigned char) (uvBytes >> 16);
+    v[x / 2 + 1] = (unsigned char) (uvBytes >> 24);
+}
+
+#endif // YUV_CONVERT_SSE2
+
+
+void ConvertBGRAToYUV420(const unsigned char* pixels,
+                         int pixelStride,
+                         int width,
+                         int height,
+                         unsigned char* y,
+                         int yStride,
+                         unsigned char* u,
+                         unsigned char* v,
+                         int uvStride,
+                         bool allowSIMD)
+{
+    for (int row = 0; row < height; row += 2)
+    {
+        const unsigned char* row0 = pixels + row * pixelStride;
+        const unsigned char* row1 = row0;
+        unsigned char* y0 = y + row * yStride;
+        unsigned char* y1 = NULL;
+        if (row + 1 < height)
+        {
+            row1 = row0 + pixelStride;
+            y1 = y0 + yStride;
+        }
+
+        unsigned char* uRow = u + (row / 2) * uvStride;
+        unsigned char* vRow = v + (row / 2) * uvStride;
+
+        int x = 0;
+#ifdef YUV_CONVERT_SSE2
+        if (allowSIMD)
+        {
+            for (; x + 4 <= width; x += 4)
+                convertBlockSSE2(row0, row1, x, y0, y1, uRow, vRow);
+        }
+#endif
+        for (; x < width; x += 2)
+        {
+            int x1 = min(x + 1, width - 1);
+            convertBlock(row0, row1, x, x1, y0, y1, uRow, vRow);
+        }
+    }
+}
@@ -0,0 +1,38 @@
+// yuvconvert.h
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+#ifndef _CELUTIL_YUVCONVERT_H_
+#define _CELUTIL_YUVCONVERT_H_
+
+/*! Convert an image of 32-bit BGRA pixels to Y'CbCr with 4:2:0 chroma
+ *  subsampling, the format taken by video encoders. Luma is limited to the
+ *  range [16, 235] and chroma to [16, 240], using the Rec. 601 weights;
+ *  each chroma sample is computed from the sum of a 2x2 block of pixels.
+ *  For images of odd width or height, the last column or row of pixels is
+ *  repeated to complete the blocks.
+ *
+ *  Strides are in bytes and may be negative, so that an image stored
+ *  bottom row first (as read from OpenGL) can be converted upright by
+ *  passing a pointer to its last row and a negative stride.
+ *
+ *  The SIMD implementation, used when available unless allowSIMD is false,
+ *  produces exactly the same values as the scalar one.
+ */
+extern void ConvertBGRAToYUV420(const unsigned char* pixels,
+                                int pixelStride,
+                                int width,
+                                int height,
+                                unsigned char* y,
+                                int yStride,
+                                unsigned char* u,
+                                unsigned char* v,
+                                int uvStride,
+                                bool allowSIMD = true);
+
+#endif // _CELUTIL_YUVCONVERT_H_
@@ -7,7 +7,8 @@
 // as published by the Free Software Foundation; either version 2
 // of the License, or (at your option) any later version.
 //
-// Create a Celestia xyzv file from a pool of SPICE SPK files
+// Create a Celestia xyzv file from a pool of SPICE SPK files, or convert
+// an existing xyz or xyzv file to a binary trajectory file.
 
 #include "SpiceUsr.h"
 #include <string>
@@ -16,7 +17,9 @@
 #include <fstream>
 #include <sstream>
 #include <iomanip>
+#include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <ctime>
 
 using namespace std;
@@ -24,6 +27,8 @@ using namespace std;
 
 const double J2000 = 2451545.0;
 
+const double SECONDS_PER_DAY = 86400.0;
+
 
 // Default values
 // Units are seconds
@@ -242,6 +247,181 @@ void printRecord(ostream& out, double et, const StateVector& state)
 }
 
 
+// A RecordWriter receives the states of a trajectory in order of
+// increasing time.
+class RecordWriter
+{
+public:
+    virtual ~RecordWriter() {};
+
+    virtual void write(double et, const StateVector& state) = 0;
+    virtual bool finish() { return true; }
+};
+
+
+// Write states to an ASCII xyzv file
+class XyzvWriter : public RecordWriter
+{
+public:
+    XyzvWriter(ostream& _out) : out(_out) {};
+
+    virtual void write(double et, const StateVector& state)
+    {
+        printRecord(out, et, state);
+    }
+
+    virtual bool finish()
+    {
+        return out.good();
+    }
+
+private:
+    ostream& out;
+};
+
+
+// Write states to a binary trajectory file. The layout of the file must
+// match what LoadBinaryTrajectory in celephem/samporbit.cpp expects. All
+// values are little endian. A 48 byte header:
+//
+//  0: magic number "CELXYZVB"
+//  8: version (16-bit, 0x0100)
+// 10: flags (16-bit; 1 = velocities present, 2 = time index present)
+// 12: number of samples (32-bit)
+// 16: number of time index intervals (32-bit)
+// 20: reserved (32-bit)
+// 24: bounding radius in km (double)
+// 32: start time of the time index (double)
+// 40: length of a time index interval in days (double)
+//
+// is followed by the samples--TDB Julian date, position in km, and
+// optionally velocity in km/day as doubles--and the time index: for each
+// interval boundary, the index of the first sample at or after it.
+class BinaryTrajectoryWriter : public RecordWriter
+{
+public:
+    BinaryTrajectoryWriter(ostream& _out, bool _hasVelocities = true) :
+        out(_out),
+        hasVelocities(_hasVelocities)
+    {
+    }
+
+    virtual void write(double et, const StateVector& state)
+    {
+        addSample(et2jd(et), state.position, state.velocity * SECONDS_PER_DAY);
+    }
+
+    // Add a sample with time as a TDB Julian date and velocity in km/day
+    void addSample(double jd, const Vec3d& position, const Vec3d& velocity)
+    {
+        // Skip samples with duplicate times; Celestia requires the times
+        // to be strictly increasing.
+        if (!times.empty() && jd <= times.back())
+            return;
+
+        times.push_back(jd);
+        positions.push_back(position);
+        velocities.push_back(velocity);
+    }
+
+    virtual bool finish()
+    {
+        unsigned int nSamples = times.size();
+        if (nSamples == 0)
+            return false;
+
+        double boundingRadius = 0.0;
+        for (unsigned int i = 0; i < nSamples; i++)
+            boundingRadius = max(boundingRadius, positions[i].length());
+
+        // Use one time index interval per sample; uniformly sampled
+        // trajectories will then have at most one sample per interval.
+        unsigned int nIntervals = max(1u, nSamples - 1);
+        double startTime = times.front();
+        double interval = (times.back() - startTime) / nIntervals;
+        vector<unsigned int> timeIndex;
+        if (interval > 0.0)
+        {
+            unsigned int n = 0;
+            for (unsigned int k = 0; k <= nIntervals; k++)
+            {
+                double t = startTime + k * interval;
+                while (n < nSamples && times[n] < t)
+                    n++;
+                timeIndex.push_back(n);
+            }
+        }
+
+        unsigned int flags = 0;
+        if (hasVelocities)
+            flags |= 1;
+        if (!timeIndex.empty())
+            flags |= 2;
+
+        out.write("CELXYZVB", 8);
+        writeUint16(0x0100);
+        writeUint16(flags);
+        writeUint32(nSamples);
+        writeUint32(timeIndex.empty() ? 0 : nIntervals);
+        writeUint32(0);
+        writeDouble(boundingRadius);
+        writeDouble(startTime);
+        writeDouble(interval);
+
+        for (unsigned int i = 0; i < nSamples; i++)
+        {
+            writeDouble(times[i]);
+            writeVector(positions[i]);
+            if (hasVelocities)
+                writeVector(velocities[i]);
+        }
+
+        for (vector<unsigned int>::const_iterator iter = timeIndex.begin();
+             iter != timeIndex.end(); iter++)
+        {
+            writeUint32(*iter);
+        }
+
+        return out.good();
+    }
+
+private:
+    void writeUint16(unsigned int n)
+    {
+        char bytes[2] = { (char) (n & 0xff), (char) ((n >> 8) & 0xff) };
+        out.write(bytes, 2);
+    }
+
+    void writeUint32(unsigned int n)
+    {
+        writeUint16(n & 0xffff);
+        writeUint16(n >> 16);
+    }
+
+    void writeDouble(double d)
+    {
+        unsigned long long n;
+        memcpy(&n, &d, sizeof(n));
+        writeUint32((unsigned int) (n & 0xffffffff));
+        writeUint32((unsigned int) (n >> 32));
+    }
+
+    void writeVector(const Vec3d& v)
+    {
+        writeDouble(v.x);
+        writeDouble(v.y);
+        writeDouble(v.z);
+    }
+
+private:
+    ostream& out;
+    bool hasVelocities;
+    vector<double> times;
+    vector<Vec3d> positions;
+    vector<Vec3d> velocities;
+};
+
+
 StateVector getStateVector(SpiceInt targetID,
                            double et,
                            const string& frameName,
@@ -335,7 +515,7 @@ void writeCommentHeader(const Configuration& config,
 
 
 bool convertSpkToXyzv(const Configuration& config,
-                      ostream& out)
+                      RecordWriter& out)
 {
     // Load the required SPICE kernels
     for (vector<string>::const_iterator iter = config.kernelList.begin();
@@ -375,7 +555,7 @@ bool convertSpkToXyzv(const Configuration& config,
     StateVector lastState = getStateVector(targetID, startET, config.frameName, observerID);
     double et = startET;
 
-    printRecord(out, et, lastState);
+    out.write(et, lastState);
 
     int sampCount = 0;
     int nTests = 0;
@@ -449,11 +629,77 @@ bool convertSpkToXyzv(const Configuration& config,
         t = t + dt;
         lastState = s1;
 
-        printRecord(out, t, lastState);
+        out.write(t, lastState);
         sampCount++;
     }
 
-    return true;
+    return out.finish();
+}
+
+
+// Skip the comment block at the start of an xyz or xyzv file
+static void skipComments(istream& in)
+{
+    char c = '\0';
+    while (in.get(c))
+    {
+        if (c == '#')
+        {
+            string line;
+            getline(in, line);
+        }
+        else if (!isspace((unsigned char) c))
+        {
+            in.unget();
+            break;
+        }
+    }
+}
+
+
+// Convert an ASCII xyz or xyzv file to a binary trajectory file. Files
+// ending in .xyz are assumed to contain positions only.
+bool convertToBinary(const string& inputFilename,
+                     const string& outputFilename)
+{
+    ifstream in(inputFilename.c_str());
+    if (!in)
+    {
+        cerr << "Error opening " << inputFilename << endl;
+        return false;
+    }
+
+    bool hasVelocities = true;
+    string::size_type extPos = inputFilename.rfind('.');
+    if (extPos != string::npos && inputFilename.substr(extPos) == ".xyz")
+        hasVelocities = false;
+
+    ofstream out(outputFilename.c_str(), ios::out | ios::binary);
+    if (!out)
+    {
+        cerr << "Error creating " << outputFilename << endl;
+        return false;
+    }
+
+    BinaryTrajectoryWriter writer(out, hasVelocities);
+
+    skipComments(in);
+    for (;;)
+    {
+        double jd = 0.0;
+        Vec3d position;
+        Vec3d velocity;
+
+        in >> jd >> position.x >> position.y >> position.z;
+        if (hasVelocities)
+            in >> velocity.x >> velocity.y >> velocity.z;
+        if (!in)
+            break;
+
+        writer.addSample(jd, position, velocity * SECONDS_PER_DAY);
+    }
+
+    return writer.finish();
 }
 
 
@@ -528,17 +774,37 @@ bool readConfig(istream& in, Configuration& config)
 }
 
 
-int main(int argc, char* argv[])
+static bool isBinaryTrajectoryFilename(const string& filename)
 {
-    // Load the leap second kernel
-    furnsh_c("naif0008.tls");
+    const string ext(".xyzvbin");
+    return filename.size() > ext.size() &&
+           filename.compare(filename.size() - ext.size(), ext.size(), ext) == 0;
+}
 
+
+int main(int argc, char* argv[])
+{
     if (argc < 2)
     {
         cerr << "Usage: spice2xyzv <config filename> [output filename]\n";
+        cerr << "       spice2xyzv -c <xyz or xyzv filename> <xyzvbin filename>\n";
         return 1;
     }
 
+    if (string(argv[1]) == "-c")
+    {
+        if (argc < 4 || !isBinaryTrajectoryFilename(argv[3]))
+        {
+            cerr << "Usage: spice2xyzv -c <xyz or xyzv filename> <xyzvbin filename>\n";
+            return 1;
+        }
+
+        return convertToBinary(argv[2], argv[3]) ? 0 : 1;
+    }
+
+    // Load the leap second kernel
+    furnsh_c("naif0008.tls");
+
 
     ifstream configFile(argv[1]);
     if (!configFile)
@@ -586,8 +852,32 @@ int main(int argc, char* argv[])
         return 1;
     }
 
-    writeCommentHeader(config, cout);
-    convertSpkToXyzv(config, cout);
+    bool ok = false;
+    if (argc < 3)
+    {
+        writeCommentHeader(config, cout);
+        XyzvWriter writer(cout);
+        ok = convertSpkToXyzv(config, writer);
+    }
+    else if (isBinaryTrajectoryFilename(argv[2]))
+    {
+        ofstream out(argv[2], ios::out | ios::binary);
+        BinaryTrajectoryWriter writer(out);
+        ok = out.good() && convertSpkToXyzv(config, writer);
+    }
+    else
+    {
+        ofstream out(argv[2]);
+        writeCommentHeader(config, out);
+        XyzvWriter writer(out);
+        ok = out.good() && convertSpkToXyzv(config, writer);
+    }
+
+    if (!ok)
+    {
+        cerr << "Error writing trajectory.\n";
+        return 1;
+    }
 
     return 0;
 }
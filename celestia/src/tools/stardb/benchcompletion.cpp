@@ -0,0 +1,217 @@
+// benchcompletion.cpp
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// Measure the time required to complete object names with the prefix
+// index used by the name databases, compared with a linear scan over
+// every name, and check that both return the same completions.
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <celutil/timer.h>
+#include <celutil/utf8.h>
+#include <celutil/prefixindex.h>
+
+using namespace std;
+
+
+static vector<string> namesFilenames;
+static unsigned int prefixLength = 2;
+static unsigned int repeatCount = 3;
+
+
+void Usage()
+{
+    cerr << "Usage: benchcompletion [options] <names file> [<names file> ...]\n";
+    cerr << "   --prefix <n> (or -p <n>)   : longest prefix length tested\n";
+    cerr << "   --repeat <n> (or -r <n>)   : number of times each search is timed\n";
+}
+
+
+bool parseCommandLine(int argc, char* argv[])
+{
+    int i = 1;
+
+    while (i < argc)
+    {
+        if (argv[i][0] == '-')
+        {
+            if (!strcmp(argv[i], "--prefix") || !strcmp(argv[i], "-p"))
+            {
+                if (i == argc - 1)
+                    return false;
+                i++;
+                prefixLength = (unsigned int) atoi(argv[i]);
+                if (prefixLength == 0)
+                    return false;
+            }
+            else if (!strcmp(argv[i], "--repeat") || !strcmp(argv[i], "-r"))
+            {
+                if (i == argc - 1)
+                    return false;
+                i++;
+                repeatCount = (unsigned int) atoi(argv[i]);
+                if (repeatCount == 0)
+                    return false;
+            }
+            else
+            {
+                cerr << "Unknown command line switch: " << argv[i] << '\n';
+                return false;
+            }
+        }
+        else
+        {
+            namesFilenames.push_back(string(argv[i]));
+        }
+        i++;
+    }
+
+    return !namesFilenames.empty();
+}
+
+
+// Read the names from a file in the starnames.dat format: each line has
+// a catalog number followed by one or more names, all separated by colons.
+bool ReadNames(const string& filename, vector<string>& names)
+{
+    ifstream in(filename.c_str(), ios::in);
+    if (!in.good())
+    {
+        cerr << "Error opening names file " << filename << '\n';
+        return false;
+    }
+
+    string line;
+    while (getline(in, line))
+    {
+        string::size_type start = line.find(':');
+        while (start != string::npos)
+        {
+            string::size_type end = line.find(':', start + 1);
+            string name = line.substr(start + 1, end == string::npos ? string::npos : end - start - 1);
+            if (!name.empty())
+                names.push_back(name);
+            start = end;
+        }
+    }
+
+    return true;
+}
+
+
+// The completion method used before the prefix index: compare the prefix
+// against every name.
+void LinearCompletion(const vector<string>& names,
+                      const string& prefix,
+                      vector<string>& completion)
+{
+    int prefixLength = UTF8Length(prefix);
+    for (vector<string>::const_iterator iter = names.begin(); iter != names.end(); ++iter)
+    {
+        if (!UTF8StringCompare(*iter, prefix, prefixLength))
+            completion.push_back(*iter);
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (!parseCommandLine(argc, argv))
+    {
+        Usage();
+        return 1;
+    }
+
+    vector<string> names;
+    for (vector<string>::const_iterator iter = namesFilenames.begin();
+         iter != namesFilenames.end(); ++iter)
+    {
+        if (!ReadNames(*iter, names))
+            return 1;
+    }
+
+    // Test every distinct prefix of the names up to the maximum length
+    vector<string> prefixes;
+    for (vector<string>::const_iterator iter = names.begin(); iter != names.end(); ++iter)
+    {
+        for (unsigned int length = 1; length <= prefixLength && length <= iter->length(); length++)
+            prefixes.push_back(iter->substr(0, length));
+    }
+    sort(prefixes.begin(), prefixes.end());
+    prefixes.erase(unique(prefixes.begin(), prefixes.end()), prefixes.end());
+
+    Timer* timer = CreateTimer();
+
+    double startTime = timer->getTime();
+    PrefixIndex index;
+    for (vector<string>::const_iterator iter = names.begin(); iter != names.end(); ++iter)
+        index.add(*iter);
+    index.sort();
+    double buildTime = timer->getTime() - startTime;
+
+    double linearTime = 0.0;
+    double indexTime = 0.0;
+    bool identical = true;
+
+    for (unsigned int i = 0; i < repeatCount; i++)
+    {
+        double linearPassTime = 0.0;
+        double indexPassTime = 0.0;
+
+        for (vector<string>::const_iterator iter = prefixes.begin(); iter != prefixes.end(); ++iter)
+        {
+            vector<string> linearCompletion;
+            vector<string> indexCompletion;
+
+            startTime = timer->getTime();
+            LinearCompletion(names, *iter, linearCompletion);
+            linearPassTime += timer->getTime() - startTime;
+
+            startTime = timer->getTime();
+            index.getCompletion(*iter, indexCompletion);
+            indexPassTime += timer->getTime() - startTime;
+
+            // The two methods return names in different orders
+            sort(linearCompletion.begin(), linearCompletion.end());
+            sort(indexCompletion.begin(), indexCompletion.end());
+            if (linearCompletion != indexCompletion)
+            {
+                if (identical)
+                    cerr << "Completions differ for prefix '" << *iter << "'\n";
+                identical = false;
+            }
+        }
+
+        if (i == 0 || linearPassTime < linearTime)
+            linearTime = linearPassTime;
+        if (i == 0 || indexPassTime < indexTime)
+            indexTime = indexPassTime;
+    }
+
+    delete timer;
+
+    cout << names.size() << " names, " << prefixes.size() << " prefixes\n";
+    cout << "index build time (s): " << buildTime << '\n';
+    cout << "method  search time (s)\n";
+    cout << "linear  " << linearTime << '\n';
+    cout << "index   " << indexTime << '\n';
+
+    if (!identical)
+    {
+        cerr << "Prefix index and linear scan produced different completions!\n";
+        return 1;
+    }
+
+    return 0;
+}
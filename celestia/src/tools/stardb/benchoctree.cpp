@@ -0,0 +1,235 @@
+// benchoctree.cpp
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// Measure the time required to build the star and deep sky object octrees
+// with different numbers of worker threads, and check that the parallel
+// builds produce exactly the same octree as the serial build.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <celutil/timer.h>
+#include <celutil/workerpool.h>
+#include <celengine/stardb.h>
+#include <celengine/dsodb.h>
+
+using namespace std;
+
+
+static string starsFilename;
+static string dsoFilename;
+static unsigned int maxThreads = 0;
+static unsigned int repeatCount = 3;
+
+
+void Usage()
+{
+    cerr << "Usage: benchoctree [options] <star database> [<deep sky catalog>]\n";
+    cerr << "   --threads <n> (or -t <n>)  : maximum number of worker threads\n";
+    cerr << "   --repeat <n> (or -r <n>)   : number of builds timed for each thread count\n";
+}
+
+
+bool parseCommandLine(int argc, char* argv[])
+{
+    int i = 1;
+    int fileCount = 0;
+
+    while (i < argc)
+    {
+        if (argv[i][0] == '-')
+        {
+            if (!strcmp(argv[i], "--threads") || !strcmp(argv[i], "-t"))
+            {
+                if (i == argc - 1)
+                    return false;
+                i++;
+                maxThreads = (unsigned int) atoi(argv[i]);
+            }
+            else if (!strcmp(argv[i], "--repeat") || !strcmp(argv[i], "-r"))
+            {
+                if (i == argc - 1)
+                    return false;
+                i++;
+                repeatCount = (unsigned int) atoi(argv[i]);
+                if (repeatCount == 0)
+                    return false;
+            }
+            else
+            {
+                cerr << "Unknown command line switch: " << argv[i] << '\n';
+                return false;
+            }
+            i++;
+        }
+        else
+        {
+            if (fileCount == 0)
+                starsFilename = string(argv[i]);
+            else if (fileCount == 1)
+                dsoFilename = string(argv[i]);
+            else
+                return false;
+            fileCount++;
+            i++;
+        }
+    }
+
+    return fileCount >= 1;
+}
+
+
+// Build the star octree using the specified number of worker threads. The
+// sorted database is written to a string, which captures the complete
+// octree structure and star order for comparison with other builds.
+bool BuildStarOctree(unsigned int threadCount, double& buildTime, string& sortedDB)
+{
+    ifstream starsFile(starsFilename.c_str(), ios::in | ios::binary);
+    if (!starsFile.good())
+    {
+        cerr << "Error opening star database " << starsFilename << '\n';
+        return false;
+    }
+
+    StarDatabase starDB;
+    if (!starDB.loadBinary(starsFile))
+    {
+        cerr << "Error reading star database " << starsFilename << '\n';
+        return false;
+    }
+
+    starDB.setBuildThreadCount(threadCount);
+
+    Timer* timer = CreateTimer();
+    double startTime = timer->getTime();
+    starDB.finish();
+    buildTime = timer->getTime() - startTime;
+    delete timer;
+
+    ostringstream out(ios::out | ios::binary);
+    starDB.writeSortedBinary(out);
+    sortedDB = out.str();
+
+    return true;
+}
+
+
+// Build the deep sky object octree using the specified number of worker
+// threads. The catalog numbers of the objects in octree order are recorded
+// for comparison with other builds.
+bool BuildDSOOctree(unsigned int threadCount, double& buildTime, vector<uint32>& order)
+{
+    ifstream dsoFile(dsoFilename.c_str(), ios::in);
+    if (!dsoFile.good())
+    {
+        cerr << "Error opening deep sky catalog " << dsoFilename << '\n';
+        return false;
+    }
+
+    DSODatabase dsoDB;
+    if (!dsoDB.load(dsoFile, ""))
+    {
+        cerr << "Error reading deep sky catalog " << dsoFilename << '\n';
+        return false;
+    }
+
+    dsoDB.setBuildThreadCount(threadCount);
+
+    Timer* timer = CreateTimer();
+    double startTime = timer->getTime();
+    dsoDB.finish();
+    buildTime = timer->getTime() - startTime;
+    delete timer;
+
+    order.clear();
+    for (uint32 i = 0; i < dsoDB.size(); i++)
+        order.push_back(dsoDB.getDSO(i)->getCatalogNumber());
+
+    return true;
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (!parseCommandLine(argc, argv))
+    {
+        Usage();
+        return 1;
+    }
+
+    if (maxThreads == 0)
+        maxThreads = DefaultWorkerThreadCount();
+
+    bool identical = true;
+
+    string serialStarDB;
+    cout << "Star octree\n";
+    cout << "threads  build time (s)\n";
+    for (unsigned int threadCount = 0; threadCount <= maxThreads; threadCount++)
+    {
+        double bestTime = 0.0;
+        for (unsigned int i = 0; i < repeatCount; i++)
+        {
+            double buildTime = 0.0;
+            string sortedDB;
+            if (!BuildStarOctree(threadCount, buildTime, sortedDB))
+                return 1;
+
+            if (i == 0 || buildTime < bestTime)
+                bestTime = buildTime;
+
+            if (threadCount == 0)
+                serialStarDB = sortedDB;
+            else if (sortedDB != serialStarDB)
+                identical = false;
+        }
+
+        cout << threadCount << "  " << bestTime << '\n';
+    }
+
+    if (!dsoFilename.empty())
+    {
+        vector<uint32> serialOrder;
+        cout << "\nDeep sky object octree\n";
+        cout << "threads  build time (s)\n";
+        for (unsigned int threadCount = 0; threadCount <= maxThreads; threadCount++)
+        {
+            double bestTime = 0.0;
+            for (unsigned int i = 0; i < repeatCount; i++)
+            {
+                double buildTime = 0.0;
+                vector<uint32> order;
+                if (!BuildDSOOctree(threadCount, buildTime, order))
+                    return 1;
+
+                if (i == 0 || buildTime < bestTime)
+                    bestTime = buildTime;
+
+                if (threadCount == 0)
+                    serialOrder = order;
+                else if (order != serialOrder)
+                    identical = false;
+            }
+
+            cout << threadCount << "  " << bestTime << '\n';
+        }
+    }
+
+    if (!identical)
+    {
+        cerr << "Parallel and serial builds produced different octrees!\n";
+        return 1;
+    }
+
+    return 0;
+}
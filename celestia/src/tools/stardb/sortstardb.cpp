@@ -0,0 +1,110 @@
+// sortstardb.cpp
+//
+// Copyright (C) 2009, the Celestia Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// Convert a binary star database to a sorted star database, which has
+// the stars prearranged into an octree and can be memory mapped by Celestia.
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <celengine/stardb.h>
+
+using namespace std;
+
+
+static string inputFilename;
+static string outputFilename;
+
+
+void Usage()
+{
+    cerr << "Usage: sortstardb <input star database> <output star database>\n";
+}
+
+
+bool parseCommandLine(int argc, char* argv[])
+{
+    int i = 1;
+    int fileCount = 0;
+
+    while (i < argc)
+    {
+        if (argv[i][0] == '-')
+        {
+            cerr << "Unknown command line switch: " << argv[i] << '\n';
+            return false;
+        }
+        else
+        {
+            if (fileCount == 0)
+            {
+                // input filename first
+                inputFilename = string(argv[i]);
+                fileCount++;
+            }
+            else if (fileCount == 1)
+            {
+                // output filename second
+                outputFilename = string(argv[i]);
+                fileCount++;
+            }
+            else
+            {
+                // more than two filenames on the command line is an error
+                return false;
+            }
+            i++;
+        }
+    }
+
+    return fileCount == 2;
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (!parseCommandLine(argc, argv))
+    {
+        Usage();
+        return 1;
+    }
+
+    ifstream inputFile(inputFilename.c_str(), ios::in | ios::binary);
+    if (!inputFile.good())
+    {
+        cerr << "Error opening input file " << inputFilename << '\n';
+        return 1;
+    }
+
+    StarDatabase starDB;
+    if (!starDB.loadBinary(inputFile))
+    {
+        cerr << "Error reading star database " << inputFilename << '\n';
+        return 1;
+    }
+
+    // Build the octree exactly as Celestia would at startup
+    starDB.finish();
+
+    ofstream outputFile(outputFilename.c_str(), ios::out | ios::binary);
+    if (!outputFile.good())
+    {
+        cerr << "Error opening output file " << outputFilename << '\n';
+        return 1;
+    }
+
+    if (!starDB.writeSortedBinary(outputFile))
+    {
+        cerr << "Error writing sorted star database " << outputFilename << '\n';
+        return 1;
+    }
+
+    return 0;
+}
@@ -28,6 +28,15 @@ MAKESTARDB_OBJS=\
 MAKEXINDEX_OBJS=\
 	$(INTDIR)\makexindex.obj
 
+SORTSTARDB_OBJS=\
+	$(INTDIR)\sortstardb.obj
+
+BENCHOCTREE_OBJS=\
+	$(INTDIR)\benchoctree.obj
+
+BENCHCOMPLETION_OBJS=\
+	$(INTDIR)\benchcompletion.obj
+
 CEL_INCLUDEDIRS=\
 	/I ../..
 
@@ -79,7 +88,7 @@ RSC_FLAGS=/l 0x409 /d "_DEBUG"
 <<
 
 
-all : $(OUTDIR)\startextdump.exe $(OUTDIR)\makestardb.exe $(OUTDIR)\makexindex.exe
+all : $(OUTDIR)\startextdump.exe $(OUTDIR)\makestardb.exe $(OUTDIR)\makexindex.exe $(OUTDIR)\sortstardb.exe $(OUTDIR)\benchoctree.exe $(OUTDIR)\benchcompletion.exe
 
 startextdump.exe : $(OUTDIR)\startextdump.exe
 
@@ -87,6 +96,12 @@ makestardb.exe : $(OUTDIR)\makestardb.exe
 
 makexindex.exe : $(OUTDIR)\makexindex.exe
 
+sortstardb.exe : $(OUTDIR)\sortstardb.exe
+
+benchoctree.exe : $(OUTDIR)\benchoctree.exe
+
+benchcompletion.exe : $(OUTDIR)\benchcompletion.exe
+
 $(OUTDIR)\startextdump.exe : $(OUTDIR) $(STARTEXTDUMP_OBJS)
 	$(LINK32) $(LINK32_FLAGS) /out:$(OUTDIR)\startextdump.exe $(STARTEXTDUMP_OBJS) $(CEL_LIBS)
 
@@ -96,6 +111,15 @@ $(OUTDIR)\makestardb.exe : $(OUTDIR) $(MAKESTARDB_OBJS)
 $(OUTDIR)\makexindex.exe : $(OUTDIR) $(MAKEXINDEX_OBJS)
 	$(LINK32) $(LINK32_FLAGS) /out:$(OUTDIR)\makexindex.exe $(MAKEXINDEX_OBJS) $(CEL_LIBS)
 
+$(OUTDIR)\sortstardb.exe : $(OUTDIR) $(SORTSTARDB_OBJS)
+	$(LINK32) $(LINK32_FLAGS) /out:$(OUTDIR)\sortstardb.exe $(SORTSTARDB_OBJS) $(CEL_LIBS)
+
+$(OUTDIR)\benchoctree.exe : $(OUTDIR) $(BENCHOCTREE_OBJS)
+	$(LINK32) $(LINK32_FLAGS) /out:$(OUTDIR)\benchoctree.exe $(BENCHOCTREE_OBJS) $(CEL_LIBS)
+
+$(OUTDIR)\benchcompletion.exe : $(OUTDIR) $(BENCHCOMPLETION_OBJS)
+	$(LINK32) $(LINK32_FLAGS) /out:$(OUTDIR)\benchcompletion.exe $(BENCHCOMPLETION_OBJS) $(CEL_LIBS)
+
 
 "$(OUTDIR)" :
 	if not exist "$(OUTDIR)/$(NULL)" mkdir "$(OUTDIR)"
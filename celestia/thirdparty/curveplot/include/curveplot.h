@@ -27,6 +27,9 @@
 // License and a copy of the GNU General Public License along with
 // orbitpath. If not, see <http://www.gnu.org/licenses/>.
 
+#ifndef _CURVEPLOT_H_
+#define _CURVEPLOT_H_
+
 #include <deque>
 #include <Eigen/Geometry>
 
@@ -109,3 +112,4 @@ class CurvePlot
     unsigned int m_lastUsed;
 };
 
+#endif // _CURVEPLOT_H_